@@ -0,0 +1,251 @@
+#include "ota_arena.h"
+#include "ota_plugin.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "rom/miniz.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+static const char *TAG = "ota_arena";
+
+#define ARENA_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+// Everything the plugin reserves during init; keep in step with the
+// ota_arena_reserve() calls in the executor and the ota_arena_reserve_bulk()
+// calls in the tracer, the compressor and below. Task stacks and TCBs stay in
+// internal RAM: the executor writes flash, which disables the cache PSRAM is
+// accessed through
+#define INTERNAL_SIZE                                                              \
+    (ARENA_ALIGN(OTA_TASK_STACK_SIZE) + ARENA_ALIGN(sizeof(StaticTask_t)) +      \
+     ARENA_ALIGN(sizeof(StaticEventGroup_t)))
+#define BULK_SIZE                                                                  \
+    (ARENA_ALIGN(OTA_ARENA_BUFFER_COUNT * OTA_ARENA_BUFFER_SIZE) +                 \
+     ARENA_ALIGN(OTA_HEARTBEAT_BUFFER_SIZE) +                                      \
+     ARENA_ALIGN(OTA_TRACE_SPAN_POOL_SIZE * sizeof(ota_trace_context_t)) +         \
+     ARENA_ALIGN(OTA_TRACE_SPAN_POOL_SIZE * OTA_TRACE_RAW_ATTR_SIZE) +             \
+     ARENA_ALIGN(OTA_COMPRESSION_ENABLED ? sizeof(tdefl_compressor) : 0))
+
+#define STATIC_INTERNAL (OTA_STATIC_MEMORY_ENABLED)
+#define STATIC_EXTERNAL (OTA_STATIC_MEMORY_ENABLED && OTA_PSRAM_BUFFERS_ENABLED)
+
+_Static_assert(OTA_ARENA_BUFFER_COUNT <= 32, "Buffer pool is tracked in a 32-bit mask");
+_Static_assert(OTA_URL_BUFFER_SIZE <= OTA_ARENA_BUFFER_SIZE, "Firmware URLs are kept in scratch buffers");
+_Static_assert(OTA_JSON_BUFFER_SIZE <= OTA_ARENA_BUFFER_SIZE, "Check responses are kept in scratch buffers");
+
+typedef struct
+{
+    uint8_t *memory;
+    size_t size;
+    size_t used;
+} arena_t;
+
+// Bulk data shares the internal arena when PSRAM placement is off. Without
+// CONFIG_SPIRAM_ALLOW_BSS_SEG_EXTERNAL_MEMORY, EXT_RAM_BSS_ATTR is empty and
+// the external arena lands in internal RAM as well
+static uint8_t internal_memory[STATIC_INTERNAL ? INTERNAL_SIZE + (STATIC_EXTERNAL ? 0 : BULK_SIZE) : 1]
+    __attribute__((aligned(8)));
+static EXT_RAM_BSS_ATTR uint8_t external_memory[STATIC_EXTERNAL ? BULK_SIZE : 1] __attribute__((aligned(8)));
+
+static arena_t internal_arena = {internal_memory, sizeof(internal_memory), 0};
+static arena_t external_arena = {external_memory, sizeof(external_memory), 0};
+static bool arena_sealed = false;
+
+static char *buffers = NULL;
+static atomic_uint buffers_in_use = 0; // Bit per pool buffer
+static char *heartbeat_buffer = NULL;
+static atomic_bool heartbeat_buffer_in_use = false;
+
+esp_err_t ota_arena_init(void)
+{
+    if (!OTA_STATIC_MEMORY_ENABLED || buffers != NULL)
+    {
+        return ESP_OK;
+    }
+
+    buffers = ota_arena_reserve_bulk(OTA_ARENA_BUFFER_COUNT * OTA_ARENA_BUFFER_SIZE);
+    heartbeat_buffer = ota_arena_reserve_bulk(OTA_HEARTBEAT_BUFFER_SIZE);
+    return buffers != NULL && heartbeat_buffer != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static void *arena_take(arena_t *arena, size_t size)
+{
+    size = ARENA_ALIGN(size);
+
+    if (!OTA_STATIC_MEMORY_ENABLED || arena_sealed || size > arena->size - arena->used)
+    {
+        ESP_LOGE(TAG, "Cannot reserve %u bytes (%u of %u used%s)", (unsigned)size, (unsigned)arena->used,
+                 (unsigned)arena->size, arena_sealed ? ", sealed" : "");
+        return NULL;
+    }
+
+    void *memory = &arena->memory[arena->used];
+    arena->used += size;
+    return memory;
+}
+
+void *ota_arena_reserve(size_t size)
+{
+    return arena_take(&internal_arena, size);
+}
+
+void *ota_arena_reserve_bulk(size_t size)
+{
+    return arena_take(STATIC_EXTERNAL ? &external_arena : &internal_arena, size);
+}
+
+void *ota_arena_bulk_calloc(size_t size)
+{
+    if (!OTA_PSRAM_BUFFERS_ENABLED)
+    {
+        return calloc(1, size);
+    }
+
+    // Falls back to internal RAM on chips or boards without PSRAM
+    return heap_caps_calloc_prefer(1, size, 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, MALLOC_CAP_DEFAULT);
+}
+
+void ota_arena_seal(void)
+{
+    if (!OTA_STATIC_MEMORY_ENABLED || arena_sealed)
+    {
+        return;
+    }
+
+    arena_sealed = true;
+    ESP_LOGI(TAG, "Static arena: %u of %u bytes reserved (%u in external RAM)", (unsigned)ota_arena_used(),
+             (unsigned)ota_arena_capacity(), (unsigned)external_arena.used);
+}
+
+size_t ota_arena_used(void)
+{
+    return internal_arena.used + external_arena.used;
+}
+
+size_t ota_arena_capacity(void)
+{
+    if (!OTA_STATIC_MEMORY_ENABLED)
+    {
+        return 0;
+    }
+    return internal_arena.size + (STATIC_EXTERNAL ? external_arena.size : 0);
+}
+
+char *ota_arena_buffer_acquire(void)
+{
+    if (!OTA_STATIC_MEMORY_ENABLED)
+    {
+        return ota_arena_bulk_calloc(OTA_ARENA_BUFFER_SIZE);
+    }
+
+    if (buffers == NULL)
+    {
+        return NULL;
+    }
+
+    unsigned in_use = atomic_load_explicit(&buffers_in_use, memory_order_relaxed);
+    while (true)
+    {
+        int slot = 0;
+        while (slot < OTA_ARENA_BUFFER_COUNT && (in_use & (1u << slot)))
+        {
+            slot++;
+        }
+        if (slot == OTA_ARENA_BUFFER_COUNT)
+        {
+            ESP_LOGW(TAG, "All %d scratch buffers in use", OTA_ARENA_BUFFER_COUNT);
+            return NULL;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(&buffers_in_use, &in_use, in_use | (1u << slot),
+                                                  memory_order_acquire, memory_order_relaxed))
+        {
+            return &buffers[slot * OTA_ARENA_BUFFER_SIZE];
+        }
+    }
+}
+
+char *ota_arena_heartbeat_buffer_acquire(size_t *size)
+{
+    if (!OTA_STATIC_MEMORY_ENABLED)
+    {
+        *size = OTA_ARENA_BUFFER_SIZE;
+        return ota_arena_bulk_calloc(OTA_ARENA_BUFFER_SIZE);
+    }
+
+    if (heartbeat_buffer == NULL || atomic_exchange_explicit(&heartbeat_buffer_in_use, true, memory_order_acquire))
+    {
+        return NULL;
+    }
+    *size = OTA_HEARTBEAT_BUFFER_SIZE;
+    return heartbeat_buffer;
+}
+
+char *ota_arena_buffer_grow(char *buffer, size_t size)
+{
+    if (OTA_STATIC_MEMORY_ENABLED)
+    {
+        return NULL;
+    }
+
+    if (!OTA_PSRAM_BUFFERS_ENABLED)
+    {
+        return realloc(buffer, size);
+    }
+    return heap_caps_realloc_prefer(buffer, size, 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, MALLOC_CAP_DEFAULT);
+}
+
+void ota_arena_buffer_release(char *buffer)
+{
+    if (buffer == NULL)
+    {
+        return;
+    }
+
+    if (!OTA_STATIC_MEMORY_ENABLED)
+    {
+        free(buffer);
+        return;
+    }
+
+    if (buffer == heartbeat_buffer)
+    {
+        atomic_store_explicit(&heartbeat_buffer_in_use, false, memory_order_release);
+        return;
+    }
+
+    unsigned slot = (buffer - buffers) / OTA_ARENA_BUFFER_SIZE;
+    atomic_fetch_and_explicit(&buffers_in_use, ~(1u << slot), memory_order_release);
+}
+
+char *ota_arena_print_json(const cJSON *json)
+{
+    if (!OTA_STATIC_MEMORY_ENABLED)
+    {
+        return cJSON_PrintUnformatted(json);
+    }
+
+    char *buffer = ota_arena_buffer_acquire();
+    if (buffer != NULL && !cJSON_PrintPreallocated((cJSON *)json, buffer, OTA_ARENA_BUFFER_SIZE, false))
+    {
+        ESP_LOGE(TAG, "JSON does not fit in OTA_ARENA_BUFFER_SIZE");
+        ota_arena_buffer_release(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+void ota_arena_free_json(char *json_string)
+{
+    if (!OTA_STATIC_MEMORY_ENABLED)
+    {
+        cJSON_free(json_string);
+        return;
+    }
+
+    ota_arena_buffer_release(json_string);
+}
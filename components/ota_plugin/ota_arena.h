@@ -0,0 +1,141 @@
+#ifndef OTA_ARENA_H
+#define OTA_ARENA_H
+
+#include "ota_config.h"
+#include "esp_err.h"
+#include "cJSON.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Static memory budget. With OTA_STATIC_MEMORY_ENABLED, the executor stack,
+ * the span pool, the scratch buffers and the heartbeat buffer are carved out
+ * of static arenas during ota_plugin_init(); their sizes are computed at
+ * compile time from ota_config.h. Once the arenas are sealed the plugin's own code does not
+ * touch the heap. Without it, the same calls fall back to the heap.
+ *
+ * Bulk data (buffers and spans) goes to PSRAM when OTA_PSRAM_BUFFERS_ENABLED
+ * and the board has it; task stacks always stay in internal RAM.
+ */
+
+/**
+ * @brief Reserve the scratch buffer pool and the heartbeat buffer
+ *
+ * Safe to call more than once.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the arena is too small
+ */
+esp_err_t ota_arena_init(void);
+
+/**
+ * @brief Reserve memory from the arena
+ *
+ * Only valid before ota_arena_seal(). Memory is never given back.
+ *
+ * @param size Bytes, rounded up to 8-byte alignment
+ * @return Memory, or NULL if the arena is exhausted or sealed
+ */
+void* ota_arena_reserve(size_t size);
+
+/**
+ * @brief Reserve memory for bulk data from the arena
+ *
+ * Like ota_arena_reserve(), but from external RAM when PSRAM placement is
+ * enabled. Not for stacks or anything used while flash is being written.
+ *
+ * @param size Bytes, rounded up to 8-byte alignment
+ * @return Memory, or NULL if the arena is exhausted or sealed
+ */
+void* ota_arena_reserve_bulk(size_t size);
+
+/**
+ * @brief Allocate zeroed bulk data from the heap, preferring PSRAM
+ *
+ * For dynamic memory mode. Falls back to internal RAM without PSRAM.
+ *
+ * @param size Bytes
+ * @return Memory to release with free(), NULL on failure
+ */
+void* ota_arena_bulk_calloc(size_t size);
+
+/**
+ * @brief End the reservation phase and log the arena usage
+ */
+void ota_arena_seal(void);
+
+/**
+ * @brief Bytes reserved so far
+ * @return Used bytes
+ */
+size_t ota_arena_used(void);
+
+/**
+ * @brief Arena size computed from ota_config.h
+ * @return Size of both arenas in bytes, 0 if static memory is disabled
+ */
+size_t ota_arena_capacity(void);
+
+/**
+ * @brief Take a scratch buffer of OTA_ARENA_BUFFER_SIZE bytes
+ *
+ * Lock-free. In static memory mode the buffer comes from a pool of
+ * OTA_ARENA_BUFFER_COUNT; otherwise it is allocated from the heap.
+ *
+ * @return Buffer, or NULL if none is free
+ */
+char* ota_arena_buffer_acquire(void);
+
+/**
+ * @brief Take the buffer heartbeat requests are encoded into
+ *
+ * In static memory mode this is the one buffer of OTA_HEARTBEAT_BUFFER_SIZE
+ * bytes reserved at init; otherwise a scratch buffer allocated from the
+ * heap, which ota_arena_buffer_grow() enlarges.
+ *
+ * @param size Output: buffer size in bytes
+ * @return Buffer to return with ota_arena_buffer_release(), NULL if it is in use or allocation failed
+ */
+char* ota_arena_heartbeat_buffer_acquire(size_t* size);
+
+/**
+ * @brief Enlarge a scratch buffer, keeping its contents
+ *
+ * Dynamic memory mode only; pool buffers have a fixed size.
+ *
+ * @param buffer Buffer from ota_arena_buffer_acquire() or an earlier call
+ * @param size New size in bytes
+ * @return Enlarged buffer, NULL on failure or in static memory mode (buffer is then unchanged)
+ */
+char* ota_arena_buffer_grow(char* buffer, size_t size);
+
+/**
+ * @brief Return a buffer taken with ota_arena_buffer_acquire() or ota_arena_heartbeat_buffer_acquire()
+ * @param buffer Buffer (can be NULL)
+ */
+void ota_arena_buffer_release(char* buffer);
+
+/**
+ * @brief Serialize JSON without formatting
+ *
+ * Into a scratch buffer in static memory mode, otherwise into a heap
+ * buffer sized by cJSON.
+ *
+ * @param json JSON to serialize
+ * @return String to free with ota_arena_free_json(), NULL on failure
+ */
+char* ota_arena_print_json(const cJSON* json);
+
+/**
+ * @brief Free a string from ota_arena_print_json()
+ * @param json_string String (can be NULL)
+ */
+void ota_arena_free_json(char* json_string);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_ARENA_H
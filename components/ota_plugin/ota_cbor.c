@@ -0,0 +1,652 @@
+#include "ota_cbor.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Major types
+#define MAJOR_UINT 0
+#define MAJOR_NEGINT 1
+#define MAJOR_BYTES 2
+#define MAJOR_TEXT 3
+#define MAJOR_ARRAY 4
+#define MAJOR_MAP 5
+#define MAJOR_TAG 6
+#define MAJOR_SIMPLE 7
+
+// Additional information values
+#define INFO_UINT8 24
+#define INFO_UINT16 25
+#define INFO_UINT32 26
+#define INFO_UINT64 27
+#define INFO_INDEFINITE 31
+
+#define SIMPLE_FALSE 0xF4
+#define SIMPLE_TRUE 0xF5
+#define SIMPLE_NULL 0xF6
+#define FLOAT_HALF 0xF9
+#define FLOAT_SINGLE 0xFA
+#define FLOAT_DOUBLE 0xFB
+#define BREAK 0xFF
+
+// Deeper nesting in a response is rejected rather than recursed into
+#define MAX_DEPTH 8
+
+// Integers up to 2^53 survive a round trip through a double
+#define MAX_EXACT_DOUBLE_INT 9007199254740992.0
+
+void ota_cbor_writer_init(ota_cbor_writer_t *writer, void *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->len = 0;
+    writer->overflow = false;
+}
+
+static void put_bytes(ota_cbor_writer_t *writer, const void *data, size_t len)
+{
+    if (writer->overflow || len > writer->size - writer->len)
+    {
+        writer->overflow = true;
+        return;
+    }
+
+    memcpy(&writer->buffer[writer->len], data, len);
+    writer->len += len;
+}
+
+static void put_byte(ota_cbor_writer_t *writer, uint8_t byte)
+{
+    put_bytes(writer, &byte, 1);
+}
+
+// Big-endian argument in the shortest form that holds it
+static void put_head(ota_cbor_writer_t *writer, uint8_t major, uint64_t value)
+{
+    uint8_t head[9];
+    uint8_t info;
+    size_t arg_len;
+
+    if (value < INFO_UINT8)
+    {
+        put_byte(writer, (major << 5) | (uint8_t)value);
+        return;
+    }
+
+    if (value <= UINT8_MAX)
+    {
+        info = INFO_UINT8;
+        arg_len = 1;
+    }
+    else if (value <= UINT16_MAX)
+    {
+        info = INFO_UINT16;
+        arg_len = 2;
+    }
+    else if (value <= UINT32_MAX)
+    {
+        info = INFO_UINT32;
+        arg_len = 4;
+    }
+    else
+    {
+        info = INFO_UINT64;
+        arg_len = 8;
+    }
+
+    head[0] = (major << 5) | info;
+    for (size_t i = 0; i < arg_len; i++)
+    {
+        head[arg_len - i] = (uint8_t)(value >> (8 * i));
+    }
+    put_bytes(writer, head, arg_len + 1);
+}
+
+void ota_cbor_put_map(ota_cbor_writer_t *writer, size_t pairs)
+{
+    if (pairs == OTA_CBOR_INDEFINITE)
+    {
+        put_byte(writer, (MAJOR_MAP << 5) | INFO_INDEFINITE);
+        return;
+    }
+    put_head(writer, MAJOR_MAP, pairs);
+}
+
+void ota_cbor_put_array(ota_cbor_writer_t *writer, size_t items)
+{
+    if (items == OTA_CBOR_INDEFINITE)
+    {
+        put_byte(writer, (MAJOR_ARRAY << 5) | INFO_INDEFINITE);
+        return;
+    }
+    put_head(writer, MAJOR_ARRAY, items);
+}
+
+void ota_cbor_put_break(ota_cbor_writer_t *writer)
+{
+    put_byte(writer, BREAK);
+}
+
+void ota_cbor_put_int(ota_cbor_writer_t *writer, int64_t value)
+{
+    if (value >= 0)
+    {
+        put_head(writer, MAJOR_UINT, (uint64_t)value);
+    }
+    else
+    {
+        // -1 - value cannot overflow, even for INT64_MIN
+        put_head(writer, MAJOR_NEGINT, (uint64_t)(-1 - value));
+    }
+}
+
+void ota_cbor_put_double(ota_cbor_writer_t *writer, double value)
+{
+    uint8_t encoded[9];
+    float single = (float)value;
+
+    if ((double)single == value || isnan(value))
+    {
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        encoded[0] = FLOAT_SINGLE;
+        for (int i = 0; i < 4; i++)
+        {
+            encoded[4 - i] = (uint8_t)(bits >> (8 * i));
+        }
+        put_bytes(writer, encoded, 5);
+        return;
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    encoded[0] = FLOAT_DOUBLE;
+    for (int i = 0; i < 8; i++)
+    {
+        encoded[8 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    put_bytes(writer, encoded, 9);
+}
+
+void ota_cbor_put_bool(ota_cbor_writer_t *writer, bool value)
+{
+    put_byte(writer, value ? SIMPLE_TRUE : SIMPLE_FALSE);
+}
+
+void ota_cbor_put_null(ota_cbor_writer_t *writer)
+{
+    put_byte(writer, SIMPLE_NULL);
+}
+
+void ota_cbor_put_text(ota_cbor_writer_t *writer, const char *text)
+{
+    size_t len = strlen(text);
+    put_head(writer, MAJOR_TEXT, len);
+    put_bytes(writer, text, len);
+}
+
+void ota_cbor_put_json(ota_cbor_writer_t *writer, const cJSON *json)
+{
+    const cJSON *child;
+
+    if (cJSON_IsObject(json))
+    {
+        ota_cbor_put_map(writer, cJSON_GetArraySize(json));
+        cJSON_ArrayForEach(child, json)
+        {
+            ota_cbor_put_text(writer, child->string);
+            ota_cbor_put_json(writer, child);
+        }
+    }
+    else if (cJSON_IsArray(json))
+    {
+        ota_cbor_put_array(writer, cJSON_GetArraySize(json));
+        cJSON_ArrayForEach(child, json)
+        {
+            ota_cbor_put_json(writer, child);
+        }
+    }
+    else if (cJSON_IsString(json))
+    {
+        ota_cbor_put_text(writer, json->valuestring);
+    }
+    else if (cJSON_IsNumber(json))
+    {
+        double value = json->valuedouble;
+        if (fabs(value) < MAX_EXACT_DOUBLE_INT && value == (double)(int64_t)value)
+        {
+            ota_cbor_put_int(writer, (int64_t)value);
+        }
+        else
+        {
+            ota_cbor_put_double(writer, value);
+        }
+    }
+    else if (cJSON_IsBool(json))
+    {
+        ota_cbor_put_bool(writer, cJSON_IsTrue(json));
+    }
+    else
+    {
+        ota_cbor_put_null(writer);
+    }
+}
+
+esp_err_t ota_cbor_writer_finish(const ota_cbor_writer_t *writer)
+{
+    return writer->overflow ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+} reader_t;
+
+// Initial byte and argument; for INFO_INDEFINITE the argument is 0
+static bool read_head(reader_t *reader, uint8_t *major, uint8_t *info, uint64_t *value)
+{
+    if (reader->pos >= reader->len)
+    {
+        return false;
+    }
+
+    uint8_t initial = reader->data[reader->pos++];
+    *major = initial >> 5;
+    *info = initial & 0x1F;
+    *value = 0;
+
+    if (*info < INFO_UINT8)
+    {
+        *value = *info;
+        return true;
+    }
+    if (*info == INFO_INDEFINITE)
+    {
+        return true;
+    }
+    if (*info > INFO_UINT64)
+    {
+        return false;
+    }
+
+    size_t arg_len = (size_t)1 << (*info - INFO_UINT8);
+    if (arg_len > reader->len - reader->pos)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < arg_len; i++)
+    {
+        *value = (*value << 8) | reader->data[reader->pos++];
+    }
+    return true;
+}
+
+static double half_to_double(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1F;
+    int mantissa = half & 0x3FF;
+    double value;
+
+    if (exponent == 0)
+    {
+        value = ldexp(mantissa, -24);
+    }
+    else if (exponent != 31)
+    {
+        value = ldexp(mantissa + 1024, exponent - 25);
+    }
+    else
+    {
+        value = mantissa == 0 ? INFINITY : NAN;
+    }
+    return (half & 0x8000) ? -value : value;
+}
+
+static bool read_item(reader_t *reader, ota_cbor_item_t *item, int depth);
+
+// Skip the entries of an array or map, entries_per_item being 2 for maps
+static bool skip_entries(reader_t *reader, uint8_t info, uint64_t count, int entries_per_item, int depth)
+{
+    ota_cbor_item_t inner;
+
+    if (info == INFO_INDEFINITE)
+    {
+        while (true)
+        {
+            if (reader->pos >= reader->len)
+            {
+                return false;
+            }
+            if (reader->data[reader->pos] == BREAK)
+            {
+                reader->pos++;
+                return true;
+            }
+            for (int i = 0; i < entries_per_item; i++)
+            {
+                if (!read_item(reader, &inner, depth + 1))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // Every entry takes at least a byte, which also keeps count * 2 in range
+    if (count > reader->len - reader->pos)
+    {
+        return false;
+    }
+    for (uint64_t i = 0; i < count * entries_per_item; i++)
+    {
+        if (!read_item(reader, &inner, depth + 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool read_item(reader_t *reader, ota_cbor_item_t *item, int depth)
+{
+    size_t start = reader->pos;
+    uint8_t major;
+    uint8_t info;
+    uint64_t value;
+
+    if (depth > MAX_DEPTH || !read_head(reader, &major, &info, &value))
+    {
+        return false;
+    }
+
+    item->type = OTA_CBOR_TYPE_OTHER;
+
+    switch (major)
+    {
+    case MAJOR_UINT:
+    case MAJOR_NEGINT:
+        if (info == INFO_INDEFINITE)
+        {
+            return false;
+        }
+        if (value <= INT64_MAX)
+        {
+            item->type = OTA_CBOR_TYPE_INT;
+            item->value.integer = major == MAJOR_UINT ? (int64_t)value : -1 - (int64_t)value;
+        }
+        break;
+    case MAJOR_BYTES:
+    case MAJOR_TEXT:
+        // Chunked strings are not used by the backend
+        if (info == INFO_INDEFINITE || value > reader->len - reader->pos)
+        {
+            return false;
+        }
+        if (major == MAJOR_TEXT)
+        {
+            item->type = OTA_CBOR_TYPE_TEXT;
+            item->value.text.ptr = (const char *)&reader->data[reader->pos];
+            item->value.text.len = (size_t)value;
+        }
+        reader->pos += (size_t)value;
+        break;
+    case MAJOR_ARRAY:
+    case MAJOR_MAP:
+        item->type = major == MAJOR_MAP ? OTA_CBOR_TYPE_MAP : OTA_CBOR_TYPE_ARRAY;
+        if (!skip_entries(reader, info, value, major == MAJOR_MAP ? 2 : 1, depth))
+        {
+            return false;
+        }
+        break;
+    case MAJOR_TAG:
+        // Tags only add meaning; report the tagged item
+        if (info == INFO_INDEFINITE || !read_item(reader, item, depth + 1))
+        {
+            return false;
+        }
+        break;
+    case MAJOR_SIMPLE:
+        switch (0xE0 | info)
+        {
+        case SIMPLE_FALSE:
+        case SIMPLE_TRUE:
+            item->type = OTA_CBOR_TYPE_BOOL;
+            item->value.boolean = (0xE0 | info) == SIMPLE_TRUE;
+            break;
+        case SIMPLE_NULL:
+            item->type = OTA_CBOR_TYPE_NULL;
+            break;
+        case FLOAT_HALF:
+            item->type = OTA_CBOR_TYPE_FLOAT;
+            item->value.number = half_to_double((uint16_t)value);
+            break;
+        case FLOAT_SINGLE:
+        {
+            uint32_t bits = (uint32_t)value;
+            float single;
+            memcpy(&single, &bits, sizeof(single));
+            item->type = OTA_CBOR_TYPE_FLOAT;
+            item->value.number = single;
+            break;
+        }
+        case FLOAT_DOUBLE:
+            item->type = OTA_CBOR_TYPE_FLOAT;
+            memcpy(&item->value.number, &value, sizeof(item->value.number));
+            break;
+        case BREAK:
+            // Only valid where skip_entries() looks for it
+            return false;
+        default:
+            break;
+        }
+        break;
+    }
+
+    item->raw = &reader->data[start];
+    item->raw_len = reader->pos - start;
+    return true;
+}
+
+esp_err_t ota_cbor_read_map(const void *data, size_t len, ota_cbor_map_cb_t callback, void *ctx)
+{
+    reader_t reader = {data, len, 0};
+    uint8_t major;
+    uint8_t info;
+    uint64_t count;
+
+    if (!data || !callback || !read_head(&reader, &major, &info, &count) || major != MAJOR_MAP)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bool indefinite = info == INFO_INDEFINITE;
+    if (!indefinite && count > len)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint64_t i = 0; indefinite || i < count; i++)
+    {
+        if (indefinite)
+        {
+            if (reader.pos >= reader.len)
+            {
+                return ESP_ERR_INVALID_ARG;
+            }
+            if (reader.data[reader.pos] == BREAK)
+            {
+                break;
+            }
+        }
+
+        ota_cbor_item_t key;
+        ota_cbor_item_t item;
+        if (!read_item(&reader, &key, 1) || !read_item(&reader, &item, 1))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (key.type == OTA_CBOR_TYPE_TEXT)
+        {
+            callback(key.value.text.ptr, key.value.text.len, &item, ctx);
+        }
+    }
+
+    return ESP_OK;
+}
+
+static cJSON *item_to_json(const ota_cbor_item_t *item)
+{
+    switch (item->type)
+    {
+    case OTA_CBOR_TYPE_INT:
+        return cJSON_CreateNumber((double)item->value.integer);
+    case OTA_CBOR_TYPE_FLOAT:
+        return cJSON_CreateNumber(item->value.number);
+    case OTA_CBOR_TYPE_BOOL:
+        return cJSON_CreateBool(item->value.boolean);
+    case OTA_CBOR_TYPE_TEXT:
+    {
+        char *text = malloc(item->value.text.len + 1);
+        if (text == NULL)
+        {
+            return NULL;
+        }
+        memcpy(text, item->value.text.ptr, item->value.text.len);
+        text[item->value.text.len] = '\0';
+        cJSON *json = cJSON_CreateString(text);
+        free(text);
+        return json;
+    }
+    default:
+        return cJSON_CreateNull();
+    }
+}
+
+// Convert the item at the reader, descending into arrays and maps
+static cJSON *read_json(reader_t *reader, int depth)
+{
+    size_t start = reader->pos;
+    uint8_t major;
+    uint8_t info;
+    uint64_t count;
+
+    if (depth > MAX_DEPTH || !read_head(reader, &major, &info, &count))
+    {
+        return NULL;
+    }
+
+    if (major == MAJOR_TAG)
+    {
+        return info == INFO_INDEFINITE ? NULL : read_json(reader, depth + 1);
+    }
+
+    if (major != MAJOR_ARRAY && major != MAJOR_MAP)
+    {
+        ota_cbor_item_t item;
+        reader->pos = start;
+        return read_item(reader, &item, depth) ? item_to_json(&item) : NULL;
+    }
+
+    bool indefinite = info == INFO_INDEFINITE;
+    cJSON *container = major == MAJOR_MAP ? cJSON_CreateObject() : cJSON_CreateArray();
+    if (container == NULL || (!indefinite && count > reader->len - reader->pos))
+    {
+        cJSON_Delete(container);
+        return NULL;
+    }
+
+    bool ok = true;
+    for (uint64_t i = 0;; i++)
+    {
+        if (!indefinite && i == count)
+        {
+            break;
+        }
+        if (indefinite)
+        {
+            if (reader->pos >= reader->len)
+            {
+                ok = false;
+                break;
+            }
+            if (reader->data[reader->pos] == BREAK)
+            {
+                reader->pos++;
+                break;
+            }
+        }
+
+        char key[64];
+        if (major == MAJOR_MAP)
+        {
+            ota_cbor_item_t key_item;
+            if (!read_item(reader, &key_item, depth + 1) || key_item.type != OTA_CBOR_TYPE_TEXT ||
+                key_item.value.text.len >= sizeof(key))
+            {
+                ok = false;
+                break;
+            }
+            ota_cbor_copy_text(&key_item, key, sizeof(key));
+        }
+
+        cJSON *value = read_json(reader, depth + 1);
+        if (value == NULL)
+        {
+            ok = false;
+            break;
+        }
+
+        if (major == MAJOR_MAP)
+        {
+            cJSON_AddItemToObject(container, key, value);
+        }
+        else
+        {
+            cJSON_AddItemToArray(container, value);
+        }
+    }
+
+    if (!ok)
+    {
+        cJSON_Delete(container);
+        return NULL;
+    }
+    return container;
+}
+
+cJSON *ota_cbor_to_json(const void *data, size_t len)
+{
+    if (!data)
+    {
+        return NULL;
+    }
+
+    reader_t reader = {data, len, 0};
+    cJSON *json = read_json(&reader, 0);
+    if (json != NULL && reader.pos != len)
+    {
+        cJSON_Delete(json); // Trailing bytes
+        return NULL;
+    }
+    return json;
+}
+
+bool ota_cbor_key_is(const char *key, size_t key_len, const char *name)
+{
+    return strlen(name) == key_len && memcmp(key, name, key_len) == 0;
+}
+
+bool ota_cbor_copy_text(const ota_cbor_item_t *item, char *buffer, size_t buffer_size)
+{
+    if (item->type != OTA_CBOR_TYPE_TEXT || buffer_size == 0)
+    {
+        return false;
+    }
+
+    size_t len = item->value.text.len < buffer_size - 1 ? item->value.text.len : buffer_size - 1;
+    memcpy(buffer, item->value.text.ptr, len);
+    buffer[len] = '\0';
+    return true;
+}
@@ -0,0 +1,206 @@
+#ifndef OTA_CBOR_H
+#define OTA_CBOR_H
+
+#include "esp_err.h"
+#include "cJSON.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Minimal CBOR (RFC 8949) for request and response bodies. The writer
+ * encodes straight into a caller buffer and the reader walks a map in place,
+ * without building a tree. Only what the backend exchanges is supported:
+ * integers, floats, booleans, null, text strings, arrays and maps with text
+ * keys.
+ */
+
+/**
+ * @brief Pass as the size of ota_cbor_put_map() or ota_cbor_put_array() for
+ *        an indefinite-length container, closed by ota_cbor_put_break()
+ */
+#define OTA_CBOR_INDEFINITE SIZE_MAX
+
+/**
+ * @brief Encoder state
+ */
+typedef struct {
+    uint8_t* buffer;
+    size_t size;
+    size_t len;    // Bytes written so far
+    bool overflow; // Set once anything did not fit; later writes are dropped
+} ota_cbor_writer_t;
+
+/**
+ * @brief Start encoding into a buffer
+ * @param writer Writer
+ * @param buffer Output buffer
+ * @param size Size of buffer
+ */
+void ota_cbor_writer_init(ota_cbor_writer_t* writer, void* buffer, size_t size);
+
+/**
+ * @brief Start a map; follow with key, value, key, value...
+ * @param writer Writer
+ * @param pairs Number of pairs, or OTA_CBOR_INDEFINITE
+ */
+void ota_cbor_put_map(ota_cbor_writer_t* writer, size_t pairs);
+
+/**
+ * @brief Start an array
+ * @param writer Writer
+ * @param items Number of items, or OTA_CBOR_INDEFINITE
+ */
+void ota_cbor_put_array(ota_cbor_writer_t* writer, size_t items);
+
+/**
+ * @brief Close an indefinite-length map or array
+ * @param writer Writer
+ */
+void ota_cbor_put_break(ota_cbor_writer_t* writer);
+
+/**
+ * @brief Write a signed integer, exact over the whole int64_t range
+ * @param writer Writer
+ * @param value Value
+ */
+void ota_cbor_put_int(ota_cbor_writer_t* writer, int64_t value);
+
+/**
+ * @brief Write a floating-point number, as float32 when that is exact
+ * @param writer Writer
+ * @param value Value
+ */
+void ota_cbor_put_double(ota_cbor_writer_t* writer, double value);
+
+/**
+ * @brief Write a boolean
+ * @param writer Writer
+ * @param value Value
+ */
+void ota_cbor_put_bool(ota_cbor_writer_t* writer, bool value);
+
+/**
+ * @brief Write null
+ * @param writer Writer
+ */
+void ota_cbor_put_null(ota_cbor_writer_t* writer);
+
+/**
+ * @brief Write a UTF-8 text string
+ * @param writer Writer
+ * @param text NUL-terminated text
+ */
+void ota_cbor_put_text(ota_cbor_writer_t* writer, const char* text);
+
+/**
+ * @brief Write a JSON value as CBOR
+ *
+ * For JSON that reaches the client already built, such as heartbeat metrics.
+ * Integral numbers are written as integers.
+ *
+ * @param writer Writer
+ * @param json Value to convert
+ */
+void ota_cbor_put_json(ota_cbor_writer_t* writer, const cJSON* json);
+
+/**
+ * @brief Finish encoding
+ * @param writer Writer
+ * @return ESP_OK if everything fit, ESP_ERR_NO_MEM otherwise
+ */
+esp_err_t ota_cbor_writer_finish(const ota_cbor_writer_t* writer);
+
+typedef enum {
+    OTA_CBOR_TYPE_INT,
+    OTA_CBOR_TYPE_FLOAT,
+    OTA_CBOR_TYPE_BOOL,
+    OTA_CBOR_TYPE_NULL,
+    OTA_CBOR_TYPE_TEXT,
+    OTA_CBOR_TYPE_ARRAY,
+    OTA_CBOR_TYPE_MAP,
+    OTA_CBOR_TYPE_OTHER, // Byte strings, undefined and other simple values
+} ota_cbor_type_t;
+
+/**
+ * @brief One decoded value, pointing into the input
+ */
+typedef struct {
+    ota_cbor_type_t type;
+    union {
+        int64_t integer; // Integers outside int64_t are reported as OTHER
+        double number;
+        bool boolean;
+        struct {
+            const char* ptr; // Not NUL-terminated
+            size_t len;
+        } text;
+    } value;
+    const uint8_t* raw; // Whole encoded item, e.g. to read a nested map
+    size_t raw_len;
+} ota_cbor_item_t;
+
+/**
+ * @brief Called for each entry of a map
+ * @param key Key, not NUL-terminated
+ * @param key_len Length of key
+ * @param item Value
+ * @param ctx Context passed to ota_cbor_read_map()
+ */
+typedef void (*ota_cbor_map_cb_t)(const char* key, size_t key_len, const ota_cbor_item_t* item, void* ctx);
+
+/**
+ * @brief Walk the entries of an encoded map
+ *
+ * Entries whose key is not a text string are skipped. The input is
+ * validated while it is walked, so entries before a malformed one have
+ * already been reported when an error is returned.
+ *
+ * @param data Encoded map
+ * @param len Bytes of data
+ * @param callback Called for each entry
+ * @param ctx Passed to callback
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if data is not a well-formed map
+ */
+esp_err_t ota_cbor_read_map(const void* data, size_t len, ota_cbor_map_cb_t callback, void* ctx);
+
+/**
+ * @brief Compare a key passed to an ota_cbor_map_cb_t with a string
+ * @param key Key
+ * @param key_len Length of key
+ * @param name NUL-terminated string
+ * @return true if they are equal
+ */
+bool ota_cbor_key_is(const char* key, size_t key_len, const char* name);
+
+/**
+ * @brief Copy a text item into a NUL-terminated buffer, truncating if needed
+ * @param item Item of type OTA_CBOR_TYPE_TEXT
+ * @param buffer Output
+ * @param buffer_size Size of buffer
+ * @return true if item is text
+ */
+bool ota_cbor_copy_text(const ota_cbor_item_t* item, char* buffer, size_t buffer_size);
+
+/**
+ * @brief Convert an encoded value to JSON
+ *
+ * For resending a CBOR body as JSON. Integers become JSON numbers, byte
+ * strings and other simple values become null.
+ *
+ * @param data Encoded value
+ * @param len Bytes of data
+ * @return The value, to be freed with cJSON_Delete(); NULL if data is not
+ *         one well-formed value with text map keys, or memory runs out
+ */
+cJSON* ota_cbor_to_json(const void* data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_CBOR_H
@@ -0,0 +1,117 @@
+#include "ota_compress.h"
+#include "ota_arena.h"
+#include "ota_metrics.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "rom/miniz.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+static const char *TAG = "ota_compress";
+
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+
+_Static_assert(OTA_COMPRESSION_LEVEL >= 1 && OTA_COMPRESSION_LEVEL <= 9, "OTA_COMPRESSION_LEVEL must be 1 - 9");
+
+// Match probes per level, as in miniz's own level mapping; levels up to 3 parse greedily
+static const int level_probes[10] = {0, 1, 6, 32, 16, 32, 128, 256, 512, 768};
+
+static tdefl_compressor *compressor = NULL;
+static atomic_flag compressor_busy = ATOMIC_FLAG_INIT;
+
+static ota_metric_handle_t bytes_in_metric = OTA_METRIC_INVALID_HANDLE;
+static ota_metric_handle_t bytes_out_metric = OTA_METRIC_INVALID_HANDLE;
+static ota_metric_handle_t cpu_metric = OTA_METRIC_INVALID_HANDLE;
+
+esp_err_t ota_compress_init(void)
+{
+    if (compressor != NULL)
+    {
+        return ESP_OK;
+    }
+
+    // The arena only budgets for the state with OTA_COMPRESSION_ENABLED
+    compressor = OTA_STATIC_MEMORY_ENABLED && OTA_COMPRESSION_ENABLED
+                     ? ota_arena_reserve_bulk(sizeof(tdefl_compressor))
+                     : ota_arena_bulk_calloc(sizeof(tdefl_compressor));
+    if (compressor == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes of compressor state", (unsigned)sizeof(tdefl_compressor));
+        return ESP_ERR_NO_MEM;
+    }
+
+    bytes_in_metric = ota_metrics_register("http.gzip.bytes_in", OTA_METRIC_COUNTER, "bytes");
+    bytes_out_metric = ota_metrics_register("http.gzip.bytes_out", OTA_METRIC_COUNTER, "bytes");
+    cpu_metric = ota_metrics_register("http.gzip.cpu_us", OTA_METRIC_COUNTER, "us");
+
+    ESP_LOGI(TAG, "Compressor ready (%u bytes of state, level %d)", (unsigned)sizeof(tdefl_compressor),
+             OTA_COMPRESSION_LEVEL);
+    return ESP_OK;
+}
+
+static void put_le32(uint8_t *dest, uint32_t value)
+{
+    dest[0] = value & 0xFF;
+    dest[1] = (value >> 8) & 0xFF;
+    dest[2] = (value >> 16) & 0xFF;
+    dest[3] = (value >> 24) & 0xFF;
+}
+
+esp_err_t ota_compress_gzip(const char *input, size_t input_len, char *output, size_t output_size,
+                            size_t *output_len)
+{
+    if (!input || !output || !output_len)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Anything that cannot beat the input is not worth sending compressed
+    size_t limit = output_size < input_len ? output_size : input_len;
+    if (limit <= GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (compressor == NULL || atomic_flag_test_and_set_explicit(&compressor_busy, memory_order_acquire))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int64_t started_at = esp_timer_get_time();
+
+    int flags = level_probes[OTA_COMPRESSION_LEVEL] | (OTA_COMPRESSION_LEVEL <= 3 ? TDEFL_GREEDY_PARSING_FLAG : 0);
+    tdefl_status status = tdefl_init(compressor, NULL, NULL, flags);
+
+    uint8_t *out = (uint8_t *)output;
+    size_t in_size = input_len;
+    size_t deflate_size = limit - GZIP_HEADER_SIZE - GZIP_TRAILER_SIZE;
+    if (status == TDEFL_STATUS_OKAY)
+    {
+        status = tdefl_compress(compressor, input, &in_size, &out[GZIP_HEADER_SIZE], &deflate_size, TDEFL_FINISH);
+    }
+
+    atomic_flag_clear_explicit(&compressor_busy, memory_order_release);
+
+    // Anything short of DONE means the deflate stream did not fit
+    if (status != TDEFL_STATUS_DONE || in_size != input_len)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Member header: magic, deflate, no flags, no mtime, no extra flags, unknown OS
+    static const uint8_t header[GZIP_HEADER_SIZE] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+    memcpy(out, header, sizeof(header));
+
+    uint8_t *trailer = &out[GZIP_HEADER_SIZE + deflate_size];
+    put_le32(trailer, esp_rom_crc32_le(0, (const uint8_t *)input, input_len));
+    put_le32(trailer + 4, (uint32_t)input_len);
+    *output_len = GZIP_HEADER_SIZE + deflate_size + GZIP_TRAILER_SIZE;
+
+    ota_metrics_counter_add(bytes_in_metric, input_len);
+    ota_metrics_counter_add(bytes_out_metric, *output_len);
+    ota_metrics_counter_add(cpu_metric, (uint32_t)(esp_timer_get_time() - started_at));
+    return ESP_OK;
+}
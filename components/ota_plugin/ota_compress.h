@@ -0,0 +1,52 @@
+#ifndef OTA_COMPRESS_H
+#define OTA_COMPRESS_H
+
+#include "ota_config.h"
+#include "esp_err.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Gzip for request bodies, using the deflate compressor (tdefl) in the chip
+ * ROM. The compressor state is allocated once by ota_compress_init() and
+ * reused for every body, so compressing does not touch the heap.
+ */
+
+/**
+ * @brief Allocate the compressor state
+ *
+ * From the bulk arena in static memory mode with OTA_COMPRESSION_ENABLED, so
+ * it must run before the arena is sealed; from the heap, preferring PSRAM,
+ * otherwise. Safe to call more than once.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the state cannot be allocated
+ */
+esp_err_t ota_compress_init(void);
+
+/**
+ * @brief Compress data into a gzip member
+ *
+ * One body is compressed at a time. A caller that finds the compressor busy,
+ * or whose output would not be smaller than its input, gets an error and
+ * should send the data as it is.
+ *
+ * @param input Data to compress
+ * @param input_len Bytes of input
+ * @param output Output buffer
+ * @param output_size Size of output
+ * @param output_len Bytes written to output
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if not initialized or busy,
+ *         ESP_ERR_INVALID_SIZE if the result does not fit in output or does not
+ *         save space
+ */
+esp_err_t ota_compress_gzip(const char* input, size_t input_len, char* output, size_t output_size,
+                            size_t* output_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_COMPRESS_H
@@ -1,45 +1,172 @@
 #ifndef OTA_CONFIG_H
 #define OTA_CONFIG_H
 
+#include "sdkconfig.h"
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-// Server Configuration
-#define OTA_SERVER_BASE_URL "http://192.168.10.149:5000/api" // Backend server URL
-#define OTA_SERVER_TIMEOUT_MS 150000                         // 150 seconds timeout for HTTP requests
-#define OTA_MAX_HTTP_OUTPUT_BUFFER 2048                      // Maximum buffer size for HTTP responses
+// Server Configuration (Kconfig defaults, see ota_settings.h for runtime overrides)
+#define OTA_SERVER_BASE_URL CONFIG_OTA_PLUGIN_SERVER_BASE_URL     // Backend server URL
+#define OTA_SERVER_TIMEOUT_MS CONFIG_OTA_PLUGIN_SERVER_TIMEOUT_MS // Timeout for HTTP requests
 
 // Device Configuration
-#define DEVICE_ID "Test_Device_001"   // This can be generated or flashed
-#define FIRMWARE_REF "esp32-devboard" // Current firmware reference, can be updated dynamically
-#define OTA_FIRMWARE_VERSION "6.0.0"  // Initial firmware version, updated dynamically
+#define DEVICE_ID CONFIG_OTA_PLUGIN_DEVICE_ID // Kconfig default, see ota_settings.h for runtime overrides
+#define FIRMWARE_REF "esp32-devboard"         // Current firmware reference, can be updated dynamically
+#define OTA_FIRMWARE_VERSION "6.0.0"          // Initial firmware version, updated dynamically
 
 // OTA Configuration
-#define OTA_CHECK_INTERVAL_MS 300000    // Check for updates every 5 minutes
-#define OTA_HEARTBEAT_INTERVAL_MS 60000 // Heartbeat every 60 seconds
-#define OTA_MAX_RETRY_COUNT 3           // Maximum retries for OTA operations
-#define OTA_RETRY_DELAY_MS 5000         // Delay between retries
-
-// Feature Flags
-#define OTA_METRICS_ENABLED true   // Enable metrics collection
-#define OTA_LOGGING_ENABLED true   // Enable logging to remote server
-#define OTA_TRACING_ENABLED true   // Enable tracing for operations
+#define OTA_CHECK_INTERVAL_MS CONFIG_OTA_PLUGIN_CHECK_INTERVAL_MS         // Kconfig default check interval
+#define OTA_HEARTBEAT_INTERVAL_MS CONFIG_OTA_PLUGIN_HEARTBEAT_INTERVAL_MS // Kconfig default heartbeat interval
+#define OTA_HEARTBEAT_DEADBAND 0.01f                                      // Relative change a metric needs to be resent in a delta heartbeat
+#define OTA_HEARTBEAT_DELTA_SLOTS 128                                     // Metrics whose last sent value is remembered for delta heartbeats
+#define OTA_MAX_RETRY_COUNT 3                                             // Maximum retries for OTA operations
+#define OTA_RETRY_DELAY_MS 5000                                           // Delay between retries
+#define OTA_DOWNLOAD_PROGRESS_STEP 65536                                  // Bytes downloaded between two download progress events
+#define OTA_RESTART_DELAY_MS 500                                          // Time event handlers get after an install before the restart
+
+// Adaptive Scheduling
+#define OTA_SCHEDULE_MIN_INTERVAL_MS 10000     // Shortest delay between two checks or heartbeats
+#define OTA_SCHEDULE_MAX_INTERVAL_MS 3600000   // Longest delay between two checks or heartbeats
+#define OTA_SCHEDULE_ROLLOUT_INTERVAL_MS 60000 // Check interval while a rollout is active
+#define OTA_SCHEDULE_WEAK_RSSI_DBM -75         // Links below this RSSI count as weak
+#define OTA_SCHEDULE_WEAK_LINK_FACTOR 2        // Interval multiplier on a weak link
+#define OTA_SCHEDULE_THROTTLE_FACTOR 4         // Interval multiplier while the backend reports load
+#define OTA_SCHEDULE_JITTER_PERCENT 10         // Random jitter, +/- percent of the interval
+
+// Feature Flags (metrics, logging and tracing are Kconfig defaults that ota_settings can override)
+#ifdef CONFIG_OTA_PLUGIN_METRICS
+#define OTA_METRICS_ENABLED true // Enable metrics collection
+#else
+#define OTA_METRICS_ENABLED false
+#endif
+#ifdef CONFIG_OTA_PLUGIN_LOGGING
+#define OTA_LOGGING_ENABLED true // Enable logging to remote server
+#else
+#define OTA_LOGGING_ENABLED false
+#endif
+#ifdef CONFIG_OTA_PLUGIN_TRACING
+#define OTA_TRACING_ENABLED true // Enable tracing for operations
+#else
+#define OTA_TRACING_ENABLED false
+#endif
+#define OTA_PROFILING_ENABLED true // Enable OTA_PROF_* cycle-counter probes
+#define OTA_EXPORTER_ENABLED false // Serve /metrics locally in Prometheus format
 #define OTA_SSL_VERIFICATION false // Enable SSL verification for secure connections
 
 // Task Configuration
-#define OTA_TASK_STACK_SIZE 8192           // Stack size for OTA tasks
-#define OTA_TASK_PRIORITY 5                // Priority for OTA tasks
-#define OTA_HEARTBEAT_TASK_STACK_SIZE 4096 // Stack size for heartbeat task
-#define OTA_HEARTBEAT_TASK_PRIORITY 3      // Priority for heartbeat task
+#define OTA_TASK_STACK_SIZE 8192     // Stack size for the executor task running all plugin jobs
+#define OTA_TASK_PRIORITY 5          // Priority for the executor task
+#if defined(CONFIG_OTA_PLUGIN_TASK_CORE_0)
+#define OTA_TASK_CORE 0 // Core the executor is pinned to (Kconfig): 0, 1 or tskNO_AFFINITY
+#elif defined(CONFIG_OTA_PLUGIN_TASK_CORE_1)
+#define OTA_TASK_CORE 1
+#else
+#define OTA_TASK_CORE tskNO_AFFINITY
+#endif
+#define OTA_EXECUTOR_MAX_JOBS 8      // Jobs the executor can schedule at once
+#define OTA_CHECK_MAX_WAITERS 4      // Callers that can wait on a requested update check
+
+// Metrics Configuration
+#define OTA_METRICS_CAPACITY 32      // Registered metrics, must be a power of two
+#define OTA_METRICS_MAX_HISTOGRAMS 4 // Histogram metrics out of OTA_METRICS_CAPACITY
+#define OTA_METRICS_NAME_SIZE 32
+#define OTA_METRICS_UNIT_SIZE 16
+
+// System Metrics Configuration
+#define OTA_SYSMON_MAX_TASKS 32 // Tasks covered by per-task CPU and stack metrics
+
+// Local Metrics Endpoint
+#define OTA_EXPORTER_PORT 9100                // Port of the /metrics endpoint
+#define OTA_EXPORTER_CHUNK_SIZE 256           // Bytes rendered per HTTP chunk
+#define OTA_EXPORTER_TASK_STACK_SIZE 4096     // Stack size for the HTTP server task
+#if defined(CONFIG_OTA_PLUGIN_EXPORTER_TASK_CORE_0)
+#define OTA_EXPORTER_TASK_CORE 0 // Core the HTTP server task is pinned to (Kconfig)
+#elif defined(CONFIG_OTA_PLUGIN_EXPORTER_TASK_CORE_1)
+#define OTA_EXPORTER_TASK_CORE 1
+#else
+#define OTA_EXPORTER_TASK_CORE tskNO_AFFINITY
+#endif
+
+// Runtime Settings
+#define OTA_REMOTE_LOG_LEVEL CONFIG_OTA_PLUGIN_REMOTE_LOG_LEVEL // Lowest ota_log_level_t sent to the backend
+#define OTA_SETTINGS_TEXT_SIZE 128                               // Buffer size for string settings (server URL, device ID)
+#define OTA_SETTINGS_MAX_LISTENERS 4                             // Modules that can watch setting changes
+
+// Memory Budget and Placement
+#ifdef CONFIG_OTA_PLUGIN_STATIC_MEMORY
+#define OTA_STATIC_MEMORY_ENABLED true // Reserve the executor stack, span pool and buffers from static arenas at init (Kconfig)
+#else
+#define OTA_STATIC_MEMORY_ENABLED false
+#endif
+#ifdef CONFIG_OTA_PLUGIN_PSRAM_BUFFERS
+#define OTA_PSRAM_BUFFERS_ENABLED true // Put scratch buffers and spans in PSRAM (Kconfig), keeping internal RAM free
+#else
+#define OTA_PSRAM_BUFFERS_ENABLED false
+#endif
+#define OTA_ARENA_BUFFER_COUNT 6        // Scratch buffers for request bodies and check responses
+#define OTA_ARENA_BUFFER_SIZE 2048      // Bytes per scratch buffer; larger request bodies fail in static mode
+#define OTA_HEARTBEAT_METRIC_SIZE 96    // Bytes budgeted per heartbeat metric, static mode only
+#define OTA_TRACE_SPAN_POOL_SIZE 24     // Spans open or held for tail sampling at once, static mode only
+#define OTA_TRACE_RAW_ATTR_SIZE 128     // Legacy JSON attributes kept per held span, static mode only
+
+// Every metric a heartbeat can carry: WiFi signal, per-task CPU and stack,
+// four per heap region, registered metrics (five per histogram), span
+// latencies and probe statistics. The static heartbeat buffer holds that
+// many at OTA_HEARTBEAT_METRIC_SIZE; metrics beyond it go with the next one
+#define OTA_HEARTBEAT_MAX_METRICS                                                                  \
+    (1 + 2 * OTA_SYSMON_MAX_TASKS + 4 * 3 + OTA_METRICS_CAPACITY + 4 * OTA_METRICS_MAX_HISTOGRAMS + \
+     5 * OTA_TRACE_HISTOGRAM_SLOTS + (OTA_PROFILING_ENABLED ? 4 * OTA_PROF_MAX_SITES : 0))
+#define OTA_HEARTBEAT_BUFFER_SIZE \
+    (OTA_ARENA_BUFFER_SIZE + (OTA_METRICS_ENABLED ? OTA_HEARTBEAT_MAX_METRICS * OTA_HEARTBEAT_METRIC_SIZE : 0))
+
+// Request Encoding and Compression
+#define OTA_CBOR_ENABLED true         // Offer CBOR; requests switch to it once the backend answers in CBOR
+#define OTA_COMPRESSION_ENABLED false // Gzip request bodies; allocates sizeof(tdefl_compressor) once, in PSRAM when available
+#define OTA_COMPRESSION_MIN_SIZE 256  // Bodies smaller than this are sent uncompressed
+#define OTA_COMPRESSION_LEVEL 1       // 1 (fastest) - 9 (smallest)
+
+// MQTT Transport (enabled and broker URI from Kconfig)
+#ifdef CONFIG_OTA_PLUGIN_MQTT
+#define OTA_MQTT_ENABLED true // Send over one persistent broker session instead of a request per message
+#define OTA_MQTT_BROKER_URI CONFIG_OTA_PLUGIN_MQTT_BROKER_URI
+#else
+#define OTA_MQTT_ENABLED false
+#define OTA_MQTT_BROKER_URI ""
+#endif
+#define OTA_MQTT_TOPIC_PREFIX "ota" // Topics are <prefix>/<device ID>/up/<endpoint> and <prefix>/<device ID>/down/<endpoint>
+#define OTA_MQTT_HEARTBEAT_QOS 1    // Heartbeats are queued while disconnected
+#define OTA_MQTT_TELEMETRY_QOS 0    // Logs and spans are dropped while disconnected; other messages use QoS 1
+#define OTA_MQTT_KEEPALIVE_SEC 60   // Broker keepalive
+#define OTA_PUSH_MAX_LISTENERS 4    // Modules that can act on messages the backend pushes
+
+// Profiling Configuration
+#define OTA_PROF_MAX_SITES 32 // Probe sites in the preallocated profiling table
 
 // Buffer Sizes
 #define OTA_JSON_BUFFER_SIZE 1024   // Buffer size for JSON data
 #define OTA_URL_BUFFER_SIZE 512     // Buffer size for URLs
 #define OTA_MESSAGE_BUFFER_SIZE 512 // Buffer size for messages
-#define OTA_TRACE_ID_SIZE 32        // Buffer size for trace IDs
-#define OTA_SPAN_ID_SIZE 16         // Buffer size for span IDs
+#define OTA_TRACE_ID_SIZE 16        // Trace ID length in bytes (W3C, hex-encoded on export)
+#define OTA_SPAN_ID_SIZE 8          // Span ID length in bytes (W3C, hex-encoded on export)
+#define OTA_TRACE_ID_HEX_SIZE 33    // Buffer size for hex-encoded trace IDs
+#define OTA_SPAN_ID_HEX_SIZE 17     // Buffer size for hex-encoded span IDs
+#define OTA_TRACEPARENT_SIZE 56     // Buffer size for W3C traceparent header values
+
+// Tracing Configuration
+#define OTA_TRACE_TLS_INDEX 1                                           // FreeRTOS thread-local storage slot holding the current span (slot 0 is used by pthread)
+#define OTA_TRACE_SAMPLE_PERCENT CONFIG_OTA_PLUGIN_TRACE_SAMPLE_PERCENT // Kconfig default head sampling rate in percent
+#define OTA_TRACE_HEAD_SAMPLE_RATE (OTA_TRACE_SAMPLE_PERCENT / 100.0f)  // Fraction of traces exported, decided when the root span starts
+#define OTA_TRACE_TAIL_LATENCY_MS 10000                                 // Unsampled traces with a span slower than this are exported anyway (0 disables)
+#define OTA_TRACE_TAIL_ON_ERROR true                                    // Unsampled traces with a failed span are exported anyway
+#define OTA_TRACE_TAIL_BUFFER_SIZE 16                                   // Finished unsampled spans held back for tail sampling
+#define OTA_TRACE_MAX_RATE_LIMITS 8                                     // Operations that can have a per-minute rate limit
+#define OTA_TRACE_HISTOGRAM_SLOTS 6                                     // Operations aggregated into latency histograms instead of exported per span
+#define OTA_TRACE_MAX_ATTRIBUTES 6                                      // Typed attributes recorded per span
+#define OTA_TRACE_ATTR_KEY_SIZE 24                                      // Buffer size for attribute keys
+#define OTA_TRACE_ATTR_STRING_SIZE 32                                   // Buffer size for string attribute values
 
     // Log Levels
     typedef enum
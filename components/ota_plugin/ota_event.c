@@ -0,0 +1,152 @@
+#include "ota_event.h"
+#include "ota_config.h"
+#include "esp_log.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <string.h>
+
+static const char *TAG = "ota_event";
+
+ESP_EVENT_DEFINE_BASE(OTA_PLUGIN_EVENT);
+
+// Seqlock: the sequence is odd while a writer updates the snapshot. Readers
+// retry until they copy it under the same even sequence, so they never take
+// a lock. Writers are serialized by the spinlock, which also keeps a reader
+// on the writer's core from spinning while the writer is preempted.
+static ota_plugin_status_snapshot_t status = {
+    .state = OTA_STATUS_IDLE,
+    .last_error = ESP_OK,
+};
+static atomic_uint status_seq = 0;
+static portMUX_TYPE status_write_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Owned by the download in progress
+static uint32_t last_progress_event = 0;
+
+static void status_write_begin(void)
+{
+    taskENTER_CRITICAL(&status_write_lock);
+    unsigned seq = atomic_load_explicit(&status_seq, memory_order_relaxed);
+    atomic_store_explicit(&status_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void status_write_end(void)
+{
+    unsigned seq = atomic_load_explicit(&status_seq, memory_order_relaxed);
+    atomic_store_explicit(&status_seq, seq + 1, memory_order_release);
+    taskEXIT_CRITICAL(&status_write_lock);
+}
+
+static void post_event(ota_plugin_event_t event_id, const void *data, size_t size)
+{
+    // Never block the executor on a slow or missing event loop
+    esp_err_t err = esp_event_post(OTA_PLUGIN_EVENT, event_id, data, size, 0);
+    if (err != ESP_OK)
+    {
+        ESP_LOGD(TAG, "Dropped event %d: %s", event_id, esp_err_to_name(err));
+    }
+}
+
+void ota_event_set_state(ota_status_t state)
+{
+    status_write_begin();
+    status.state = state;
+    status_write_end();
+}
+
+void ota_event_check_started(void)
+{
+    ota_event_set_state(OTA_STATUS_CHECKING);
+    post_event(OTA_PLUGIN_EVENT_CHECK_STARTED, NULL, 0);
+}
+
+void ota_event_check_finished(const ota_check_result_t *result)
+{
+    int64_t now = esp_timer_get_time();
+
+    status_write_begin();
+    status.state = result->err == ESP_OK ? OTA_STATUS_IDLE : OTA_STATUS_FAILED;
+    status.last_error = result->err;
+    status.last_check_time = now;
+    strncpy(status.available_version, result->update_available ? result->new_version : "",
+            sizeof(status.available_version) - 1);
+    status.available_version[sizeof(status.available_version) - 1] = '\0';
+    status_write_end();
+
+    post_event(OTA_PLUGIN_EVENT_CHECK_FINISHED, result, sizeof(*result));
+
+    if (result->err == ESP_OK && result->update_available)
+    {
+        ota_plugin_event_version_t data = {0};
+        strncpy(data.version, result->new_version, sizeof(data.version) - 1);
+        post_event(OTA_PLUGIN_EVENT_UPDATE_AVAILABLE, &data, sizeof(data));
+    }
+}
+
+void ota_event_download_progress(uint32_t received, uint32_t total)
+{
+    status_write_begin();
+    status.state = OTA_STATUS_DOWNLOADING;
+    status.bytes_received = received;
+    status.bytes_total = total;
+    status_write_end();
+
+    if (received < last_progress_event)
+    {
+        last_progress_event = 0; // New download
+    }
+    bool first = received > 0 && last_progress_event == 0;
+    bool complete = total > 0 && received >= total;
+
+    if (first || complete || received - last_progress_event >= OTA_DOWNLOAD_PROGRESS_STEP)
+    {
+        last_progress_event = complete ? 0 : received;
+
+        ota_plugin_event_progress_t data = {.received = received, .total = total};
+        post_event(OTA_PLUGIN_EVENT_DOWNLOAD_PROGRESS, &data, sizeof(data));
+    }
+}
+
+void ota_event_install_finished(esp_err_t err, const char *version)
+{
+    status_write_begin();
+    status.state = err == ESP_OK ? OTA_STATUS_SUCCESS : OTA_STATUS_FAILED;
+    status.last_error = err;
+    status_write_end();
+
+    last_progress_event = 0;
+
+    ota_plugin_event_install_t data = {.err = err};
+    strncpy(data.version, version ? version : "", sizeof(data.version) - 1);
+    post_event(err == ESP_OK ? OTA_PLUGIN_EVENT_INSTALL_DONE : OTA_PLUGIN_EVENT_INSTALL_FAILED,
+               &data, sizeof(data));
+}
+
+void ota_event_heartbeat_result(esp_err_t err)
+{
+    status_write_begin();
+    uint32_t failures = err == ESP_OK ? 0 : status.heartbeat_failures + 1;
+    status.heartbeat_failures = failures;
+    status_write_end();
+
+    if (err != ESP_OK)
+    {
+        ota_plugin_event_heartbeat_t data = {.err = err, .consecutive_failures = failures};
+        post_event(OTA_PLUGIN_EVENT_HEARTBEAT_FAILED, &data, sizeof(data));
+    }
+}
+
+void ota_event_get_snapshot(ota_plugin_status_snapshot_t *snapshot)
+{
+    unsigned seq;
+    do
+    {
+        seq = atomic_load_explicit(&status_seq, memory_order_acquire);
+        memcpy(snapshot, &status, sizeof(*snapshot));
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || atomic_load_explicit(&status_seq, memory_order_relaxed) != seq);
+}
@@ -0,0 +1,79 @@
+#ifndef OTA_EVENT_H
+#define OTA_EVENT_H
+
+#include "ota_plugin.h"
+#include "esp_err.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Plugin state transitions. Each call updates the status snapshot read by
+ * ota_plugin_get_status_snapshot() and posts the matching OTA_PLUGIN_EVENT
+ * to the default event loop without blocking. Events are dropped when the
+ * default loop does not exist or its queue is full; the snapshot is always
+ * updated.
+ */
+
+/**
+ * @brief Set the plugin state without posting an event
+ * @param state New state
+ */
+void ota_event_set_state(ota_status_t state);
+
+/**
+ * @brief An update check started
+ */
+void ota_event_check_started(void);
+
+/**
+ * @brief An update check finished
+ *
+ * Also posts OTA_PLUGIN_EVENT_UPDATE_AVAILABLE if the server offered a new
+ * version.
+ *
+ * @param result Outcome of the check, before any install
+ */
+void ota_event_check_finished(const ota_check_result_t* result);
+
+/**
+ * @brief Firmware download progressed
+ *
+ * The snapshot is updated on every call. An event is posted when the first
+ * byte arrives, every OTA_DOWNLOAD_PROGRESS_STEP bytes and at the end.
+ *
+ * @param received Bytes received so far
+ * @param total Image size in bytes, 0 if unknown
+ */
+void ota_event_download_progress(uint32_t received, uint32_t total);
+
+/**
+ * @brief A firmware install finished
+ * @param err ESP_OK if the image was installed, error code otherwise
+ * @param version Version that was installed
+ */
+void ota_event_install_finished(esp_err_t err, const char* version);
+
+/**
+ * @brief Record the outcome of a heartbeat
+ *
+ * Failures post OTA_PLUGIN_EVENT_HEARTBEAT_FAILED; a success resets the
+ * failure count.
+ *
+ * @param err ESP_OK if the heartbeat was delivered, error code otherwise
+ */
+void ota_event_heartbeat_result(esp_err_t err);
+
+/**
+ * @brief Read a consistent copy of the plugin status
+ * @param snapshot Output
+ */
+void ota_event_get_snapshot(ota_plugin_status_snapshot_t* snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_EVENT_H
@@ -0,0 +1,378 @@
+#include "ota_executor.h"
+#include "ota_metrics.h"
+#include "ota_arena.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+
+static const char *TAG = "ota_executor";
+
+typedef struct
+{
+    const char *name;
+    ota_executor_job_fn_t fn;
+    void *arg;
+    ota_job_priority_t priority;
+    int64_t deadline_us;
+    bool scheduled;
+} executor_job_t;
+
+// The table is tiny, so picking the next job is a linear scan: the earliest
+// deadline wins, except that among jobs already due the highest priority
+// runs first
+static executor_job_t jobs[OTA_EXECUTOR_MAX_JOBS];
+static volatile ota_executor_job_t running_job = OTA_EXECUTOR_INVALID_JOB;
+
+static TaskHandle_t executor_task_handle = NULL;
+static volatile bool executor_running = false;
+
+// Lets stop and cancel block until the executor acknowledges instead of polling
+static EventGroupHandle_t executor_events = NULL;
+static StaticEventGroup_t *executor_events_buffer = NULL;
+#define EXECUTOR_STOPPED_BIT (1 << 0)
+#define EXECUTOR_JOB_DONE_BIT (1 << 1)
+static ota_metric_handle_t lag_metric = OTA_METRIC_INVALID_HANDLE;
+
+static portMUX_TYPE executor_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Static memory mode: the task lives in the arena and is created once
+static StackType_t *executor_stack = NULL;
+static StaticTask_t *executor_tcb = NULL;
+
+// Must be called with executor_lock held
+static ota_executor_job_t pick_job(int64_t now)
+{
+    ota_executor_job_t best = OTA_EXECUTOR_INVALID_JOB;
+
+    for (int i = 0; i < OTA_EXECUTOR_MAX_JOBS; i++)
+    {
+        const executor_job_t *job = &jobs[i];
+        if (!job->scheduled)
+        {
+            continue;
+        }
+        if (best == OTA_EXECUTOR_INVALID_JOB)
+        {
+            best = i;
+            continue;
+        }
+
+        const executor_job_t *current = &jobs[best];
+        bool due = job->deadline_us <= now;
+        bool current_due = current->deadline_us <= now;
+
+        if (due && current_due && job->priority != current->priority)
+        {
+            if (job->priority > current->priority)
+            {
+                best = i;
+            }
+        }
+        else if (job->deadline_us < current->deadline_us)
+        {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+static void run_jobs(void)
+{
+    ESP_LOGI(TAG, "Executor task started");
+
+    while (executor_running)
+    {
+        int64_t now = esp_timer_get_time();
+
+        taskENTER_CRITICAL(&executor_lock);
+        ota_executor_job_t next = pick_job(now);
+        executor_job_t job = {0};
+        if (next != OTA_EXECUTOR_INVALID_JOB)
+        {
+            job = jobs[next];
+            if (job.deadline_us <= now)
+            {
+                running_job = next;
+            }
+        }
+        taskEXIT_CRITICAL(&executor_lock);
+
+        if (next == OTA_EXECUTOR_INVALID_JOB || job.deadline_us > now)
+        {
+            // Sleep until the next deadline; adding a job or stopping wakes us
+            TickType_t ticks = portMAX_DELAY;
+            if (next != OTA_EXECUTOR_INVALID_JOB)
+            {
+                ticks = pdMS_TO_TICKS((job.deadline_us - now + 999) / 1000);
+                ticks = ticks > 0 ? ticks : 1;
+            }
+            ulTaskNotifyTake(pdTRUE, ticks);
+            continue;
+        }
+
+        // How late the job starts, from sharing one task between all jobs
+        ota_metrics_histogram_record(lag_metric, (now - job.deadline_us) / 1000);
+
+        uint32_t delay_ms = job.fn(job.arg);
+        int64_t finished = esp_timer_get_time();
+
+        taskENTER_CRITICAL(&executor_lock);
+        executor_job_t *entry = &jobs[next];
+        if (entry->scheduled)
+        {
+            if (delay_ms == OTA_EXECUTOR_DONE)
+            {
+                entry->scheduled = false;
+            }
+            else
+            {
+                entry->deadline_us = finished + (int64_t)delay_ms * 1000;
+            }
+        }
+        running_job = OTA_EXECUTOR_INVALID_JOB;
+        taskEXIT_CRITICAL(&executor_lock);
+
+        xEventGroupSetBits(executor_events, EXECUTOR_JOB_DONE_BIT);
+    }
+
+    ESP_LOGI(TAG, "Executor task stopped");
+}
+
+static void executor_task(void *pvParameters)
+{
+    if (!OTA_STATIC_MEMORY_ENABLED)
+    {
+        run_jobs();
+        executor_task_handle = NULL;
+        xEventGroupSetBits(executor_events, EXECUTOR_STOPPED_BIT);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    // An arena stack cannot be reused while the idle task may still be
+    // cleaning up the deleted task, so the task parks between runs instead
+    while (true)
+    {
+        run_jobs();
+        xEventGroupSetBits(executor_events, EXECUTOR_STOPPED_BIT);
+        while (!executor_running)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
+esp_err_t ota_executor_init(void)
+{
+    if (executor_events != NULL)
+    {
+        return ESP_OK;
+    }
+
+    if (!OTA_STATIC_MEMORY_ENABLED)
+    {
+        executor_events = xEventGroupCreate();
+        if (executor_events == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create executor event group");
+            return ESP_ERR_NO_MEM;
+        }
+        return ESP_OK;
+    }
+
+    executor_stack = ota_arena_reserve(OTA_TASK_STACK_SIZE);
+    executor_tcb = ota_arena_reserve(sizeof(StaticTask_t));
+    executor_events_buffer = ota_arena_reserve(sizeof(StaticEventGroup_t));
+    if (executor_stack == NULL || executor_tcb == NULL || executor_events_buffer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    executor_events = xEventGroupCreateStatic(executor_events_buffer);
+    return ESP_OK;
+}
+
+esp_err_t ota_executor_start(void)
+{
+    if (executor_running)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (lag_metric == OTA_METRIC_INVALID_HANDLE)
+    {
+        lag_metric = ota_metrics_register("executor.lag_ms", OTA_METRIC_HISTOGRAM, "ms");
+    }
+
+    esp_err_t err = ota_executor_init();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    xEventGroupClearBits(executor_events, EXECUTOR_STOPPED_BIT);
+
+    executor_running = true;
+
+    if (OTA_STATIC_MEMORY_ENABLED && executor_task_handle != NULL)
+    {
+        // Wake the parked task
+        xTaskNotifyGive(executor_task_handle);
+        return ESP_OK;
+    }
+
+    // Pinning keeps network and flash work off the application's real-time core
+    BaseType_t ret = pdFAIL;
+    if (OTA_STATIC_MEMORY_ENABLED)
+    {
+        executor_task_handle = xTaskCreateStaticPinnedToCore(executor_task, "ota_executor", OTA_TASK_STACK_SIZE, NULL,
+                                                             OTA_TASK_PRIORITY, executor_stack, executor_tcb,
+                                                             OTA_TASK_CORE);
+        ret = executor_task_handle != NULL ? pdPASS : pdFAIL;
+    }
+    else
+    {
+        ret = xTaskCreatePinnedToCore(executor_task, "ota_executor",
+                                      OTA_TASK_STACK_SIZE, NULL,
+                                      OTA_TASK_PRIORITY, &executor_task_handle,
+                                      OTA_TASK_CORE);
+    }
+
+    if (ret != pdPASS)
+    {
+        executor_running = false;
+        ESP_LOGE(TAG, "Failed to create executor task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t ota_executor_stop(void)
+{
+    if (!executor_running)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    executor_running = false;
+
+    // Wake the task and wait for it to exit; a job in progress finishes first
+    if (executor_task_handle != NULL)
+    {
+        xTaskNotifyGive(executor_task_handle);
+    }
+    xEventGroupWaitBits(executor_events, EXECUTOR_STOPPED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    return ESP_OK;
+}
+
+ota_executor_job_t ota_executor_add(const char *name, ota_executor_job_fn_t fn, void *arg,
+                                    ota_job_priority_t priority, uint32_t delay_ms)
+{
+    if (!name || !fn)
+    {
+        return OTA_EXECUTOR_INVALID_JOB;
+    }
+
+    ota_executor_job_t handle = OTA_EXECUTOR_INVALID_JOB;
+
+    taskENTER_CRITICAL(&executor_lock);
+    for (int i = 0; i < OTA_EXECUTOR_MAX_JOBS; i++)
+    {
+        // A cancelled job may still be finishing its last run
+        if (!jobs[i].scheduled && running_job != i)
+        {
+            jobs[i] = (executor_job_t){
+                .name = name,
+                .fn = fn,
+                .arg = arg,
+                .priority = priority,
+                .deadline_us = esp_timer_get_time() + (int64_t)delay_ms * 1000,
+                .scheduled = true,
+            };
+            handle = i;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&executor_lock);
+
+    if (handle == OTA_EXECUTOR_INVALID_JOB)
+    {
+        ESP_LOGE(TAG, "No free job slot for %s", name);
+        return handle;
+    }
+
+    if (executor_task_handle != NULL)
+    {
+        xTaskNotifyGive(executor_task_handle);
+    }
+
+    ESP_LOGD(TAG, "Scheduled %s in %lu ms", name, (unsigned long)delay_ms);
+    return handle;
+}
+
+esp_err_t ota_executor_cancel(ota_executor_job_t job)
+{
+    if (job < 0 || job >= OTA_EXECUTOR_MAX_JOBS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&executor_lock);
+    bool was_scheduled = jobs[job].scheduled;
+    jobs[job].scheduled = false;
+    taskEXIT_CRITICAL(&executor_lock);
+
+    if (!was_scheduled)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Let a run in progress finish before the caller tears down its state
+    if (executor_events != NULL && xTaskGetCurrentTaskHandle() != executor_task_handle)
+    {
+        while (true)
+        {
+            xEventGroupClearBits(executor_events, EXECUTOR_JOB_DONE_BIT);
+            if (running_job != job)
+            {
+                break;
+            }
+            xEventGroupWaitBits(executor_events, EXECUTOR_JOB_DONE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t ota_executor_expedite(ota_executor_job_t job, uint32_t within_ms)
+{
+    if (job < 0 || job >= OTA_EXECUTOR_MAX_JOBS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t deadline = esp_timer_get_time() + (int64_t)within_ms * 1000;
+
+    taskENTER_CRITICAL(&executor_lock);
+    bool scheduled = jobs[job].scheduled;
+    if (scheduled && deadline < jobs[job].deadline_us)
+    {
+        jobs[job].deadline_us = deadline;
+    }
+    taskEXIT_CRITICAL(&executor_lock);
+
+    if (!scheduled)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (executor_task_handle != NULL)
+    {
+        xTaskNotifyGive(executor_task_handle);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,103 @@
+#ifndef OTA_EXECUTOR_H
+#define OTA_EXECUTOR_H
+
+#include "ota_config.h"
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Job callback
+ * @param arg Argument given to ota_executor_add()
+ * @return Delay in milliseconds until the job runs again, counted from the
+ *         end of this run, or OTA_EXECUTOR_DONE to remove the job
+ */
+typedef uint32_t (*ota_executor_job_fn_t)(void* arg);
+
+#define OTA_EXECUTOR_DONE UINT32_MAX
+
+/**
+ * @brief Handle of a scheduled job
+ */
+typedef int8_t ota_executor_job_t;
+
+#define OTA_EXECUTOR_INVALID_JOB ((ota_executor_job_t)-1)
+
+/**
+ * @brief Job priorities; when several jobs are due the highest runs first
+ */
+typedef enum {
+    OTA_JOB_PRIORITY_TELEMETRY, // Heartbeats, log and span export
+    OTA_JOB_PRIORITY_FIRMWARE   // Update checks and downloads
+} ota_job_priority_t;
+
+/**
+ * @brief Create the executor's event group and, in static memory mode,
+ *        reserve its stack from the arena
+ *
+ * Called by ota_executor_start() if needed; safe to call more than once.
+ *
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_executor_init(void);
+
+/**
+ * @brief Start the executor task that runs all periodic plugin jobs
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_executor_start(void);
+
+/**
+ * @brief Stop the executor task; jobs stay scheduled for the next start
+ *
+ * Returns as soon as the task has exited: immediately when idle, otherwise
+ * once the job in progress has finished.
+ *
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_executor_stop(void);
+
+/**
+ * @brief Schedule a job
+ * @param name Job name (not copied)
+ * @param fn Job callback
+ * @param arg Passed to fn
+ * @param priority Job priority
+ * @param delay_ms Delay before the first run
+ * @return Job handle, or OTA_EXECUTOR_INVALID_JOB if OTA_EXECUTOR_MAX_JOBS are scheduled
+ */
+ota_executor_job_t ota_executor_add(const char* name, ota_executor_job_fn_t fn, void* arg,
+                                    ota_job_priority_t priority, uint32_t delay_ms);
+
+/**
+ * @brief Remove a job
+ *
+ * If the job is running on the executor, waits for the run to finish, unless
+ * called from the job itself.
+ *
+ * @param job Job handle
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the job is not scheduled
+ */
+esp_err_t ota_executor_cancel(ota_executor_job_t job);
+
+/**
+ * @brief Run a job within the given delay, or sooner if already due sooner
+ *
+ * Wakes the executor immediately. A job currently running is not re-run
+ * until it returns; its return value then sets the next deadline.
+ *
+ * @param job Job handle
+ * @param within_ms Latest start, in milliseconds from now; 0 runs the job next
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the job is not scheduled
+ */
+esp_err_t ota_executor_expedite(ota_executor_job_t job, uint32_t within_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_EXECUTOR_H
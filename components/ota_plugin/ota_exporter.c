@@ -0,0 +1,283 @@
+#include "ota_exporter.h"
+#include "ota_plugin.h"
+#include "ota_status.h"
+#include "ota_metrics.h"
+#include "ota_trace.h"
+#include "ota_settings.h"
+#include "esp_log.h"
+#include "esp_http_server.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "ota_exporter";
+
+static httpd_handle_t server = NULL;
+
+// Output is batched into a small buffer and flushed whenever the next line
+// might not fit, so rendering never holds the whole page in memory
+typedef struct
+{
+    char buffer[OTA_EXPORTER_CHUNK_SIZE];
+    size_t len;
+    ota_exporter_write_cb_t write;
+    void *ctx;
+    esp_err_t err;
+} exporter_writer_t;
+
+static void flush(exporter_writer_t *writer)
+{
+    if (writer->err == ESP_OK && writer->len > 0)
+    {
+        writer->err = writer->write(writer->buffer, writer->len, writer->ctx);
+    }
+    writer->len = 0;
+}
+
+static void emit(exporter_writer_t *writer, const char *format, ...)
+{
+    if (writer->err != ESP_OK)
+    {
+        return;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        size_t available = sizeof(writer->buffer) - writer->len;
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(writer->buffer + writer->len, available, format, args);
+        va_end(args);
+
+        if (written < 0)
+        {
+            return;
+        }
+        if ((size_t)written < available)
+        {
+            writer->len += written;
+            return;
+        }
+
+        // Did not fit: send what is buffered and retry into an empty buffer,
+        // truncating lines longer than the whole buffer
+        flush(writer);
+    }
+
+    writer->len = strnlen(writer->buffer, sizeof(writer->buffer) - 1);
+}
+
+// Prometheus metric names allow [a-zA-Z0-9_:] only
+static void sanitize_name(const char *name, char *out, size_t out_size)
+{
+    size_t i = 0;
+    for (; name[i] != '\0' && i < out_size - 1; i++)
+    {
+        char c = name[i];
+        bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' ||
+                     c == ':';
+        out[i] = valid ? c : '_';
+    }
+    out[i] = '\0';
+}
+
+// Label values escape backslash, double quote and newline
+static void escape_label(const char *value, char *out, size_t out_size)
+{
+    size_t j = 0;
+    for (size_t i = 0; value[i] != '\0' && j + 2 < out_size; i++)
+    {
+        char c = value[i];
+        if (c == '\\' || c == '"' || c == '\n')
+        {
+            out[j++] = '\\';
+            c = c == '\n' ? 'n' : c;
+        }
+        out[j++] = c;
+    }
+    out[j] = '\0';
+}
+
+static void render_device(exporter_writer_t *writer)
+{
+    char ip[16] = "";
+    char version[64];
+    char device_id[OTA_SETTINGS_TEXT_SIZE];
+    char label[OTA_SETTINGS_TEXT_SIZE];
+    char ref[64];
+
+    ota_status_get_device_ip(ip, sizeof(ip));
+    escape_label(ota_plugin_get_firmware_version(), version, sizeof(version));
+    ota_settings_get_str(OTA_SETTING_DEVICE_ID, device_id, sizeof(device_id));
+    escape_label(device_id, label, sizeof(label));
+    escape_label(FIRMWARE_REF, ref, sizeof(ref));
+
+    emit(writer, "# TYPE ota_device_info gauge\n");
+    emit(writer, "ota_device_info{device_id=\"%s\",firmware_version=\"%s\",firmware_ref=\"%s\",ip=\"%s\"} 1\n",
+         label, version, ref, ip);
+    emit(writer, "# TYPE ota_uptime_seconds counter\n");
+    emit(writer, "ota_uptime_seconds %lu\n", (unsigned long)ota_status_get_uptime_sec());
+}
+
+static void render_registry(exporter_writer_t *writer)
+{
+    size_t count = ota_metrics_count();
+    ota_metric_snapshot_t snapshot;
+    char name[OTA_METRICS_NAME_SIZE + 4];
+    char sanitized[OTA_METRICS_NAME_SIZE];
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (ota_metrics_snapshot(i, &snapshot, false) != ESP_OK)
+        {
+            continue;
+        }
+
+        sanitize_name(snapshot.name, sanitized, sizeof(sanitized));
+        snprintf(name, sizeof(name), "ota_%s", sanitized);
+
+        switch (snapshot.type)
+        {
+        case OTA_METRIC_COUNTER:
+            emit(writer, "# TYPE %s counter\n%s %lu\n", name, name, (unsigned long)snapshot.value.counter);
+            break;
+        case OTA_METRIC_GAUGE:
+            emit(writer, "# TYPE %s gauge\n%s %g\n", name, name, snapshot.value.gauge.last);
+            break;
+        case OTA_METRIC_HISTOGRAM:
+            emit(writer, "# TYPE %s summary\n", name);
+            emit(writer, "%s{quantile=\"0.5\"} %lu\n", name, (unsigned long)snapshot.value.histogram.p50);
+            emit(writer, "%s{quantile=\"0.9\"} %lu\n", name, (unsigned long)snapshot.value.histogram.p90);
+            emit(writer, "%s{quantile=\"0.99\"} %lu\n", name, (unsigned long)snapshot.value.histogram.p99);
+            emit(writer, "%s_sum %llu\n", name, (unsigned long long)snapshot.value.histogram.sum);
+            emit(writer, "%s_count %lu\n", name, (unsigned long)snapshot.value.histogram.count);
+            break;
+        }
+    }
+}
+
+static void render_span_latency(exporter_writer_t *writer)
+{
+    ota_trace_latency_summary_t summaries[OTA_TRACE_HISTOGRAM_SLOTS];
+    size_t count = ota_trace_histogram_collect(summaries, OTA_TRACE_HISTOGRAM_SLOTS, false);
+    char operation[96];
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    emit(writer, "# TYPE ota_span_latency_seconds summary\n");
+    for (size_t i = 0; i < count; i++)
+    {
+        const ota_trace_latency_summary_t *summary = &summaries[i];
+        escape_label(summary->operation, operation, sizeof(operation));
+
+        emit(writer, "ota_span_latency_seconds{operation=\"%s\",quantile=\"0.5\"} %.6f\n", operation,
+             summary->p50_us / 1e6);
+        emit(writer, "ota_span_latency_seconds{operation=\"%s\",quantile=\"0.9\"} %.6f\n", operation,
+             summary->p90_us / 1e6);
+        emit(writer, "ota_span_latency_seconds{operation=\"%s\",quantile=\"0.99\"} %.6f\n", operation,
+             summary->p99_us / 1e6);
+        emit(writer, "ota_span_latency_seconds_sum{operation=\"%s\"} %.6f\n", operation,
+             summary->sum_us / 1e6);
+        emit(writer, "ota_span_latency_seconds_count{operation=\"%s\"} %lu\n", operation,
+             (unsigned long)summary->count);
+    }
+}
+
+esp_err_t ota_exporter_render(ota_exporter_write_cb_t write, void *ctx)
+{
+    if (!write)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    exporter_writer_t writer = {
+        .len = 0,
+        .write = write,
+        .ctx = ctx,
+        .err = ESP_OK,
+    };
+
+    render_device(&writer);
+    render_registry(&writer);
+    render_span_latency(&writer);
+    flush(&writer);
+
+    return writer.err;
+}
+
+static esp_err_t send_chunk(const char *data, size_t len, void *ctx)
+{
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, data, len);
+}
+
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+
+    esp_err_t err = ota_exporter_render(send_chunk, req);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to send metrics: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    // Zero-length chunk terminates the chunked response
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+esp_err_t ota_exporter_start(void)
+{
+    if (server != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = OTA_EXPORTER_PORT;
+    config.ctrl_port = OTA_EXPORTER_PORT + 1;
+    config.max_uri_handlers = 1;
+    config.stack_size = OTA_EXPORTER_TASK_STACK_SIZE;
+    config.core_id = OTA_EXPORTER_TASK_CORE;
+
+    esp_err_t err = httpd_start(&server, &config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start metrics server: %s", esp_err_to_name(err));
+        server = NULL;
+        return err;
+    }
+
+    httpd_uri_t metrics_uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_handler,
+        .user_ctx = NULL,
+    };
+
+    err = httpd_register_uri_handler(server, &metrics_uri);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to register /metrics: %s", esp_err_to_name(err));
+        httpd_stop(server);
+        server = NULL;
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Serving metrics on port %d", OTA_EXPORTER_PORT);
+    return ESP_OK;
+}
+
+esp_err_t ota_exporter_stop(void)
+{
+    if (server == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = httpd_stop(server);
+    server = NULL;
+    return err;
+}
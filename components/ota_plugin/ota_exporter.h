@@ -0,0 +1,53 @@
+#ifndef OTA_EXPORTER_H
+#define OTA_EXPORTER_H
+
+#include "ota_config.h"
+#include "esp_err.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Receives a piece of rendered output
+ * @param data Text, not NUL-terminated
+ * @param len Length of data
+ * @param ctx Caller context passed to ota_exporter_render()
+ * @return ESP_OK to continue, error code to abort rendering
+ */
+typedef esp_err_t (*ota_exporter_write_cb_t)(const char* data, size_t len, void* ctx);
+
+/**
+ * @brief Start the local metrics endpoint
+ *
+ * Serves GET /metrics on OTA_EXPORTER_PORT in Prometheus text format.
+ *
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_exporter_start(void);
+
+/**
+ * @brief Stop the local metrics endpoint
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_exporter_stop(void);
+
+/**
+ * @brief Render heartbeat fields, registered metrics and span latency
+ *        histograms in Prometheus text exposition format
+ *
+ * Output is produced in small pieces through a fixed stack buffer. Reading
+ * does not reset any heartbeat window.
+ *
+ * @param write Called with each piece of output
+ * @param ctx Passed to write
+ * @return ESP_OK on success, or the first error returned by write
+ */
+esp_err_t ota_exporter_render(ota_exporter_write_cb_t write, void* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_EXPORTER_H
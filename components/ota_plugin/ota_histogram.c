@@ -0,0 +1,160 @@
+#include "ota_histogram.h"
+#include <string.h>
+
+static inline uint32_t bucket_index(uint32_t value)
+{
+    if (value < OTA_HISTOGRAM_SUB_BUCKETS)
+    {
+        return value;
+    }
+
+    uint32_t exponent = 31 - __builtin_clz(value);
+    if (exponent >= OTA_HISTOGRAM_VALUE_BITS)
+    {
+        return OTA_HISTOGRAM_BUCKETS - 1;
+    }
+
+    uint32_t sub_bucket = (value >> (exponent - OTA_HISTOGRAM_SUB_BUCKET_BITS)) & (OTA_HISTOGRAM_SUB_BUCKETS - 1);
+    return (exponent - OTA_HISTOGRAM_SUB_BUCKET_BITS + 1) * OTA_HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+// Midpoint of the values that fall into a bucket
+static uint32_t bucket_value(uint32_t index)
+{
+    if (index < OTA_HISTOGRAM_SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    uint32_t shift = index / OTA_HISTOGRAM_SUB_BUCKETS - 1;
+    uint32_t lower = (OTA_HISTOGRAM_SUB_BUCKETS + index % OTA_HISTOGRAM_SUB_BUCKETS) << shift;
+    return lower + ((1u << shift) >> 1);
+}
+
+void ota_histogram_reset(ota_histogram_t *hist)
+{
+    for (int i = 0; i < OTA_HISTOGRAM_BUCKETS; i++)
+    {
+        atomic_store_explicit(&hist->counts[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&hist->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->max, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->sum, 0, memory_order_relaxed);
+}
+
+void ota_histogram_record(ota_histogram_t *hist, uint32_t value)
+{
+    atomic_fetch_add_explicit(&hist->counts[bucket_index(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum, value, memory_order_relaxed);
+
+    uint32_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    while (value > max &&
+           !atomic_compare_exchange_weak_explicit(&hist->max, &max, value,
+                                                  memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+void ota_histogram_summarize(ota_histogram_t *hist, ota_histogram_summary_t *summary, bool reset)
+{
+    uint32_t counts[OTA_HISTOGRAM_BUCKETS];
+    uint32_t total = 0;
+
+    // Sum the buckets rather than trusting hist->count, so the summary stays
+    // consistent with the buckets while other tasks keep recording
+    for (int i = 0; i < OTA_HISTOGRAM_BUCKETS; i++)
+    {
+        counts[i] = reset ? atomic_exchange_explicit(&hist->counts[i], 0, memory_order_relaxed)
+                          : atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+        total += counts[i];
+    }
+
+    memset(summary, 0, sizeof(*summary));
+    summary->count = total;
+    summary->max = reset ? atomic_exchange_explicit(&hist->max, 0, memory_order_relaxed)
+                         : atomic_load_explicit(&hist->max, memory_order_relaxed);
+    summary->sum = reset ? atomic_exchange_explicit(&hist->sum, 0, memory_order_relaxed)
+                         : atomic_load_explicit(&hist->sum, memory_order_relaxed);
+    if (reset)
+    {
+        atomic_store_explicit(&hist->count, 0, memory_order_relaxed);
+    }
+
+    if (total == 0)
+    {
+        return;
+    }
+
+    // Ranks are 1-based: the pXX value is the smallest bucket whose cumulative
+    // count reaches ceil(total * XX / 100)
+    uint32_t rank_p50 = (total * 50 + 99) / 100;
+    uint32_t rank_p90 = (total * 90 + 99) / 100;
+    uint32_t rank_p99 = (total * 99 + 99) / 100;
+    uint32_t cumulative = 0;
+    bool have_p50 = false, have_p90 = false;
+
+    for (int i = 0; i < OTA_HISTOGRAM_BUCKETS; i++)
+    {
+        if (counts[i] == 0)
+        {
+            continue;
+        }
+
+        cumulative += counts[i];
+        uint32_t value = bucket_value(i);
+        if (value > summary->max)
+        {
+            value = summary->max;
+        }
+
+        if (!have_p50 && cumulative >= rank_p50)
+        {
+            summary->p50 = value;
+            have_p50 = true;
+        }
+        if (!have_p90 && cumulative >= rank_p90)
+        {
+            summary->p90 = value;
+            have_p90 = true;
+        }
+        if (cumulative >= rank_p99)
+        {
+            summary->p99 = value;
+            break;
+        }
+    }
+}
+
+void ota_histogram_discard(ota_histogram_t *hist, const ota_histogram_summary_t *window)
+{
+    if (window->count == 0)
+    {
+        return;
+    }
+
+    ota_histogram_summary_t now;
+    ota_histogram_summarize(hist, &now, true);
+    if (now.count <= window->count)
+    {
+        return;
+    }
+
+    // Put back what was recorded since the window was read. A new maximum
+    // can only come from those values, so it is one of them.
+    uint32_t late = now.count - window->count;
+    uint64_t late_sum = now.sum > window->sum ? now.sum - window->sum : 0;
+    if (now.max > window->max)
+    {
+        ota_histogram_record(hist, now.max);
+        late--;
+        late_sum = late_sum > now.max ? late_sum - now.max : 0;
+    }
+
+    for (uint32_t i = 0; i < late; i++)
+    {
+        uint64_t value = late_sum / (late - i);
+        ota_histogram_record(hist, value > UINT32_MAX ? UINT32_MAX : (uint32_t)value);
+        late_sum -= value;
+    }
+}
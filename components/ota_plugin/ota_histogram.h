@@ -0,0 +1,88 @@
+#ifndef OTA_HISTOGRAM_H
+#define OTA_HISTOGRAM_H
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Log-linear (HDR-style) bucketing: values below OTA_HISTOGRAM_SUB_BUCKETS are
+// counted exactly, above that every power of two is split into
+// OTA_HISTOGRAM_SUB_BUCKETS linear buckets, bounding the relative error to
+// 1 / OTA_HISTOGRAM_SUB_BUCKETS. Values of 2^OTA_HISTOGRAM_VALUE_BITS or more
+// share the last bucket; the exact maximum is tracked separately.
+#define OTA_HISTOGRAM_SUB_BUCKET_BITS 3
+#define OTA_HISTOGRAM_SUB_BUCKETS (1 << OTA_HISTOGRAM_SUB_BUCKET_BITS)
+#define OTA_HISTOGRAM_VALUE_BITS 28 // 2^28 us = ~268 s
+#define OTA_HISTOGRAM_BUCKETS ((OTA_HISTOGRAM_VALUE_BITS - OTA_HISTOGRAM_SUB_BUCKET_BITS + 1) * OTA_HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * @brief Fixed-memory histogram, safe to record into from any task without locks
+ */
+typedef struct
+{
+    atomic_uint_least32_t counts[OTA_HISTOGRAM_BUCKETS];
+    atomic_uint_least32_t count;
+    atomic_uint_least32_t max;
+    atomic_uint_least64_t sum;
+} ota_histogram_t;
+
+/**
+ * @brief Percentile summary of a histogram
+ */
+typedef struct
+{
+    uint32_t count;
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+    uint64_t sum; // Exact sum of the recorded values
+} ota_histogram_summary_t;
+
+/**
+ * @brief Reset a histogram to empty
+ * @param hist Histogram
+ */
+void ota_histogram_reset(ota_histogram_t *hist);
+
+/**
+ * @brief Record a value
+ * @param hist Histogram
+ * @param value Value to record
+ */
+void ota_histogram_record(ota_histogram_t *hist, uint32_t value);
+
+/**
+ * @brief Summarize a histogram
+ *
+ * Percentiles are reported as the midpoint of their bucket, capped at the
+ * recorded maximum.
+ *
+ * @param hist Histogram
+ * @param summary Output: percentile summary
+ * @param reset Start a new window by clearing the histogram while reading it
+ */
+void ota_histogram_summarize(ota_histogram_t *hist, ota_histogram_summary_t *summary, bool reset);
+
+/**
+ * @brief Drop a window that was summarized without reset, e.g. once it has
+ *        been delivered
+ *
+ * Values recorded after the summary keep their count, sum and maximum; the
+ * rest of them are recorded again at their mean, which is exact for one value.
+ *
+ * @param hist Histogram
+ * @param window Summary taken with reset false
+ */
+void ota_histogram_discard(ota_histogram_t *hist, const ota_histogram_summary_t *window);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_HISTOGRAM_H
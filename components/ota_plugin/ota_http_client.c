@@ -1,20 +1,71 @@
 #include "ota_http_client.h"
 #include "ota_config.h"
+#include "ota_trace.h"
+#include "ota_schedule.h"
+#include "ota_arena.h"
+#include "ota_settings.h"
+#include "ota_compress.h"
+#include "ota_cbor.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_http_client.h"
 #include "esp_https_ota.h"
 #include "esp_crt_bundle.h"
 #include "cJSON.h"
+#include "freertos/FreeRTOS.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
 
 static const char *TAG = "ota_http_client";
 
-// HTTP response buffer
+#define CONTENT_TYPE_JSON "application/json"
+#define CONTENT_TYPE_CBOR "application/cbor"
+
+// Request bodies switch to CBOR once the backend has answered in CBOR, and
+// back to JSON for good if it refuses a CBOR body: a backend that answers in
+// CBOR but cannot read it would otherwise flip the encoding on every request
+static atomic_bool backend_speaks_cbor = false;
+static atomic_bool cbor_refused = false;
+
+static const ota_transport_t *default_transport = &ota_transport_http;
+static const ota_transport_t *transport = &ota_transport_http;
+static bool client_started = false;
+
+// The latest check result pushed over a transport that does not reply;
+// checks report it until the backend pushes another
+typedef struct
+{
+    bool received;
+    bool update_available;
+    char firmware_url[OTA_URL_BUFFER_SIZE];
+    char version[64];
+} announcement_t;
+
+static announcement_t announcement;
+static portMUX_TYPE announcement_lock = portMUX_INITIALIZER_UNLOCKED;
+
+typedef struct
+{
+    ota_http_push_listener_t listener;
+    void *ctx;
+} push_listener_slot_t;
+
+static push_listener_slot_t push_listeners[OTA_PUSH_MAX_LISTENERS];
+
+static void on_transport_receive(const char *endpoint, const char *body, size_t body_len, bool cbor);
+
+// Caller's response buffer, filled as data arrives
 typedef struct
 {
     char *buffer;
-    int buffer_len;
-    int data_len;
+    size_t buffer_len;
+    size_t data_len;
+    bool cbor;            // Response Content-Type is CBOR
+    uint32_t retry_after; // Retry-After in seconds, 0 if absent or an HTTP date
 } http_response_buffer_t;
 
 static esp_err_t http_event_handler(esp_http_client_event_t *evt)
@@ -23,269 +74,1428 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt)
 
     switch (evt->event_id)
     {
+    case HTTP_EVENT_ON_HEADER:
+        if (output_buffer != NULL && strcasecmp(evt->header_key, "Content-Type") == 0)
+        {
+            output_buffer->cbor = strncasecmp(evt->header_value, CONTENT_TYPE_CBOR, strlen(CONTENT_TYPE_CBOR)) == 0;
+        }
+        else if (output_buffer != NULL && strcasecmp(evt->header_key, "Retry-After") == 0)
+        {
+            char *end;
+            unsigned long delay_sec = strtoul(evt->header_value, &end, 10);
+            output_buffer->retry_after = end != evt->header_value && *end == '\0' ? delay_sec : 0;
+        }
+        break;
     case HTTP_EVENT_ON_DATA:
-        if (output_buffer != NULL && evt->data_len > 0)
+        if (output_buffer != NULL && output_buffer->buffer != NULL && evt->data_len > 0)
+        {
+            // Truncate rather than grow: the caller sized the buffer for the response it expects
+            size_t room = output_buffer->buffer_len - 1 - output_buffer->data_len;
+            size_t copy_len = (size_t)evt->data_len < room ? (size_t)evt->data_len : room;
+            if (copy_len < (size_t)evt->data_len)
+            {
+                ESP_LOGW(TAG, "Response truncated to %u bytes", (unsigned)(output_buffer->buffer_len - 1));
+            }
+
+            memcpy(output_buffer->buffer + output_buffer->data_len, evt->data, copy_len);
+            output_buffer->data_len += copy_len;
+            output_buffer->buffer[output_buffer->data_len] = '\0';
+        }
+        break;
+    default:
+        break;
+    }
+    return ESP_OK;
+}
+
+// Time a request. With a current span the request becomes its child span, so
+// per-request latency nests under the operation that caused it; otherwise the
+// duration still feeds the operation's latency histogram, if it has one
+typedef struct
+{
+    const char *operation;
+    int64_t started_at;
+    ota_trace_context_t *span;
+} request_timing_t;
+
+static void start_request_timing(request_timing_t *timing, const char *operation)
+{
+    timing->operation = operation;
+    timing->started_at = esp_timer_get_time();
+    timing->span = NULL;
+
+    if (ota_trace_get_current() != NULL)
+    {
+        timing->span = ota_trace_start_operation(operation, NULL);
+        ota_trace_enter(timing->span);
+    }
+}
+
+static void end_request_timing(request_timing_t *timing, int status_code)
+{
+    if (timing->span == NULL)
+    {
+        ota_trace_record_duration(timing->operation, esp_timer_get_time() - timing->started_at);
+        return;
+    }
+
+    if (status_code < 200 || status_code >= 300)
+    {
+        ota_trace_set_error(timing->span, ESP_FAIL);
+    }
+
+    ota_trace_set_attr_int(timing->span, "http.status_code", status_code);
+    ota_trace_end_operation(timing->span, NULL);
+    timing->span = NULL;
+}
+
+// Tag an outgoing request with the caller's span so the backend can link its
+// own server-side spans to the device trace
+static void set_traceparent_header(esp_http_client_handle_t client)
+{
+    ota_trace_context_t *span = ota_trace_get_current();
+    char traceparent[OTA_TRACEPARENT_SIZE];
+
+    if (span != NULL && ota_trace_format_traceparent(span, traceparent, sizeof(traceparent)) == ESP_OK)
+    {
+        esp_http_client_set_header(client, "traceparent", traceparent);
+    }
+}
+
+// Scheduling hints the backend may attach to check and heartbeat responses
+static void apply_schedule_hints(cJSON *response_json, ota_schedule_kind_t kind)
+{
+    cJSON *next_check_in = cJSON_GetObjectItem(response_json, "nextCheckIn");
+    if (cJSON_IsNumber(next_check_in) && next_check_in->valuedouble > 0)
+    {
+        ota_schedule_set_hint(kind, (uint32_t)next_check_in->valuedouble);
+    }
+
+    cJSON *throttle = cJSON_GetObjectItem(response_json, "throttle");
+    if (cJSON_IsBool(throttle))
+    {
+        ota_schedule_set_throttled(cJSON_IsTrue(throttle));
+    }
+
+    cJSON *rollout_active = cJSON_GetObjectItem(response_json, "rolloutActive");
+    if (cJSON_IsBool(rollout_active))
+    {
+        ota_schedule_set_rollout_active(cJSON_IsTrue(rollout_active));
+    }
+}
+
+// The same hints read from a CBOR response entry
+static void apply_cbor_schedule_hint(const char *key, size_t key_len, const ota_cbor_item_t *item,
+                                     ota_schedule_kind_t kind)
+{
+    if (ota_cbor_key_is(key, key_len, "nextCheckIn"))
+    {
+        double next_check_in = item->type == OTA_CBOR_TYPE_INT ? (double)item->value.integer
+                               : item->type == OTA_CBOR_TYPE_FLOAT ? item->value.number
+                                                                   : 0;
+        if (next_check_in > 0)
+        {
+            ota_schedule_set_hint(kind, (uint32_t)next_check_in);
+        }
+    }
+    else if (ota_cbor_key_is(key, key_len, "throttle") && item->type == OTA_CBOR_TYPE_BOOL)
+    {
+        ota_schedule_set_throttled(item->value.boolean);
+    }
+    else if (ota_cbor_key_is(key, key_len, "rolloutActive") && item->type == OTA_CBOR_TYPE_BOOL)
+    {
+        ota_schedule_set_rollout_active(item->value.boolean);
+    }
+}
+
+static bool use_cbor(void)
+{
+    return OTA_CBOR_ENABLED && atomic_load_explicit(&backend_speaks_cbor, memory_order_relaxed);
+}
+
+// JSON text written straight into a scratch buffer, for bodies that must
+// not allocate. Output past the end of the buffer is dropped and reported
+// when the body is finished, like the CBOR writer does.
+typedef struct
+{
+    char *buffer;
+    size_t size;
+    size_t len;
+    bool first; // The open object has no member yet
+    bool overflow;
+} json_writer_t;
+
+static void json_put(json_writer_t *json, const char *text, size_t len)
+{
+    // Keep room for the NUL
+    if (json->overflow || len >= json->size - json->len)
+    {
+        json->overflow = true;
+        return;
+    }
+    memcpy(&json->buffer[json->len], text, len);
+    json->len += len;
+    json->buffer[json->len] = '\0';
+}
+
+static void json_put_string(json_writer_t *json, const char *value)
+{
+    const char *plain = value;
+
+    json_put(json, "\"", 1);
+    for (; *value; value++)
+    {
+        unsigned char c = *value;
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+
+        char escaped[8];
+        int len = c < 0x20 ? snprintf(escaped, sizeof(escaped), "\\u%04x", c)
+                           : snprintf(escaped, sizeof(escaped), "\\%c", c);
+        json_put(json, plain, value - plain);
+        json_put(json, escaped, len);
+        plain = value + 1;
+    }
+    json_put(json, plain, value - plain);
+    json_put(json, "\"", 1);
+}
+
+static void json_put_key(json_writer_t *json, const char *key)
+{
+    if (!json->first)
+    {
+        json_put(json, ",", 1);
+    }
+    json->first = false;
+    json_put_string(json, key);
+    json_put(json, ":", 1);
+}
+
+// Shortest of 15 or 17 significant digits that reads back exactly, as
+// cJSON prints numbers
+static void json_put_double(json_writer_t *json, double value)
+{
+    char text[32];
+    int len;
+    if (!isfinite(value))
+    {
+        len = snprintf(text, sizeof(text), "null");
+    }
+    else
+    {
+        len = snprintf(text, sizeof(text), "%1.15g", value);
+        if (strtod(text, NULL) != value)
+        {
+            len = snprintf(text, sizeof(text), "%1.17g", value);
+        }
+    }
+    json_put(json, text, len);
+}
+
+// A request body built as JSON or, once the backend speaks it, as CBOR
+// written straight into a scratch buffer. Fields go to the top-level object,
+// or to the nested one between message_begin_object() and message_end_object().
+// A streamed message writes its JSON into the scratch buffer too, instead of
+// building a cJSON tree on the heap.
+typedef struct
+{
+    bool cbor;
+    bool streamed;
+    bool growable; // A heartbeat; its buffer is enlarged when a metric does not fit
+    cJSON *root;
+    cJSON *object; // Object fields are added to
+    char *buffer;  // CBOR or streamed JSON output
+    ota_cbor_writer_t writer;
+    json_writer_t json;
+    char *json_string;
+} message_t;
+
+static esp_err_t message_begin(message_t *message)
+{
+    memset(message, 0, sizeof(*message));
+    message->cbor = use_cbor();
+
+    if (message->cbor)
+    {
+        message->buffer = ota_arena_buffer_acquire();
+        if (message->buffer == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        ota_cbor_writer_init(&message->writer, message->buffer, OTA_ARENA_BUFFER_SIZE);
+        ota_cbor_put_map(&message->writer, OTA_CBOR_INDEFINITE);
+        return ESP_OK;
+    }
+
+    message->root = cJSON_CreateObject();
+    message->object = message->root;
+    return message->root != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// For bodies that fit in a scratch buffer and are sent often (spans)
+static esp_err_t message_begin_streamed(message_t *message)
+{
+    if (use_cbor())
+    {
+        return message_begin(message);
+    }
+
+    memset(message, 0, sizeof(*message));
+    message->streamed = true;
+    message->buffer = ota_arena_buffer_acquire();
+    if (message->buffer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    message->json = (json_writer_t){.buffer = message->buffer, .size = OTA_ARENA_BUFFER_SIZE, .first = true};
+    json_put(&message->json, "{", 1);
+    return ESP_OK;
+}
+
+// For heartbeats: streamed like spans, into a buffer sized for every metric
+// in static memory mode and one that grows with them otherwise
+static esp_err_t message_begin_heartbeat(message_t *message)
+{
+    memset(message, 0, sizeof(*message));
+    size_t size;
+    message->buffer = ota_arena_heartbeat_buffer_acquire(&size);
+    if (message->buffer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    message->growable = true;
+
+    message->cbor = use_cbor();
+    if (message->cbor)
+    {
+        ota_cbor_writer_init(&message->writer, message->buffer, size);
+        ota_cbor_put_map(&message->writer, OTA_CBOR_INDEFINITE);
+        return ESP_OK;
+    }
+
+    message->streamed = true;
+    message->json = (json_writer_t){.buffer = message->buffer, .size = size, .first = true};
+    json_put(&message->json, "{", 1);
+    return ESP_OK;
+}
+
+static size_t message_len(const message_t *message)
+{
+    return message->cbor ? message->writer.len : message->json.len;
+}
+
+// Nothing was dropped and spare bytes are left to close the message
+static bool message_fits(const message_t *message, size_t spare)
+{
+    if (message->cbor)
+    {
+        return !message->writer.overflow && message->writer.size - message->writer.len >= spare;
+    }
+    // The JSON writer keeps room for the NUL
+    return !message->json.overflow && message->json.size - message->json.len > spare;
+}
+
+// Drop what was written after mark; first is the JSON writer's state at mark
+static void message_rewind(message_t *message, size_t mark, bool first)
+{
+    if (message->cbor)
+    {
+        message->writer.len = mark;
+        message->writer.overflow = false;
+        return;
+    }
+    message->json.len = mark;
+    message->json.buffer[mark] = '\0';
+    message->json.overflow = false;
+    message->json.first = first;
+}
+
+// Double the buffer of a growable message
+static bool message_grow(message_t *message)
+{
+    size_t size = 2 * (message->cbor ? message->writer.size : message->json.size);
+    char *buffer = message->growable ? ota_arena_buffer_grow(message->buffer, size) : NULL;
+    if (buffer == NULL)
+    {
+        return false;
+    }
+
+    message->buffer = buffer;
+    if (message->cbor)
+    {
+        message->writer.buffer = (uint8_t *)buffer;
+        message->writer.size = size;
+    }
+    else
+    {
+        message->json.buffer = buffer;
+        message->json.size = size;
+    }
+    return true;
+}
+
+static void message_add_string(message_t *message, const char *key, const char *value)
+{
+    if (message->cbor)
+    {
+        ota_cbor_put_text(&message->writer, key);
+        ota_cbor_put_text(&message->writer, value);
+        return;
+    }
+    if (message->streamed)
+    {
+        json_put_key(&message->json, key);
+        json_put_string(&message->json, value);
+        return;
+    }
+    cJSON_AddStringToObject(message->object, key, value);
+}
+
+// Exact in CBOR and streamed JSON; a cJSON tree carries it as a double
+static void message_add_int(message_t *message, const char *key, int64_t value)
+{
+    if (message->cbor)
+    {
+        ota_cbor_put_text(&message->writer, key);
+        ota_cbor_put_int(&message->writer, value);
+        return;
+    }
+    if (message->streamed)
+    {
+        char text[24];
+        json_put_key(&message->json, key);
+        json_put(&message->json, text, snprintf(text, sizeof(text), "%lld", (long long)value));
+        return;
+    }
+    cJSON_AddNumberToObject(message->object, key, (double)value);
+}
+
+static void message_add_double(message_t *message, const char *key, double value)
+{
+    if (message->cbor)
+    {
+        ota_cbor_put_text(&message->writer, key);
+        ota_cbor_put_double(&message->writer, value);
+        return;
+    }
+    if (message->streamed)
+    {
+        json_put_key(&message->json, key);
+        json_put_double(&message->json, value);
+        return;
+    }
+    cJSON_AddNumberToObject(message->object, key, value);
+}
+
+static void message_add_bool(message_t *message, const char *key, bool value)
+{
+    if (message->cbor)
+    {
+        ota_cbor_put_text(&message->writer, key);
+        ota_cbor_put_bool(&message->writer, value);
+        return;
+    }
+    if (message->streamed)
+    {
+        json_put_key(&message->json, key);
+        json_put(&message->json, value ? "true" : "false", value ? 4 : 5);
+        return;
+    }
+    cJSON_AddBoolToObject(message->object, key, value);
+}
+
+// Takes ownership of value
+static void message_add_json(message_t *message, const char *key, cJSON *value)
+{
+    if (message->cbor)
+    {
+        ota_cbor_put_text(&message->writer, key);
+        ota_cbor_put_json(&message->writer, value);
+        cJSON_Delete(value);
+        return;
+    }
+    if (message->streamed)
+    {
+        json_writer_t *json = &message->json;
+        json_put_key(json, key);
+        if (!json->overflow &&
+            cJSON_PrintPreallocated(value, &json->buffer[json->len], json->size - json->len, false))
+        {
+            json->len += strlen(&json->buffer[json->len]);
+        }
+        else
+        {
+            json->overflow = true;
+        }
+        cJSON_Delete(value);
+        return;
+    }
+    cJSON_AddItemToObject(message->object, key, value);
+}
+
+static void message_begin_object(message_t *message, const char *key)
+{
+    if (message->cbor)
+    {
+        ota_cbor_put_text(&message->writer, key);
+        ota_cbor_put_map(&message->writer, OTA_CBOR_INDEFINITE);
+        return;
+    }
+    if (message->streamed)
+    {
+        json_put_key(&message->json, key);
+        json_put(&message->json, "{", 1);
+        message->json.first = true;
+        return;
+    }
+    message->object = cJSON_AddObjectToObject(message->root, key);
+}
+
+static void message_end_object(message_t *message)
+{
+    if (message->cbor)
+    {
+        ota_cbor_put_break(&message->writer);
+        return;
+    }
+    if (message->streamed)
+    {
+        json_put(&message->json, "}", 1);
+        message->json.first = false;
+        return;
+    }
+    message->object = message->root;
+}
+
+// An array of objects, each between message_begin_element() and
+// message_end_object(); CBOR and streamed messages only
+static void message_begin_array(message_t *message, const char *key)
+{
+    if (message->cbor)
+    {
+        ota_cbor_put_text(&message->writer, key);
+        ota_cbor_put_array(&message->writer, OTA_CBOR_INDEFINITE);
+        return;
+    }
+    json_put_key(&message->json, key);
+    json_put(&message->json, "[", 1);
+    message->json.first = true;
+}
+
+static void message_begin_element(message_t *message)
+{
+    if (message->cbor)
+    {
+        ota_cbor_put_map(&message->writer, OTA_CBOR_INDEFINITE);
+        return;
+    }
+    if (!message->json.first)
+    {
+        json_put(&message->json, ",", 1);
+    }
+    json_put(&message->json, "{", 1);
+    message->json.first = true;
+}
+
+static void message_end_array(message_t *message)
+{
+    if (message->cbor)
+    {
+        ota_cbor_put_break(&message->writer);
+        return;
+    }
+    json_put(&message->json, "]", 1);
+    message->json.first = false;
+}
+
+// Send the message; the response, if any, is described by response
+static esp_err_t message_post(message_t *message, const char *endpoint, char *response_buffer,
+                              size_t response_buffer_size, ota_http_response_t *response)
+{
+    const char *body;
+    size_t body_len;
+
+    if (message->cbor)
+    {
+        ota_cbor_put_break(&message->writer);
+        if (ota_cbor_writer_finish(&message->writer) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "CBOR request does not fit in its buffer");
+            return ESP_ERR_NO_MEM;
+        }
+        body = message->buffer;
+        body_len = message->writer.len;
+    }
+    else if (message->streamed)
+    {
+        json_put(&message->json, "}", 1);
+        if (message->json.overflow)
+        {
+            ESP_LOGE(TAG, "JSON request does not fit in its buffer");
+            return ESP_ERR_NO_MEM;
+        }
+        body = message->buffer;
+        body_len = message->json.len;
+    }
+    else
+    {
+        message->json_string = ota_arena_print_json(message->root);
+        cJSON_Delete(message->root);
+        message->root = NULL;
+        if (!message->json_string)
+        {
+            ESP_LOGE(TAG, "Failed to create JSON request");
+            return ESP_ERR_NO_MEM;
+        }
+        body = message->json_string;
+        body_len = strlen(message->json_string);
+    }
+
+    return ota_http_post(endpoint, body, body_len, message->cbor, response_buffer, response_buffer_size, response);
+}
+
+static void message_free(message_t *message)
+{
+    cJSON_Delete(message->root);
+    ota_arena_free_json(message->json_string);
+    ota_arena_buffer_release(message->buffer);
+}
+
+static esp_err_t ota_download_client_init_cb(esp_http_client_handle_t client)
+{
+    set_traceparent_header(client);
+    return ESP_OK;
+}
+
+esp_err_t ota_http_client_init(void)
+{
+    // Without a compressor, bodies are sent uncompressed
+    if (OTA_COMPRESSION_ENABLED && ota_compress_init() != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Request compression unavailable");
+    }
+
+    default_transport = OTA_MQTT_ENABLED ? &ota_transport_mqtt : &ota_transport_http;
+    transport = default_transport;
+
+    ESP_LOGI(TAG, "HTTP client initialized, sending over %s", transport->name);
+    return ESP_OK;
+}
+
+esp_err_t ota_http_client_start(void)
+{
+    if (client_started)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = transport->start ? transport->start(on_transport_receive) : ESP_OK;
+    if (err == ESP_OK)
+    {
+        // Each session negotiates the body encoding afresh: the backend may
+        // have changed while the client was stopped
+        atomic_store_explicit(&backend_speaks_cbor, false, memory_order_relaxed);
+        atomic_store_explicit(&cbor_refused, false, memory_order_relaxed);
+        client_started = true;
+    }
+    return err;
+}
+
+void ota_http_client_stop(void)
+{
+    if (!client_started)
+    {
+        return;
+    }
+
+    if (transport->stop)
+    {
+        transport->stop();
+    }
+    client_started = false;
+}
+
+esp_err_t ota_http_client_set_transport(const ota_transport_t *new_transport)
+{
+    if (client_started)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    transport = new_transport ? new_transport : default_transport;
+    return ESP_OK;
+}
+
+esp_err_t ota_http_add_push_listener(ota_http_push_listener_t listener, void *ctx)
+{
+    if (!listener)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 0; i < OTA_PUSH_MAX_LISTENERS; i++)
+    {
+        if (!push_listeners[i].listener)
+        {
+            push_listeners[i] = (push_listener_slot_t){listener, ctx};
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t ota_http_post_json(const char *endpoint, const char *json_data, char *response_buffer, size_t response_buffer_size)
+{
+    if (!json_data)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ota_http_post(endpoint, json_data, strlen(json_data), false, response_buffer, response_buffer_size, NULL);
+}
+
+esp_err_t ota_http_post(const char *endpoint, const char *body, size_t body_len, bool cbor, char *response_buffer,
+                        size_t response_buffer_size, ota_http_response_t *response)
+{
+    if (!endpoint || !body)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ota_transport_response_t info = {0};
+    esp_err_t err = transport->send(endpoint, body, body_len, cbor, response_buffer, response_buffer_size, &info);
+
+    if (err == ESP_ERR_NOT_SUPPORTED && cbor)
+    {
+        if (!atomic_exchange_explicit(&cbor_refused, true, memory_order_relaxed))
+        {
+            ESP_LOGW(TAG, "Backend refused a CBOR body, sending JSON from now on");
+        }
+        atomic_store_explicit(&backend_speaks_cbor, false, memory_order_relaxed);
+
+        // Resend the refused body once, so the message is not lost
+        cJSON *json = ota_cbor_to_json(body, body_len);
+        char *json_string = ota_arena_print_json(json);
+        cJSON_Delete(json);
+        if (json_string == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to convert CBOR request to JSON");
+            err = ESP_ERR_NO_MEM;
+        }
+        else
+        {
+            err = transport->send(endpoint, json_string, strlen(json_string), false, response_buffer,
+                                  response_buffer_size, &info);
+            ota_arena_free_json(json_string);
+        }
+    }
+
+    if (err == ESP_OK && OTA_CBOR_ENABLED && info.cbor && !atomic_load_explicit(&cbor_refused, memory_order_relaxed) &&
+        !atomic_exchange_explicit(&backend_speaks_cbor, true, memory_order_relaxed))
+    {
+        ESP_LOGI(TAG, "Backend answers in CBOR, sending CBOR from now on");
+    }
+
+    if (response)
+    {
+        *response = info;
+    }
+    return err;
+}
+
+static esp_err_t http_send(const char *endpoint, const char *body, size_t body_len, bool cbor, char *response_buffer,
+                           size_t response_buffer_size, ota_transport_response_t *response)
+{
+    char base_url[OTA_SETTINGS_TEXT_SIZE];
+    ota_settings_get_str(OTA_SETTING_SERVER_URL, base_url, sizeof(base_url));
+    char url[OTA_URL_BUFFER_SIZE];
+    snprintf(url, sizeof(url), "%s%s", base_url, endpoint);
+
+    char operation[64];
+    snprintf(operation, sizeof(operation), "http_post %s", endpoint);
+    request_timing_t timing;
+    start_request_timing(&timing, operation);
+    int status_code = 0;
+
+    bool has_output = response_buffer != NULL && response_buffer_size > 0;
+    http_response_buffer_t output_buffer = {
+        .buffer = has_output ? response_buffer : NULL,
+        .buffer_len = response_buffer_size,
+        .data_len = 0,
+        .cbor = false,
+        .retry_after = 0};
+    if (has_output)
+    {
+        response_buffer[0] = '\0';
+    }
+    if (response)
+    {
+        response->len = 0;
+        response->cbor = false;
+    }
+
+    esp_http_client_config_t config = {
+        .url = url,
+        .method = HTTP_METHOD_POST,
+        .event_handler = http_event_handler,
+        .user_data = &output_buffer,
+        .timeout_ms = ota_settings_get_u32(OTA_SETTING_SERVER_TIMEOUT_MS),
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .skip_cert_common_name_check = !OTA_SSL_VERIFICATION,
+        .keep_alive_enable = true,
+        .keep_alive_idle = 5,
+        .keep_alive_interval = 5,
+        .keep_alive_count = 3,
+    };
+
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to initialize HTTP client");
+        end_request_timing(&timing, status_code);
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = ESP_OK;
+
+    // Set headers; offering CBOR is how the backend learns the device speaks it
+    esp_http_client_set_header(client, "Content-Type", cbor ? CONTENT_TYPE_CBOR : CONTENT_TYPE_JSON);
+    esp_http_client_set_header(client, "Accept",
+                               OTA_CBOR_ENABLED ? CONTENT_TYPE_CBOR ", " CONTENT_TYPE_JSON ";q=0.9" : CONTENT_TYPE_JSON);
+    esp_http_client_set_header(client, "User-Agent", "ESP32-OTA-Plugin/1.0");
+    set_traceparent_header(client);
+
+    // Set POST data, gzipped when that saves space
+    char *compressed = NULL;
+    size_t compressed_len = 0;
+    if (OTA_COMPRESSION_ENABLED && body_len >= OTA_COMPRESSION_MIN_SIZE)
+    {
+        compressed = ota_arena_buffer_acquire();
+        if (compressed != NULL &&
+            ota_compress_gzip(body, body_len, compressed, OTA_ARENA_BUFFER_SIZE, &compressed_len) != ESP_OK)
         {
-            // Reallocate buffer if needed
-            if (output_buffer->data_len + evt->data_len >= output_buffer->buffer_len)
+            ota_arena_buffer_release(compressed);
+            compressed = NULL;
+        }
+    }
+
+    if (compressed != NULL)
+    {
+        esp_http_client_set_header(client, "Content-Encoding", "gzip");
+        esp_http_client_set_post_field(client, compressed, compressed_len);
+    }
+    else
+    {
+        esp_http_client_set_post_field(client, body, body_len);
+    }
+
+    // Perform request
+    err = esp_http_client_perform(client);
+    if (err == ESP_OK)
+    {
+        status_code = esp_http_client_get_status_code(client);
+        ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %lld",
+                 status_code, esp_http_client_get_content_length(client));
+
+        if (status_code >= 200 && status_code < 300)
+        {
+            ota_schedule_set_throttled(false);
+
+            if (response)
+            {
+                response->len = output_buffer.data_len;
+                response->cbor = output_buffer.cbor;
+            }
+        }
+        else
+        {
+            ESP_LOGE(TAG, "HTTP request failed with status %d", status_code);
+            err = ESP_FAIL;
+
+            if (has_output)
+            {
+                response_buffer[0] = '\0'; // Error bodies are not responses
+            }
+
+            if (status_code == 429 || status_code == 503)
             {
-                output_buffer->buffer_len = output_buffer->data_len + evt->data_len + 1;
-                output_buffer->buffer = realloc(output_buffer->buffer, output_buffer->buffer_len);
-                if (output_buffer->buffer == NULL)
+                ota_schedule_set_throttled(true);
+                if (output_buffer.retry_after > 0)
                 {
-                    ESP_LOGE(TAG, "Failed to reallocate memory for response buffer");
-                    return ESP_FAIL;
+                    ota_schedule_set_retry_after(output_buffer.retry_after);
                 }
             }
 
-            memcpy(output_buffer->buffer + output_buffer->data_len, evt->data, evt->data_len);
-            output_buffer->data_len += evt->data_len;
-            output_buffer->buffer[output_buffer->data_len] = '\0';
+            // Unsupported Media Type: ota_http_post() resends the body as JSON
+            if (cbor && status_code == 415)
+            {
+                err = ESP_ERR_NOT_SUPPORTED;
+            }
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
+    }
+
+    esp_http_client_cleanup(client);
+    ota_arena_buffer_release(compressed);
+    end_request_timing(&timing, status_code);
+    return err;
+}
+
+const ota_transport_t ota_transport_http = {
+    .name = "http",
+    .replies = true,
+    .send = http_send,
+};
+
+// Fields of a check response; the JSON and the CBOR reader fill the same struct
+typedef struct
+{
+    bool has_update_available;
+    bool update_available;
+    char *firmware_url;
+    size_t url_size;
+    char *new_version;
+    size_t version_size;
+    // Copied once the whole map is read and, as in the JSON reader, only if
+    // an update is available; zero-initialized, they copy nothing
+    ota_cbor_item_t cbor_url;
+    ota_cbor_item_t cbor_version;
+} check_response_t;
+
+static void read_cbor_check_entry(const char *key, size_t key_len, const ota_cbor_item_t *item, void *ctx)
+{
+    check_response_t *check = (check_response_t *)ctx;
+
+    if (ota_cbor_key_is(key, key_len, "updateAvailable") && item->type == OTA_CBOR_TYPE_BOOL)
+    {
+        check->has_update_available = true;
+        check->update_available = item->value.boolean;
+    }
+    else if (ota_cbor_key_is(key, key_len, "firmwareUrl"))
+    {
+        check->cbor_url = *item;
+    }
+    else if (ota_cbor_key_is(key, key_len, "version"))
+    {
+        check->cbor_version = *item;
+    }
+    else
+    {
+        apply_cbor_schedule_hint(key, key_len, item, OTA_SCHEDULE_CHECK);
+    }
+}
+
+static esp_err_t read_cbor_check_response(const char *response, size_t len, check_response_t *check)
+{
+    esp_err_t err = ota_cbor_read_map(response, len, read_cbor_check_entry, check);
+    if (err == ESP_OK && check->update_available)
+    {
+        if (check->firmware_url && check->url_size > 0)
+        {
+            ota_cbor_copy_text(&check->cbor_url, check->firmware_url, check->url_size);
+        }
+        if (check->new_version && check->version_size > 0)
+        {
+            ota_cbor_copy_text(&check->cbor_version, check->new_version, check->version_size);
+        }
+    }
+    return err;
+}
+
+static esp_err_t read_json_check_response(const char *response, check_response_t *check)
+{
+    cJSON *response_json = cJSON_Parse(response);
+    if (!response_json)
+    {
+        ESP_LOGE(TAG, "Failed to parse JSON response");
+        return ESP_FAIL;
+    }
+
+    apply_schedule_hints(response_json, OTA_SCHEDULE_CHECK);
+
+    cJSON *update_available_json = cJSON_GetObjectItem(response_json, "updateAvailable");
+    if (cJSON_IsBool(update_available_json))
+    {
+        check->has_update_available = true;
+        check->update_available = cJSON_IsTrue(update_available_json);
+    }
+
+    if (check->update_available)
+    {
+        cJSON *firmware_url_json = cJSON_GetObjectItem(response_json, "firmwareUrl");
+        cJSON *new_version_json = cJSON_GetObjectItem(response_json, "version");
+
+        if (check->firmware_url && check->url_size > 0 && cJSON_IsString(firmware_url_json))
+        {
+            strncpy(check->firmware_url, firmware_url_json->valuestring, check->url_size - 1);
+            check->firmware_url[check->url_size - 1] = '\0';
+        }
+
+        if (check->new_version && check->version_size > 0 && cJSON_IsString(new_version_json))
+        {
+            strncpy(check->new_version, new_version_json->valuestring, check->version_size - 1);
+            check->new_version[check->version_size - 1] = '\0';
         }
-        break;
-    default:
-        break;
     }
+
+    cJSON_Delete(response_json);
     return ESP_OK;
 }
 
-esp_err_t ota_http_client_init(void)
+static void release_check_response(char *response)
 {
-    ESP_LOGI(TAG, "HTTP client initialized");
-    return ESP_OK;
+    if (OTA_STATIC_MEMORY_ENABLED)
+    {
+        ota_arena_buffer_release(response);
+    }
 }
 
-esp_err_t ota_http_post_json(const char *endpoint, const char *json_data, char *response_buffer, size_t response_buffer_size)
+static void copy_text(char *dest, size_t dest_size, const char *src)
 {
-    if (!endpoint || !json_data)
+    if (dest && dest_size > 0)
     {
-        return ESP_ERR_INVALID_ARG;
+        strncpy(dest, src, dest_size - 1);
+        dest[dest_size - 1] = '\0';
     }
+}
 
-    char url[OTA_URL_BUFFER_SIZE];
-    snprintf(url, sizeof(url), "%s%s", OTA_SERVER_BASE_URL, endpoint);
-
-    http_response_buffer_t output_buffer = {
-        .buffer = malloc(OTA_MAX_HTTP_OUTPUT_BUFFER),
-        .buffer_len = OTA_MAX_HTTP_OUTPUT_BUFFER,
-        .data_len = 0};
-
-    if (output_buffer.buffer == NULL)
+// An announcement of the running version is stale, e.g. a retained message
+// received again after installing it
+static void read_announcement(const char *current_version, bool *update_available, char *firmware_url,
+                              size_t url_size, char *new_version, size_t version_size)
+{
+    announcement_t latest;
+    taskENTER_CRITICAL(&announcement_lock);
+    latest = announcement;
+    taskEXIT_CRITICAL(&announcement_lock);
+
+    *update_available =
+        latest.received && latest.update_available && strcmp(latest.version, current_version) != 0;
+    if (*update_available)
     {
-        ESP_LOGE(TAG, "Failed to allocate memory for response buffer");
-        return ESP_ERR_NO_MEM;
+        copy_text(firmware_url, url_size, latest.firmware_url);
+        copy_text(new_version, version_size, latest.version);
     }
+}
 
-    esp_http_client_config_t config = {
-        .url = url,
-        .method = HTTP_METHOD_POST,
-        .event_handler = http_event_handler,
-        .user_data = &output_buffer,
-        .timeout_ms = OTA_SERVER_TIMEOUT_MS,
-        .crt_bundle_attach = esp_crt_bundle_attach,
-        .skip_cert_common_name_check = !OTA_SSL_VERIFICATION,
-        .keep_alive_enable = true,
-        .keep_alive_idle = 5,
-        .keep_alive_interval = 5,
-        .keep_alive_count = 3,
-    };
-
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (client == NULL)
+esp_err_t ota_http_check_firmware_update(const char *device_id, const char *current_version,
+                                         bool *update_available, char *firmware_url, size_t url_size,
+                                         char *new_version, size_t version_size)
+{
+    if (!device_id || !current_version || !update_available)
     {
-        ESP_LOGE(TAG, "Failed to initialize HTTP client");
-        free(output_buffer.buffer);
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_ARG;
     }
 
-    esp_err_t err = ESP_OK;
-
-    // Set headers
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-    esp_http_client_set_header(client, "User-Agent", "ESP32-OTA-Plugin/1.0");
-
-    // Set POST data
-    esp_http_client_set_post_field(client, json_data, strlen(json_data));
-
-    // Perform request
-    err = esp_http_client_perform(client);
-    if (err == ESP_OK)
+    // Create request
+    message_t request;
+    esp_err_t err = message_begin(&request);
+    if (err != ESP_OK)
     {
-        int status_code = esp_http_client_get_status_code(client);
-        ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %lld",
-                 status_code, esp_http_client_get_content_length(client));
+        message_free(&request);
+        return err;
+    }
+    message_add_string(&request, "deviceId", device_id);
+    message_add_string(&request, "version", current_version);
+
+    // Make HTTP request. The response goes to a scratch buffer in static
+    // memory mode and stays on the stack otherwise, off the heap either way.
+    char stack_response[OTA_STATIC_MEMORY_ENABLED ? 1 : OTA_JSON_BUFFER_SIZE];
+    char *response = OTA_STATIC_MEMORY_ENABLED ? ota_arena_buffer_acquire() : stack_response;
+    if (!response)
+    {
+        message_free(&request);
+        return ESP_ERR_NO_MEM;
+    }
+    ota_http_response_t response_info;
+    err = message_post(&request, "/firmware/check", response, OTA_JSON_BUFFER_SIZE, &response_info);
+    message_free(&request);
 
-        if (status_code >= 200 && status_code < 300)
+    if (err != ESP_OK || !transport->replies)
+    {
+        release_check_response(response);
+        if (err == ESP_OK)
         {
-            if (response_buffer && response_buffer_size > 0 && output_buffer.data_len > 0)
-            {
-                size_t copy_len = (output_buffer.data_len < response_buffer_size - 1) ? output_buffer.data_len : response_buffer_size - 1;
-                memcpy(response_buffer, output_buffer.buffer, copy_len);
-                response_buffer[copy_len] = '\0';
-            }
+            read_announcement(current_version, update_available, firmware_url, url_size, new_version, version_size);
         }
-        else
+        return err;
+    }
+
+    // Parse response; URL and version are only meaningful with an update
+    check_response_t check = {
+        .firmware_url = firmware_url,
+        .url_size = url_size,
+        .new_version = new_version,
+        .version_size = version_size,
+    };
+    if (response_info.cbor)
+    {
+        err = read_cbor_check_response(response, response_info.len, &check);
+        if (err != ESP_OK)
         {
-            ESP_LOGE(TAG, "HTTP request failed with status %d", status_code);
+            ESP_LOGE(TAG, "Failed to parse CBOR response");
             err = ESP_FAIL;
         }
     }
     else
     {
-        ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
+        err = read_json_check_response(response, &check);
+    }
+    release_check_response(response);
+
+    if (err == ESP_OK && !check.has_update_available)
+    {
+        ESP_LOGE(TAG, "Invalid response format");
+        err = ESP_FAIL;
+    }
+    if (err == ESP_OK)
+    {
+        *update_available = check.update_available;
     }
 
-    esp_http_client_cleanup(client);
-    free(output_buffer.buffer);
     return err;
 }
 
-esp_err_t ota_http_check_firmware_update(const char *device_id, const char *current_version,
-                                         bool *update_available, char *firmware_url, size_t url_size,
-                                         char *new_version, size_t version_size)
+esp_err_t ota_http_report_firmware_status(const char *device_id, const char *version, const char *status)
 {
-    if (!device_id || !current_version || !update_available)
+    if (!device_id || !version || !status)
     {
         return ESP_ERR_INVALID_ARG;
     }
 
-    // Create JSON request
-    cJSON *json = cJSON_CreateObject();
-    cJSON *device_id_json = cJSON_CreateString(device_id);
-    cJSON *version_json = cJSON_CreateString(current_version);
+    // Create request
+    message_t request;
+    esp_err_t err = message_begin(&request);
+    if (err == ESP_OK)
+    {
+        message_add_string(&request, "deviceId", device_id);
+        message_add_string(&request, "version", version);
+        message_add_string(&request, "status", status);
+
+        err = message_post(&request, "/firmware/report", NULL, 0, NULL);
+    }
+    message_free(&request);
 
-    cJSON_AddItemToObject(json, "deviceId", device_id_json);
-    cJSON_AddItemToObject(json, "version", version_json);
+    return err;
+}
 
-    char *json_string = cJSON_Print(json);
-    cJSON_Delete(json);
+// A settings delta read from CBOR, as the JSON object ota_settings validates.
+// Text too long for a setting is passed as null so the delta is rejected
+// rather than applied truncated
+static void add_cbor_config_entry(const char *key, size_t key_len, const ota_cbor_item_t *item, void *ctx)
+{
+    cJSON *config = (cJSON *)ctx;
+    char name[32];
+    char text[OTA_SETTINGS_TEXT_SIZE];
+    cJSON *value;
 
-    if (!json_string)
+    if (key_len >= sizeof(name))
     {
-        ESP_LOGE(TAG, "Failed to create JSON request");
-        return ESP_ERR_NO_MEM;
+        return;
     }
+    memcpy(name, key, key_len);
+    name[key_len] = '\0';
 
-    // Make HTTP request
-    char response[OTA_JSON_BUFFER_SIZE];
-    esp_err_t err = ota_http_post_json("/firmware/check", json_string, response, sizeof(response));
-    free(json_string);
+    switch (item->type)
+    {
+    case OTA_CBOR_TYPE_INT:
+        value = cJSON_CreateNumber((double)item->value.integer);
+        break;
+    case OTA_CBOR_TYPE_FLOAT:
+        value = cJSON_CreateNumber(item->value.number);
+        break;
+    case OTA_CBOR_TYPE_BOOL:
+        value = cJSON_CreateBool(item->value.boolean);
+        break;
+    case OTA_CBOR_TYPE_TEXT:
+        value = item->value.text.len < sizeof(text) && ota_cbor_copy_text(item, text, sizeof(text))
+                    ? cJSON_CreateString(text)
+                    : cJSON_CreateNull();
+        break;
+    default:
+        value = cJSON_CreateNull();
+        break;
+    }
+    cJSON_AddItemToObject(config, name, value);
+}
 
-    if (err != ESP_OK)
+static void read_cbor_heartbeat_entry(const char *key, size_t key_len, const ota_cbor_item_t *item, void *ctx)
+{
+    bool *resync = (bool *)ctx;
+
+    if (ota_cbor_key_is(key, key_len, "resync"))
     {
-        return err;
+        if (resync)
+        {
+            *resync = item->type == OTA_CBOR_TYPE_BOOL && item->value.boolean;
+        }
+    }
+    else if (ota_cbor_key_is(key, key_len, "config") && item->type == OTA_CBOR_TYPE_MAP)
+    {
+        cJSON *config = cJSON_CreateObject();
+        if (config && ota_cbor_read_map(item->raw, item->raw_len, add_cbor_config_entry, config) == ESP_OK)
+        {
+            ota_settings_apply_json(config);
+        }
+        cJSON_Delete(config);
+    }
+    else
+    {
+        apply_cbor_schedule_hint(key, key_len, item, OTA_SCHEDULE_HEARTBEAT);
     }
+}
 
-    // Parse response
+static void read_json_heartbeat_response(const char *response, bool *resync)
+{
     cJSON *response_json = cJSON_Parse(response);
     if (!response_json)
     {
-        ESP_LOGE(TAG, "Failed to parse JSON response");
-        return ESP_FAIL;
+        return;
     }
 
-    cJSON *update_available_json = cJSON_GetObjectItem(response_json, "updateAvailable");
-    if (cJSON_IsBool(update_available_json))
+    if (resync)
     {
-        *update_available = cJSON_IsTrue(update_available_json);
-
-        if (*update_available)
-        {
-            cJSON *firmware_url_json = cJSON_GetObjectItem(response_json, "firmwareUrl");
-            cJSON *new_version_json = cJSON_GetObjectItem(response_json, "version");
+        *resync = cJSON_IsTrue(cJSON_GetObjectItem(response_json, "resync"));
+    }
+    apply_schedule_hints(response_json, OTA_SCHEDULE_HEARTBEAT);
 
-            if (firmware_url && url_size > 0 && cJSON_IsString(firmware_url_json))
-            {
-                strncpy(firmware_url, firmware_url_json->valuestring, url_size - 1);
-                firmware_url[url_size - 1] = '\0';
-            }
+    cJSON *config = cJSON_GetObjectItem(response_json, "config");
+    if (config)
+    {
+        ota_settings_apply_json(config);
+    }
+    cJSON_Delete(response_json);
+}
 
-            if (new_version && version_size > 0 && cJSON_IsString(new_version_json))
-            {
-                strncpy(new_version, new_version_json->valuestring, version_size - 1);
-                new_version[version_size - 1] = '\0';
-            }
-        }
+static void notify_push(ota_http_push_t push)
+{
+    for (int i = 0; i < OTA_PUSH_MAX_LISTENERS && push_listeners[i].listener; i++)
+    {
+        push_listeners[i].listener(push, push_listeners[i].ctx);
     }
-    else
+}
+
+// An announcement carries the fields of a check response
+static void receive_announcement(const char *body, size_t body_len, bool cbor)
+{
+    announcement_t received = {0};
+    check_response_t check = {
+        .firmware_url = received.firmware_url,
+        .url_size = sizeof(received.firmware_url),
+        .new_version = received.version,
+        .version_size = sizeof(received.version),
+    };
+
+    esp_err_t err = cbor ? read_cbor_check_response(body, body_len, &check) : read_json_check_response(body, &check);
+    if (err != ESP_OK || !check.has_update_available)
     {
-        ESP_LOGE(TAG, "Invalid response format");
-        err = ESP_FAIL;
+        ESP_LOGW(TAG, "Ignoring malformed update announcement");
+        return;
     }
+    received.received = true;
+    received.update_available = check.update_available;
 
-    cJSON_Delete(response_json);
-    return err;
+    taskENTER_CRITICAL(&announcement_lock);
+    announcement = received;
+    taskEXIT_CRITICAL(&announcement_lock);
+
+    if (received.update_available)
+    {
+        ESP_LOGI(TAG, "Backend announced firmware %s", received.version);
+        notify_push(OTA_HTTP_PUSH_UPDATE);
+    }
 }
 
-esp_err_t ota_http_report_firmware_status(const char *device_id, const char *version, const char *status)
+static void receive_heartbeat_answer(const char *body, size_t body_len, bool cbor)
 {
-    if (!device_id || !version || !status)
+    bool resync = false;
+
+    if (!cbor)
     {
-        return ESP_ERR_INVALID_ARG;
+        read_json_heartbeat_response(body, &resync);
+    }
+    else if (ota_cbor_read_map(body, body_len, read_cbor_heartbeat_entry, &resync) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Malformed CBOR heartbeat answer");
     }
 
-    // Create JSON request
-    cJSON *json = cJSON_CreateObject();
-    cJSON_AddStringToObject(json, "deviceId", device_id);
-    cJSON_AddStringToObject(json, "version", version);
-    cJSON_AddStringToObject(json, "status", status);
+    if (resync)
+    {
+        notify_push(OTA_HTTP_PUSH_RESYNC);
+    }
+}
 
-    char *json_string = cJSON_Print(json);
-    cJSON_Delete(json);
+// Messages pushed by the backend, on the transport's task
+static void on_transport_receive(const char *endpoint, const char *body, size_t body_len, bool cbor)
+{
+    if (OTA_CBOR_ENABLED && cbor && !atomic_load_explicit(&cbor_refused, memory_order_relaxed) &&
+        !atomic_exchange_explicit(&backend_speaks_cbor, true, memory_order_relaxed))
+    {
+        ESP_LOGI(TAG, "Backend pushes CBOR, sending CBOR from now on");
+    }
 
-    if (!json_string)
+    if (strcmp(endpoint, "/firmware/check") == 0)
     {
-        ESP_LOGE(TAG, "Failed to create JSON request");
-        return ESP_ERR_NO_MEM;
+        receive_announcement(body, body_len, cbor);
+    }
+    else if (strcmp(endpoint, "/heartbeat") == 0)
+    {
+        receive_heartbeat_answer(body, body_len, cbor);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Ignoring message for %s", endpoint);
     }
+}
 
-    esp_err_t err = ota_http_post_json("/firmware/report", json_string, NULL, 0);
-    free(json_string);
+// Metric writes go straight into the heartbeat request
+struct ota_http_metrics_writer
+{
+    message_t *message;
+    bool started; // The "metrics" key and array are written
+    bool full;    // A metric did not fit; later ones are left out as well
+};
 
-    return err;
+// Closing the array and the request: a break or bracket each
+#define METRICS_CLOSE_SIZE 2
+
+static void write_metric(message_t *message, const char *name, double value, const char *unit,
+                         const ota_metric_window_t *window)
+{
+    message_begin_element(message);
+    message_add_string(message, "name", name);
+    message_add_double(message, "value", value);
+    message_add_string(message, "unit", unit);
+    if (window != NULL && window->count > 0)
+    {
+        message_add_int(message, "count", window->count);
+        message_add_double(message, "sum", window->sum);
+        message_add_double(message, "min", window->min);
+        message_add_double(message, "max", window->max);
+    }
+    message_end_object(message);
 }
 
-esp_err_t ota_http_send_heartbeat(const char *device_id, uint32_t uptime_sec, const char *ip,
-                                  const char *firmware_ref, const char *metrics_json)
+bool ota_http_metrics_put(ota_http_metrics_writer_t *metrics, const char *name, double value, const char *unit,
+                          const ota_metric_window_t *window)
 {
-    if (!device_id || !ip || !firmware_ref)
+    if (!metrics || !name || !unit || metrics->full)
     {
-        return ESP_ERR_INVALID_ARG;
+        return false;
     }
 
-    // Create JSON request
-    cJSON *json = cJSON_CreateObject();
-    cJSON_AddStringToObject(json, "deviceId", device_id);
-    cJSON_AddNumberToObject(json, "uptimeSec", uptime_sec);
-    cJSON_AddStringToObject(json, "ip", ip);
-    cJSON_AddStringToObject(json, "firmwareRef", firmware_ref);
+    message_t *message = metrics->message;
+    size_t mark = message_len(message);
+    bool first = message->json.first;
 
-    // Add metrics array
-    if (metrics_json)
+    while (true)
     {
-        cJSON *metrics = cJSON_Parse(metrics_json);
-        if (metrics)
+        if (!metrics->started)
+        {
+            message_begin_array(message, "metrics");
+        }
+        write_metric(message, name, value, unit, window);
+        if (message_fits(message, METRICS_CLOSE_SIZE))
+        {
+            metrics->started = true;
+            return true;
+        }
+
+        // Written again from the mark into the larger buffer
+        message_rewind(message, mark, first);
+        if (!message_grow(message))
         {
-            cJSON_AddItemToObject(json, "metrics", metrics);
+            metrics->full = true;
+            return false;
         }
     }
-    else
+}
+
+esp_err_t ota_http_send_heartbeat(const char *device_id, const char *session_id, uint32_t seq, bool full,
+                                  uint32_t uptime_sec, const char *ip, const char *firmware_ref,
+                                  ota_http_metrics_source_t metrics, void *metrics_ctx, bool *resync)
+{
+    if (!device_id || !session_id || (full && (!ip || !firmware_ref)))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Create request
+    message_t request;
+    esp_err_t err = message_begin_heartbeat(&request);
+    if (err != ESP_OK)
+    {
+        message_free(&request);
+        return err;
+    }
+    message_add_string(&request, "deviceId", device_id);
+    message_add_string(&request, "sessionId", session_id);
+    message_add_int(&request, "seq", seq);
+    message_add_bool(&request, "full", full);
+    message_add_int(&request, "uptimeSec", uptime_sec);
+
+    // Deltas omit unchanged fields
+    if (ip)
+    {
+        message_add_string(&request, "ip", ip);
+    }
+    if (firmware_ref)
     {
-        cJSON_AddItemToObject(json, "metrics", cJSON_CreateArray());
+        message_add_string(&request, "firmwareRef", firmware_ref);
     }
 
-    char *json_string = cJSON_Print(json);
-    cJSON_Delete(json);
+    // A delta without changed metrics has no metrics array; a full snapshot
+    // always has one
+    ota_http_metrics_writer_t metrics_writer = {.message = &request};
+    if (metrics)
+    {
+        metrics(&metrics_writer, metrics_ctx);
+    }
+    if (metrics_writer.started || full)
+    {
+        if (!metrics_writer.started)
+        {
+            message_begin_array(&request, "metrics");
+        }
+        message_end_array(&request);
+    }
 
-    if (!json_string)
+    // Room for a settings delta
+    char *response = ota_arena_buffer_acquire();
+    if (!response)
     {
-        ESP_LOGE(TAG, "Failed to create JSON request");
+        message_free(&request);
         return ESP_ERR_NO_MEM;
     }
+    ota_http_response_t response_info;
+    err = message_post(&request, "/heartbeat", response, OTA_ARENA_BUFFER_SIZE, &response_info);
+    message_free(&request);
+
+    if (resync)
+    {
+        *resync = false;
+    }
 
-    esp_err_t err = ota_http_post_json("/heartbeat", json_string, NULL, 0);
-    free(json_string);
+    // The server answers { resync: true } when it has lost the session state,
+    // and { config: {...} } to change settings
+    if (err == ESP_OK && response_info.len > 0)
+    {
+        if (!response_info.cbor)
+        {
+            read_json_heartbeat_response(response, resync);
+        }
+        else if (ota_cbor_read_map(response, response_info.len, read_cbor_heartbeat_entry, resync) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Malformed CBOR heartbeat response");
+        }
+    }
 
+    ota_arena_buffer_release(response);
     return err;
 }
 
@@ -297,86 +1507,108 @@ esp_err_t ota_http_send_log(const char *device_id, const char *level, const char
         return ESP_ERR_INVALID_ARG;
     }
 
-    // Create JSON request
-    cJSON *json = cJSON_CreateObject();
-    cJSON_AddStringToObject(json, "deviceId", device_id);
-    cJSON_AddStringToObject(json, "level", level);
-    cJSON_AddStringToObject(json, "message", message);
-
-    if (stack_trace)
+    // Create request
+    message_t request;
+    esp_err_t err = message_begin(&request);
+    if (err == ESP_OK)
     {
-        cJSON_AddStringToObject(json, "stack_trace", stack_trace);
-    }
+        message_add_string(&request, "deviceId", device_id);
+        message_add_string(&request, "level", level);
+        message_add_string(&request, "message", message);
 
-    if (context)
-    {
-        cJSON_AddStringToObject(json, "context", context);
-    }
+        if (stack_trace)
+        {
+            message_add_string(&request, "stack_trace", stack_trace);
+        }
 
-    char *json_string = cJSON_Print(json);
-    cJSON_Delete(json);
+        if (context)
+        {
+            message_add_string(&request, "context", context);
+        }
 
-    if (!json_string)
-    {
-        ESP_LOGE(TAG, "Failed to create JSON request");
-        return ESP_ERR_NO_MEM;
+        err = message_post(&request, "/log", NULL, 0, NULL);
     }
-
-    esp_err_t err = ota_http_post_json("/log", json_string, NULL, 0);
-    free(json_string);
+    message_free(&request);
 
     return err;
 }
 
 esp_err_t ota_http_send_trace(const char *device_id, const char *trace_id, const char *span_id,
                               const char *parent_span_id, const char *operation, uint32_t duration_ms,
-                              int64_t started_at, int64_t ended_at, const char *attributes)
+                              int64_t started_at, int64_t ended_at,
+                              const ota_trace_attr_t *attributes, size_t attribute_count,
+                              const char *raw_attributes)
 {
     if (!device_id || !trace_id || !span_id || !operation)
     {
         return ESP_ERR_INVALID_ARG;
     }
 
-    // Create JSON request
-    cJSON *json = cJSON_CreateObject();
-    cJSON_AddStringToObject(json, "deviceId", device_id);
-    cJSON_AddStringToObject(json, "trace_id", trace_id);
-    cJSON_AddStringToObject(json, "span_id", span_id);
-    cJSON_AddStringToObject(json, "operation", operation);
-    cJSON_AddNumberToObject(json, "duration_ms", duration_ms);
-    cJSON_AddNumberToObject(json, "started_at", (double)started_at);
-    cJSON_AddNumberToObject(json, "ended_at", (double)ended_at);
+    // Written straight into a scratch buffer in either encoding
+    message_t request;
+    esp_err_t err = message_begin_streamed(&request);
+    if (err != ESP_OK)
+    {
+        message_free(&request);
+        return err;
+    }
+    message_add_string(&request, "deviceId", device_id);
+    message_add_string(&request, "trace_id", trace_id);
+    message_add_string(&request, "span_id", span_id);
+    message_add_string(&request, "operation", operation);
+    message_add_int(&request, "duration_ms", duration_ms);
+    message_add_int(&request, "started_at", started_at);
+    message_add_int(&request, "ended_at", ended_at);
 
     if (parent_span_id && strlen(parent_span_id) > 0)
     {
-        cJSON_AddStringToObject(json, "parent_span", parent_span_id);
+        message_add_string(&request, "parent_span", parent_span_id);
     }
 
-    if (attributes)
+    cJSON *raw = raw_attributes ? cJSON_Parse(raw_attributes) : NULL;
+    if (attribute_count > 0 || cJSON_IsObject(raw))
     {
-        cJSON *attrs = cJSON_Parse(attributes);
-        if (attrs)
+        message_begin_object(&request, "attributes");
+
+        // Legacy JSON attributes, then typed ones
+        while (cJSON_IsObject(raw) && raw->child)
         {
-            cJSON_AddItemToObject(json, "attributes", attrs);
+            cJSON *raw_attr = cJSON_DetachItemViaPointer(raw, raw->child);
+            message_add_json(&request, raw_attr->string, raw_attr);
         }
-    }
 
-    char *json_string = cJSON_Print(json);
-    cJSON_Delete(json);
+        for (size_t i = 0; i < attribute_count; i++)
+        {
+            const ota_trace_attr_t *attr = &attributes[i];
+            switch (attr->type)
+            {
+            case OTA_TRACE_ATTR_STRING:
+                message_add_string(&request, attr->key, attr->value.string);
+                break;
+            case OTA_TRACE_ATTR_INT:
+                message_add_int(&request, attr->key, attr->value.integer);
+                break;
+            case OTA_TRACE_ATTR_DOUBLE:
+                message_add_double(&request, attr->key, attr->value.number);
+                break;
+            case OTA_TRACE_ATTR_BOOL:
+                message_add_bool(&request, attr->key, attr->value.boolean);
+                break;
+            }
+        }
 
-    if (!json_string)
-    {
-        ESP_LOGE(TAG, "Failed to create JSON request");
-        return ESP_ERR_NO_MEM;
+        message_end_object(&request);
     }
+    cJSON_Delete(raw);
 
-    esp_err_t err = ota_http_post_json("/trace", json_string, NULL, 0);
-    free(json_string);
+    err = message_post(&request, "/trace", NULL, 0, NULL);
+    message_free(&request);
 
     return err;
 }
 
-esp_err_t ota_http_download_and_install_firmware(const char *firmware_url)
+esp_err_t ota_http_download_and_install_firmware(const char *firmware_url, ota_http_progress_cb_t progress,
+                                                 void *ctx)
 {
     if (!firmware_url)
     {
@@ -387,7 +1619,7 @@ esp_err_t ota_http_download_and_install_firmware(const char *firmware_url)
 
     esp_http_client_config_t http_config = {
         .url = firmware_url,
-        .timeout_ms = OTA_SERVER_TIMEOUT_MS,
+        .timeout_ms = ota_settings_get_u32(OTA_SETTING_SERVER_TIMEOUT_MS),
         .use_global_ca_store = false,
         .crt_bundle_attach = esp_crt_bundle_attach,
         .skip_cert_common_name_check = !OTA_SSL_VERIFICATION,
@@ -395,18 +1627,61 @@ esp_err_t ota_http_download_and_install_firmware(const char *firmware_url)
 
     esp_https_ota_config_t ota_config = {
         .http_config = &http_config,
+        .http_client_init_cb = ota_download_client_init_cb,
     };
 
-    esp_err_t ret = esp_https_ota(&ota_config);
+    request_timing_t timing;
+    start_request_timing(&timing, "http_download_firmware");
+
+    esp_https_ota_handle_t ota_handle = NULL;
+    esp_err_t ret = esp_https_ota_begin(&ota_config, &ota_handle);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "OTA begin failed: %s", esp_err_to_name(ret));
+        end_request_timing(&timing, 0);
+        return ret;
+    }
+
+    int image_size = esp_https_ota_get_image_size(ota_handle);
+    uint32_t total = image_size > 0 ? (uint32_t)image_size : 0;
+
+    // Each perform call downloads and writes one chunk
+    while ((ret = esp_https_ota_perform(ota_handle)) == ESP_ERR_HTTPS_OTA_IN_PROGRESS)
+    {
+        if (progress)
+        {
+            progress((uint32_t)esp_https_ota_get_image_len_read(ota_handle), total, ctx);
+        }
+    }
+
+    if (ret == ESP_OK && !esp_https_ota_is_complete_data_received(ota_handle))
+    {
+        ret = ESP_ERR_INVALID_SIZE;
+    }
+
     if (ret == ESP_OK)
     {
-        ESP_LOGI(TAG, "OTA update successful, restarting...");
-        esp_restart();
+        if (progress)
+        {
+            progress((uint32_t)esp_https_ota_get_image_len_read(ota_handle), total, ctx);
+        }
+
+        // Validates the image and selects it for the next boot
+        ret = esp_https_ota_finish(ota_handle);
     }
     else
     {
-        ESP_LOGE(TAG, "OTA update failed: %s", esp_err_to_name(ret));
+        esp_https_ota_abort(ota_handle);
+    }
+
+    if (ret == ESP_OK)
+    {
+        ESP_LOGI(TAG, "OTA update successful");
+        end_request_timing(&timing, 200);
+        return ESP_OK;
     }
 
+    ESP_LOGE(TAG, "OTA update failed: %s", esp_err_to_name(ret));
+    end_request_timing(&timing, 0);
     return ret;
-}
\ No newline at end of file
+}
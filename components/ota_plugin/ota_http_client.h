@@ -1,6 +1,9 @@
 #ifndef OTA_HTTP_CLIENT_H
 #define OTA_HTTP_CLIENT_H
 
+#include "ota_plugin.h"
+#include "ota_transport.h"
+#include "ota_metrics.h"
 #include "esp_err.h"
 #include <stdint.h>
 #include <stdbool.h>
@@ -12,10 +15,69 @@ extern "C" {
 
 /**
  * @brief Initialize HTTP client
+ *
+ * Selects the MQTT transport with OTA_MQTT_ENABLED, HTTP otherwise.
+ *
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t ota_http_client_init(void);
 
+/**
+ * @brief Start the transport, e.g. connect to the MQTT broker
+ *
+ * Requests go out in JSON until the backend answers in CBOR.
+ *
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_http_client_start(void);
+
+/**
+ * @brief Stop the transport
+ */
+void ota_http_client_stop(void);
+
+/**
+ * @brief Replace the transport requests go through
+ *
+ * Call while the client is stopped, e.g. to plug in a custom transport or a
+ * test double.
+ *
+ * @param transport Transport, NULL for the one chosen at init
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the client is started
+ */
+esp_err_t ota_http_client_set_transport(const ota_transport_t* transport);
+
+/**
+ * @brief What the backend pushed, over a transport that does not reply
+ */
+typedef enum {
+    OTA_HTTP_PUSH_UPDATE, // A firmware update was announced
+    OTA_HTTP_PUSH_RESYNC, // The next heartbeat should be a full snapshot
+} ota_http_push_t;
+
+/**
+ * @brief Called when the backend pushes something the plugin must act on
+ * @param push What was pushed
+ * @param ctx Context passed to ota_http_add_push_listener()
+ */
+typedef void (*ota_http_push_listener_t)(ota_http_push_t push, void* ctx);
+
+/**
+ * @brief Register a push listener
+ *
+ * Listeners cannot be removed; register each one once, not on every init.
+ *
+ * @param listener Called from the transport's task; must not block
+ * @param ctx Passed to the listener
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if OTA_PUSH_MAX_LISTENERS are registered
+ */
+esp_err_t ota_http_add_push_listener(ota_http_push_listener_t listener, void* ctx);
+
+/**
+ * @brief What came back from a request made with ota_http_post()
+ */
+typedef ota_transport_response_t ota_http_response_t;
+
 /**
  * @brief Send HTTP POST request with JSON data
  * @param endpoint API endpoint (relative to base URL)
@@ -27,8 +89,37 @@ esp_err_t ota_http_client_init(void);
 esp_err_t ota_http_post_json(const char* endpoint, const char* json_data, 
                            char* response_buffer, size_t response_buffer_size);
 
+/**
+ * @brief Send HTTP POST request with a JSON or CBOR body
+ *
+ * Goes through the current transport; over MQTT the body is published and
+ * response is always empty.
+ *
+ * With OTA_CBOR_ENABLED the request offers CBOR in its Accept header. A
+ * successful CBOR response makes the plugin's own requests switch to CBOR.
+ * A CBOR body the transport refuses (ESP_ERR_NOT_SUPPORTED, an HTTP 415) is
+ * resent once as JSON, and the plugin keeps sending JSON from then on.
+ *
+ * @param endpoint API endpoint (relative to base URL)
+ * @param body Request body
+ * @param body_len Bytes of body
+ * @param cbor True if body is CBOR
+ * @param response_buffer Buffer to store response (can be NULL)
+ * @param response_buffer_size Size of response buffer
+ * @param response Output: length and encoding of a successful response (can be NULL)
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_http_post(const char* endpoint, const char* body, size_t body_len, bool cbor,
+                        char* response_buffer, size_t response_buffer_size, ota_http_response_t* response);
+
 /**
  * @brief Check for firmware updates
+ *
+ * Over a transport that does not reply, the request is still sent so the
+ * backend learns the version, and the result is the latest announcement the
+ * backend pushed; with none yet, or one for current_version, no update is
+ * available.
+ *
  * @param device_id Device identifier
  * @param current_version Current firmware version
  * @param update_available Output: true if update is available
@@ -52,16 +143,50 @@ esp_err_t ota_http_check_firmware_update(const char* device_id, const char* curr
 esp_err_t ota_http_report_firmware_status(const char* device_id, const char* version, const char* status);
 
 /**
- * @brief Send heartbeat with metrics
+ * @brief The metrics array of a heartbeat being encoded
+ */
+typedef struct ota_http_metrics_writer ota_http_metrics_writer_t;
+
+/**
+ * @brief Writes a heartbeat's metrics with ota_http_metrics_put()
+ * @param metrics Metrics array of the request
+ * @param ctx Context passed to ota_http_send_heartbeat()
+ */
+typedef void (*ota_http_metrics_source_t)(ota_http_metrics_writer_t* metrics, void* ctx);
+
+/**
+ * @brief Write one metric straight into the heartbeat request
+ *
+ * In dynamic memory mode the request buffer grows as needed. Once a metric
+ * does not fit, it and every later one are left out of the request.
+ *
+ * @param metrics Metrics array passed to the source
+ * @param name Metric name
+ * @param value Current value
+ * @param unit Unit
+ * @param window Samples since the last delivered heartbeat (NULL or empty for none)
+ * @return true if the metric is in the request, false if it was left out
+ */
+bool ota_http_metrics_put(ota_http_metrics_writer_t* metrics, const char* name, double value, const char* unit,
+                          const ota_metric_window_t* window);
+
+/**
+ * @brief Send full or delta heartbeat with metrics
  * @param device_id Device identifier
+ * @param session_id Heartbeat session identifier, new on every heartbeat start
+ * @param seq Sequence number within the session, lets the server detect gaps
+ * @param full True for a full snapshot, false for a delta
  * @param uptime_sec Device uptime in seconds
- * @param ip Device IP address
- * @param firmware_ref Current firmware reference
- * @param metrics_json JSON array of metrics (can be NULL)
+ * @param ip Device IP address (NULL in a delta if unchanged)
+ * @param firmware_ref Current firmware reference (NULL in a delta if unchanged)
+ * @param metrics Called once while the request is encoded to write the metrics (can be NULL)
+ * @param metrics_ctx Passed to metrics
+ * @param resync Output: true if the server requested a full snapshot (can be NULL)
  * @return ESP_OK on success, error code otherwise
  */
-esp_err_t ota_http_send_heartbeat(const char* device_id, uint32_t uptime_sec, const char* ip, 
-                                 const char* firmware_ref, const char* metrics_json);
+esp_err_t ota_http_send_heartbeat(const char* device_id, const char* session_id, uint32_t seq, bool full,
+                                 uint32_t uptime_sec, const char* ip, const char* firmware_ref,
+                                 ota_http_metrics_source_t metrics, void* metrics_ctx, bool* resync);
 
 /**
  * @brief Send log message
@@ -85,19 +210,37 @@ esp_err_t ota_http_send_log(const char* device_id, const char* level, const char
  * @param duration_ms Operation duration in milliseconds
  * @param started_at Start timestamp
  * @param ended_at End timestamp
- * @param attributes Optional JSON attributes
+ * @param attributes Typed attributes (can be NULL)
+ * @param attribute_count Number of typed attributes
+ * @param raw_attributes Optional legacy JSON attributes
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t ota_http_send_trace(const char* device_id, const char* trace_id, const char* span_id, 
                              const char* parent_span_id, const char* operation, uint32_t duration_ms, 
-                             int64_t started_at, int64_t ended_at, const char* attributes);
+                             int64_t started_at, int64_t ended_at,
+                             const ota_trace_attr_t* attributes, size_t attribute_count,
+                             const char* raw_attributes);
+
+/**
+ * @brief Receives firmware download progress
+ * @param received Bytes received so far
+ * @param total Image size in bytes, 0 if unknown
+ * @param ctx Context given to ota_http_download_and_install_firmware()
+ */
+typedef void (*ota_http_progress_cb_t)(uint32_t received, uint32_t total, void* ctx);
 
 /**
  * @brief Download and install firmware
+ *
+ * Does not restart the device; the new image runs after the next restart.
+ *
  * @param firmware_url URL of firmware to download
+ * @param progress Called after each downloaded chunk (can be NULL)
+ * @param ctx Passed to progress
  * @return ESP_OK on success, error code otherwise
  */
-esp_err_t ota_http_download_and_install_firmware(const char* firmware_url);
+esp_err_t ota_http_download_and_install_firmware(const char* firmware_url, ota_http_progress_cb_t progress,
+                                                 void* ctx);
 
 #ifdef __cplusplus
 }
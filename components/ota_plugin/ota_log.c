@@ -1,6 +1,7 @@
 #include "ota_log.h"
 #include "ota_config.h"
 #include "ota_http_client.h"
+#include "ota_settings.h"
 #include "esp_log.h"
 #include <string.h>
 
@@ -30,8 +31,9 @@ esp_err_t ota_log_init(void) {
 
 // Send log message with specified level
 esp_err_t ota_log_send(ota_log_level_t level, const char* message, const char* stack_trace, const char* context) {
-    if (!OTA_LOGGING_ENABLED) {
-        return ESP_OK; // Logging disabled, but not an error
+    if (!ota_settings_get_bool(OTA_SETTING_LOGGING_ENABLED) ||
+        level < (ota_log_level_t)ota_settings_get_u32(OTA_SETTING_LOG_LEVEL)) {
+        return ESP_OK; // Logging disabled or filtered, but not an error
     }
     
     if (!message) {
@@ -39,8 +41,10 @@ esp_err_t ota_log_send(ota_log_level_t level, const char* message, const char* s
     }
     
     const char* level_str = log_level_to_string(level);
+    char device_id[OTA_SETTINGS_TEXT_SIZE];
+    ota_settings_get_str(OTA_SETTING_DEVICE_ID, device_id, sizeof(device_id));
     
-    esp_err_t err = ota_http_send_log(DEVICE_ID, level_str, message, stack_trace, context);
+    esp_err_t err = ota_http_send_log(device_id, level_str, message, stack_trace, context);
     
     if (err == ESP_OK) {
         ESP_LOGD(TAG, "Log sent: [%s] %s", level_str, message);
@@ -0,0 +1,383 @@
+#include "ota_metrics.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <string.h>
+#include <math.h>
+
+static const char *TAG = "ota_metrics";
+
+// Open-addressing index over the entries, at most half full
+#define INDEX_SIZE (2 * OTA_METRICS_CAPACITY)
+#define INDEX_EMPTY 0
+
+typedef struct
+{
+    char name[OTA_METRICS_NAME_SIZE];
+    char unit[OTA_METRICS_UNIT_SIZE];
+    ota_metric_type_t type;
+    int8_t histogram; // Slot in the histogram pool, histograms only
+    atomic_uint_least32_t value; // Counter value, or last gauge value as float bits
+    // Gauge window; float fields hold float bits
+    atomic_uint_least32_t count;
+    atomic_uint_least32_t sum;
+    atomic_uint_least32_t min;
+    atomic_uint_least32_t max;
+} metric_entry_t;
+
+static metric_entry_t entries[OTA_METRICS_CAPACITY];
+static atomic_int entry_count = 0;
+
+// Entry index + 1, published with release ordering after the entry is
+// complete, so lookups need no lock. Entries are never removed.
+static atomic_int_least16_t name_index[INDEX_SIZE];
+
+static ota_histogram_t histograms[OTA_METRICS_MAX_HISTOGRAMS];
+static int histogram_count = 0;
+
+static portMUX_TYPE register_lock = portMUX_INITIALIZER_UNLOCKED;
+
+_Static_assert((INDEX_SIZE & (INDEX_SIZE - 1)) == 0, "OTA_METRICS_CAPACITY must be a power of two");
+
+static uint32_t hash_name(const char *name)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; name[i] != '\0' && i < OTA_METRICS_NAME_SIZE - 1; i++)
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline bool name_matches(const metric_entry_t *entry, const char *name)
+{
+    return strncmp(entry->name, name, OTA_METRICS_NAME_SIZE - 1) == 0;
+}
+
+static inline uint32_t float_bits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline float bits_float(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void reset_window(metric_entry_t *entry)
+{
+    atomic_store_explicit(&entry->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&entry->sum, float_bits(0.0f), memory_order_relaxed);
+    atomic_store_explicit(&entry->min, float_bits(INFINITY), memory_order_relaxed);
+    atomic_store_explicit(&entry->max, float_bits(-INFINITY), memory_order_relaxed);
+}
+
+static void float_add(atomic_uint_least32_t *target, float value)
+{
+    uint32_t bits = atomic_load_explicit(target, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(target, &bits, float_bits(bits_float(bits) + value),
+                                                  memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+static void float_min(atomic_uint_least32_t *target, float value)
+{
+    uint32_t bits = atomic_load_explicit(target, memory_order_relaxed);
+    while (value < bits_float(bits) &&
+           !atomic_compare_exchange_weak_explicit(target, &bits, float_bits(value),
+                                                  memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+static void float_max(atomic_uint_least32_t *target, float value)
+{
+    uint32_t bits = atomic_load_explicit(target, memory_order_relaxed);
+    while (value > bits_float(bits) &&
+           !atomic_compare_exchange_weak_explicit(target, &bits, float_bits(value),
+                                                  memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+static inline metric_entry_t *entry_for(ota_metric_handle_t handle, ota_metric_type_t type)
+{
+    if (handle < 0 || handle >= atomic_load_explicit(&entry_count, memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    metric_entry_t *entry = &entries[handle];
+    return entry->type == type ? entry : NULL;
+}
+
+esp_err_t ota_metrics_init(void)
+{
+    ESP_LOGI(TAG, "Metrics registry initialized (capacity %d)", OTA_METRICS_CAPACITY);
+    return ESP_OK;
+}
+
+ota_metric_handle_t ota_metrics_find(const char *name)
+{
+    if (!name)
+    {
+        return OTA_METRIC_INVALID_HANDLE;
+    }
+
+    uint32_t slot = hash_name(name) & (INDEX_SIZE - 1);
+    for (int probe = 0; probe < INDEX_SIZE; probe++)
+    {
+        int index = atomic_load_explicit(&name_index[slot], memory_order_acquire);
+        if (index == INDEX_EMPTY)
+        {
+            break;
+        }
+        if (name_matches(&entries[index - 1], name))
+        {
+            return (ota_metric_handle_t)(index - 1);
+        }
+        slot = (slot + 1) & (INDEX_SIZE - 1);
+    }
+
+    return OTA_METRIC_INVALID_HANDLE;
+}
+
+ota_metric_handle_t ota_metrics_register(const char *name, ota_metric_type_t type, const char *unit)
+{
+    if (!name || !unit)
+    {
+        return OTA_METRIC_INVALID_HANDLE;
+    }
+
+    ota_metric_handle_t handle = ota_metrics_find(name);
+    if (handle != OTA_METRIC_INVALID_HANDLE)
+    {
+        return entries[handle].type == type ? handle : OTA_METRIC_INVALID_HANDLE;
+    }
+
+    taskENTER_CRITICAL(&register_lock);
+
+    // Another task may have registered the name since the lookup above
+    handle = ota_metrics_find(name);
+    int count = atomic_load_explicit(&entry_count, memory_order_relaxed);
+    bool has_room = count < OTA_METRICS_CAPACITY &&
+                    (type != OTA_METRIC_HISTOGRAM || histogram_count < OTA_METRICS_MAX_HISTOGRAMS);
+
+    if (handle == OTA_METRIC_INVALID_HANDLE && has_room)
+    {
+        metric_entry_t *entry = &entries[count];
+        strncpy(entry->name, name, sizeof(entry->name) - 1);
+        entry->name[sizeof(entry->name) - 1] = '\0';
+        strncpy(entry->unit, unit, sizeof(entry->unit) - 1);
+        entry->unit[sizeof(entry->unit) - 1] = '\0';
+        entry->type = type;
+        entry->histogram = -1;
+        atomic_store_explicit(&entry->value, type == OTA_METRIC_GAUGE ? float_bits(0.0f) : 0, memory_order_relaxed);
+        reset_window(entry);
+
+        if (type == OTA_METRIC_HISTOGRAM)
+        {
+            entry->histogram = histogram_count++;
+            ota_histogram_reset(&histograms[entry->histogram]);
+        }
+
+        atomic_store_explicit(&entry_count, count + 1, memory_order_release);
+
+        uint32_t slot = hash_name(entry->name) & (INDEX_SIZE - 1);
+        while (atomic_load_explicit(&name_index[slot], memory_order_relaxed) != INDEX_EMPTY)
+        {
+            slot = (slot + 1) & (INDEX_SIZE - 1);
+        }
+        atomic_store_explicit(&name_index[slot], count + 1, memory_order_release);
+
+        handle = count;
+    }
+    else if (handle != OTA_METRIC_INVALID_HANDLE && entries[handle].type != type)
+    {
+        handle = OTA_METRIC_INVALID_HANDLE;
+    }
+
+    taskEXIT_CRITICAL(&register_lock);
+
+    if (handle == OTA_METRIC_INVALID_HANDLE && !has_room)
+    {
+        ESP_LOGW(TAG, "Metrics registry full, %s not registered", name);
+    }
+    return handle;
+}
+
+void ota_metrics_counter_add(ota_metric_handle_t handle, uint32_t delta)
+{
+    metric_entry_t *entry = entry_for(handle, OTA_METRIC_COUNTER);
+    if (entry)
+    {
+        atomic_fetch_add_explicit(&entry->value, delta, memory_order_relaxed);
+    }
+}
+
+void ota_metrics_gauge_set(ota_metric_handle_t handle, float value)
+{
+    metric_entry_t *entry = entry_for(handle, OTA_METRIC_GAUGE);
+    if (entry)
+    {
+        atomic_store_explicit(&entry->value, float_bits(value), memory_order_relaxed);
+        float_add(&entry->sum, value);
+        float_min(&entry->min, value);
+        float_max(&entry->max, value);
+        // Counted last so a reader never sees samples missing from the sum
+        atomic_fetch_add_explicit(&entry->count, 1, memory_order_release);
+    }
+}
+
+void ota_metrics_histogram_record(ota_metric_handle_t handle, uint32_t value)
+{
+    metric_entry_t *entry = entry_for(handle, OTA_METRIC_HISTOGRAM);
+    if (entry)
+    {
+        ota_histogram_record(&histograms[entry->histogram], value);
+    }
+}
+
+// Each field is swapped out on its own, so a sample racing with the reset may
+// be split across two windows; no sample is lost or counted twice.
+static void read_window(metric_entry_t *entry, ota_metric_window_t *window, bool reset)
+{
+    window->last = bits_float(atomic_load_explicit(&entry->value, memory_order_relaxed));
+
+    if (reset)
+    {
+        window->count = atomic_exchange_explicit(&entry->count, 0, memory_order_acquire);
+        window->sum = bits_float(atomic_exchange_explicit(&entry->sum, float_bits(0.0f), memory_order_relaxed));
+        window->min = bits_float(atomic_exchange_explicit(&entry->min, float_bits(INFINITY), memory_order_relaxed));
+        window->max = bits_float(atomic_exchange_explicit(&entry->max, float_bits(-INFINITY), memory_order_relaxed));
+    }
+    else
+    {
+        window->count = atomic_load_explicit(&entry->count, memory_order_acquire);
+        window->sum = bits_float(atomic_load_explicit(&entry->sum, memory_order_relaxed));
+        window->min = bits_float(atomic_load_explicit(&entry->min, memory_order_relaxed));
+        window->max = bits_float(atomic_load_explicit(&entry->max, memory_order_relaxed));
+    }
+
+    if (window->count == 0)
+    {
+        window->sum = window->min = window->max = 0.0f;
+    }
+}
+
+size_t ota_metrics_count(void)
+{
+    return atomic_load_explicit(&entry_count, memory_order_acquire);
+}
+
+esp_err_t ota_metrics_snapshot(ota_metric_handle_t handle, ota_metric_snapshot_t *snapshot, bool reset)
+{
+    if (!snapshot || handle < 0 || handle >= (ota_metric_handle_t)ota_metrics_count())
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    metric_entry_t *entry = &entries[handle];
+    snapshot->name = entry->name;
+    snapshot->unit = entry->unit;
+    snapshot->type = entry->type;
+
+    switch (entry->type)
+    {
+    case OTA_METRIC_COUNTER:
+        snapshot->value.counter = atomic_load_explicit(&entry->value, memory_order_relaxed);
+        break;
+    case OTA_METRIC_GAUGE:
+        read_window(entry, &snapshot->value.gauge, reset);
+        break;
+    case OTA_METRIC_HISTOGRAM:
+        ota_histogram_summarize(&histograms[entry->histogram], &snapshot->value.histogram, reset);
+        break;
+    }
+
+    return ESP_OK;
+}
+
+// Put back what was set since the window was read: count and sum are exact,
+// and the last value set is one of those samples
+static void discard_window(metric_entry_t *entry, const ota_metric_window_t *window)
+{
+    if (window->count == 0)
+    {
+        return;
+    }
+
+    ota_metric_window_t now;
+    read_window(entry, &now, true);
+    if (now.count <= window->count)
+    {
+        return;
+    }
+
+    uint32_t late = now.count - window->count;
+    float late_sum = now.sum - window->sum;
+    float mean = late_sum / late;
+    float low = now.min < window->min ? now.min : fminf(now.last, mean);
+    float high = now.max > window->max ? now.max : fmaxf(now.last, mean);
+
+    atomic_fetch_add_explicit(&entry->count, late, memory_order_relaxed);
+    float_add(&entry->sum, late_sum);
+    float_min(&entry->min, low);
+    float_max(&entry->max, high);
+}
+
+esp_err_t ota_metrics_discard_window(ota_metric_handle_t handle, const ota_metric_snapshot_t *window)
+{
+    if (!window || handle < 0 || handle >= (ota_metric_handle_t)ota_metrics_count())
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    metric_entry_t *entry = &entries[handle];
+    if (entry->type != window->type)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    switch (entry->type)
+    {
+    case OTA_METRIC_COUNTER:
+        break; // Counters have no window
+    case OTA_METRIC_GAUGE:
+        discard_window(entry, &window->value.gauge);
+        break;
+    case OTA_METRIC_HISTOGRAM:
+        ota_histogram_discard(&histograms[entry->histogram], &window->value.histogram);
+        break;
+    }
+
+    return ESP_OK;
+}
+
+void ota_metrics_reset(void)
+{
+    int count = ota_metrics_count();
+
+    for (int i = 0; i < count; i++)
+    {
+        metric_entry_t *entry = &entries[i];
+        if (entry->type == OTA_METRIC_HISTOGRAM)
+        {
+            ota_histogram_reset(&histograms[entry->histogram]);
+        }
+        else
+        {
+            atomic_store_explicit(&entry->value, entry->type == OTA_METRIC_GAUGE ? float_bits(0.0f) : 0,
+                                  memory_order_relaxed);
+            reset_window(entry);
+        }
+    }
+}
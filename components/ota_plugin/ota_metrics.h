@@ -0,0 +1,142 @@
+#ifndef OTA_METRICS_H
+#define OTA_METRICS_H
+
+#include "ota_config.h"
+#include "ota_histogram.h"
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Metric types
+ */
+typedef enum
+{
+    OTA_METRIC_COUNTER,   // Monotonic count, only ever incremented
+    OTA_METRIC_GAUGE,     // Sampled value, aggregated per window
+    OTA_METRIC_HISTOGRAM  // Distribution of recorded values
+} ota_metric_type_t;
+
+/**
+ * @brief Handle of a registered metric; valid for the lifetime of the program
+ */
+typedef int16_t ota_metric_handle_t;
+
+#define OTA_METRIC_INVALID_HANDLE ((ota_metric_handle_t)-1)
+
+/**
+ * @brief Gauge samples aggregated over a window
+ */
+typedef struct
+{
+    float last;     // Last value set, carried over between windows
+    uint32_t count; // Samples in the window
+    float sum;
+    float min;
+    float max;
+} ota_metric_window_t;
+
+/**
+ * @brief Point-in-time copy of a metric
+ */
+typedef struct
+{
+    const char* name;
+    const char* unit;
+    ota_metric_type_t type;
+    union {
+        uint32_t counter;
+        ota_metric_window_t gauge;
+        ota_histogram_summary_t histogram;
+    } value;
+} ota_metric_snapshot_t;
+
+/**
+ * @brief Initialize the metrics registry
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_metrics_init(void);
+
+/**
+ * @brief Register a metric, or look up an existing metric with the same name
+ *
+ * The name and unit are copied (interned) once here; updates through the
+ * returned handle never touch strings. Metrics cannot be unregistered.
+ *
+ * @param name Metric name (truncated to OTA_METRICS_NAME_SIZE - 1)
+ * @param type Metric type
+ * @param unit Metric unit
+ * @return Handle, or OTA_METRIC_INVALID_HANDLE if the registry is full or the
+ *         name is registered with a different type
+ */
+ota_metric_handle_t ota_metrics_register(const char* name, ota_metric_type_t type, const char* unit);
+
+/**
+ * @brief Look up a registered metric by name
+ * @param name Metric name
+ * @return Handle, or OTA_METRIC_INVALID_HANDLE if not registered
+ */
+ota_metric_handle_t ota_metrics_find(const char* name);
+
+/**
+ * @brief Add to a counter (lock-free)
+ * @param handle Counter handle
+ * @param delta Amount to add
+ */
+void ota_metrics_counter_add(ota_metric_handle_t handle, uint32_t delta);
+
+/**
+ * @brief Set a gauge and add the value to its window (lock-free)
+ * @param handle Gauge handle
+ * @param value New value
+ */
+void ota_metrics_gauge_set(ota_metric_handle_t handle, float value);
+
+/**
+ * @brief Record a value into a histogram (lock-free)
+ * @param handle Histogram handle
+ * @param value Value to record
+ */
+void ota_metrics_histogram_record(ota_metric_handle_t handle, uint32_t value);
+
+/**
+ * @brief Number of registered metrics; handles are 0 .. count - 1
+ * @return Number of registered metrics
+ */
+size_t ota_metrics_count(void);
+
+/**
+ * @brief Read a metric
+ * @param handle Metric handle
+ * @param snapshot Output: metric values
+ * @param reset_window Start a new window after reading (gauges and histograms)
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_metrics_snapshot(ota_metric_handle_t handle, ota_metric_snapshot_t* snapshot, bool reset_window);
+
+/**
+ * @brief Drop a window read without reset, e.g. once it has been delivered
+ *
+ * Samples added after the read stay in the window with their count and sum.
+ *
+ * @param handle Metric handle
+ * @param window Snapshot taken with reset_window false
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_metrics_discard_window(ota_metric_handle_t handle, const ota_metric_snapshot_t* window);
+
+/**
+ * @brief Reset the values of all metrics, keeping them registered
+ */
+void ota_metrics_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_METRICS_H
@@ -0,0 +1,316 @@
+#include "ota_mqtt.h"
+#include "ota_config.h"
+#include "ota_arena.h"
+#include "ota_metrics.h"
+#include "ota_settings.h"
+#include "esp_log.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "ota_mqtt";
+
+#define TOPIC_SIZE (OTA_SETTINGS_TEXT_SIZE + 64)
+#define ENDPOINT_SIZE 48
+
+// Retained presence flag, cleared by the broker through the last will if the
+// device drops off without disconnecting
+#define ONLINE_ENDPOINT "/online"
+
+static esp_mqtt_client_handle_t client = NULL;
+static ota_transport_receive_cb_t receive_callback = NULL;
+static atomic_bool connected = false;
+
+// <prefix>/<device ID>, fixed while the session runs so the subscription and
+// the broker's session state stay with one client ID
+static char topic_root[TOPIC_SIZE];
+
+// Message being reassembled. The client hands over payloads larger than its
+// own buffer in several MQTT_EVENT_DATA events, all from its task.
+static char *incoming = NULL;
+static size_t incoming_len = 0;
+static char incoming_endpoint[ENDPOINT_SIZE];
+
+static ota_metric_handle_t published_metric = OTA_METRIC_INVALID_HANDLE;
+static ota_metric_handle_t dropped_metric = OTA_METRIC_INVALID_HANDLE;
+static ota_metric_handle_t received_metric = OTA_METRIC_INVALID_HANDLE;
+
+static void format_topic(char *topic, size_t size, const char *direction, const char *endpoint)
+{
+    snprintf(topic, size, "%s/%s%s", topic_root, direction, endpoint);
+}
+
+// Logs and spans are plentiful and worth little once stale; everything else
+// is delivered at least once
+static int qos_for(const char *endpoint)
+{
+    if (strcmp(endpoint, "/log") == 0 || strcmp(endpoint, "/trace") == 0)
+    {
+        return OTA_MQTT_TELEMETRY_QOS;
+    }
+    if (strcmp(endpoint, "/heartbeat") == 0)
+    {
+        return OTA_MQTT_HEARTBEAT_QOS;
+    }
+    return 1;
+}
+
+static void discard_incoming(void)
+{
+    ota_arena_buffer_release(incoming);
+    incoming = NULL;
+    incoming_len = 0;
+}
+
+// First fragment: keep the message if it is for this device and fits in a
+// scratch buffer, with room for the NUL the receiver relies on
+static void begin_incoming(const esp_mqtt_event_t *event)
+{
+    discard_incoming();
+
+    char prefix[TOPIC_SIZE];
+    format_topic(prefix, sizeof(prefix), "down", "");
+    size_t prefix_len = strlen(prefix);
+    size_t topic_len = event->topic_len > 0 ? (size_t)event->topic_len : 0;
+
+    if (topic_len <= prefix_len || topic_len - prefix_len >= ENDPOINT_SIZE ||
+        strncmp(event->topic, prefix, prefix_len) != 0 || event->topic[prefix_len] != '/')
+    {
+        return;
+    }
+
+    if (event->total_data_len <= 0 || event->total_data_len >= OTA_ARENA_BUFFER_SIZE)
+    {
+        ESP_LOGW(TAG, "Dropping %d byte message on %.*s", event->total_data_len, event->topic_len, event->topic);
+        ota_metrics_counter_add(dropped_metric, 1);
+        return;
+    }
+
+    incoming = ota_arena_buffer_acquire();
+    if (incoming == NULL)
+    {
+        ESP_LOGW(TAG, "No buffer for message on %.*s", event->topic_len, event->topic);
+        ota_metrics_counter_add(dropped_metric, 1);
+        return;
+    }
+
+    memcpy(incoming_endpoint, &event->topic[prefix_len], topic_len - prefix_len);
+    incoming_endpoint[topic_len - prefix_len] = '\0';
+}
+
+static void on_data(const esp_mqtt_event_t *event)
+{
+    if (event->current_data_offset == 0)
+    {
+        begin_incoming(event);
+    }
+
+    if (incoming == NULL || event->current_data_offset != (int)incoming_len ||
+        incoming_len + event->data_len >= OTA_ARENA_BUFFER_SIZE)
+    {
+        return;
+    }
+
+    memcpy(&incoming[incoming_len], event->data, event->data_len);
+    incoming_len += event->data_len;
+
+    if ((int)incoming_len < event->total_data_len)
+    {
+        return;
+    }
+    incoming[incoming_len] = '\0';
+    ota_metrics_counter_add(received_metric, 1);
+
+    // MQTT 3.1.1 has no content type; a CBOR map starts with major type 5,
+    // which no JSON document does
+    uint8_t first = (uint8_t)incoming[0];
+    bool cbor = first >= 0xA0 && first <= 0xBF;
+
+    if (receive_callback)
+    {
+        receive_callback(incoming_endpoint, incoming, incoming_len, cbor);
+    }
+    discard_incoming();
+}
+
+static void on_connected(void)
+{
+    char topic[TOPIC_SIZE];
+
+    // The broker keeps the subscription across reconnects; renewing it covers
+    // a broker that lost the session
+    format_topic(topic, sizeof(topic), "down", "/#");
+    if (esp_mqtt_client_subscribe(client, topic, 1) < 0)
+    {
+        ESP_LOGW(TAG, "Failed to subscribe to %s", topic);
+    }
+
+    format_topic(topic, sizeof(topic), "up", ONLINE_ENDPOINT);
+    esp_mqtt_client_publish(client, topic, "1", 1, 1, 1);
+
+    atomic_store(&connected, true);
+    ESP_LOGI(TAG, "Connected to %s", OTA_MQTT_BROKER_URI);
+}
+
+void ota_mqtt_handle_event(const esp_mqtt_event_t *event)
+{
+    if (client == NULL)
+    {
+        return;
+    }
+
+    switch (event->event_id)
+    {
+    case MQTT_EVENT_CONNECTED:
+        on_connected();
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        // The client reconnects by itself
+        atomic_store(&connected, false);
+        ESP_LOGW(TAG, "Disconnected from broker");
+        break;
+    case MQTT_EVENT_DATA:
+        on_data(event);
+        break;
+    default:
+        break;
+    }
+}
+
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    ota_mqtt_handle_event((const esp_mqtt_event_t *)event_data);
+}
+
+static esp_err_t mqtt_start(ota_transport_receive_cb_t receive)
+{
+    if (client != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    char device_id[OTA_SETTINGS_TEXT_SIZE];
+    ota_settings_get_str(OTA_SETTING_DEVICE_ID, device_id, sizeof(device_id));
+    snprintf(topic_root, sizeof(topic_root), "%s/%s", OTA_MQTT_TOPIC_PREFIX, device_id);
+    receive_callback = receive;
+
+    if (published_metric == OTA_METRIC_INVALID_HANDLE)
+    {
+        published_metric = ota_metrics_register("mqtt.published", OTA_METRIC_COUNTER, "messages");
+        dropped_metric = ota_metrics_register("mqtt.dropped", OTA_METRIC_COUNTER, "messages");
+        received_metric = ota_metrics_register("mqtt.received", OTA_METRIC_COUNTER, "messages");
+    }
+
+    char will_topic[TOPIC_SIZE];
+    format_topic(will_topic, sizeof(will_topic), "up", ONLINE_ENDPOINT);
+
+    // A persistent session: the broker holds the subscription and queues
+    // QoS 1 announcements while the device is away
+    esp_mqtt_client_config_t config = {
+        .broker.address.uri = OTA_MQTT_BROKER_URI,
+        .credentials.client_id = device_id,
+        .session = {
+            .disable_clean_session = true,
+            .keepalive = OTA_MQTT_KEEPALIVE_SEC,
+            .last_will = {.topic = will_topic, .msg = "0", .qos = 1, .retain = 1},
+        },
+    };
+
+    client = esp_mqtt_client_init(&config);
+    if (client == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to initialize MQTT client");
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, mqtt_event_handler, NULL);
+    if (err == ESP_OK)
+    {
+        err = esp_mqtt_client_start(client);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start MQTT client: %s", esp_err_to_name(err));
+        esp_mqtt_client_destroy(client);
+        client = NULL;
+        return err;
+    }
+
+    ESP_LOGI(TAG, "MQTT transport started, topics under %s", topic_root);
+    return ESP_OK;
+}
+
+static void mqtt_stop(void)
+{
+    if (client == NULL)
+    {
+        return;
+    }
+
+    // A clean disconnect does not trigger the last will
+    if (atomic_load(&connected))
+    {
+        char topic[TOPIC_SIZE];
+        format_topic(topic, sizeof(topic), "up", ONLINE_ENDPOINT);
+        esp_mqtt_client_publish(client, topic, "0", 1, 1, 1);
+    }
+
+    esp_mqtt_client_destroy(client);
+    client = NULL;
+    atomic_store(&connected, false);
+    discard_incoming();
+    ESP_LOGI(TAG, "MQTT transport stopped");
+}
+
+// Publish and return; answers come back on the down topics
+static esp_err_t mqtt_send(const char *endpoint, const char *body, size_t body_len, bool cbor,
+                           char *response_buffer, size_t response_buffer_size, ota_transport_response_t *response)
+{
+    if (response_buffer != NULL && response_buffer_size > 0)
+    {
+        response_buffer[0] = '\0';
+    }
+    if (response)
+    {
+        response->len = 0;
+        response->cbor = false;
+    }
+
+    if (client == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int qos = qos_for(endpoint);
+    bool online = atomic_load(&connected);
+    if (!online && qos == 0)
+    {
+        ota_metrics_counter_add(dropped_metric, 1);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    char topic[TOPIC_SIZE];
+    format_topic(topic, sizeof(topic), "up", endpoint);
+
+    // While disconnected, QoS 1 messages wait in the client's outbox
+    int msg_id = online ? esp_mqtt_client_publish(client, topic, body, body_len, qos, 0)
+                        : esp_mqtt_client_enqueue(client, topic, body, body_len, qos, 0, true);
+    if (msg_id < 0)
+    {
+        ESP_LOGW(TAG, "Failed to publish to %s", topic);
+        ota_metrics_counter_add(dropped_metric, 1);
+        return ESP_FAIL;
+    }
+
+    ota_metrics_counter_add(published_metric, 1);
+    return ESP_OK;
+}
+
+const ota_transport_t ota_transport_mqtt = {
+    .name = "mqtt",
+    .replies = false,
+    .start = mqtt_start,
+    .stop = mqtt_stop,
+    .send = mqtt_send,
+};
@@ -0,0 +1,31 @@
+#ifndef OTA_MQTT_H
+#define OTA_MQTT_H
+
+#include "ota_transport.h"
+#include "mqtt_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * MQTT transport (ota_transport_mqtt). Includes the esp-mqtt headers, so
+ * only components that require mqtt can use it.
+ */
+
+/**
+ * @brief Handle one event of the transport's MQTT client
+ *
+ * Registered with the client when the transport starts. Exposed so tests
+ * can replay connection and data events without a broker. Ignored while
+ * the transport is stopped.
+ *
+ * @param event Client event
+ */
+void ota_mqtt_handle_event(const esp_mqtt_event_t* event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_MQTT_H
@@ -4,254 +4,389 @@
 #include "ota_status.h"
 #include "ota_log.h"
 #include "ota_trace.h"
+#include "ota_schedule.h"
+#include "ota_exporter.h"
+#include "ota_executor.h"
+#include "ota_event.h"
+#include "ota_state.h"
+#include "ota_arena.h"
+#include "ota_settings.h"
 #include "esp_log.h"
+#include "esp_system.h"
 #include "esp_timer.h"
 #include "esp_ota_ops.h"
 #include "esp_mac.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
 #include "nvs_flash.h"
-#include "nvs.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include <string.h>
 
 static const char *TAG = "ota_plugin";
 
 static bool plugin_initialized = false;
 static bool plugin_running = false;
-static ota_status_t current_status = OTA_STATUS_IDLE;
-static TaskHandle_t ota_task_handle = NULL;
+static ota_executor_job_t update_check_job_handle = OTA_EXECUTOR_INVALID_JOB;
+static esp_event_handler_instance_t got_ip_handler = NULL;
+static esp_event_handler_instance_t lost_ip_handler = NULL;
+static esp_event_handler_instance_t disconnected_handler = NULL;
+static bool boot_status_pending = true; // Owned by update_check_job
+
+// Requested checks. Requests are merged: they join the check in flight when
+// it does at least what they ask for, otherwise the next queued check.
+typedef struct
+{
+    ota_check_cb_t callback;
+    void *ctx;
+} check_waiter_t;
+
+static check_waiter_t pending_waiters[OTA_CHECK_MAX_WAITERS];
+static int pending_count = 0;
+static ota_check_mode_t pending_mode = OTA_CHECK_ONLY;
+static bool check_queued = false;
+static check_waiter_t active_waiters[OTA_CHECK_MAX_WAITERS];
+static int active_count = 0;
+static ota_check_mode_t active_mode = OTA_CHECK_ONLY;
+static bool check_in_flight = false;
+static ota_executor_job_t requested_check_handle = OTA_EXECUTOR_INVALID_JOB; // Queued, not started
+static uint32_t requested_check_runs = 0;
+static portMUX_TYPE check_lock = portMUX_INITIALIZER_UNLOCKED;
 static int64_t plugin_start_time = 0;
 
-// NVS keys
-#define NVS_NAMESPACE "ota_plugin"
-#define NVS_KEY_UPDATE_STATUS "update_status"
-#define NVS_KEY_LAST_VERSION "last_version"
-#define NVS_KEY_CURRENT_VERSION "current_version"
-
 static char current_firmware_version[32] = OTA_FIRMWARE_VERSION;
 
 static esp_err_t load_current_firmware_version(void)
 {
-    nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
-    if (err != ESP_OK)
-    {
-        ESP_LOGI(TAG, "Could not open NVS, using default firmware version: %s", OTA_FIRMWARE_VERSION);
-        strcpy(current_firmware_version, OTA_FIRMWARE_VERSION);
-        return ESP_OK;
-    }
+    // Falls back to OTA_FIRMWARE_VERSION if NVS cannot be read
+    esp_err_t err = ota_state_load();
 
-    size_t required_size = sizeof(current_firmware_version);
-    err = nvs_get_str(nvs_handle, NVS_KEY_CURRENT_VERSION, current_firmware_version, &required_size);
-    if (err != ESP_OK)
-    {
-        // First boot - initialize NVS with default version
-        ESP_LOGI(TAG, "First boot detected, initializing firmware version: %s", OTA_FIRMWARE_VERSION);
-        strcpy(current_firmware_version, OTA_FIRMWARE_VERSION);
+    ota_state_t state;
+    ota_state_get(&state);
+    strncpy(current_firmware_version, state.firmware_version, sizeof(current_firmware_version) - 1);
+    current_firmware_version[sizeof(current_firmware_version) - 1] = '\0';
 
-        // Save the default version to NVS for future boots
-        err = nvs_set_str(nvs_handle, NVS_KEY_CURRENT_VERSION, current_firmware_version);
-        if (err == ESP_OK)
-        {
-            nvs_commit(nvs_handle);
-        }
-    }
-    else
+    return err;
+}
+
+static esp_err_t check_and_report_boot_status(void)
+{
+    ota_state_t state;
+    ota_state_get(&state);
+
+    if (strlen(state.update_status) == 0)
     {
-        ESP_LOGI(TAG, "Loaded firmware version from NVS: %s", current_firmware_version);
+        return ESP_OK; // Nothing to report
     }
 
-    nvs_close(nvs_handle);
-    return ESP_OK;
-}
+    ESP_LOGI(TAG, "Reporting boot status: %s for version %s", state.update_status, state.last_version);
 
-static esp_err_t save_current_firmware_version(const char *version)
-{
-    nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    char device_id[OTA_SETTINGS_TEXT_SIZE];
+    ota_settings_get_str(OTA_SETTING_DEVICE_ID, device_id, sizeof(device_id));
+
+    esp_err_t err = ota_http_report_firmware_status(device_id,
+                                                    strlen(state.last_version) > 0 ? state.last_version : current_firmware_version,
+                                                    state.update_status);
     if (err != ESP_OK)
     {
+        ESP_LOGW(TAG, "Failed to report boot status: %s", esp_err_to_name(err));
         return err;
     }
 
-    err = nvs_set_str(nvs_handle, NVS_KEY_CURRENT_VERSION, version);
-    if (err == ESP_OK)
-    {
-        err = nvs_commit(nvs_handle);
-        if (err == ESP_OK)
-        {
-            strcpy(current_firmware_version, version);
-            ESP_LOGI(TAG, "Updated firmware version to: %s", version);
-        }
-    }
+    ESP_LOGI(TAG, "Boot status reported successfully");
+    ota_state_set_update_status(NULL, NULL);
+    return ota_state_commit();
+}
 
-    nvs_close(nvs_handle);
-    return err;
+static void on_download_progress(uint32_t received, uint32_t total, void *ctx)
+{
+    ota_event_download_progress(received, total);
 }
 
-static esp_err_t check_and_report_boot_status(void)
+// Check for an update and, if asked to, install it; shared by the periodic
+// check and requested checks
+static esp_err_t run_update_check(const char *operation, bool install, ota_check_result_t *result)
 {
-    nvs_handle_t nvs_handle;
-    esp_err_t err;
+    ota_trace_context_t *trace_ctx = ota_trace_start(operation, NULL);
+    ota_trace_enter(trace_ctx); // Nest the check's HTTP requests under this span
 
-    err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
-    if (err != ESP_OK)
-    {
-        ESP_LOGE(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
-        return err;
-    }
+    ota_event_check_started();
 
-    // Check if we have an update status to report
-    char update_status[16] = {0};
-    size_t required_size = sizeof(update_status);
-    err = nvs_get_str(nvs_handle, NVS_KEY_UPDATE_STATUS, update_status, &required_size);
+    bool update_available = false;
+    char firmware_url[OTA_URL_BUFFER_SIZE] = {0};
+    char new_version[64] = {0};
+    char device_id[OTA_SETTINGS_TEXT_SIZE];
+    ota_settings_get_str(OTA_SETTING_DEVICE_ID, device_id, sizeof(device_id));
 
-    if (err == ESP_OK && strlen(update_status) > 0)
-    {
-        // We have a status to report
-        char last_version[32] = {0};
-        required_size = sizeof(last_version);
-        nvs_get_str(nvs_handle, NVS_KEY_LAST_VERSION, last_version, &required_size);
+    esp_err_t err = ota_http_check_firmware_update(device_id, current_firmware_version,
+                                                   &update_available, firmware_url,
+                                                   sizeof(firmware_url), new_version,
+                                                   sizeof(new_version));
 
-        ESP_LOGI(TAG, "Reporting boot status: %s for version %s", update_status, last_version);
+    ota_trace_set_attr_str(trace_ctx, "firmware.version", current_firmware_version);
+    ota_trace_set_attr_bool(trace_ctx, "update_available", update_available);
 
-        // Report the status
-        esp_err_t report_err = ota_http_report_firmware_status(DEVICE_ID,
-                                                               strlen(last_version) > 0 ? last_version : current_firmware_version,
-                                                               update_status);
+    ota_check_result_t check = {.err = err, .update_available = err == ESP_OK && update_available};
+    strncpy(check.new_version, new_version, sizeof(check.new_version) - 1);
+    ota_event_check_finished(&check);
 
-        if (report_err == ESP_OK)
+    if (err == ESP_OK)
+    {
+        if (update_available)
         {
-            ESP_LOGI(TAG, "Boot status reported successfully");
-            // Clear the status from NVS
-            nvs_erase_key(nvs_handle, NVS_KEY_UPDATE_STATUS);
-            nvs_erase_key(nvs_handle, NVS_KEY_LAST_VERSION);
-            nvs_commit(nvs_handle);
+            ESP_LOGI(TAG, "Firmware update available: %s -> %s", current_firmware_version, new_version);
+            ota_trace_set_attr_str(trace_ctx, "firmware.new_version", new_version);
+            ota_log_info("Firmware update available", new_version);
+
+            if (trace_ctx)
+            {
+                ota_trace_add_event(trace_ctx, "update_available", NULL);
+            }
         }
         else
         {
-            ESP_LOGW(TAG, "Failed to report boot status: %s", esp_err_to_name(report_err));
+            ESP_LOGD(TAG, "No firmware update available");
         }
-    }
 
-    nvs_close(nvs_handle);
-    return ESP_OK;
-}
+        if (update_available && install)
+        {
+            // Save new version and status BEFORE attempting update
+            // (because the device restarts as soon as it is installed)
+            ota_state_set_firmware_version(new_version);
+            ota_state_set_update_status("COMPLETED", new_version);
+            ota_state_commit();
 
-static esp_err_t save_update_status(const char *status, const char *version)
-{
-    nvs_handle_t nvs_handle;
-    esp_err_t err;
+            ESP_LOGI(TAG, "Starting firmware download and installation...");
+            err = ota_http_download_and_install_firmware(firmware_url, on_download_progress, NULL);
+            ota_event_install_finished(err, new_version);
 
-    err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
-    if (err != ESP_OK)
+            if (err == ESP_OK)
+            {
+                ESP_LOGI(TAG, "OTA update completed successfully, restarting...");
+                if (trace_ctx)
+                {
+                    ota_trace_end_operation(trace_ctx, NULL);
+                }
+
+                // Let event handlers see the install before the restart
+                vTaskDelay(pdMS_TO_TICKS(OTA_RESTART_DELAY_MS));
+                esp_restart();
+            }
+            else
+            {
+                // Restore old version and set failure status on error
+                ota_state_set_firmware_version(current_firmware_version);
+                ota_state_set_update_status("FAILED", new_version);
+                ota_state_commit();
+
+                ESP_LOGE(TAG, "OTA update failed: %s", esp_err_to_name(err));
+                ota_trace_set_error(trace_ctx, err);
+                ota_log_error("OTA update failed", esp_err_to_name(err), new_version);
+
+                if (trace_ctx)
+                {
+                    ota_trace_add_event(trace_ctx, "update_failed", NULL);
+                }
+            }
+        }
+    }
+    else
     {
-        return err;
+        ESP_LOGW(TAG, "Failed to check for firmware update: %s", esp_err_to_name(err));
+        ota_trace_set_error(trace_ctx, err);
+        ota_log_warn("Failed to check for firmware update", esp_err_to_name(err));
     }
 
-    err = nvs_set_str(nvs_handle, NVS_KEY_UPDATE_STATUS, status);
-    if (err == ESP_OK && version)
+    if (trace_ctx)
     {
-        err = nvs_set_str(nvs_handle, NVS_KEY_LAST_VERSION, version);
+        ota_trace_end_operation(trace_ctx, NULL);
     }
 
-    if (err == ESP_OK)
+    if (result)
     {
-        err = nvs_commit(nvs_handle);
+        *result = check;
+        result->err = err;
     }
 
-    nvs_close(nvs_handle);
     return err;
 }
 
-static void ota_check_task(void *pvParameters)
+static uint32_t update_check_job(void *arg)
 {
-    ESP_LOGI(TAG, "OTA check task started");
+    if (!ota_schedule_is_online())
+    {
+        return ota_schedule_next_interval_ms(OTA_SCHEDULE_CHECK);
+    }
 
-    while (plugin_running)
+    // Report the outcome of the last update before a new one can replace it
+    if (boot_status_pending && check_and_report_boot_status() == ESP_OK)
     {
-        ota_trace_context_t *trace_ctx = ota_trace_start("ota_update_check", NULL);
+        boot_status_pending = false;
+        ota_log_info("OTA plugin started", current_firmware_version);
+    }
 
-        current_status = OTA_STATUS_CHECKING;
+    esp_err_t err = run_update_check("ota_update_check", true, NULL);
+    ota_schedule_report_result(OTA_SCHEDULE_CHECK, err);
 
-        bool update_available = false;
-        char firmware_url[OTA_URL_BUFFER_SIZE] = {0};
-        char new_version[64] = {0};
+    return ota_schedule_next_interval_ms(OTA_SCHEDULE_CHECK);
+}
 
-        esp_err_t err = ota_http_check_firmware_update(DEVICE_ID, current_firmware_version,
-                                                       &update_available, firmware_url,
-                                                       sizeof(firmware_url), new_version,
-                                                       sizeof(new_version));
+static void complete_waiters(const check_waiter_t *waiters, int count, const ota_check_result_t *result)
+{
+    for (int i = 0; i < count; i++)
+    {
+        waiters[i].callback(result, waiters[i].ctx);
+    }
+}
 
-        if (err == ESP_OK)
-        {
-            if (update_available)
-            {
-                ESP_LOGI(TAG, "Firmware update available: %s -> %s", current_firmware_version, new_version);
-                ota_log_info("Firmware update available", new_version);
+// One-shot job serving every request queued before it started
+static uint32_t requested_check_job(void *arg)
+{
+    taskENTER_CRITICAL(&check_lock);
+    memcpy(active_waiters, pending_waiters, sizeof(check_waiter_t) * pending_count);
+    active_count = pending_count;
+    active_mode = pending_mode;
+    pending_count = 0;
+    pending_mode = OTA_CHECK_ONLY;
+    check_queued = false;
+    check_in_flight = true;
+    requested_check_handle = OTA_EXECUTOR_INVALID_JOB;
+    requested_check_runs++;
+    taskEXIT_CRITICAL(&check_lock);
+
+    ota_check_result_t result = {0};
+    run_update_check("requested_ota_check", active_mode == OTA_CHECK_AND_INSTALL, &result);
+
+    // Requests that joined while the check was running are included
+    check_waiter_t waiters[OTA_CHECK_MAX_WAITERS];
+    taskENTER_CRITICAL(&check_lock);
+    int count = active_count;
+    memcpy(waiters, active_waiters, sizeof(check_waiter_t) * count);
+    active_count = 0;
+    check_in_flight = false;
+    taskEXIT_CRITICAL(&check_lock);
+
+    complete_waiters(waiters, count, &result);
+    return OTA_EXECUTOR_DONE;
+}
 
-                if (trace_ctx)
-                {
-                    ota_trace_add_event(trace_ctx, "update_available", NULL);
-                }
+// With the executor stopped, fail the requests whose check will not run
+// rather than leave their callers waiting for the next start
+static void fail_requested_checks(void)
+{
+    check_waiter_t waiters[OTA_CHECK_MAX_WAITERS * 2];
+    taskENTER_CRITICAL(&check_lock);
+    int count = pending_count;
+    memcpy(waiters, pending_waiters, sizeof(check_waiter_t) * pending_count);
+    memcpy(&waiters[count], active_waiters, sizeof(check_waiter_t) * active_count);
+    count += active_count;
+    ota_executor_job_t job = requested_check_handle;
+    requested_check_handle = OTA_EXECUTOR_INVALID_JOB;
+    pending_count = 0;
+    pending_mode = OTA_CHECK_ONLY;
+    check_queued = false;
+    active_count = 0;
+    check_in_flight = false;
+    taskEXIT_CRITICAL(&check_lock);
+
+    if (job != OTA_EXECUTOR_INVALID_JOB)
+    {
+        ota_executor_cancel(job);
+    }
 
-                current_status = OTA_STATUS_DOWNLOADING;
+    ota_check_result_t result = {.err = ESP_ERR_INVALID_STATE};
+    complete_waiters(waiters, count, &result);
+}
 
-                // Save new version and status BEFORE attempting update
-                // (because esp_https_ota restarts device on success)
-                save_current_firmware_version(new_version);
-                save_update_status("COMPLETED", new_version);
+static bool station_has_ip(void)
+{
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    esp_netif_ip_info_t ip_info;
 
-                ESP_LOGI(TAG, "Starting firmware download and installation...");
-                err = ota_http_download_and_install_firmware(firmware_url);
+    return netif != NULL && esp_netif_get_ip_info(netif, &ip_info) == ESP_OK && ip_info.ip.addr != 0;
+}
 
-                if (err == ESP_OK)
-                {
-                    ESP_LOGI(TAG, "OTA update completed successfully, restarting...");
-                    current_status = OTA_STATUS_SUCCESS;
-                    // Device will restart automatically from esp_https_ota
-                }
-                else
-                {
-                    // Restore old version and set failure status on error
-                    save_current_firmware_version(current_firmware_version);
-                    save_update_status("FAILED", new_version);
-
-                    ESP_LOGE(TAG, "OTA update failed: %s", esp_err_to_name(err));
-                    current_status = OTA_STATUS_FAILED;
-                    ota_log_error("OTA update failed", esp_err_to_name(err), new_version);
-
-                    if (trace_ctx)
-                    {
-                        ota_trace_add_event(trace_ctx, "update_failed", NULL);
-                    }
-                }
-            }
-            else
-            {
-                ESP_LOGD(TAG, "No firmware update available");
-                current_status = OTA_STATUS_IDLE;
-            }
-        }
-        else
-        {
-            ESP_LOGW(TAG, "Failed to check for firmware update: %s", esp_err_to_name(err));
-            current_status = OTA_STATUS_FAILED;
-            ota_log_warn("Failed to check for firmware update", esp_err_to_name(err));
-        }
+// Network work starts when the station gets an address and pauses when it
+// loses it; on reconnect, catch up on the check and heartbeat missed
+static void on_network_event(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ota_schedule_set_online(true);
+        ota_executor_expedite(update_check_job_handle, 0);
+        ota_status_send_heartbeat_now();
+    }
+    else
+    {
+        ota_schedule_set_online(false);
+    }
+}
 
-        if (trace_ctx)
-        {
-            ota_trace_end_operation(trace_ctx, NULL);
-        }
+static void register_network_events(void)
+{
+    if (esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, on_network_event, NULL,
+                                            &got_ip_handler) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to register for IP events, checks wait for their interval after reconnect");
+        got_ip_handler = NULL;
+    }
+
+    if (esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_LOST_IP, on_network_event, NULL,
+                                            &lost_ip_handler) != ESP_OK)
+    {
+        lost_ip_handler = NULL;
+    }
+
+    if (esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, on_network_event, NULL,
+                                            &disconnected_handler) != ESP_OK)
+    {
+        disconnected_handler = NULL;
+    }
+
+    // The address may have been assigned before the plugin started. Without
+    // the IP event, never park the jobs.
+    ota_schedule_set_online(station_has_ip() || got_ip_handler == NULL);
+}
 
-        // Wait before next check
-        vTaskDelay(pdMS_TO_TICKS(OTA_CHECK_INTERVAL_MS));
+static void unregister_network_events(void)
+{
+    if (got_ip_handler != NULL)
+    {
+        esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, got_ip_handler);
+        got_ip_handler = NULL;
+    }
+
+    if (lost_ip_handler != NULL)
+    {
+        esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_LOST_IP, lost_ip_handler);
+        lost_ip_handler = NULL;
+    }
+
+    if (disconnected_handler != NULL)
+    {
+        esp_event_handler_instance_unregister(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, disconnected_handler);
+        disconnected_handler = NULL;
     }
+}
+
+// A shorter check interval takes effect now rather than after the current one
+static void on_setting_changed(ota_setting_t setting, void *ctx)
+{
+    if (setting == OTA_SETTING_CHECK_INTERVAL_MS && plugin_running)
+    {
+        ota_executor_expedite(update_check_job_handle, ota_settings_get_u32(OTA_SETTING_CHECK_INTERVAL_MS));
+    }
+}
 
-    ESP_LOGI(TAG, "OTA check task stopped");
-    ota_task_handle = NULL;
-    vTaskDelete(NULL);
+// An announced update is installed now rather than at the next check
+static void on_push(ota_http_push_t push, void *ctx)
+{
+    if (push == OTA_HTTP_PUSH_UPDATE && plugin_running)
+    {
+        ota_executor_expedite(update_check_job_handle, 0);
+    }
 }
 
 esp_err_t ota_plugin_init(void)
@@ -264,8 +399,20 @@ esp_err_t ota_plugin_init(void)
     ESP_LOGI(TAG, "Initializing OTA plugin...");
     plugin_start_time = esp_timer_get_time();
 
+    // Static memory mode reserves everything the plugin needs before it runs
+    esp_err_t err = ota_arena_init();
+    if (err == ESP_OK)
+    {
+        err = ota_executor_init();
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to reserve plugin memory: %s", esp_err_to_name(err));
+        return err;
+    }
+
     // Initialize NVS FIRST
-    esp_err_t err = nvs_flash_init();
+    err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
     {
         ESP_ERROR_CHECK(nvs_flash_erase());
@@ -281,13 +428,46 @@ esp_err_t ota_plugin_init(void)
     load_current_firmware_version();
     ESP_LOGI(TAG, "Using firmware version: %s", current_firmware_version);
 
+    // Before the modules that read settings while initializing. Listeners
+    // cannot be removed, so they are registered on the first init only.
+    ota_settings_init();
+    static bool settings_listening = false;
+    if (!settings_listening)
+    {
+        err = ota_settings_add_listener(on_setting_changed, NULL);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to listen for settings: %s", esp_err_to_name(err));
+            return err;
+        }
+        settings_listening = true;
+    }
+
     // Initialize sub-modules
+    err = ota_schedule_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to initialize scheduler: %s", esp_err_to_name(err));
+        return err;
+    }
+
     err = ota_http_client_init();
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to initialize HTTP client: %s", esp_err_to_name(err));
         return err;
     }
+    static bool push_listening = false;
+    if (!push_listening)
+    {
+        err = ota_http_add_push_listener(on_push, NULL);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to listen for pushed messages: %s", esp_err_to_name(err));
+            return err;
+        }
+        push_listening = true;
+    }
 
     err = ota_status_init();
     if (err != ESP_OK)
@@ -310,11 +490,12 @@ esp_err_t ota_plugin_init(void)
         return err;
     }
 
+    ota_arena_seal();
+
     plugin_initialized = true;
-    current_status = OTA_STATUS_IDLE;
+    ota_event_set_state(OTA_STATUS_IDLE);
 
     ESP_LOGI(TAG, "OTA plugin initialized successfully");
-    ota_log_info("OTA plugin initialized", current_firmware_version);
 
     return ESP_OK;
 }
@@ -333,33 +514,58 @@ esp_err_t ota_plugin_start(void)
 
     ESP_LOGI(TAG, "Starting OTA plugin...");
 
-    // Check and report boot status first
-    check_and_report_boot_status();
+    // No network I/O here: the boot status report and the first check and
+    // heartbeat run on the executor once the station has an IP address.
+    // One executor task runs the update checks and heartbeats
+    esp_err_t err = ota_executor_start();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start executor: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    // Over MQTT, connects in the background and keeps reconnecting
+    err = ota_http_client_start();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start transport: %s", esp_err_to_name(err));
+        ota_executor_stop();
+        return err;
+    }
 
     // Start heartbeat
-    esp_err_t err = ota_status_start_heartbeat();
+    err = ota_status_start_heartbeat();
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to start heartbeat: %s", esp_err_to_name(err));
+        ota_http_client_stop();
+        ota_executor_stop();
         return err;
     }
 
-    // Start OTA check task
-    plugin_running = true;
-    BaseType_t ret = xTaskCreate(ota_check_task, "ota_check_task",
-                                 OTA_TASK_STACK_SIZE, NULL,
-                                 OTA_TASK_PRIORITY, &ota_task_handle);
-
-    if (ret != pdPASS)
+    // Schedule OTA checks, ahead of telemetry whenever both are due
+    update_check_job_handle = ota_executor_add("update_check", update_check_job, NULL,
+                                               OTA_JOB_PRIORITY_FIRMWARE, 0);
+    if (update_check_job_handle == OTA_EXECUTOR_INVALID_JOB)
     {
-        plugin_running = false;
         ota_status_stop_heartbeat();
-        ESP_LOGE(TAG, "Failed to create OTA check task");
+        ota_http_client_stop();
+        ota_executor_stop();
+        ESP_LOGE(TAG, "Failed to schedule OTA checks");
         return ESP_FAIL;
     }
 
+    plugin_running = true;
+
+    register_network_events();
+
+    if (OTA_EXPORTER_ENABLED)
+    {
+        // Local scraping is optional; the plugin runs without it
+        ota_exporter_start();
+    }
+
     ESP_LOGI(TAG, "OTA plugin started successfully");
-    ota_log_info("OTA plugin started", NULL);
 
     return ESP_OK;
 }
@@ -375,23 +581,30 @@ esp_err_t ota_plugin_stop(void)
 
     plugin_running = false;
 
+    unregister_network_events();
+
+    // Waits for a check in progress to finish
+    ota_executor_cancel(update_check_job_handle);
+    update_check_job_handle = OTA_EXECUTOR_INVALID_JOB;
+
     // Stop heartbeat
     ota_status_stop_heartbeat();
 
-    // Wait for OTA task to finish
-    if (ota_task_handle != NULL)
+    if (OTA_EXPORTER_ENABLED)
     {
-        while (ota_task_handle != NULL)
-        {
-            vTaskDelay(pdMS_TO_TICKS(100));
-        }
+        ota_exporter_stop();
     }
 
-    current_status = OTA_STATUS_IDLE;
+    ota_executor_stop();
+    fail_requested_checks();
+
+    ota_event_set_state(OTA_STATUS_IDLE);
 
     ESP_LOGI(TAG, "OTA plugin stopped");
     ota_log_info("OTA plugin stopped", NULL);
 
+    ota_http_client_stop();
+
     return ESP_OK;
 }
 
@@ -412,55 +625,123 @@ esp_err_t ota_plugin_deinit(void)
     }
 
     plugin_initialized = false;
-    current_status = OTA_STATUS_IDLE;
+    ota_event_set_state(OTA_STATUS_IDLE);
 
     ESP_LOGI(TAG, "OTA plugin deinitialized");
     return ESP_OK;
 }
 
-esp_err_t ota_plugin_check_update(void)
+esp_err_t ota_plugin_check_update_async(ota_check_mode_t mode, ota_check_cb_t callback, void *ctx)
 {
-    if (!plugin_initialized)
+    if (!callback)
     {
-        return ESP_ERR_INVALID_STATE;
+        return ESP_ERR_INVALID_ARG;
     }
 
-    ESP_LOGI(TAG, "Manual OTA update check requested");
+    if (!plugin_running)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    ota_trace_context_t *trace_ctx = ota_trace_start("manual_ota_check", NULL);
+    bool schedule = false;
+    uint32_t runs = 0;
+    esp_err_t err = ESP_OK;
 
-    bool update_available = false;
-    char firmware_url[OTA_URL_BUFFER_SIZE] = {0};
-    char new_version[64] = {0};
+    taskENTER_CRITICAL(&check_lock);
+    if (check_in_flight && mode <= active_mode && active_count < OTA_CHECK_MAX_WAITERS)
+    {
+        active_waiters[active_count++] = (check_waiter_t){callback, ctx};
+    }
+    else if (pending_count < OTA_CHECK_MAX_WAITERS)
+    {
+        pending_waiters[pending_count++] = (check_waiter_t){callback, ctx};
+        pending_mode = mode > pending_mode ? mode : pending_mode;
+        schedule = !check_queued;
+        check_queued = true;
+        runs = requested_check_runs;
+    }
+    else
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    taskEXIT_CRITICAL(&check_lock);
 
-    esp_err_t err = ota_http_check_firmware_update(DEVICE_ID, current_firmware_version,
-                                                   &update_available, firmware_url,
-                                                   sizeof(firmware_url), new_version,
-                                                   sizeof(new_version));
+    if (!schedule)
+    {
+        return err;
+    }
 
-    if (err == ESP_OK)
+    ota_executor_job_t job = ota_executor_add("requested_check", requested_check_job, NULL, OTA_JOB_PRIORITY_FIRMWARE, 0);
+    if (job != OTA_EXECUTOR_INVALID_JOB)
     {
-        if (update_available)
-        {
-            ESP_LOGI(TAG, "Manual check: Update available %s -> %s", current_firmware_version, new_version);
-            ota_log_info("Manual OTA check: Update available", new_version);
-        }
-        else
+        taskENTER_CRITICAL(&check_lock);
+        if (requested_check_runs == runs)
         {
-            ESP_LOGI(TAG, "Manual check: No update available");
+            requested_check_handle = job; // Unless the job already started
         }
+        taskEXIT_CRITICAL(&check_lock);
     }
     else
     {
-        ESP_LOGW(TAG, "Manual check failed: %s", esp_err_to_name(err));
-        ota_log_warn("Manual OTA check failed", esp_err_to_name(err));
+        // Fail every request that joined the check that will not run
+        check_waiter_t waiters[OTA_CHECK_MAX_WAITERS];
+        taskENTER_CRITICAL(&check_lock);
+        int count = pending_count;
+        memcpy(waiters, pending_waiters, sizeof(check_waiter_t) * count);
+        pending_count = 0;
+        pending_mode = OTA_CHECK_ONLY;
+        check_queued = false;
+        taskEXIT_CRITICAL(&check_lock);
+
+        ota_check_result_t result = {.err = ESP_ERR_NO_MEM};
+        complete_waiters(waiters, count, &result);
+        return ESP_ERR_NO_MEM;
     }
 
-    if (trace_ctx)
+    ESP_LOGI(TAG, "OTA update check requested");
+    return ESP_OK;
+}
+
+typedef struct
+{
+    SemaphoreHandle_t done;
+    ota_check_result_t result;
+} check_update_wait_t;
+
+static void check_update_done(const ota_check_result_t *result, void *ctx)
+{
+    check_update_wait_t *wait = ctx;
+    wait->result = *result;
+    xSemaphoreGive(wait->done);
+}
+
+esp_err_t ota_plugin_check_update(void)
+{
+    if (!plugin_initialized)
     {
-        ota_trace_end_operation(trace_ctx, NULL);
+        return ESP_ERR_INVALID_STATE;
     }
 
+    ESP_LOGI(TAG, "Manual OTA update check requested");
+
+    // Without the executor, check in the caller's context
+    if (!plugin_running)
+    {
+        return run_update_check("manual_ota_check", false, NULL);
+    }
+
+    StaticSemaphore_t done_buffer;
+    check_update_wait_t wait = {.done = xSemaphoreCreateBinaryStatic(&done_buffer)};
+
+    // Check only, like the stopped path above
+    esp_err_t err = ota_plugin_check_update_async(OTA_CHECK_ONLY, check_update_done, &wait);
+    if (err == ESP_OK)
+    {
+        xSemaphoreTake(wait.done, portMAX_DELAY);
+        err = wait.result.err;
+    }
+
+    vSemaphoreDelete(wait.done);
     return err;
 }
 
@@ -481,7 +762,14 @@ esp_err_t ota_trace_end(ota_trace_context_t *trace_ctx, const char *attributes)
 
 ota_status_t ota_plugin_get_status(void)
 {
-    return current_status;
+    ota_plugin_status_snapshot_t snapshot;
+    ota_event_get_snapshot(&snapshot);
+    return snapshot.state;
+}
+
+void ota_plugin_get_status_snapshot(ota_plugin_status_snapshot_t *snapshot)
+{
+    ota_event_get_snapshot(snapshot);
 }
 
 uint32_t ota_plugin_get_uptime_sec(void)
@@ -489,6 +777,11 @@ uint32_t ota_plugin_get_uptime_sec(void)
     return (esp_timer_get_time() - plugin_start_time) / 1000000;
 }
 
+const char *ota_plugin_get_firmware_version(void)
+{
+    return current_firmware_version;
+}
+
 esp_err_t ota_plugin_send_metric(const char *name, float value, const char *unit)
 {
     return ota_status_add_custom_metric(name, value, unit);
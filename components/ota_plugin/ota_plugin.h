@@ -4,6 +4,8 @@
 #include "ota_config.h"
 #include "esp_err.h"
 #include "esp_timer.h"
+#include "esp_event.h"
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -37,11 +39,110 @@ esp_err_t ota_plugin_stop(void);
 esp_err_t ota_plugin_deinit(void);
 
 /**
- * @brief Manually trigger OTA update check
- * @return ESP_OK on success, error code otherwise
+ * @brief What a requested update check does
+ */
+typedef enum {
+    OTA_CHECK_ONLY,        // Report whether an update is available
+    OTA_CHECK_AND_INSTALL  // Also download and install it
+} ota_check_mode_t;
+
+/**
+ * @brief Outcome of a requested update check
+ */
+typedef struct {
+    esp_err_t err;          // ESP_OK if the check (and install, if requested) succeeded
+    bool update_available;
+    char new_version[64];   // Version offered by the server, if any
+} ota_check_result_t;
+
+/**
+ * @brief Receives the outcome of a requested update check
+ *
+ * Runs on the plugin executor task: keep it short and do not call
+ * ota_plugin_check_update() from it.
+ *
+ * @param result Check outcome, valid during the call only
+ * @param ctx Context given to ota_plugin_check_update_async()
+ */
+typedef void (*ota_check_cb_t)(const ota_check_result_t* result, void* ctx);
+
+/**
+ * @brief Event base of the plugin's state changes, posted to the default event loop
+ */
+ESP_EVENT_DECLARE_BASE(OTA_PLUGIN_EVENT);
+
+/**
+ * @brief OTA_PLUGIN_EVENT ids and their event data
+ */
+typedef enum {
+    OTA_PLUGIN_EVENT_CHECK_STARTED,     // No data
+    OTA_PLUGIN_EVENT_CHECK_FINISHED,    // ota_check_result_t of the check, before any install
+    OTA_PLUGIN_EVENT_UPDATE_AVAILABLE,  // ota_plugin_event_version_t
+    OTA_PLUGIN_EVENT_DOWNLOAD_PROGRESS, // ota_plugin_event_progress_t
+    OTA_PLUGIN_EVENT_INSTALL_DONE,      // ota_plugin_event_install_t, OTA_RESTART_DELAY_MS before the restart
+    OTA_PLUGIN_EVENT_INSTALL_FAILED,    // ota_plugin_event_install_t
+    OTA_PLUGIN_EVENT_HEARTBEAT_FAILED   // ota_plugin_event_heartbeat_t
+} ota_plugin_event_t;
+
+typedef struct {
+    char version[64];
+} ota_plugin_event_version_t;
+
+typedef struct {
+    uint32_t received; // Bytes downloaded so far
+    uint32_t total;    // Image size in bytes, 0 if unknown
+} ota_plugin_event_progress_t;
+
+typedef struct {
+    esp_err_t err;     // ESP_OK for OTA_PLUGIN_EVENT_INSTALL_DONE
+    char version[64];  // Version being installed
+} ota_plugin_event_install_t;
+
+typedef struct {
+    esp_err_t err;
+    uint32_t consecutive_failures;
+} ota_plugin_event_heartbeat_t;
+
+/**
+ * @brief Plugin status, read as one consistent copy
+ */
+typedef struct {
+    ota_status_t state;
+    esp_err_t last_error;          // Error of the last check or install, ESP_OK if it succeeded
+    uint32_t bytes_received;       // Progress of the current or last download
+    uint32_t bytes_total;          // Image size of that download, 0 if unknown
+    uint32_t heartbeat_failures;   // Consecutive failed heartbeats
+    int64_t last_check_time;       // esp_timer time of the last finished check, 0 if none
+    char available_version[64];    // Version offered by the last check, empty if none
+} ota_plugin_status_snapshot_t;
+
+/**
+ * @brief Manually trigger OTA update check and wait for the result
+ *
+ * While the plugin runs, the check is queued on the plugin executor and
+ * merged with other pending requests; otherwise it runs in the caller's
+ * context. Either way it only reports whether an update is available; use
+ * ota_plugin_check_update_async() with OTA_CHECK_AND_INSTALL to install it.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if the plugin stopped
+ *         before the check ran, error code otherwise
  */
 esp_err_t ota_plugin_check_update(void);
 
+/**
+ * @brief Queue an update check without blocking
+ *
+ * Requests made while a check is queued or in flight share its network
+ * call. Up to OTA_CHECK_MAX_WAITERS requests can wait at once.
+ *
+ * @param mode Check only, or check and install
+ * @param callback Called once with the result
+ * @param ctx Passed to callback
+ * @return ESP_OK if queued, ESP_ERR_INVALID_STATE if the plugin is not
+ *         running, ESP_ERR_NO_MEM if too many requests are waiting
+ */
+esp_err_t ota_plugin_check_update_async(ota_check_mode_t mode, ota_check_cb_t callback, void* ctx);
+
 /**
  * @brief Log a message to the remote server
  * @param level Log level
@@ -63,7 +164,7 @@ ota_trace_context_t* ota_trace_start(const char* operation, const char* parent_s
 /**
  * @brief End a trace operation
  * @param trace_ctx Trace context from ota_trace_start
- * @param attributes Optional JSON attributes string
+ * @param attributes Optional JSON attributes string (prefer the typed ota_trace_set_attr_* functions)
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t ota_trace_end(ota_trace_context_t* trace_ctx, const char* attributes);
@@ -74,12 +175,27 @@ esp_err_t ota_trace_end(ota_trace_context_t* trace_ctx, const char* attributes);
  */
 ota_status_t ota_plugin_get_status(void);
 
+/**
+ * @brief Get a consistent copy of the plugin status
+ *
+ * Lock-free and cheap enough to poll from any task or core.
+ *
+ * @param snapshot Output
+ */
+void ota_plugin_get_status_snapshot(ota_plugin_status_snapshot_t* snapshot);
+
 /**
  * @brief Get device uptime in seconds
  * @return Uptime in seconds
  */
 uint32_t ota_plugin_get_uptime_sec(void);
 
+/**
+ * @brief Get the running firmware version
+ * @return Firmware version string
+ */
+const char* ota_plugin_get_firmware_version(void);
+
 /**
  * @brief Send custom metric
  * @param name Metric name
@@ -89,13 +205,39 @@ uint32_t ota_plugin_get_uptime_sec(void);
  */
 esp_err_t ota_plugin_send_metric(const char* name, float value, const char* unit);
 
+// Typed span attribute, stored inline in the span
+typedef enum {
+    OTA_TRACE_ATTR_STRING,
+    OTA_TRACE_ATTR_INT,
+    OTA_TRACE_ATTR_DOUBLE,
+    OTA_TRACE_ATTR_BOOL
+} ota_trace_attr_type_t;
+
+typedef struct {
+    char key[OTA_TRACE_ATTR_KEY_SIZE];
+    ota_trace_attr_type_t type;
+    union {
+        char string[OTA_TRACE_ATTR_STRING_SIZE];
+        int64_t integer;
+        double number;
+        bool boolean;
+    } value;
+} ota_trace_attr_t;
+
 // Trace context structure
 struct ota_trace_context_s {
-    char trace_id[OTA_TRACE_ID_SIZE];
-    char span_id[OTA_SPAN_ID_SIZE];
-    char parent_span_id[OTA_SPAN_ID_SIZE];
+    uint8_t trace_id[OTA_TRACE_ID_SIZE];
+    uint8_t span_id[OTA_SPAN_ID_SIZE];
+    uint8_t parent_span_id[OTA_SPAN_ID_SIZE]; // All zero for root spans
     char operation[64];
     int64_t start_time;
+    int64_t end_time;
+    bool sampled;                  // Head sampling decision, shared by the whole trace
+    bool failed;                   // Set by ota_trace_set_error, forces tail sampling
+    ota_trace_attr_t attributes[OTA_TRACE_MAX_ATTRIBUTES];
+    uint8_t attribute_count;
+    char* raw_attributes;          // Copy of legacy JSON attributes while held for tail sampling
+    ota_trace_context_t* previous; // Span that was current before this one was entered
 };
 
 #ifdef __cplusplus
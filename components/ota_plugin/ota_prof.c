@@ -0,0 +1,183 @@
+#include "ota_prof.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <string.h>
+
+static const char *TAG = "ota_prof";
+
+typedef struct
+{
+    uint32_t count;
+    uint64_t total;
+    uint32_t min;
+    uint32_t max;
+} prof_counters_t;
+
+// One row per site and core: each core only writes its own row, with its
+// interrupts masked, so no lock is shared between cores on the hot path
+static prof_counters_t prof_table[OTA_PROF_MAX_SITES][portNUM_PROCESSORS];
+static const char *prof_names[OTA_PROF_MAX_SITES];
+static atomic_int prof_site_count = 0; // Published after the site's name and rows are written
+static portMUX_TYPE prof_register_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void ota_prof_register(ota_prof_site_t *site)
+{
+    bool full = false;
+
+    taskENTER_CRITICAL(&prof_register_lock);
+    if (site->index == OTA_PROF_SITE_UNREGISTERED)
+    {
+        int index = atomic_load_explicit(&prof_site_count, memory_order_relaxed);
+        if (index < OTA_PROF_MAX_SITES)
+        {
+            prof_names[index] = site->name;
+            for (int core = 0; core < portNUM_PROCESSORS; core++)
+            {
+                prof_table[index][core] = (prof_counters_t){.min = UINT32_MAX};
+            }
+            atomic_store_explicit(&prof_site_count, index + 1, memory_order_release);
+            site->index = index;
+        }
+        else
+        {
+            site->index = OTA_PROF_SITE_TABLE_FULL;
+            full = true;
+        }
+    }
+    taskEXIT_CRITICAL(&prof_register_lock);
+
+    if (full)
+    {
+        ESP_LOGW(TAG, "Profiling table full, probe %s ignored", site->name);
+    }
+}
+
+void ota_prof_accumulate(int table_index, uint32_t cycles)
+{
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    prof_counters_t *counters = &prof_table[table_index][xPortGetCoreID()];
+
+    counters->count++;
+    counters->total += cycles;
+    if (cycles < counters->min)
+    {
+        counters->min = cycles;
+    }
+    if (cycles > counters->max)
+    {
+        counters->max = cycles;
+    }
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+// Sum a site's rows over the cores, optionally clearing them
+static void read_site(int index, ota_prof_stat_t *stat, bool reset)
+{
+    stat->name = prof_names[index];
+    stat->count = 0;
+    stat->total_cycles = 0;
+    stat->min_cycles = UINT32_MAX;
+    stat->max_cycles = 0;
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        prof_counters_t counters = prof_table[index][core];
+        if (reset)
+        {
+            prof_table[index][core] = (prof_counters_t){.min = UINT32_MAX};
+        }
+
+        stat->count += counters.count;
+        stat->total_cycles += counters.total;
+        if (counters.min < stat->min_cycles)
+        {
+            stat->min_cycles = counters.min;
+        }
+        if (counters.max > stat->max_cycles)
+        {
+            stat->max_cycles = counters.max;
+        }
+    }
+
+    if (stat->count == 0)
+    {
+        stat->min_cycles = 0;
+    }
+}
+
+size_t ota_prof_snapshot(ota_prof_stat_t *stats, size_t max_stats, bool reset)
+{
+    if (!stats)
+    {
+        return 0;
+    }
+
+    // Readers do not take the registration lock; the acquire pairs with the
+    // release in ota_prof_register(), so every counted site has its name
+    int site_count = atomic_load_explicit(&prof_site_count, memory_order_acquire);
+    size_t written = 0;
+
+    for (int i = 0; i < site_count && written < max_stats; i++)
+    {
+        read_site(i, &stats[written++], reset);
+    }
+
+    return written;
+}
+
+void ota_prof_discard(const ota_prof_stat_t *stats, size_t count)
+{
+    if (!stats)
+    {
+        return;
+    }
+
+    int site_count = atomic_load_explicit(&prof_site_count, memory_order_acquire);
+    for (int i = 0; i < site_count && i < (int)count; i++)
+    {
+        const ota_prof_stat_t *window = &stats[i];
+        if (window->count == 0)
+        {
+            continue;
+        }
+
+        ota_prof_stat_t now;
+        read_site(i, &now, true);
+        if (now.count <= window->count)
+        {
+            continue;
+        }
+
+        // Measurements recorded since the read go back into this core's row:
+        // count and total are exact, a new minimum or maximum is one of them,
+        // and otherwise their mean stands in
+        uint32_t late = now.count - window->count;
+        uint64_t late_total = now.total_cycles - window->total_cycles;
+        uint32_t mean = late_total / late;
+        uint32_t low = now.min_cycles < window->min_cycles ? now.min_cycles : mean;
+        uint32_t high = now.max_cycles > window->max_cycles ? now.max_cycles : mean;
+
+        UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+        prof_counters_t *counters = &prof_table[i][xPortGetCoreID()];
+        counters->count += late;
+        counters->total += late_total;
+        if (low < counters->min)
+        {
+            counters->min = low;
+        }
+        if (high > counters->max)
+        {
+            counters->max = high;
+        }
+        portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+    }
+}
+
+double ota_prof_cycles_to_us(uint64_t cycles)
+{
+    return (double)cycles / esp_rom_get_cpu_ticks_per_us();
+}
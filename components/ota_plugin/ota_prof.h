@@ -0,0 +1,188 @@
+#ifndef OTA_PROF_H
+#define OTA_PROF_H
+
+#include "ota_config.h"
+#include "esp_err.h"
+#include "esp_cpu.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A static probe site; created by the OTA_PROF_* macros
+ */
+typedef struct {
+    const char* name;
+    volatile int16_t index; // Slot in the profiling table, assigned on first use
+} ota_prof_site_t;
+
+#define OTA_PROF_SITE_UNREGISTERED -1
+#define OTA_PROF_SITE_TABLE_FULL -2
+
+/**
+ * @brief Accumulated statistics of one probe site
+ */
+typedef struct {
+    const char* name;
+    uint32_t count;
+    uint64_t total_cycles;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+} ota_prof_stat_t;
+
+/**
+ * @brief Read the CPU cycle counter
+ * @return Current cycle count of the calling core
+ */
+static inline uint32_t ota_prof_cycles(void)
+{
+    return (uint32_t)esp_cpu_get_cycle_count();
+}
+
+/**
+ * @brief Start of a measurement: the cycle count and the core it was read on
+ */
+typedef struct {
+    uint32_t cycles;
+    int core;
+} ota_prof_start_t;
+
+/**
+ * @brief Read the start of a measurement
+ * @return Cycle count and core ID of the calling core
+ */
+static inline ota_prof_start_t ota_prof_start(void)
+{
+    return (ota_prof_start_t){ota_prof_cycles(), esp_cpu_get_core_id()};
+}
+
+/**
+ * @brief Assign a table slot to a probe site (called once per site by ota_prof_record)
+ * @param site Probe site
+ */
+void ota_prof_register(ota_prof_site_t* site);
+
+/**
+ * @brief Accumulate one measurement in the calling core's row of the table
+ * @param table_index Slot assigned to the site
+ * @param cycles Measured cycles
+ */
+void ota_prof_accumulate(int table_index, uint32_t cycles);
+
+/**
+ * @brief Record a measurement for a probe site
+ * @param site Probe site
+ * @param cycles Measured cycles
+ */
+static inline void ota_prof_record(ota_prof_site_t* site, uint32_t cycles)
+{
+    if (__builtin_expect(site->index == OTA_PROF_SITE_UNREGISTERED, 0)) {
+        ota_prof_register(site);
+    }
+    if (site->index >= 0) {
+        ota_prof_accumulate(site->index, cycles);
+    }
+}
+
+/**
+ * @brief Record the cycles elapsed since a start read on the same core
+ *
+ * The cycle counters of the two cores are not synchronized, so a measurement
+ * whose task migrated to the other core in between is dropped.
+ *
+ * @param site Probe site
+ * @param start Start of the measurement
+ */
+static inline void ota_prof_stop(ota_prof_site_t* site, ota_prof_start_t start)
+{
+    uint32_t cycles = ota_prof_cycles();
+    if (__builtin_expect(esp_cpu_get_core_id() == start.core, 1)) {
+        ota_prof_record(site, cycles - start.cycles);
+    }
+}
+
+/**
+ * @brief Copy the accumulated statistics of all registered probe sites
+ * @param stats Output array
+ * @param max_stats Capacity of stats
+ * @param reset Start a new window by clearing the table after reading it
+ *              (a measurement recorded concurrently on the other core may be lost)
+ * @return Number of entries written
+ */
+size_t ota_prof_snapshot(ota_prof_stat_t* stats, size_t max_stats, bool reset);
+
+/**
+ * @brief Drop statistics read without reset, e.g. once they have been delivered
+ *
+ * Measurements recorded after the read keep their count and total. As with a
+ * reset, one recorded concurrently on the other core may be lost.
+ *
+ * @param stats Entries returned by ota_prof_snapshot with reset false
+ * @param count Number of entries
+ */
+void ota_prof_discard(const ota_prof_stat_t* stats, size_t count);
+
+/**
+ * @brief Convert CPU cycles to microseconds
+ * @param cycles Cycle count
+ * @return Microseconds
+ */
+double ota_prof_cycles_to_us(uint64_t cycles);
+
+#if OTA_PROFILING_ENABLED
+
+/**
+ * @brief Start timing a probe; pair with OTA_PROF_END(probe) in the same scope
+ *
+ * Each probe costs a cycle counter read at both ends plus a few dozen cycles to
+ * accumulate count, total, min and max; no allocation, locking or formatting.
+ * A measurement is dropped if an unpinned task moved to the other core before
+ * OTA_PROF_END, as the two cores' cycle counters are not synchronized.
+ *
+ * Example:
+ *   OTA_PROF_BEGIN(filter_step);
+ *   run_filter();
+ *   OTA_PROF_END(filter_step);
+ */
+#define OTA_PROF_BEGIN(probe)                                                        \
+    static ota_prof_site_t _ota_prof_site_##probe = {#probe, OTA_PROF_SITE_UNREGISTERED}; \
+    const ota_prof_start_t _ota_prof_start_##probe = ota_prof_start()
+
+#define OTA_PROF_END(probe) \
+    ota_prof_stop(&_ota_prof_site_##probe, _ota_prof_start_##probe)
+
+typedef struct {
+    ota_prof_site_t* site;
+    ota_prof_start_t start;
+} ota_prof_scope_t;
+
+static inline void ota_prof_scope_end(ota_prof_scope_t* scope)
+{
+    ota_prof_stop(scope->site, scope->start);
+}
+
+/**
+ * @brief Time the rest of the enclosing block as a probe
+ */
+#define OTA_PROF_SCOPE(probe)                                                        \
+    static ota_prof_site_t _ota_prof_site_##probe = {#probe, OTA_PROF_SITE_UNREGISTERED}; \
+    ota_prof_scope_t _ota_prof_scope_##probe __attribute__((cleanup(ota_prof_scope_end))) = \
+        {&_ota_prof_site_##probe, ota_prof_start()}
+
+#else
+
+#define OTA_PROF_BEGIN(probe) do { } while (0)
+#define OTA_PROF_END(probe) do { } while (0)
+#define OTA_PROF_SCOPE(probe) do { } while (0)
+
+#endif // OTA_PROFILING_ENABLED
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_PROF_H
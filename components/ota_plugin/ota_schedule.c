@@ -0,0 +1,233 @@
+#include "ota_schedule.h"
+#include "ota_settings.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "ota_schedule";
+
+typedef struct
+{
+    ota_setting_t base_setting; // Baseline interval, tunable at runtime
+    uint32_t consecutive_errors;
+    uint32_t hint_ms; // 0 when no hint is pending
+} schedule_state_t;
+
+static schedule_state_t schedules[OTA_SCHEDULE_COUNT] = {
+    [OTA_SCHEDULE_CHECK] = {.base_setting = OTA_SETTING_CHECK_INTERVAL_MS},
+    [OTA_SCHEDULE_HEARTBEAT] = {.base_setting = OTA_SETTING_HEARTBEAT_INTERVAL_MS},
+};
+
+static bool throttled = false;
+static int64_t retry_after_until_us = 0; // Backend asked for no requests before this esp_timer time
+static bool rollout_active = false;
+static int last_rssi = 0; // 0 until the first reading
+static bool online = false;
+
+// Updated by the check and heartbeat tasks and the HTTP client
+static portMUX_TYPE schedule_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t clamp_interval(uint64_t interval_ms)
+{
+    if (interval_ms < OTA_SCHEDULE_MIN_INTERVAL_MS)
+    {
+        return OTA_SCHEDULE_MIN_INTERVAL_MS;
+    }
+    if (interval_ms > OTA_SCHEDULE_MAX_INTERVAL_MS)
+    {
+        return OTA_SCHEDULE_MAX_INTERVAL_MS;
+    }
+    return (uint32_t)interval_ms;
+}
+
+// Spread devices that booted together over the interval
+static uint32_t add_jitter(uint32_t interval_ms)
+{
+    uint32_t spread = (uint64_t)interval_ms * OTA_SCHEDULE_JITTER_PERCENT / 100;
+    if (spread == 0)
+    {
+        return interval_ms;
+    }
+
+    uint32_t offset = esp_random() % (2 * spread + 1);
+    return interval_ms - spread + offset;
+}
+
+esp_err_t ota_schedule_init(void)
+{
+    // The network state is kept; its events may arrive before init
+    taskENTER_CRITICAL(&schedule_lock);
+    for (int i = 0; i < OTA_SCHEDULE_COUNT; i++)
+    {
+        schedules[i].consecutive_errors = 0;
+        schedules[i].hint_ms = 0;
+    }
+    throttled = false;
+    retry_after_until_us = 0;
+    rollout_active = false;
+    last_rssi = 0;
+    taskEXIT_CRITICAL(&schedule_lock);
+
+    ESP_LOGI(TAG, "Adaptive scheduler initialized");
+    return ESP_OK;
+}
+
+uint32_t ota_schedule_next_interval_ms(ota_schedule_kind_t kind)
+{
+    if (kind >= OTA_SCHEDULE_COUNT)
+    {
+        return OTA_SCHEDULE_MAX_INTERVAL_MS;
+    }
+
+    taskENTER_CRITICAL(&schedule_lock);
+
+    // Paused until the network comes back, which expedites the job
+    if (!online)
+    {
+        taskEXIT_CRITICAL(&schedule_lock);
+        return OTA_SCHEDULE_MAX_INTERVAL_MS;
+    }
+
+    schedule_state_t *schedule = &schedules[kind];
+    uint32_t hint_ms = schedule->hint_ms;
+    schedule->hint_ms = 0;
+
+    uint64_t interval_ms = ota_settings_get_u32(schedule->base_setting);
+    int64_t retry_after_ms = (retry_after_until_us - esp_timer_get_time()) / 1000;
+
+    if (throttled)
+    {
+        // Back off from the regular interval; the rejected request counts as
+        // an error, but retrying it sooner would only add to the load
+        interval_ms *= OTA_SCHEDULE_THROTTLE_FACTOR;
+    }
+    else if (schedule->consecutive_errors > 0)
+    {
+        // Retry sooner, backing off exponentially up to the regular interval
+        uint32_t shift = schedule->consecutive_errors - 1 < 16 ? schedule->consecutive_errors - 1 : 16;
+        uint64_t retry_ms = (uint64_t)OTA_RETRY_DELAY_MS << shift;
+        if (retry_ms < interval_ms)
+        {
+            interval_ms = retry_ms;
+        }
+    }
+    else if (kind == OTA_SCHEDULE_CHECK && rollout_active && OTA_SCHEDULE_ROLLOUT_INTERVAL_MS < interval_ms)
+    {
+        interval_ms = OTA_SCHEDULE_ROLLOUT_INTERVAL_MS;
+    }
+
+    if (last_rssi != 0 && last_rssi < OTA_SCHEDULE_WEAK_RSSI_DBM)
+    {
+        interval_ms *= OTA_SCHEDULE_WEAK_LINK_FACTOR;
+    }
+
+    taskEXIT_CRITICAL(&schedule_lock);
+
+    // The server already spreads its hints
+    uint32_t next_ms = hint_ms > 0 ? clamp_interval(hint_ms) : add_jitter(clamp_interval(interval_ms));
+
+    // Nothing runs before the time a Retry-After asked for
+    if (retry_after_ms > next_ms)
+    {
+        next_ms = clamp_interval(retry_after_ms);
+    }
+    return next_ms;
+}
+
+void ota_schedule_report_result(ota_schedule_kind_t kind, esp_err_t result)
+{
+    if (kind >= OTA_SCHEDULE_COUNT)
+    {
+        return;
+    }
+
+    taskENTER_CRITICAL(&schedule_lock);
+    if (result == ESP_OK)
+    {
+        schedules[kind].consecutive_errors = 0;
+    }
+    else
+    {
+        schedules[kind].consecutive_errors++;
+    }
+    taskEXIT_CRITICAL(&schedule_lock);
+}
+
+void ota_schedule_set_hint(ota_schedule_kind_t kind, uint32_t delay_sec)
+{
+    if (kind >= OTA_SCHEDULE_COUNT || delay_sec == 0)
+    {
+        return;
+    }
+
+    uint64_t hint_ms = (uint64_t)delay_sec * 1000;
+
+    taskENTER_CRITICAL(&schedule_lock);
+    schedules[kind].hint_ms = hint_ms > UINT32_MAX ? UINT32_MAX : (uint32_t)hint_ms;
+    taskEXIT_CRITICAL(&schedule_lock);
+
+    ESP_LOGD(TAG, "Server hint for %s: %lu s", kind == OTA_SCHEDULE_CHECK ? "check" : "heartbeat",
+             (unsigned long)delay_sec);
+}
+
+void ota_schedule_set_throttled(bool value)
+{
+    if (value != throttled)
+    {
+        ESP_LOGI(TAG, "Backend %s", value ? "reports load, backing off" : "load cleared");
+    }
+
+    taskENTER_CRITICAL(&schedule_lock);
+    throttled = value;
+    taskEXIT_CRITICAL(&schedule_lock);
+}
+
+void ota_schedule_set_retry_after(uint32_t delay_sec)
+{
+    int64_t until_us = esp_timer_get_time() + (int64_t)delay_sec * 1000000;
+
+    taskENTER_CRITICAL(&schedule_lock);
+    if (until_us > retry_after_until_us)
+    {
+        retry_after_until_us = until_us;
+    }
+    taskEXIT_CRITICAL(&schedule_lock);
+
+    ESP_LOGI(TAG, "Backend asked to retry after %lu s", (unsigned long)delay_sec);
+}
+
+void ota_schedule_set_rollout_active(bool active)
+{
+    taskENTER_CRITICAL(&schedule_lock);
+    rollout_active = active;
+    taskEXIT_CRITICAL(&schedule_lock);
+}
+
+void ota_schedule_report_rssi(int rssi)
+{
+    taskENTER_CRITICAL(&schedule_lock);
+    last_rssi = rssi;
+    taskEXIT_CRITICAL(&schedule_lock);
+}
+
+void ota_schedule_set_online(bool value)
+{
+    if (value != online)
+    {
+        ESP_LOGI(TAG, "Network %s", value ? "up" : "down, pausing checks and heartbeats");
+    }
+
+    taskENTER_CRITICAL(&schedule_lock);
+    online = value;
+    taskEXIT_CRITICAL(&schedule_lock);
+}
+
+bool ota_schedule_is_online(void)
+{
+    taskENTER_CRITICAL(&schedule_lock);
+    bool value = online;
+    taskEXIT_CRITICAL(&schedule_lock);
+    return value;
+}
@@ -0,0 +1,108 @@
+#ifndef OTA_SCHEDULE_H
+#define OTA_SCHEDULE_H
+
+#include "ota_config.h"
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Periodic activities driven by the adaptive scheduler
+ */
+typedef enum {
+    OTA_SCHEDULE_CHECK,     // Firmware update check
+    OTA_SCHEDULE_HEARTBEAT, // Heartbeat
+    OTA_SCHEDULE_COUNT
+} ota_schedule_kind_t;
+
+/**
+ * @brief Initialize the adaptive scheduler
+ *
+ * Clears errors, hints, backoff requests and link readings; the network state
+ * set with ota_schedule_set_online() is kept.
+ *
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_schedule_init(void);
+
+/**
+ * @brief Compute the delay until the next run of an activity
+ *
+ * Starts from OTA_CHECK_INTERVAL_MS or OTA_HEARTBEAT_INTERVAL_MS. A pending
+ * server hint is used as is. Otherwise, while the backend reports load, the
+ * interval is OTA_SCHEDULE_THROTTLE_FACTOR times the regular one; if not,
+ * it shortens after errors and, for checks, during an active rollout. It then
+ * lengthens on a weak link, is clamped to
+ * [OTA_SCHEDULE_MIN_INTERVAL_MS, OTA_SCHEDULE_MAX_INTERVAL_MS] and gets
+ * +/- OTA_SCHEDULE_JITTER_PERCENT of random jitter. The result never ends
+ * before a pending Retry-After, up to OTA_SCHEDULE_MAX_INTERVAL_MS.
+ *
+ * @param kind Activity
+ * @return Delay in milliseconds
+ */
+uint32_t ota_schedule_next_interval_ms(ota_schedule_kind_t kind);
+
+/**
+ * @brief Report the outcome of a run
+ * @param kind Activity
+ * @param result ESP_OK on success, error code otherwise
+ */
+void ota_schedule_report_result(ota_schedule_kind_t kind, esp_err_t result);
+
+/**
+ * @brief Apply a server-provided nextCheckIn hint to the next interval
+ * @param kind Activity
+ * @param delay_sec Requested delay in seconds
+ */
+void ota_schedule_set_hint(ota_schedule_kind_t kind, uint32_t delay_sec);
+
+/**
+ * @brief Record whether the backend asked devices to back off
+ * @param throttled True while the backend reports load
+ */
+void ota_schedule_set_throttled(bool throttled);
+
+/**
+ * @brief Hold off every activity after the backend sent Retry-After
+ * @param delay_sec Seconds from now before the next request
+ */
+void ota_schedule_set_retry_after(uint32_t delay_sec);
+
+/**
+ * @brief Record whether a firmware rollout is active for this device
+ * @param active True while a rollout is active
+ */
+void ota_schedule_set_rollout_active(bool active);
+
+/**
+ * @brief Record the current WiFi signal strength
+ * @param rssi RSSI in dBm
+ */
+void ota_schedule_report_rssi(int rssi);
+
+/**
+ * @brief Record whether the station has an IP address
+ *
+ * While offline, ota_schedule_next_interval_ms() returns
+ * OTA_SCHEDULE_MAX_INTERVAL_MS so jobs stay parked until the network-up
+ * event expedites them.
+ *
+ * @param online True while the station has an IP address
+ */
+void ota_schedule_set_online(bool online);
+
+/**
+ * @brief Check whether the station has an IP address
+ * @return True while online
+ */
+bool ota_schedule_is_online(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_SCHEDULE_H
@@ -0,0 +1,438 @@
+#include "ota_settings.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "ota_settings";
+
+#define NVS_NAMESPACE "ota_settings"
+
+typedef enum
+{
+    SETTING_NUMBER,
+    SETTING_BOOL,
+    SETTING_STRING,
+} setting_type_t;
+
+typedef struct
+{
+    const char *json_key; // Key in remote deltas
+    const char *nvs_key;  // Key of the override in NVS, at most 15 characters
+    setting_type_t type;
+    uint32_t min;
+    uint32_t max;
+    uint32_t default_number;
+    const char *default_text;
+    int text_slot;   // Index into texts for string settings
+    bool local_only; // Cannot be changed by a remote delta
+} setting_def_t;
+
+static const setting_def_t defs[OTA_SETTING_COUNT] = {
+    // A spoofed response must not be able to redirect the device for good
+    [OTA_SETTING_SERVER_URL] = {"serverUrl", "server_url", SETTING_STRING, .default_text = OTA_SERVER_BASE_URL,
+                                .text_slot = 0, .local_only = true},
+    [OTA_SETTING_DEVICE_ID] = {"deviceId", "device_id", SETTING_STRING, .default_text = DEVICE_ID, .text_slot = 1,
+                               .local_only = true},
+    [OTA_SETTING_SERVER_TIMEOUT_MS] = {"serverTimeoutMs", "timeout_ms", SETTING_NUMBER, 1000, 600000,
+                                       OTA_SERVER_TIMEOUT_MS},
+    [OTA_SETTING_CHECK_INTERVAL_MS] = {"checkIntervalMs", "check_ms", SETTING_NUMBER, OTA_SCHEDULE_MIN_INTERVAL_MS,
+                                       OTA_SCHEDULE_MAX_INTERVAL_MS, OTA_CHECK_INTERVAL_MS},
+    [OTA_SETTING_HEARTBEAT_INTERVAL_MS] = {"heartbeatIntervalMs", "heartbeat_ms", SETTING_NUMBER,
+                                           OTA_SCHEDULE_MIN_INTERVAL_MS, OTA_SCHEDULE_MAX_INTERVAL_MS,
+                                           OTA_HEARTBEAT_INTERVAL_MS},
+    [OTA_SETTING_METRICS_ENABLED] = {"metricsEnabled", "metrics", SETTING_BOOL, 0, 1, OTA_METRICS_ENABLED},
+    [OTA_SETTING_LOGGING_ENABLED] = {"loggingEnabled", "logging", SETTING_BOOL, 0, 1, OTA_LOGGING_ENABLED},
+    [OTA_SETTING_LOG_LEVEL] = {"logLevel", "log_level", SETTING_NUMBER, OTA_LOG_LEVEL_INFO, OTA_LOG_LEVEL_FATAL,
+                               OTA_REMOTE_LOG_LEVEL},
+    [OTA_SETTING_TRACING_ENABLED] = {"tracingEnabled", "tracing", SETTING_BOOL, 0, 1, OTA_TRACING_ENABLED},
+    [OTA_SETTING_TRACE_SAMPLE_PERCENT] = {"traceSamplePercent", "trace_sample", SETTING_NUMBER, 0, 100,
+                                          OTA_TRACE_SAMPLE_PERCENT},
+};
+
+#define TEXT_SLOTS 2
+
+// Current values, starting from the defaults above
+static uint32_t numbers[OTA_SETTING_COUNT] = {
+    [OTA_SETTING_SERVER_TIMEOUT_MS] = OTA_SERVER_TIMEOUT_MS,
+    [OTA_SETTING_CHECK_INTERVAL_MS] = OTA_CHECK_INTERVAL_MS,
+    [OTA_SETTING_HEARTBEAT_INTERVAL_MS] = OTA_HEARTBEAT_INTERVAL_MS,
+    [OTA_SETTING_METRICS_ENABLED] = OTA_METRICS_ENABLED,
+    [OTA_SETTING_LOGGING_ENABLED] = OTA_LOGGING_ENABLED,
+    [OTA_SETTING_LOG_LEVEL] = OTA_REMOTE_LOG_LEVEL,
+    [OTA_SETTING_TRACING_ENABLED] = OTA_TRACING_ENABLED,
+    [OTA_SETTING_TRACE_SAMPLE_PERCENT] = OTA_TRACE_SAMPLE_PERCENT,
+};
+static char texts[TEXT_SLOTS][OTA_SETTINGS_TEXT_SIZE] = {OTA_SERVER_BASE_URL, DEVICE_ID};
+
+// Values are read from every plugin task and changed by the executor or the application
+static portMUX_TYPE settings_lock = portMUX_INITIALIZER_UNLOCKED;
+
+typedef struct
+{
+    ota_settings_listener_t listener;
+    void *ctx;
+} listener_slot_t;
+
+static listener_slot_t listeners[OTA_SETTINGS_MAX_LISTENERS];
+
+// A change set: which settings it touches and their new values
+typedef struct
+{
+    bool present[OTA_SETTING_COUNT];
+    uint32_t numbers[OTA_SETTING_COUNT];
+    const char *texts[OTA_SETTING_COUNT];
+} settings_delta_t;
+
+_Static_assert(sizeof(OTA_SERVER_BASE_URL) <= OTA_SETTINGS_TEXT_SIZE, "Default server URL too long");
+_Static_assert(sizeof(DEVICE_ID) <= OTA_SETTINGS_TEXT_SIZE, "Default device ID too long");
+
+static bool is_valid(ota_setting_t setting, uint32_t number, const char *text)
+{
+    const setting_def_t *def = &defs[setting];
+
+    if (def->type != SETTING_STRING)
+    {
+        return number >= def->min && number <= def->max;
+    }
+
+    size_t length = text ? strlen(text) : 0;
+    if (length == 0 || length >= OTA_SETTINGS_TEXT_SIZE)
+    {
+        return false;
+    }
+    if (setting == OTA_SETTING_SERVER_URL)
+    {
+        return strncmp(text, "http://", 7) == 0 || strncmp(text, "https://", 8) == 0;
+    }
+    return true;
+}
+
+static void notify(const bool changed[OTA_SETTING_COUNT])
+{
+    listener_slot_t slots[OTA_SETTINGS_MAX_LISTENERS];
+
+    taskENTER_CRITICAL(&settings_lock);
+    memcpy(slots, listeners, sizeof(slots));
+    taskEXIT_CRITICAL(&settings_lock);
+
+    for (int setting = 0; setting < OTA_SETTING_COUNT; setting++)
+    {
+        if (!changed[setting])
+        {
+            continue;
+        }
+        for (int i = 0; i < OTA_SETTINGS_MAX_LISTENERS && slots[i].listener; i++)
+        {
+            slots[i].listener((ota_setting_t)setting, slots[i].ctx);
+        }
+    }
+}
+
+static esp_err_t persist(const settings_delta_t *delta)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    for (int setting = 0; setting < OTA_SETTING_COUNT && err == ESP_OK; setting++)
+    {
+        if (!delta->present[setting])
+        {
+            continue;
+        }
+        if (defs[setting].type == SETTING_STRING)
+        {
+            err = nvs_set_str(nvs_handle, defs[setting].nvs_key, delta->texts[setting]);
+        }
+        else
+        {
+            err = nvs_set_u32(nvs_handle, defs[setting].nvs_key, delta->numbers[setting]);
+        }
+    }
+
+    // One commit for the whole delta
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+    return err;
+}
+
+// Validate everything first so a delta is applied whole or not at all
+static esp_err_t apply(const settings_delta_t *delta, bool store)
+{
+    for (int setting = 0; setting < OTA_SETTING_COUNT; setting++)
+    {
+        if (delta->present[setting] && !is_valid(setting, delta->numbers[setting], delta->texts[setting]))
+        {
+            ESP_LOGW(TAG, "Rejected invalid value for %s", defs[setting].json_key);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    bool changed[OTA_SETTING_COUNT] = {false};
+    bool any_changed = false;
+
+    taskENTER_CRITICAL(&settings_lock);
+    for (int setting = 0; setting < OTA_SETTING_COUNT; setting++)
+    {
+        if (!delta->present[setting])
+        {
+            continue;
+        }
+        if (defs[setting].type == SETTING_STRING)
+        {
+            char *text = texts[defs[setting].text_slot];
+            changed[setting] = strcmp(text, delta->texts[setting]) != 0;
+            strcpy(text, delta->texts[setting]); // Length checked by is_valid
+        }
+        else
+        {
+            changed[setting] = numbers[setting] != delta->numbers[setting];
+            numbers[setting] = delta->numbers[setting];
+        }
+        any_changed |= changed[setting];
+    }
+    taskEXIT_CRITICAL(&settings_lock);
+
+    if (!any_changed)
+    {
+        return ESP_OK;
+    }
+
+    for (int setting = 0; setting < OTA_SETTING_COUNT; setting++)
+    {
+        if (changed[setting])
+        {
+            ESP_LOGI(TAG, "Setting %s changed", defs[setting].json_key);
+        }
+    }
+
+    // The new values are live even if they could not be stored
+    if (store)
+    {
+        esp_err_t err = persist(delta);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to store settings: %s", esp_err_to_name(err));
+        }
+    }
+
+    notify(changed);
+    return ESP_OK;
+}
+
+esp_err_t ota_settings_init(void)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        return ESP_OK; // No overrides yet
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not open NVS, using defaults: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    settings_delta_t stored = {0};
+    char stored_texts[TEXT_SLOTS][OTA_SETTINGS_TEXT_SIZE];
+    int overrides = 0;
+
+    for (int setting = 0; setting < OTA_SETTING_COUNT; setting++)
+    {
+        const setting_def_t *def = &defs[setting];
+        if (def->type == SETTING_STRING)
+        {
+            size_t size = OTA_SETTINGS_TEXT_SIZE;
+            char *text = stored_texts[def->text_slot];
+            stored.present[setting] = nvs_get_str(nvs_handle, def->nvs_key, text, &size) == ESP_OK;
+            stored.texts[setting] = text;
+        }
+        else
+        {
+            stored.present[setting] = nvs_get_u32(nvs_handle, def->nvs_key, &stored.numbers[setting]) == ESP_OK;
+        }
+
+        // A value stored by firmware with wider limits falls back to the default
+        if (stored.present[setting] && !is_valid(setting, stored.numbers[setting], stored.texts[setting]))
+        {
+            ESP_LOGW(TAG, "Ignoring stored %s: out of range", def->json_key);
+            stored.present[setting] = false;
+        }
+        overrides += stored.present[setting];
+    }
+    nvs_close(nvs_handle);
+
+    ESP_LOGI(TAG, "Loaded %d setting overrides", overrides);
+    return apply(&stored, false);
+}
+
+uint32_t ota_settings_get_u32(ota_setting_t setting)
+{
+    if (setting >= OTA_SETTING_COUNT)
+    {
+        return 0;
+    }
+
+    // Aligned 32-bit reads do not tear
+    return numbers[setting];
+}
+
+bool ota_settings_get_bool(ota_setting_t setting)
+{
+    return ota_settings_get_u32(setting) != 0;
+}
+
+void ota_settings_get_str(ota_setting_t setting, char *buffer, size_t buffer_size)
+{
+    if (!buffer || buffer_size == 0)
+    {
+        return;
+    }
+    buffer[0] = '\0';
+    if (setting >= OTA_SETTING_COUNT || defs[setting].type != SETTING_STRING)
+    {
+        return;
+    }
+
+    taskENTER_CRITICAL(&settings_lock);
+    strncpy(buffer, texts[defs[setting].text_slot], buffer_size - 1);
+    taskEXIT_CRITICAL(&settings_lock);
+    buffer[buffer_size - 1] = '\0';
+}
+
+esp_err_t ota_settings_set_u32(ota_setting_t setting, uint32_t value)
+{
+    if (setting >= OTA_SETTING_COUNT || defs[setting].type == SETTING_STRING)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    settings_delta_t delta = {0};
+    delta.present[setting] = true;
+    delta.numbers[setting] = value;
+    return apply(&delta, true);
+}
+
+esp_err_t ota_settings_set_str(ota_setting_t setting, const char *value)
+{
+    if (setting >= OTA_SETTING_COUNT || defs[setting].type != SETTING_STRING)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    settings_delta_t delta = {0};
+    delta.present[setting] = true;
+    delta.texts[setting] = value;
+    return apply(&delta, true);
+}
+
+esp_err_t ota_settings_apply_json(const cJSON *json)
+{
+    if (!cJSON_IsObject(json))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    settings_delta_t delta = {0};
+    for (int setting = 0; setting < OTA_SETTING_COUNT; setting++)
+    {
+        const setting_def_t *def = &defs[setting];
+        cJSON *item = cJSON_GetObjectItem(json, def->json_key);
+        if (!item)
+        {
+            continue;
+        }
+
+        if (def->local_only)
+        {
+            ESP_LOGW(TAG, "Rejected settings delta: %s can only be changed on the device", def->json_key);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        bool well_typed = false;
+        switch (def->type)
+        {
+        case SETTING_NUMBER:
+            well_typed = cJSON_IsNumber(item) && item->valuedouble >= 0 && item->valuedouble <= UINT32_MAX;
+            delta.numbers[setting] = well_typed ? (uint32_t)item->valuedouble : 0;
+            break;
+        case SETTING_BOOL:
+            well_typed = cJSON_IsBool(item);
+            delta.numbers[setting] = cJSON_IsTrue(item);
+            break;
+        case SETTING_STRING:
+            well_typed = cJSON_IsString(item);
+            delta.texts[setting] = well_typed ? item->valuestring : NULL;
+            break;
+        }
+
+        if (!well_typed)
+        {
+            ESP_LOGW(TAG, "Rejected settings delta: %s has the wrong type", def->json_key);
+            return ESP_ERR_INVALID_ARG;
+        }
+        delta.present[setting] = true;
+    }
+
+    return apply(&delta, true);
+}
+
+esp_err_t ota_settings_reset(void)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err == ESP_OK)
+    {
+        err = nvs_erase_all(nvs_handle);
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to erase settings: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    settings_delta_t defaults = {0};
+    for (int setting = 0; setting < OTA_SETTING_COUNT; setting++)
+    {
+        defaults.present[setting] = true;
+        defaults.numbers[setting] = defs[setting].default_number;
+        defaults.texts[setting] = defs[setting].default_text;
+    }
+    return apply(&defaults, false);
+}
+
+esp_err_t ota_settings_add_listener(ota_settings_listener_t listener, void *ctx)
+{
+    if (!listener)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_ERR_NO_MEM;
+    taskENTER_CRITICAL(&settings_lock);
+    for (int i = 0; i < OTA_SETTINGS_MAX_LISTENERS; i++)
+    {
+        if (!listeners[i].listener)
+        {
+            listeners[i] = (listener_slot_t){listener, ctx};
+            err = ESP_OK;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&settings_lock);
+    return err;
+}
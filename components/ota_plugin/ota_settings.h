@@ -0,0 +1,121 @@
+#ifndef OTA_SETTINGS_H
+#define OTA_SETTINGS_H
+
+#include "ota_config.h"
+#include "esp_err.h"
+#include "cJSON.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Runtime configuration. Defaults come from Kconfig through ota_config.h,
+ * overrides are kept in NVS and survive restarts, and the backend can send
+ * deltas in heartbeat responses. Every change is validated before it is
+ * applied, and applied without a restart.
+ */
+
+typedef enum {
+    OTA_SETTING_SERVER_URL,            // String: backend base URL
+    OTA_SETTING_DEVICE_ID,             // String: device ID sent with every request
+    OTA_SETTING_SERVER_TIMEOUT_MS,     // Number: HTTP request timeout
+    OTA_SETTING_CHECK_INTERVAL_MS,     // Number: baseline update check interval
+    OTA_SETTING_HEARTBEAT_INTERVAL_MS, // Number: baseline heartbeat interval
+    OTA_SETTING_METRICS_ENABLED,       // Bool: send metrics with heartbeats
+    OTA_SETTING_LOGGING_ENABLED,       // Bool: send logs to the backend
+    OTA_SETTING_LOG_LEVEL,             // Number: lowest ota_log_level_t sent to the backend
+    OTA_SETTING_TRACING_ENABLED,       // Bool: record and export spans
+    OTA_SETTING_TRACE_SAMPLE_PERCENT,  // Number: head sampling rate, 0 - 100
+    OTA_SETTING_COUNT
+} ota_setting_t;
+
+/**
+ * @brief Called after a setting changed
+ * @param setting Setting that changed
+ * @param ctx Context passed to ota_settings_add_listener()
+ */
+typedef void (*ota_settings_listener_t)(ota_setting_t setting, void* ctx);
+
+/**
+ * @brief Load the overrides stored in NVS
+ *
+ * Stored values that no longer pass validation are ignored.
+ *
+ * @return ESP_OK on success, error code otherwise (defaults stay in effect)
+ */
+esp_err_t ota_settings_init(void);
+
+/**
+ * @brief Read a number setting
+ * @param setting Setting
+ * @return Current value, 0 for string settings
+ */
+uint32_t ota_settings_get_u32(ota_setting_t setting);
+
+/**
+ * @brief Read a bool setting
+ * @param setting Setting
+ * @return Current value
+ */
+bool ota_settings_get_bool(ota_setting_t setting);
+
+/**
+ * @brief Copy a string setting
+ * @param setting Setting
+ * @param buffer Output
+ * @param buffer_size Size of buffer
+ */
+void ota_settings_get_str(ota_setting_t setting, char* buffer, size_t buffer_size);
+
+/**
+ * @brief Change a number or bool setting and store it in NVS
+ * @param setting Setting
+ * @param value New value
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the value is out of range
+ */
+esp_err_t ota_settings_set_u32(ota_setting_t setting, uint32_t value);
+
+/**
+ * @brief Change a string setting and store it in NVS
+ * @param setting Setting
+ * @param value New value
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the value is rejected
+ */
+esp_err_t ota_settings_set_str(ota_setting_t setting, const char* value);
+
+/**
+ * @brief Apply a delta such as { "heartbeatIntervalMs": 120000 }
+ *
+ * All or nothing: if any known key has an invalid value, or is serverUrl or
+ * deviceId, which only the device itself can change, nothing changes.
+ * Unknown keys are ignored so newer backends can address newer firmware.
+ * The changed settings are stored with one NVS commit.
+ *
+ * @param delta JSON object keyed by setting name
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the delta was rejected
+ */
+esp_err_t ota_settings_apply_json(const cJSON* delta);
+
+/**
+ * @brief Drop all overrides and return to the Kconfig defaults
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_settings_reset(void);
+
+/**
+ * @brief Get notified of setting changes
+ * @param listener Called in the context that made the change
+ * @param ctx Passed to the listener
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if OTA_SETTINGS_MAX_LISTENERS are registered
+ */
+esp_err_t ota_settings_add_listener(ota_settings_listener_t listener, void* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_SETTINGS_H
@@ -0,0 +1,214 @@
+#include "ota_state.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "ota_state";
+
+#define NVS_NAMESPACE "ota_plugin"
+#define NVS_KEY_STATE "state"
+
+// Separate keys written before the state blob existed
+#define NVS_KEY_UPDATE_STATUS "update_status"
+#define NVS_KEY_LAST_VERSION "last_version"
+#define NVS_KEY_CURRENT_VERSION "current_version"
+
+static ota_state_t state = {
+    .layout = OTA_STATE_LAYOUT_VERSION,
+    .size = sizeof(ota_state_t),
+    .firmware_version = OTA_FIRMWARE_VERSION,
+};
+static bool dirty = false;
+
+// The cache is updated by the executor and read by API callers
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void copy_field(char *dest, size_t size, const char *src)
+{
+    strncpy(dest, src ? src : "", size - 1);
+    dest[size - 1] = '\0';
+}
+
+// Read the keys written before the state blob existed
+static bool read_legacy_keys(nvs_handle_t nvs_handle, ota_state_t *out)
+{
+    size_t size = sizeof(out->firmware_version);
+    if (nvs_get_str(nvs_handle, NVS_KEY_CURRENT_VERSION, out->firmware_version, &size) != ESP_OK)
+    {
+        // First boot
+        copy_field(out->firmware_version, sizeof(out->firmware_version), OTA_FIRMWARE_VERSION);
+        return false;
+    }
+
+    size = sizeof(out->update_status);
+    if (nvs_get_str(nvs_handle, NVS_KEY_UPDATE_STATUS, out->update_status, &size) != ESP_OK)
+    {
+        out->update_status[0] = '\0';
+    }
+
+    size = sizeof(out->last_version);
+    if (nvs_get_str(nvs_handle, NVS_KEY_LAST_VERSION, out->last_version, &size) != ESP_OK)
+    {
+        out->last_version[0] = '\0';
+    }
+
+    return true;
+}
+
+// A record written by a newer layout: keep the fields this one knows. NVS
+// only reads a blob whole, so it goes through a temporary buffer once at boot
+static esp_err_t read_newer_record(nvs_handle_t nvs_handle, size_t stored_size, ota_state_t *out)
+{
+    uint8_t *record = malloc(stored_size);
+    if (!record)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = nvs_get_blob(nvs_handle, NVS_KEY_STATE, record, &stored_size);
+    if (err == ESP_OK)
+    {
+        memcpy(out, record, sizeof(*out));
+    }
+    free(record);
+    return err;
+}
+
+esp_err_t ota_state_load(void)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Could not open NVS, using default firmware version: %s", OTA_FIRMWARE_VERSION);
+        return err;
+    }
+
+    ota_state_t loaded = {0};
+    size_t size = 0;
+    err = nvs_get_blob(nvs_handle, NVS_KEY_STATE, NULL, &size);
+    bool newer = err == ESP_OK && size > sizeof(loaded);
+    if (newer)
+    {
+        err = read_newer_record(nvs_handle, size, &loaded);
+    }
+    else if (err == ESP_OK)
+    {
+        err = nvs_get_blob(nvs_handle, NVS_KEY_STATE, &loaded, &size);
+    }
+
+    // Fields added since an older blob was written stay zeroed. A newer blob
+    // is left as written, for the firmware that wrote it, until the state
+    // next changes
+    bool valid = err == ESP_OK && loaded.size == size &&
+                 (newer ? loaded.layout > OTA_STATE_LAYOUT_VERSION : loaded.layout <= OTA_STATE_LAYOUT_VERSION);
+    bool current = valid && loaded.layout >= OTA_STATE_LAYOUT_VERSION;
+    bool migrated = false;
+    if (!valid)
+    {
+        memset(&loaded, 0, sizeof(loaded));
+        migrated = read_legacy_keys(nvs_handle, &loaded);
+    }
+
+    loaded.layout = OTA_STATE_LAYOUT_VERSION;
+    loaded.size = sizeof(ota_state_t);
+
+    err = ESP_OK;
+    if (!current)
+    {
+        // Write the record before dropping the keys it replaces, in one commit
+        err = nvs_set_blob(nvs_handle, NVS_KEY_STATE, &loaded, sizeof(loaded));
+        if (err == ESP_OK && migrated)
+        {
+            ESP_LOGI(TAG, "Migrated legacy NVS keys into the state record");
+            nvs_erase_key(nvs_handle, NVS_KEY_CURRENT_VERSION);
+            nvs_erase_key(nvs_handle, NVS_KEY_UPDATE_STATUS);
+            nvs_erase_key(nvs_handle, NVS_KEY_LAST_VERSION);
+        }
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs_handle);
+        }
+    }
+
+    nvs_close(nvs_handle);
+
+    taskENTER_CRITICAL(&state_lock);
+    state = loaded;
+    dirty = err != ESP_OK;
+    taskEXIT_CRITICAL(&state_lock);
+
+    ESP_LOGI(TAG, "Loaded state: firmware %s%s%s", loaded.firmware_version,
+             loaded.update_status[0] ? ", pending status " : "", loaded.update_status);
+
+    return err;
+}
+
+void ota_state_get(ota_state_t *out)
+{
+    taskENTER_CRITICAL(&state_lock);
+    *out = state;
+    taskEXIT_CRITICAL(&state_lock);
+}
+
+void ota_state_set_firmware_version(const char *version)
+{
+    taskENTER_CRITICAL(&state_lock);
+    if (strncmp(state.firmware_version, version, sizeof(state.firmware_version) - 1) != 0)
+    {
+        copy_field(state.firmware_version, sizeof(state.firmware_version), version);
+        dirty = true;
+    }
+    taskEXIT_CRITICAL(&state_lock);
+}
+
+void ota_state_set_update_status(const char *status, const char *version)
+{
+    taskENTER_CRITICAL(&state_lock);
+    copy_field(state.update_status, sizeof(state.update_status), status);
+    copy_field(state.last_version, sizeof(state.last_version), version);
+    dirty = true;
+    taskEXIT_CRITICAL(&state_lock);
+}
+
+esp_err_t ota_state_commit(void)
+{
+    ota_state_t snapshot;
+
+    taskENTER_CRITICAL(&state_lock);
+    bool was_dirty = dirty;
+    snapshot = state;
+    dirty = false;
+    taskEXIT_CRITICAL(&state_lock);
+
+    if (!was_dirty)
+    {
+        return ESP_OK;
+    }
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err == ESP_OK)
+    {
+        // One blob, one commit: the record is replaced as a whole
+        err = nvs_set_blob(nvs_handle, NVS_KEY_STATE, &snapshot, sizeof(snapshot));
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to commit state: %s", esp_err_to_name(err));
+        taskENTER_CRITICAL(&state_lock);
+        dirty = true;
+        taskEXIT_CRITICAL(&state_lock);
+    }
+
+    return err;
+}
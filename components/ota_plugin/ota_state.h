@@ -0,0 +1,74 @@
+#ifndef OTA_STATE_H
+#define OTA_STATE_H
+
+#include "ota_config.h"
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Layout of the NVS state record; bump when appending fields
+#define OTA_STATE_LAYOUT_VERSION 1
+
+/**
+ * @brief Persistent plugin state, stored as one NVS blob
+ *
+ * Fields are only ever appended; a blob written by an older layout loads
+ * with the new fields zeroed, and one written by a newer layout (after a
+ * rollback) loads the fields this layout knows.
+ */
+typedef struct {
+    uint16_t layout;           // OTA_STATE_LAYOUT_VERSION of the writer
+    uint16_t size;             // sizeof(ota_state_t) of the writer
+    char firmware_version[32]; // Version of the running (or just installed) firmware
+    char update_status[16];    // Update outcome to report after boot, empty if none
+    char last_version[32];     // Version the pending status refers to
+} ota_state_t;
+
+/**
+ * @brief Load the state into the RAM cache
+ *
+ * Migrates the separate keys written by earlier firmware on first use. On
+ * first boot the cache starts from OTA_FIRMWARE_VERSION and is committed.
+ *
+ * @return ESP_OK on success, error code otherwise (the cache is still usable)
+ */
+esp_err_t ota_state_load(void);
+
+/**
+ * @brief Copy the cached state
+ * @param state Output
+ */
+void ota_state_get(ota_state_t* state);
+
+/**
+ * @brief Set the firmware version
+ * @param version Firmware version
+ */
+void ota_state_set_firmware_version(const char* version);
+
+/**
+ * @brief Set the update outcome to report after the next boot
+ * @param status Status ("COMPLETED", "FAILED"), NULL or empty to clear
+ * @param version Version the status refers to (can be NULL)
+ */
+void ota_state_set_update_status(const char* status, const char* version);
+
+/**
+ * @brief Write the cached state to NVS if it changed
+ *
+ * Setters only mark the cache dirty; call this once per state transition
+ * so a transition costs one NVS commit.
+ *
+ * @return ESP_OK on success or if nothing changed, error code otherwise
+ */
+esp_err_t ota_state_commit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_STATE_H
@@ -1,35 +1,60 @@
 #include "ota_status.h"
 #include "ota_config.h"
 #include "ota_http_client.h"
+#include "ota_trace.h"
+#include "ota_prof.h"
+#include "ota_metrics.h"
+#include "ota_sysmon.h"
+#include "ota_schedule.h"
+#include "ota_executor.h"
+#include "ota_event.h"
+#include "ota_settings.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
 #include "esp_netif.h"
 #include "esp_timer.h"
 #include "esp_mac.h"
+#include "esp_random.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "cJSON.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 
 static const char *TAG = "ota_status";
 
-static TaskHandle_t heartbeat_task_handle = NULL;
+static ota_executor_job_t heartbeat_job_handle = OTA_EXECUTOR_INVALID_JOB;
 static bool heartbeat_running = false;
 static int64_t plugin_start_time = 0;
+static bool first_heartbeat_recorded = false;
 
-// Metrics collection
+// Delta heartbeat state, owned by heartbeat_job
 typedef struct
 {
-    char name[32];
+    uint32_t name_hash;
     float value;
-    char unit[16];
-} ota_metric_t;
-
-static ota_metric_t custom_metrics[10];
-static int custom_metrics_count = 0;
-
-static esp_err_t get_device_ip(char *ip_str, size_t ip_str_size)
+} sent_metric_t;
+
+static char session_id[17];
+static uint32_t heartbeat_seq = 0;
+static bool resync_pending = true;
+static atomic_bool resync_pushed = false; // Set from the transport's task
+static char sent_ip[16];
+static sent_metric_t sent_metrics[OTA_HEARTBEAT_DELTA_SLOTS];
+static int sent_metric_count = 0;
+static sent_metric_t staged_metrics[OTA_HEARTBEAT_DELTA_SLOTS];
+static int staged_metric_count = 0;
+
+// Windows read into the heartbeat in flight; they are only dropped once the
+// heartbeat is delivered, so a failed send carries them over to the next one
+static ota_metric_snapshot_t read_metrics[OTA_METRICS_CAPACITY];
+static size_t read_metric_count = 0;
+static ota_trace_latency_summary_t read_latency[OTA_TRACE_HISTOGRAM_SLOTS];
+static size_t read_latency_count = 0;
+static ota_prof_stat_t read_prof[OTA_PROF_MAX_SITES];
+static size_t read_prof_count = 0;
+
+esp_err_t ota_status_get_device_ip(char *ip_str, size_t ip_str_size)
 {
     esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
     if (netif == NULL)
@@ -48,11 +73,6 @@ static esp_err_t get_device_ip(char *ip_str, size_t ip_str_size)
     return ESP_OK;
 }
 
-static float get_fake_battery_percentage(void)
-{
-    return 20.0f + (rand() % 81);
-}
-
 static int get_wifi_signal_strength(void)
 {
     wifi_ap_record_t ap_info;
@@ -64,112 +84,435 @@ static int get_wifi_signal_strength(void)
     return -70; // Default value if can't get real signal
 }
 
-static float get_free_heap_percentage(void)
+static uint32_t hash_metric_name(const char *name)
 {
-    size_t free_heap = esp_get_free_heap_size();
-    size_t min_free_heap = esp_get_minimum_free_heap_size();
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++)
+    {
+        hash ^= (uint8_t)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-    size_t total_heap = free_heap + (free_heap - min_free_heap);
-    if (total_heap == 0)
-        total_heap = free_heap;
+static sent_metric_t *find_sent_metric(sent_metric_t *table, int count, uint32_t name_hash)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (table[i].name_hash == name_hash)
+        {
+            return &table[i];
+        }
+    }
+    return NULL;
+}
 
-    return ((float)free_heap / total_heap) * 100.0f;
+static bool exceeds_deadband(float previous, float current)
+{
+    float threshold = OTA_HEARTBEAT_DEADBAND * (previous < 0 ? -previous : previous);
+    float change = current - previous;
+    return change > threshold || -change > threshold || (threshold == 0 && change != 0);
 }
 
-static char *create_metrics_json(void)
+// The metrics of the heartbeat being encoded
+typedef struct
 {
-    cJSON *metrics_array = cJSON_CreateArray();
+    ota_http_metrics_writer_t *writer;
+    bool full;
+    bool truncated; // The request had no room for a metric; the rest are left out
+} heartbeat_metrics_t;
+
+// Drop a metric that stayed within the deadband of the value last delivered
+// and write and stage the rest; staged values only become the new reference
+// once the server has accepted the heartbeat. A gauge summarizing samples set
+// during the window is always kept, since its count/sum/min/max are not
+// repeated. Returns false if the metric belongs in the heartbeat but was left
+// out, so it is sent again with the next one.
+static bool add_metric_with_window(heartbeat_metrics_t *metrics, const char *name, double value, const char *unit,
+                                   const ota_metric_window_t *window)
+{
+    if (metrics->truncated)
+    {
+        return false;
+    }
 
-    // Add battery metric
-    cJSON *battery_metric = cJSON_CreateObject();
-    cJSON_AddStringToObject(battery_metric, "name", "battery_percentage");
-    cJSON_AddNumberToObject(battery_metric, "value", get_fake_battery_percentage());
-    cJSON_AddStringToObject(battery_metric, "unit", "%");
-    cJSON_AddItemToArray(metrics_array, battery_metric);
+    uint32_t name_hash = hash_metric_name(name);
+    sent_metric_t *sent = find_sent_metric(sent_metrics, sent_metric_count, name_hash);
 
-    // Add WiFi signal strength
-    cJSON *wifi_metric = cJSON_CreateObject();
-    cJSON_AddStringToObject(wifi_metric, "name", "wifi_signal_strength");
-    cJSON_AddNumberToObject(wifi_metric, "value", get_wifi_signal_strength());
-    cJSON_AddStringToObject(wifi_metric, "unit", "dBm");
-    cJSON_AddItemToArray(metrics_array, wifi_metric);
+    bool has_window = window != NULL && window->count > 0;
+    if (!metrics->full && !has_window && sent != NULL && !exceeds_deadband(sent->value, value))
+    {
+        return true;
+    }
 
-    // Add free heap
-    cJSON *heap_metric = cJSON_CreateObject();
-    cJSON_AddStringToObject(heap_metric, "name", "free_heap_percentage");
-    cJSON_AddNumberToObject(heap_metric, "value", get_free_heap_percentage());
-    cJSON_AddStringToObject(heap_metric, "unit", "%");
-    cJSON_AddItemToArray(metrics_array, heap_metric);
+    if (!ota_http_metrics_put(metrics->writer, name, value, unit, window))
+    {
+        ESP_LOGW(TAG, "Heartbeat has no room for %s and later metrics, sending them with the next one", name);
+        metrics->truncated = true;
+        return false;
+    }
 
-    // Add custom metrics
-    for (int i = 0; i < custom_metrics_count; i++)
+    if (staged_metric_count < OTA_HEARTBEAT_DELTA_SLOTS)
     {
-        cJSON *custom_metric = cJSON_CreateObject();
-        cJSON_AddStringToObject(custom_metric, "name", custom_metrics[i].name);
-        cJSON_AddNumberToObject(custom_metric, "value", custom_metrics[i].value);
-        cJSON_AddStringToObject(custom_metric, "unit", custom_metrics[i].unit);
-        cJSON_AddItemToArray(metrics_array, custom_metric);
+        staged_metrics[staged_metric_count].name_hash = name_hash;
+        staged_metrics[staged_metric_count].value = value;
+        staged_metric_count++;
     }
+    return true;
+}
 
-    char *json_string = cJSON_Print(metrics_array);
-    cJSON_Delete(metrics_array);
+static bool add_metric(heartbeat_metrics_t *metrics, const char *name, double value, const char *unit)
+{
+    return add_metric_with_window(metrics, name, value, unit, NULL);
+}
 
-    return json_string;
+static void add_system_metric(const char *name, double value, const char *unit, void *ctx)
+{
+    add_metric((heartbeat_metrics_t *)ctx, name, value, unit);
 }
 
-static void heartbeat_task(void *pvParameters)
+// Windows are only counted as read, and so dropped on delivery, once all of
+// their metrics are in the heartbeat
+static void add_latency_metrics(heartbeat_metrics_t *metrics)
 {
-    char ip_str[16];
+    size_t count = ota_trace_histogram_collect(read_latency, OTA_TRACE_HISTOGRAM_SLOTS, false);
+    char name[96];
 
-    ESP_LOGI(TAG, "Heartbeat task started");
+    for (read_latency_count = 0; read_latency_count < count; read_latency_count++)
+    {
+        const ota_trace_latency_summary_t *summary = &read_latency[read_latency_count];
+        if (summary->count == 0)
+        {
+            continue;
+        }
 
-    while (heartbeat_running)
+        bool added = true;
+        snprintf(name, sizeof(name), "latency.%s.count", summary->operation);
+        added &= add_metric(metrics, name, summary->count, "count");
+        snprintf(name, sizeof(name), "latency.%s.p50", summary->operation);
+        added &= add_metric(metrics, name, summary->p50_us / 1000.0, "ms");
+        snprintf(name, sizeof(name), "latency.%s.p90", summary->operation);
+        added &= add_metric(metrics, name, summary->p90_us / 1000.0, "ms");
+        snprintf(name, sizeof(name), "latency.%s.p99", summary->operation);
+        added &= add_metric(metrics, name, summary->p99_us / 1000.0, "ms");
+        snprintf(name, sizeof(name), "latency.%s.max", summary->operation);
+        added &= add_metric(metrics, name, summary->max_us / 1000.0, "ms");
+        if (!added)
+        {
+            break;
+        }
+    }
+}
+
+static void add_profiling_metrics(heartbeat_metrics_t *metrics)
+{
+    size_t count = ota_prof_snapshot(read_prof, OTA_PROF_MAX_SITES, false);
+    char name[96];
+
+    for (read_prof_count = 0; read_prof_count < count; read_prof_count++)
     {
-        if (get_device_ip(ip_str, sizeof(ip_str)) == ESP_OK)
+        const ota_prof_stat_t *stat = &read_prof[read_prof_count];
+        if (stat->count == 0)
         {
-            char *metrics_json = NULL;
+            continue;
+        }
 
-            if (OTA_METRICS_ENABLED)
-            {
-                metrics_json = create_metrics_json();
-            }
+        bool added = true;
+        snprintf(name, sizeof(name), "prof.%s.count", stat->name);
+        added &= add_metric(metrics, name, stat->count, "count");
+        snprintf(name, sizeof(name), "prof.%s.mean", stat->name);
+        added &= add_metric(metrics, name, ota_prof_cycles_to_us(stat->total_cycles) / stat->count, "us");
+        snprintf(name, sizeof(name), "prof.%s.min", stat->name);
+        added &= add_metric(metrics, name, ota_prof_cycles_to_us(stat->min_cycles), "us");
+        snprintf(name, sizeof(name), "prof.%s.max", stat->name);
+        added &= add_metric(metrics, name, ota_prof_cycles_to_us(stat->max_cycles), "us");
+        if (!added)
+        {
+            break;
+        }
+    }
+}
 
-            uint32_t uptime_sec = (esp_timer_get_time() - plugin_start_time) / 1000000;
+static void add_registered_metrics(heartbeat_metrics_t *metrics)
+{
+    size_t count = ota_metrics_count();
+    char name[OTA_METRICS_NAME_SIZE + 8];
 
-            esp_err_t err = ota_http_send_heartbeat(DEVICE_ID, uptime_sec, ip_str,
-                                                    FIRMWARE_REF, metrics_json);
+    for (read_metric_count = 0; read_metric_count < count; read_metric_count++)
+    {
+        ota_metric_snapshot_t *snapshot = &read_metrics[read_metric_count];
+        if (ota_metrics_snapshot(read_metric_count, snapshot, false) != ESP_OK)
+        {
+            break;
+        }
 
-            if (err == ESP_OK)
-            {
-                ESP_LOGD(TAG, "Heartbeat sent successfully");
-            }
-            else
+        bool added = true;
+        switch (snapshot->type)
+        {
+        case OTA_METRIC_COUNTER:
+            added = add_metric(metrics, snapshot->name, snapshot->value.counter, snapshot->unit);
+            break;
+        case OTA_METRIC_GAUGE:
+            // One summary per gauge: the last value plus the samples set
+            // since the last delivered heartbeat
+            added = add_metric_with_window(metrics, snapshot->name, snapshot->value.gauge.last, snapshot->unit,
+                                           &snapshot->value.gauge);
+            break;
+        case OTA_METRIC_HISTOGRAM:
+            if (snapshot->value.histogram.count == 0)
             {
-                ESP_LOGW(TAG, "Failed to send heartbeat: %s", esp_err_to_name(err));
+                break;
             }
+            snprintf(name, sizeof(name), "%s.count", snapshot->name);
+            added &= add_metric(metrics, name, snapshot->value.histogram.count, "count");
+            snprintf(name, sizeof(name), "%s.p50", snapshot->name);
+            added &= add_metric(metrics, name, snapshot->value.histogram.p50, snapshot->unit);
+            snprintf(name, sizeof(name), "%s.p90", snapshot->name);
+            added &= add_metric(metrics, name, snapshot->value.histogram.p90, snapshot->unit);
+            snprintf(name, sizeof(name), "%s.p99", snapshot->name);
+            added &= add_metric(metrics, name, snapshot->value.histogram.p99, snapshot->unit);
+            snprintf(name, sizeof(name), "%s.max", snapshot->name);
+            added &= add_metric(metrics, name, snapshot->value.histogram.max, snapshot->unit);
+            break;
+        }
+        if (!added)
+        {
+            break;
+        }
+    }
+}
 
-            if (metrics_json)
-            {
-                free(metrics_json);
-            }
+// The heartbeat carrying these windows was delivered; samples recorded while
+// it was in flight stay for the next one
+static void discard_read_windows(void)
+{
+    for (size_t i = 0; i < read_metric_count; i++)
+    {
+        ota_metrics_discard_window(i, &read_metrics[i]);
+    }
+    ota_trace_histogram_discard(read_latency, read_latency_count);
+    ota_prof_discard(read_prof, read_prof_count);
+}
+
+// Called by the HTTP client while it encodes the heartbeat
+static void write_metrics(ota_http_metrics_writer_t *writer, void *ctx)
+{
+    heartbeat_metrics_t *metrics = ctx;
+    metrics->writer = writer;
+
+    // Add WiFi signal strength
+    add_metric(metrics, "wifi_signal_strength", get_wifi_signal_strength(), "dBm");
+
+    // Add per-task CPU and stack usage and per-capability heap state
+    ota_sysmon_collect(add_system_metric, metrics);
+
+    // Add registered metrics
+    add_registered_metrics(metrics);
+
+    // Add span latency percentiles aggregated since the last delivered heartbeat
+    add_latency_metrics(metrics);
+
+    // Add cycle-counter probe statistics accumulated since the last delivered heartbeat
+    add_profiling_metrics(metrics);
+}
+
+static void commit_staged_metrics(bool full)
+{
+    if (full)
+    {
+        sent_metric_count = 0;
+    }
+
+    for (int i = 0; i < staged_metric_count; i++)
+    {
+        sent_metric_t *sent = find_sent_metric(sent_metrics, sent_metric_count, staged_metrics[i].name_hash);
+        if (sent == NULL && sent_metric_count < OTA_HEARTBEAT_DELTA_SLOTS)
+        {
+            sent = &sent_metrics[sent_metric_count++];
+            sent->name_hash = staged_metrics[i].name_hash;
+        }
+        if (sent != NULL)
+        {
+            sent->value = staged_metrics[i].value;
+        }
+    }
+}
+
+static void start_session(void)
+{
+    uint8_t id[8];
+    esp_fill_random(id, sizeof(id));
+    for (size_t i = 0; i < sizeof(id); i++)
+    {
+        snprintf(&session_id[i * 2], 3, "%02x", id[i]);
+    }
+
+    heartbeat_seq = 0;
+    resync_pending = true;
+    sent_ip[0] = '\0';
+    sent_metric_count = 0;
+}
+
+esp_err_t ota_status_send_heartbeat(const char *ip_str)
+{
+    if (!ip_str)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (atomic_exchange(&resync_pushed, false))
+    {
+        resync_pending = true;
+    }
+
+    bool full = resync_pending;
+    heartbeat_metrics_t metrics = {.full = full};
+    bool metrics_enabled = ota_settings_get_bool(OTA_SETTING_METRICS_ENABLED);
+
+    // Filled in while the metrics are written; metrics and windows left out
+    // of the request, or not read because encoding failed first, are neither
+    // delivered nor a reference for the next delta
+    staged_metric_count = 0;
+    read_metric_count = 0;
+    read_latency_count = 0;
+    read_prof_count = 0;
+
+    bool ip_changed = strcmp(ip_str, sent_ip) != 0;
+    uint32_t uptime_sec = (esp_timer_get_time() - plugin_start_time) / 1000000;
+    bool resync = false;
+
+    char device_id[OTA_SETTINGS_TEXT_SIZE];
+    ota_settings_get_str(OTA_SETTING_DEVICE_ID, device_id, sizeof(device_id));
+
+    esp_err_t err = ota_http_send_heartbeat(device_id, session_id, heartbeat_seq++, full, uptime_sec,
+                                            (full || ip_changed) ? ip_str : NULL,
+                                            full ? FIRMWARE_REF : NULL,
+                                            metrics_enabled ? write_metrics : NULL, &metrics, &resync);
+
+    // On failure the next heartbeat is still a delta against the last
+    // delivered state; the server sees the skipped sequence number
+    if (err == ESP_OK)
+    {
+        commit_staged_metrics(full);
+        discard_read_windows();
+        strncpy(sent_ip, ip_str, sizeof(sent_ip) - 1);
+        sent_ip[sizeof(sent_ip) - 1] = '\0';
+        resync_pending = resync;
+    }
+
+    return err;
+}
+
+// Boot to first delivered heartbeat, once per boot
+static void record_first_heartbeat(void)
+{
+    if (first_heartbeat_recorded)
+    {
+        return;
+    }
+    first_heartbeat_recorded = true;
+
+    float boot_ms = esp_timer_get_time() / 1000.0f;
+    ESP_LOGI(TAG, "First heartbeat delivered %.0f ms after boot", boot_ms);
+
+    ota_metric_handle_t handle = ota_metrics_register("boot.first_heartbeat_ms", OTA_METRIC_GAUGE, "ms");
+    if (handle != OTA_METRIC_INVALID_HANDLE)
+    {
+        ota_metrics_gauge_set(handle, boot_ms);
+    }
+}
+
+static uint32_t heartbeat_job(void *arg)
+{
+    char ip_str[16];
+
+    // Telemetry pauses while the network is down
+    if (!ota_schedule_is_online())
+    {
+        return ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT);
+    }
+
+    if (ota_status_get_device_ip(ip_str, sizeof(ip_str)) == ESP_OK)
+    {
+        ota_schedule_report_rssi(get_wifi_signal_strength());
+        esp_err_t err = ota_status_send_heartbeat(ip_str);
+        ota_schedule_report_result(OTA_SCHEDULE_HEARTBEAT, err);
+        ota_event_heartbeat_result(err);
+
+        if (err == ESP_OK)
+        {
+            ESP_LOGD(TAG, "Heartbeat sent successfully");
+            record_first_heartbeat();
         }
         else
         {
-            ESP_LOGW(TAG, "Failed to get device IP for heartbeat");
+            ESP_LOGW(TAG, "Failed to send heartbeat: %s", esp_err_to_name(err));
         }
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Failed to get device IP for heartbeat");
+        ota_event_heartbeat_result(ESP_ERR_INVALID_STATE);
+    }
+
+    return ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT);
+}
 
-        vTaskDelay(pdMS_TO_TICKS(OTA_HEARTBEAT_INTERVAL_MS));
+// A shorter interval takes effect now rather than after the current one
+static void on_setting_changed(ota_setting_t setting, void *ctx)
+{
+    if (setting == OTA_SETTING_HEARTBEAT_INTERVAL_MS && heartbeat_running)
+    {
+        ota_executor_expedite(heartbeat_job_handle, ota_settings_get_u32(OTA_SETTING_HEARTBEAT_INTERVAL_MS));
     }
+}
 
-    ESP_LOGI(TAG, "Heartbeat task stopped");
-    heartbeat_task_handle = NULL;
-    vTaskDelete(NULL);
+// Over a transport that does not reply, the backend asks for a full
+// snapshot with a pushed message; send it now
+static void on_push(ota_http_push_t push, void *ctx)
+{
+    if (push == OTA_HTTP_PUSH_RESYNC)
+    {
+        atomic_store(&resync_pushed, true);
+        if (heartbeat_running)
+        {
+            ota_executor_expedite(heartbeat_job_handle, 0);
+        }
+    }
 }
 
 esp_err_t ota_status_init(void)
 {
     plugin_start_time = esp_timer_get_time();
-    custom_metrics_count = 0;
+    ota_metrics_init();
+    ota_sysmon_init();
+    start_session();
+
+    // Listeners cannot be removed; register them on the first init only
+    static bool settings_listening = false;
+    if (!settings_listening)
+    {
+        esp_err_t err = ota_settings_add_listener(on_setting_changed, NULL);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to listen for settings: %s", esp_err_to_name(err));
+            return err;
+        }
+        settings_listening = true;
+    }
+    static bool push_listening = false;
+    if (!push_listening)
+    {
+        esp_err_t err = ota_http_add_push_listener(on_push, NULL);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to listen for pushed messages: %s", esp_err_to_name(err));
+            return err;
+        }
+        push_listening = true;
+    }
+
     ESP_LOGI(TAG, "Status module initialized");
     return ESP_OK;
 }
@@ -181,19 +524,17 @@ esp_err_t ota_status_start_heartbeat(void)
         return ESP_ERR_INVALID_STATE;
     }
 
-    heartbeat_running = true;
-
-    BaseType_t ret = xTaskCreate(heartbeat_task, "heartbeat_task",
-                                 OTA_HEARTBEAT_TASK_STACK_SIZE, NULL,
-                                 OTA_HEARTBEAT_TASK_PRIORITY, &heartbeat_task_handle);
+    start_session();
 
-    if (ret != pdPASS)
+    heartbeat_job_handle = ota_executor_add("heartbeat", heartbeat_job, NULL, OTA_JOB_PRIORITY_TELEMETRY, 0);
+    if (heartbeat_job_handle == OTA_EXECUTOR_INVALID_JOB)
     {
-        heartbeat_running = false;
-        ESP_LOGE(TAG, "Failed to create heartbeat task");
+        ESP_LOGE(TAG, "Failed to schedule heartbeat");
         return ESP_FAIL;
     }
 
+    heartbeat_running = true;
+
     ESP_LOGI(TAG, "Heartbeat started");
     return ESP_OK;
 }
@@ -207,43 +548,47 @@ esp_err_t ota_status_stop_heartbeat(void)
 
     heartbeat_running = false;
 
-    // Wait for task to finish
-    if (heartbeat_task_handle != NULL)
-    {
-        while (heartbeat_task_handle != NULL)
-        {
-            vTaskDelay(pdMS_TO_TICKS(100));
-        }
-    }
+    // Waits for a heartbeat in progress to finish
+    ota_executor_cancel(heartbeat_job_handle);
+    heartbeat_job_handle = OTA_EXECUTOR_INVALID_JOB;
 
     ESP_LOGI(TAG, "Heartbeat stopped");
     return ESP_OK;
 }
 
-esp_err_t ota_status_add_custom_metric(const char *name, float value, const char *unit)
+esp_err_t ota_status_send_heartbeat_now(void)
 {
-    if (!name || !unit || custom_metrics_count >= 10)
+    if (!heartbeat_running)
     {
-        return ESP_ERR_INVALID_ARG;
+        return ESP_ERR_INVALID_STATE;
     }
 
-    strncpy(custom_metrics[custom_metrics_count].name, name, sizeof(custom_metrics[0].name) - 1);
-    custom_metrics[custom_metrics_count].name[sizeof(custom_metrics[0].name) - 1] = '\0';
+    return ota_executor_expedite(heartbeat_job_handle, 0);
+}
 
-    custom_metrics[custom_metrics_count].value = value;
+esp_err_t ota_status_add_custom_metric(const char *name, float value, const char *unit)
+{
+    if (!name || !unit)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    strncpy(custom_metrics[custom_metrics_count].unit, unit, sizeof(custom_metrics[0].unit) - 1);
-    custom_metrics[custom_metrics_count].unit[sizeof(custom_metrics[0].unit) - 1] = '\0';
+    ota_metric_handle_t handle = ota_metrics_register(name, OTA_METRIC_GAUGE, unit);
+    if (handle == OTA_METRIC_INVALID_HANDLE)
+    {
+        // Registered under the same name as a counter or histogram
+        return ota_metrics_find(name) != OTA_METRIC_INVALID_HANDLE ? ESP_ERR_INVALID_ARG : ESP_ERR_NO_MEM;
+    }
 
-    custom_metrics_count++;
+    ota_metrics_gauge_set(handle, value);
 
-    ESP_LOGD(TAG, "Added custom metric: %s = %.2f %s", name, value, unit);
+    ESP_LOGD(TAG, "Set custom metric: %s = %.2f %s", name, value, unit);
     return ESP_OK;
 }
 
 esp_err_t ota_status_clear_custom_metrics(void)
 {
-    custom_metrics_count = 0;
+    ota_metrics_reset();
     ESP_LOGD(TAG, "Cleared custom metrics");
     return ESP_OK;
 }
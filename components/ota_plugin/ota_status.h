@@ -4,6 +4,7 @@
 #include "esp_err.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,32 +17,62 @@ extern "C" {
 esp_err_t ota_status_init(void);
 
 /**
- * @brief Start heartbeat task
+ * @brief Schedule heartbeats on the plugin executor
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t ota_status_start_heartbeat(void);
 
 /**
- * @brief Stop heartbeat task
+ * @brief Stop sending heartbeats
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t ota_status_stop_heartbeat(void);
 
 /**
- * @brief Add custom metric to be included in heartbeat
+ * @brief Send the next heartbeat now instead of at its scheduled time
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if heartbeats are stopped
+ */
+esp_err_t ota_status_send_heartbeat_now(void);
+
+/**
+ * @brief Build and send one heartbeat from the calling task
+ *
+ * The heartbeat job calls this on every run; call it directly only while
+ * heartbeats are stopped, e.g. from a test.
+ *
+ * @param ip_str Device IP address to report
+ * @return ESP_OK if the backend accepted the heartbeat, error code otherwise
+ */
+esp_err_t ota_status_send_heartbeat(const char* ip_str);
+
+/**
+ * @brief Set a custom gauge metric included in every heartbeat
+ *
+ * The metric is registered on first use. Values set between two heartbeats
+ * are aggregated into count, sum, min, max and last value.
+ *
  * @param name Metric name
  * @param value Metric value
  * @param unit Metric unit
- * @return ESP_OK on success, error code otherwise
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if name is already registered
+ *         with another type, ESP_ERR_NO_MEM if the registry is full
  */
 esp_err_t ota_status_add_custom_metric(const char* name, float value, const char* unit);
 
 /**
- * @brief Clear all custom metrics
+ * @brief Reset the values of all registered metrics
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t ota_status_clear_custom_metrics(void);
 
+/**
+ * @brief Get the device IP address on the WiFi station interface
+ * @param ip_str Output buffer
+ * @param ip_str_size Size of ip_str (at least 16)
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_status_get_device_ip(char* ip_str, size_t ip_str_size);
+
 /**
  * @brief Get device uptime in seconds
  * @return Uptime in seconds
@@ -0,0 +1,142 @@
+#include "ota_sysmon.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+
+static const char *TAG = "ota_sysmon";
+
+static const struct
+{
+    const char *name;
+    uint32_t caps;
+} heap_regions[] = {
+    {"internal", MALLOC_CAP_INTERNAL},
+    {"dma", MALLOC_CAP_DMA},
+    {"psram", MALLOC_CAP_SPIRAM},
+};
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+typedef struct
+{
+    UBaseType_t task_number;
+    uint32_t run_time;
+} task_run_time_t;
+
+// Static so collection neither allocates nor needs a large stack
+static TaskStatus_t task_status[OTA_SYSMON_MAX_TASKS];
+static task_run_time_t previous_run_time[OTA_SYSMON_MAX_TASKS];
+static UBaseType_t previous_task_count = 0;
+static uint32_t previous_total_run_time = 0;
+static bool task_overflow_logged = false;
+
+static uint32_t previous_task_run_time(UBaseType_t task_number)
+{
+    for (UBaseType_t i = 0; i < previous_task_count; i++)
+    {
+        if (previous_run_time[i].task_number == task_number)
+        {
+            return previous_run_time[i].run_time;
+        }
+    }
+    // Created during this window
+    return 0;
+}
+
+static void collect_task_metrics(ota_sysmon_metric_cb_t callback, void *ctx)
+{
+    uint32_t total_run_time = 0;
+    UBaseType_t count = uxTaskGetSystemState(task_status, OTA_SYSMON_MAX_TASKS, &total_run_time);
+
+    if (count == 0)
+    {
+        if (!task_overflow_logged)
+        {
+            ESP_LOGW(TAG, "More than %d tasks, raise OTA_SYSMON_MAX_TASKS", OTA_SYSMON_MAX_TASKS);
+            task_overflow_logged = true;
+        }
+        return;
+    }
+
+    // Run-time counters wrap; unsigned subtraction handles a single wrap
+    uint32_t window = total_run_time - previous_total_run_time;
+    bool first_window = previous_task_count == 0;
+    char name[48];
+
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        const TaskStatus_t *task = &task_status[i];
+
+        if (!first_window && window > 0)
+        {
+            uint32_t task_time = task->ulRunTimeCounter - previous_task_run_time(task->xTaskNumber);
+            snprintf(name, sizeof(name), "task.%s.cpu", task->pcTaskName);
+            callback(name, 100.0 * task_time / window, "%", ctx);
+        }
+
+        snprintf(name, sizeof(name), "task.%s.stack_free", task->pcTaskName);
+        callback(name, task->usStackHighWaterMark * sizeof(StackType_t), "bytes", ctx);
+    }
+
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        previous_run_time[i].task_number = task_status[i].xTaskNumber;
+        previous_run_time[i].run_time = task_status[i].ulRunTimeCounter;
+    }
+    previous_task_count = count;
+    previous_total_run_time = total_run_time;
+}
+#endif
+
+static void collect_heap_metrics(ota_sysmon_metric_cb_t callback, void *ctx)
+{
+    char name[48];
+
+    for (size_t i = 0; i < sizeof(heap_regions) / sizeof(heap_regions[0]); i++)
+    {
+        if (heap_caps_get_total_size(heap_regions[i].caps) == 0)
+        {
+            continue; // e.g. no PSRAM fitted
+        }
+
+        multi_heap_info_t info;
+        heap_caps_get_info(&info, heap_regions[i].caps);
+
+        // Share of free memory that cannot be handed out in one allocation
+        double fragmentation = info.total_free_bytes > 0
+                                   ? 100.0 * (1.0 - (double)info.largest_free_block / info.total_free_bytes)
+                                   : 0.0;
+
+        snprintf(name, sizeof(name), "heap.%s.free", heap_regions[i].name);
+        callback(name, info.total_free_bytes, "bytes", ctx);
+        snprintf(name, sizeof(name), "heap.%s.largest_block", heap_regions[i].name);
+        callback(name, info.largest_free_block, "bytes", ctx);
+        snprintf(name, sizeof(name), "heap.%s.min_free", heap_regions[i].name);
+        callback(name, info.minimum_free_bytes, "bytes", ctx);
+        snprintf(name, sizeof(name), "heap.%s.fragmentation", heap_regions[i].name);
+        callback(name, fragmentation, "%", ctx);
+    }
+}
+
+esp_err_t ota_sysmon_init(void)
+{
+#if !(configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS)
+    ESP_LOGW(TAG, "FreeRTOS run-time stats disabled, task metrics unavailable");
+#endif
+    ESP_LOGI(TAG, "System metrics collector initialized");
+    return ESP_OK;
+}
+
+void ota_sysmon_collect(ota_sysmon_metric_cb_t callback, void *ctx)
+{
+    if (!callback)
+    {
+        return;
+    }
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+    collect_task_metrics(callback, ctx);
+#endif
+    collect_heap_metrics(callback, ctx);
+}
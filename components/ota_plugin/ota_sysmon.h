@@ -0,0 +1,46 @@
+#ifndef OTA_SYSMON_H
+#define OTA_SYSMON_H
+
+#include "ota_config.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Receives one system metric
+ * @param name Metric name
+ * @param value Metric value
+ * @param unit Metric unit
+ * @param ctx Caller context passed to ota_sysmon_collect()
+ */
+typedef void (*ota_sysmon_metric_cb_t)(const char* name, double value, const char* unit, void* ctx);
+
+/**
+ * @brief Initialize the system metrics collector
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_sysmon_init(void);
+
+/**
+ * @brief Collect system health metrics
+ *
+ * Reports, for every task, the CPU utilisation since the previous call
+ * (task.<name>.cpu, percent of one core) and the stack high-water mark
+ * (task.<name>.stack_free, bytes), and for each heap capability (internal,
+ * dma, psram) the free size, largest free block, minimum free size since
+ * boot and fragmentation (heap.<cap>.free/largest_block/min_free/fragmentation).
+ *
+ * Not thread-safe: call from a single task.
+ *
+ * @param callback Called once per metric
+ * @param ctx Passed to the callback
+ */
+void ota_sysmon_collect(ota_sysmon_metric_cb_t callback, void* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_SYSMON_H
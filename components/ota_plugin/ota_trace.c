@@ -1,51 +1,450 @@
 #include "ota_trace.h"
 #include "ota_config.h"
 #include "ota_http_client.h"
+#include "ota_histogram.h"
+#include "ota_arena.h"
+#include "ota_settings.h"
 #include "esp_log.h"
 #include "esp_timer.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 static const char *TAG = "ota_trace";
 
-static uint32_t trace_counter = 0;
-static uint32_t span_counter = 0;
+#if configNUM_THREAD_LOCAL_STORAGE_POINTERS <= OTA_TRACE_TLS_INDEX
+#error "OTA_TRACE_TLS_INDEX needs CONFIG_FREERTOS_THREAD_LOCAL_STORAGE_POINTERS > OTA_TRACE_TLS_INDEX"
+#endif
 
-static void generate_trace_id(char* trace_id, size_t size) {
-    snprintf(trace_id, size, "trace_%08lx_%08lx", (unsigned long)esp_timer_get_time(), ++trace_counter);
+static const uint8_t zero_span_id[OTA_SPAN_ID_SIZE] = {0};
+
+#define KEPT_TRACE_SLOTS 4 // Recently promoted traces whose later spans are exported too
+
+typedef struct {
+    char operation[64];
+    uint32_t max_per_minute;
+    uint64_t tokens; // Milli-tokens
+    int64_t last_refill;
+} rate_limit_t;
+
+static portMUX_TYPE sampler_lock = portMUX_INITIALIZER_UNLOCKED;
+static ota_trace_sampler_config_t sampler_config = {
+    .head_sample_rate = OTA_TRACE_HEAD_SAMPLE_RATE,
+    .tail_latency_ms = OTA_TRACE_TAIL_LATENCY_MS,
+    .tail_on_error = OTA_TRACE_TAIL_ON_ERROR,
+};
+static rate_limit_t rate_limits[OTA_TRACE_MAX_RATE_LIMITS];
+
+// Finished spans of unsampled traces, oldest first
+static ota_trace_context_t* held_spans[OTA_TRACE_TAIL_BUFFER_SIZE];
+static size_t held_count = 0;
+
+static uint8_t kept_traces[KEPT_TRACE_SLOTS][OTA_TRACE_ID_SIZE];
+static size_t kept_traces_next = 0;
+
+// Static memory mode: spans and their raw attributes come from a pool
+// reserved in the arena instead of the heap
+static portMUX_TYPE span_pool_lock = portMUX_INITIALIZER_UNLOCKED;
+static ota_trace_context_t* span_pool = NULL;
+static char* raw_attr_pool = NULL;
+static bool span_pool_used[OTA_TRACE_SPAN_POOL_SIZE];
+
+typedef struct {
+    char operation[64];
+    atomic_bool active; // Set once the slot is fully initialized, never cleared
+    ota_histogram_t histogram;
+} latency_histogram_t;
+
+static portMUX_TYPE histogram_lock = portMUX_INITIALIZER_UNLOCKED;
+static latency_histogram_t latency_histograms[OTA_TRACE_HISTOGRAM_SLOTS];
+
+// Operations on hot paths summarized in the heartbeat rather than exported per span
+static const char* const default_histogram_operations[] = {
+    "http_post /firmware/check",
+    "http_post /heartbeat",
+    "http_post /log",
+};
+
+// IDs come straight from the hardware RNG, which is safe to call from any task
+// and unique across reboots and devices; they are only hex-encoded on export
+static void generate_trace_id(uint8_t* trace_id) {
+    esp_fill_random(trace_id, OTA_TRACE_ID_SIZE);
+}
+
+static void generate_span_id(uint8_t* span_id) {
+    do {
+        esp_fill_random(span_id, OTA_SPAN_ID_SIZE);
+    } while (memcmp(span_id, zero_span_id, OTA_SPAN_ID_SIZE) == 0); // All zero is invalid in W3C
+}
+
+static void hex_encode(const uint8_t* bytes, size_t len, char* out) {
+    static const char hex[] = "0123456789abcdef";
+    
+    for (size_t i = 0; i < len; i++) {
+        out[2 * i] = hex[bytes[i] >> 4];
+        out[2 * i + 1] = hex[bytes[i] & 0x0f];
+    }
+    out[2 * len] = '\0';
 }
 
-static void generate_span_id(char* span_id, size_t size) {
-    snprintf(span_id, size, "span_%08lx", ++span_counter);
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static bool hex_decode(const char* hex, uint8_t* bytes, size_t len) {
+    if (strlen(hex) != 2 * len) {
+        return false;
+    }
+    
+    for (size_t i = 0; i < len; i++) {
+        int hi = hex_digit(hex[2 * i]);
+        int lo = hex_digit(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        bytes[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return true;
+}
+
+static inline ota_trace_context_t* get_current_span(void) {
+    return (ota_trace_context_t*)pvTaskGetThreadLocalStoragePointer(NULL, OTA_TRACE_TLS_INDEX);
+}
+
+static inline void set_current_span(ota_trace_context_t* ctx) {
+    vTaskSetThreadLocalStoragePointer(NULL, OTA_TRACE_TLS_INDEX, ctx);
+}
+
+// Take a span out of the calling task's chain of entered spans, wherever it
+// is, so no span is left pointing at it once it is freed
+static void unlink_span(ota_trace_context_t* ctx) {
+    ota_trace_context_t* current = get_current_span();
+    
+    if (current == ctx) {
+        set_current_span(ctx->previous);
+    } else {
+        for (ota_trace_context_t* span = current; span; span = span->previous) {
+            if (span->previous == ctx) {
+                span->previous = ctx->previous;
+                break;
+            }
+        }
+    }
+    ctx->previous = NULL;
+}
+
+// Export with no current span so the HTTP requests made to deliver the span
+// do not open child spans of their own (which would recurse forever)
+static esp_err_t export_span(const ota_trace_context_t* ctx, const char* raw_attributes) {
+    char trace_hex[OTA_TRACE_ID_HEX_SIZE];
+    char span_hex[OTA_SPAN_ID_HEX_SIZE];
+    char parent_hex[OTA_SPAN_ID_HEX_SIZE];
+    bool has_parent = memcmp(ctx->parent_span_id, zero_span_id, OTA_SPAN_ID_SIZE) != 0;
+    uint32_t duration_ms = (ctx->end_time - ctx->start_time) / 1000;
+    
+    hex_encode(ctx->trace_id, OTA_TRACE_ID_SIZE, trace_hex);
+    hex_encode(ctx->span_id, OTA_SPAN_ID_SIZE, span_hex);
+    if (has_parent) {
+        hex_encode(ctx->parent_span_id, OTA_SPAN_ID_SIZE, parent_hex);
+    }
+    
+    ota_trace_context_t* saved = get_current_span();
+    set_current_span(NULL);
+
+    char device_id[OTA_SETTINGS_TEXT_SIZE];
+    ota_settings_get_str(OTA_SETTING_DEVICE_ID, device_id, sizeof(device_id));
+
+    esp_err_t err = ota_http_send_trace(device_id, trace_hex, span_hex, has_parent ? parent_hex : NULL,
+                                       ctx->operation, duration_ms, ctx->start_time, ctx->end_time,
+                                       ctx->attributes, ctx->attribute_count,
+                                       ctx->raw_attributes ? ctx->raw_attributes : raw_attributes);
+
+    set_current_span(saved);
+    
+    if (err == ESP_OK) {
+        ESP_LOGD(TAG, "Trace sent: %s completed in %lu ms", ctx->operation, (unsigned long)duration_ms);
+    } else {
+        ESP_LOGW(TAG, "Failed to send trace: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+// Lock-free: slots are only ever appended, and published through 'active'
+static latency_histogram_t* find_histogram(const char* operation) {
+    for (int i = 0; i < OTA_TRACE_HISTOGRAM_SLOTS; i++) {
+        latency_histogram_t* slot = &latency_histograms[i];
+        if (!atomic_load_explicit(&slot->active, memory_order_acquire)) {
+            break;
+        }
+        if (strcmp(slot->operation, operation) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static ota_trace_context_t* alloc_context(void) {
+    if (!OTA_STATIC_MEMORY_ENABLED) {
+        return ota_arena_bulk_calloc(sizeof(ota_trace_context_t));
+    }
+    
+    ota_trace_context_t* ctx = NULL;
+    taskENTER_CRITICAL(&span_pool_lock);
+    for (int i = 0; span_pool && i < OTA_TRACE_SPAN_POOL_SIZE; i++) {
+        if (!span_pool_used[i]) {
+            span_pool_used[i] = true;
+            ctx = &span_pool[i];
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&span_pool_lock);
+    
+    if (ctx) {
+        memset(ctx, 0, sizeof(*ctx));
+    }
+    return ctx;
+}
+
+static void free_context(ota_trace_context_t* ctx) {
+    if (!OTA_STATIC_MEMORY_ENABLED) {
+        free(ctx->raw_attributes);
+        free(ctx);
+        return;
+    }
+    
+    taskENTER_CRITICAL(&span_pool_lock);
+    span_pool_used[ctx - span_pool] = false;
+    taskEXIT_CRITICAL(&span_pool_lock);
+}
+
+// Keep a copy of the caller's attributes, which do not outlive finish_span()
+static void hold_raw_attributes(ota_trace_context_t* ctx, const char* raw_attributes) {
+    if (!OTA_STATIC_MEMORY_ENABLED) {
+        ctx->raw_attributes = strdup(raw_attributes);
+        return;
+    }
+    
+    if (strlen(raw_attributes) >= OTA_TRACE_RAW_ATTR_SIZE) {
+        ESP_LOGW(TAG, "Dropping attributes of held span %s: longer than OTA_TRACE_RAW_ATTR_SIZE", ctx->operation);
+        return;
+    }
+    ctx->raw_attributes = &raw_attr_pool[(ctx - span_pool) * OTA_TRACE_RAW_ATTR_SIZE];
+    strcpy(ctx->raw_attributes, raw_attributes);
+}
+
+static bool rate_limit_allows(const char* operation) {
+    bool allowed = true;
+    int64_t now = esp_timer_get_time();
+    
+    taskENTER_CRITICAL(&sampler_lock);
+    for (int i = 0; i < OTA_TRACE_MAX_RATE_LIMITS; i++) {
+        rate_limit_t* limit = &rate_limits[i];
+        if (limit->max_per_minute == 0 || strcmp(limit->operation, operation) != 0) {
+            continue;
+        }
+        
+        // Token bucket in milli-tokens, refilled at max_per_minute per minute.
+        // Only the time turned into tokens is consumed, so callers faster
+        // than one milli-token still build up a refill.
+        uint64_t capacity = (uint64_t)limit->max_per_minute * 1000;
+        uint64_t refill = (uint64_t)(now - limit->last_refill) * limit->max_per_minute / 60000;
+        if (limit->tokens + refill >= capacity) {
+            limit->tokens = capacity;
+            limit->last_refill = now;
+        } else {
+            limit->tokens += refill;
+            limit->last_refill += (int64_t)(refill * 60000 / limit->max_per_minute);
+        }
+        
+        if (limit->tokens >= 1000) {
+            limit->tokens -= 1000;
+        } else {
+            allowed = false;
+        }
+        break;
+    }
+    taskEXIT_CRITICAL(&sampler_lock);
+    
+    return allowed;
+}
+
+// Head sampling: decided once when a trace's root span starts
+static bool head_sample(const char* operation) {
+    ota_trace_sampler_config_t config;
+    ota_trace_get_sampler(&config);
+    
+    bool sampled = config.head_sample_rate >= 1.0f ||
+                   (config.head_sample_rate > 0.0f &&
+                    esp_random() < (uint32_t)(config.head_sample_rate * (double)UINT32_MAX));
+    
+    return sampled && rate_limit_allows(operation);
+}
+
+static bool trace_is_kept(const uint8_t* trace_id) {
+    for (int i = 0; i < KEPT_TRACE_SLOTS; i++) {
+        if (memcmp(kept_traces[i], trace_id, OTA_TRACE_ID_SIZE) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Finish a span and take ownership of it: sampled spans are exported right
+// away, unsampled ones are held until tail sampling promotes their trace or
+// they are evicted by newer spans
+static esp_err_t finish_span(ota_trace_context_t* ctx, const char* raw_attributes) {
+    // Failed spans skip the histogram so tail sampling can still export them
+    if (!ctx->failed && ota_trace_record_duration(ctx->operation, ctx->end_time - ctx->start_time)) {
+        free_context(ctx);
+        return ESP_OK;
+    }
+    
+    if (ctx->sampled) {
+        esp_err_t err = export_span(ctx, raw_attributes);
+        free_context(ctx);
+        return err;
+    }
+    
+    ota_trace_sampler_config_t config;
+    ota_trace_get_sampler(&config);
+    
+    uint32_t duration_ms = (ctx->end_time - ctx->start_time) / 1000;
+    bool promote = (config.tail_on_error && ctx->failed) ||
+                   (config.tail_latency_ms > 0 && duration_ms >= config.tail_latency_ms);
+    
+    if (!promote && raw_attributes) {
+        hold_raw_attributes(ctx, raw_attributes);
+    }
+    
+    ota_trace_context_t* released[OTA_TRACE_TAIL_BUFFER_SIZE];
+    size_t released_count = 0;
+    ota_trace_context_t* evicted = NULL;
+    
+    taskENTER_CRITICAL(&sampler_lock);
+    if (!promote && trace_is_kept(ctx->trace_id)) {
+        promote = true;
+    }
+    
+    if (promote) {
+        if (!trace_is_kept(ctx->trace_id)) {
+            memcpy(kept_traces[kept_traces_next], ctx->trace_id, OTA_TRACE_ID_SIZE);
+            kept_traces_next = (kept_traces_next + 1) % KEPT_TRACE_SLOTS;
+        }
+        
+        // Release the spans of this trace that finished earlier
+        size_t remaining = 0;
+        for (size_t i = 0; i < held_count; i++) {
+            if (memcmp(held_spans[i]->trace_id, ctx->trace_id, OTA_TRACE_ID_SIZE) == 0) {
+                released[released_count++] = held_spans[i];
+            } else {
+                held_spans[remaining++] = held_spans[i];
+            }
+        }
+        held_count = remaining;
+    } else {
+        if (held_count == OTA_TRACE_TAIL_BUFFER_SIZE) {
+            evicted = held_spans[0];
+            memmove(&held_spans[0], &held_spans[1], (held_count - 1) * sizeof(held_spans[0]));
+            held_count--;
+        }
+        held_spans[held_count++] = ctx;
+    }
+    taskEXIT_CRITICAL(&sampler_lock);
+    
+    if (evicted) {
+        free_context(evicted);
+    }
+    
+    if (!promote) {
+        ESP_LOGV(TAG, "Holding unsampled span: %s", ctx->operation);
+        return ESP_OK;
+    }
+    
+    ESP_LOGD(TAG, "Tail sampling exports trace of %s (%u earlier spans)", ctx->operation, (unsigned)released_count);
+    
+    esp_err_t err = export_span(ctx, raw_attributes);
+    free_context(ctx);
+    
+    for (size_t i = 0; i < released_count; i++) {
+        export_span(released[i], NULL);
+        free_context(released[i]);
+    }
+    
+    return err;
+}
+
+static void apply_sample_setting(ota_setting_t setting, void* ctx) {
+    if (setting != OTA_SETTING_TRACE_SAMPLE_PERCENT) {
+        return;
+    }
+    
+    taskENTER_CRITICAL(&sampler_lock);
+    sampler_config.head_sample_rate = ota_settings_get_u32(OTA_SETTING_TRACE_SAMPLE_PERCENT) / 100.0f;
+    taskEXIT_CRITICAL(&sampler_lock);
 }
 
 esp_err_t ota_trace_init(void) {
-    trace_counter = 0;
-    span_counter = 0;
+    if (OTA_STATIC_MEMORY_ENABLED && !span_pool) {
+        span_pool = ota_arena_reserve_bulk(OTA_TRACE_SPAN_POOL_SIZE * sizeof(ota_trace_context_t));
+        raw_attr_pool = ota_arena_reserve_bulk(OTA_TRACE_SPAN_POOL_SIZE * OTA_TRACE_RAW_ATTR_SIZE);
+        if (!span_pool || !raw_attr_pool) {
+            span_pool = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    
+    for (size_t i = 0; i < sizeof(default_histogram_operations) / sizeof(default_histogram_operations[0]); i++) {
+        ota_trace_histogram_enable(default_histogram_operations[i]);
+    }
+    
+    static bool listening = false;
+    if (!listening) {
+        listening = ota_settings_add_listener(apply_sample_setting, NULL) == ESP_OK;
+        apply_sample_setting(OTA_SETTING_TRACE_SAMPLE_PERCENT, NULL);
+    }
+    
     ESP_LOGI(TAG, "Trace module initialized");
     return ESP_OK;
 }
 
 ota_trace_context_t* ota_trace_start_operation(const char* operation, const char* parent_span_id) {
-    if (!OTA_TRACING_ENABLED || !operation) {
+    if (!ota_settings_get_bool(OTA_SETTING_TRACING_ENABLED) || !operation) {
         return NULL;
     }
     
-    ota_trace_context_t* ctx = malloc(sizeof(ota_trace_context_t));
+    ota_trace_context_t* ctx = alloc_context();
     if (!ctx) {
         ESP_LOGE(TAG, "Failed to allocate memory for trace context");
         return NULL;
     }
     
-    memset(ctx, 0, sizeof(ota_trace_context_t));
-    
-    generate_trace_id(ctx->trace_id, sizeof(ctx->trace_id));
-    generate_span_id(ctx->span_id, sizeof(ctx->span_id));
+    ota_trace_context_t* current = parent_span_id ? NULL : get_current_span();
+    if (current) {
+        // Join the current span's trace as its child
+        memcpy(ctx->trace_id, current->trace_id, sizeof(ctx->trace_id));
+        memcpy(ctx->parent_span_id, current->span_id, sizeof(ctx->parent_span_id));
+        ctx->sampled = current->sampled;
+    } else {
+        generate_trace_id(ctx->trace_id);
+        ctx->sampled = head_sample(operation);
+    }
+    generate_span_id(ctx->span_id);
     
-    if (parent_span_id) {
-        strncpy(ctx->parent_span_id, parent_span_id, sizeof(ctx->parent_span_id) - 1);
-        ctx->parent_span_id[sizeof(ctx->parent_span_id) - 1] = '\0';
+    if (parent_span_id && !hex_decode(parent_span_id, ctx->parent_span_id, sizeof(ctx->parent_span_id))) {
+        ESP_LOGW(TAG, "Ignoring malformed parent span ID: %s", parent_span_id);
+        memset(ctx->parent_span_id, 0, sizeof(ctx->parent_span_id));
     }
     
     strncpy(ctx->operation, operation, sizeof(ctx->operation) - 1);
@@ -53,61 +452,357 @@ ota_trace_context_t* ota_trace_start_operation(const char* operation, const char
     
     ctx->start_time = esp_timer_get_time();
     
-    ESP_LOGD(TAG, "Started trace: %s [%s]", operation, ctx->trace_id);
+    ESP_LOGD(TAG, "Started trace: %s", operation);
     return ctx;
 }
 
 esp_err_t ota_trace_end_operation(ota_trace_context_t* trace_ctx, const char* attributes) {
-    if (!OTA_TRACING_ENABLED || !trace_ctx) {
+    if (!trace_ctx) {
         return ESP_ERR_INVALID_ARG;
     }
     
-    int64_t end_time = esp_timer_get_time();
-    uint32_t duration_ms = (end_time - trace_ctx->start_time) / 1000;
+    trace_ctx->end_time = esp_timer_get_time();
+    unlink_span(trace_ctx);
     
-    esp_err_t err = ota_http_send_trace(DEVICE_ID, trace_ctx->trace_id, trace_ctx->span_id,
-                                       strlen(trace_ctx->parent_span_id) > 0 ? trace_ctx->parent_span_id : NULL,
-                                       trace_ctx->operation, duration_ms,
-                                       trace_ctx->start_time, end_time, attributes);
+    return finish_span(trace_ctx, attributes);
+}
+
+esp_err_t ota_trace_add_event(ota_trace_context_t* trace_ctx, const char* event_name, const char* attributes) {
+    if (!ota_settings_get_bool(OTA_SETTING_TRACING_ENABLED) || !trace_ctx || !event_name) {
+        return ESP_ERR_INVALID_ARG;
+    }
     
-    if (err == ESP_OK) {
-        ESP_LOGD(TAG, "Trace sent: %s completed in %lu ms", trace_ctx->operation, (unsigned long)duration_ms);
-    } else {
-        ESP_LOGW(TAG, "Failed to send trace: %s", esp_err_to_name(err));
+    // Events are sent as zero-length child spans and sampled with their trace
+    ota_trace_context_t* event = alloc_context();
+    if (!event) {
+        ESP_LOGE(TAG, "Failed to allocate memory for trace event");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    memcpy(event->trace_id, trace_ctx->trace_id, sizeof(event->trace_id));
+    memcpy(event->parent_span_id, trace_ctx->span_id, sizeof(event->parent_span_id));
+    generate_span_id(event->span_id);
+    strncpy(event->operation, event_name, sizeof(event->operation) - 1);
+    event->start_time = esp_timer_get_time();
+    event->end_time = event->start_time;
+    event->sampled = trace_ctx->sampled;
+    
+    return finish_span(event, attributes);
+}
+
+// Find the slot for a key, reusing an existing one so setting a key twice
+// overwrites it. A NULL span, as started while tracing is disabled, takes
+// any attribute and records nothing
+static esp_err_t attribute_slot(ota_trace_context_t* trace_ctx, const char* key, ota_trace_attr_type_t type,
+                                ota_trace_attr_t** slot) {
+    *slot = NULL;
+    if (!key) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!trace_ctx) {
+        return ESP_OK;
     }
     
-    free(trace_ctx);
+    ota_trace_attr_t* attr = NULL;
+    for (uint8_t i = 0; i < trace_ctx->attribute_count; i++) {
+        if (strncmp(trace_ctx->attributes[i].key, key, OTA_TRACE_ATTR_KEY_SIZE - 1) == 0) {
+            attr = &trace_ctx->attributes[i];
+            break;
+        }
+    }
+    
+    if (!attr) {
+        if (trace_ctx->attribute_count >= OTA_TRACE_MAX_ATTRIBUTES) {
+            ESP_LOGW(TAG, "Span %s has no room for attribute %s", trace_ctx->operation, key);
+            return ESP_ERR_NO_MEM;
+        }
+        attr = &trace_ctx->attributes[trace_ctx->attribute_count++];
+        strncpy(attr->key, key, sizeof(attr->key) - 1);
+        attr->key[sizeof(attr->key) - 1] = '\0';
+    }
+    
+    attr->type = type;
+    *slot = attr;
+    return ESP_OK;
+}
+
+esp_err_t ota_trace_set_attr_str(ota_trace_context_t* trace_ctx, const char* key, const char* value) {
+    if (!value) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    ota_trace_attr_t* attr;
+    esp_err_t err = attribute_slot(trace_ctx, key, OTA_TRACE_ATTR_STRING, &attr);
+    if (attr) {
+        strncpy(attr->value.string, value, sizeof(attr->value.string) - 1);
+        attr->value.string[sizeof(attr->value.string) - 1] = '\0';
+    }
     return err;
 }
 
-esp_err_t ota_trace_add_event(ota_trace_context_t* trace_ctx, const char* event_name, const char* attributes) {
-    if (!OTA_TRACING_ENABLED || !trace_ctx || !event_name) {
+esp_err_t ota_trace_set_attr_int(ota_trace_context_t* trace_ctx, const char* key, int64_t value) {
+    ota_trace_attr_t* attr;
+    esp_err_t err = attribute_slot(trace_ctx, key, OTA_TRACE_ATTR_INT, &attr);
+    if (attr) {
+        attr->value.integer = value;
+    }
+    return err;
+}
+
+esp_err_t ota_trace_set_attr_double(ota_trace_context_t* trace_ctx, const char* key, double value) {
+    ota_trace_attr_t* attr;
+    esp_err_t err = attribute_slot(trace_ctx, key, OTA_TRACE_ATTR_DOUBLE, &attr);
+    if (attr) {
+        attr->value.number = value;
+    }
+    return err;
+}
+
+esp_err_t ota_trace_set_attr_bool(ota_trace_context_t* trace_ctx, const char* key, bool value) {
+    ota_trace_attr_t* attr;
+    esp_err_t err = attribute_slot(trace_ctx, key, OTA_TRACE_ATTR_BOOL, &attr);
+    if (attr) {
+        attr->value.boolean = value;
+    }
+    return err;
+}
+
+void ota_trace_set_error(ota_trace_context_t* trace_ctx, esp_err_t error) {
+    if (trace_ctx && error != ESP_OK) {
+        trace_ctx->failed = true;
+        ota_trace_set_attr_str(trace_ctx, "error", esp_err_to_name(error));
+    }
+}
+
+esp_err_t ota_trace_set_sampler(const ota_trace_sampler_config_t* config) {
+    if (!config || config->head_sample_rate < 0.0f || config->head_sample_rate > 1.0f) {
         return ESP_ERR_INVALID_ARG;
     }
     
-    // For simplicity, we'll send events as separate spans with very short duration
-    char event_span_id[OTA_SPAN_ID_SIZE];
-    generate_span_id(event_span_id, sizeof(event_span_id));
+    taskENTER_CRITICAL(&sampler_lock);
+    sampler_config = *config;
+    taskEXIT_CRITICAL(&sampler_lock);
     
-    int64_t event_time = esp_timer_get_time();
+    ESP_LOGI(TAG, "Sampler: head rate %.3f, tail latency %lu ms, tail on error %d",
+             config->head_sample_rate, (unsigned long)config->tail_latency_ms, config->tail_on_error);
+    return ESP_OK;
+}
+
+void ota_trace_get_sampler(ota_trace_sampler_config_t* config) {
+    if (!config) {
+        return;
+    }
     
-    esp_err_t err = ota_http_send_trace(DEVICE_ID, trace_ctx->trace_id, event_span_id,
-                                       trace_ctx->span_id, event_name, 0,
-                                       event_time, event_time, attributes);
+    taskENTER_CRITICAL(&sampler_lock);
+    *config = sampler_config;
+    taskEXIT_CRITICAL(&sampler_lock);
+}
+
+esp_err_t ota_trace_set_rate_limit(const char* operation, uint32_t max_per_minute) {
+    if (!operation) {
+        return ESP_ERR_INVALID_ARG;
+    }
     
-    if (err == ESP_OK) {
-        ESP_LOGD(TAG, "Trace event sent: %s", event_name);
-    } else {
-        ESP_LOGW(TAG, "Failed to send trace event: %s", esp_err_to_name(err));
+    esp_err_t err = ESP_ERR_NO_MEM;
+    rate_limit_t* free_slot = NULL;
+    
+    taskENTER_CRITICAL(&sampler_lock);
+    for (int i = 0; i < OTA_TRACE_MAX_RATE_LIMITS; i++) {
+        rate_limit_t* limit = &rate_limits[i];
+        if (limit->max_per_minute == 0) {
+            if (!free_slot) {
+                free_slot = limit;
+            }
+        } else if (strcmp(limit->operation, operation) == 0) {
+            free_slot = limit;
+            break;
+        }
+    }
+    
+    if (free_slot) {
+        strncpy(free_slot->operation, operation, sizeof(free_slot->operation) - 1);
+        free_slot->operation[sizeof(free_slot->operation) - 1] = '\0';
+        free_slot->max_per_minute = max_per_minute;
+        free_slot->tokens = (uint64_t)max_per_minute * 1000; // Start with a full bucket
+        free_slot->last_refill = esp_timer_get_time();
+        err = ESP_OK;
+    } else if (max_per_minute == 0) {
+        err = ESP_OK; // Removing a limit that was never set
     }
+    taskEXIT_CRITICAL(&sampler_lock);
     
     return err;
 }
 
+esp_err_t ota_trace_histogram_enable(const char* operation) {
+    if (!operation) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    esp_err_t err = ESP_ERR_NO_MEM;
+    
+    taskENTER_CRITICAL(&histogram_lock);
+    for (int i = 0; i < OTA_TRACE_HISTOGRAM_SLOTS; i++) {
+        latency_histogram_t* slot = &latency_histograms[i];
+        if (!atomic_load_explicit(&slot->active, memory_order_relaxed)) {
+            strncpy(slot->operation, operation, sizeof(slot->operation) - 1);
+            slot->operation[sizeof(slot->operation) - 1] = '\0';
+            ota_histogram_reset(&slot->histogram);
+            atomic_store_explicit(&slot->active, true, memory_order_release);
+            err = ESP_OK;
+            break;
+        }
+        if (strcmp(slot->operation, operation) == 0) {
+            err = ESP_OK;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&histogram_lock);
+    
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "No histogram slot left for %s", operation);
+    }
+    return err;
+}
+
+bool ota_trace_record_duration(const char* operation, int64_t duration_us) {
+    if (!operation) {
+        return false;
+    }
+    
+    latency_histogram_t* slot = find_histogram(operation);
+    if (!slot) {
+        return false;
+    }
+    
+    ota_histogram_record(&slot->histogram, duration_us > UINT32_MAX ? UINT32_MAX : (uint32_t)duration_us);
+    return true;
+}
+
+size_t ota_trace_histogram_collect(ota_trace_latency_summary_t* summaries, size_t max_summaries, bool reset) {
+    size_t count = 0;
+    
+    for (int i = 0; i < OTA_TRACE_HISTOGRAM_SLOTS && count < max_summaries; i++) {
+        latency_histogram_t* slot = &latency_histograms[i];
+        if (!atomic_load_explicit(&slot->active, memory_order_acquire)) {
+            break;
+        }
+        
+        ota_histogram_summary_t summary;
+        ota_histogram_summarize(&slot->histogram, &summary, reset);
+        
+        summaries[count].operation = slot->operation;
+        summaries[count].count = summary.count;
+        summaries[count].p50_us = summary.p50;
+        summaries[count].p90_us = summary.p90;
+        summaries[count].p99_us = summary.p99;
+        summaries[count].max_us = summary.max;
+        summaries[count].sum_us = summary.sum;
+        count++;
+    }
+    
+    return count;
+}
+
+void ota_trace_histogram_discard(const ota_trace_latency_summary_t* summaries, size_t count) {
+    if (!summaries) {
+        return;
+    }
+    
+    // Slots are only appended, so summary i was collected from slot i
+    for (size_t i = 0; i < count && i < OTA_TRACE_HISTOGRAM_SLOTS; i++) {
+        latency_histogram_t* slot = &latency_histograms[i];
+        if (!atomic_load_explicit(&slot->active, memory_order_acquire)) {
+            break;
+        }
+        
+        ota_histogram_summary_t window = {
+            .count = summaries[i].count,
+            .max = summaries[i].max_us,
+            .sum = summaries[i].sum_us,
+        };
+        ota_histogram_discard(&slot->histogram, &window);
+    }
+}
+
+void ota_trace_enter(ota_trace_context_t* trace_ctx) {
+    if (!trace_ctx) {
+        return;
+    }
+    
+    trace_ctx->previous = get_current_span();
+    set_current_span(trace_ctx);
+}
+
+void ota_trace_exit(ota_trace_context_t* trace_ctx) {
+    if (!trace_ctx) {
+        return;
+    }
+    
+    unlink_span(trace_ctx);
+}
+
+ota_trace_context_t* ota_trace_get_current(void) {
+    return get_current_span();
+}
+
+ota_trace_context_t* ota_trace_start_scoped(const char* operation) {
+    ota_trace_context_t* ctx = ota_trace_start_operation(operation, NULL);
+    ota_trace_enter(ctx);
+    return ctx;
+}
+
+void ota_trace_scope_cleanup(ota_trace_context_t** trace_ctx) {
+    if (trace_ctx && *trace_ctx) {
+        ota_trace_end_operation(*trace_ctx, NULL);
+        *trace_ctx = NULL;
+    }
+}
+
+esp_err_t ota_trace_format_traceparent(ota_trace_context_t* trace_ctx, char* buffer, size_t buffer_size) {
+    if (!trace_ctx || !buffer || buffer_size < OTA_TRACEPARENT_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    // version "00", trace-id, parent-id (this span), flags "01" (sampled) or "00"
+    char* p = buffer;
+    memcpy(p, "00-", 3);
+    p += 3;
+    hex_encode(trace_ctx->trace_id, OTA_TRACE_ID_SIZE, p);
+    p += 2 * OTA_TRACE_ID_SIZE;
+    *p++ = '-';
+    hex_encode(trace_ctx->span_id, OTA_SPAN_ID_SIZE, p);
+    p += 2 * OTA_SPAN_ID_SIZE;
+    memcpy(p, trace_ctx->sampled ? "-01" : "-00", 4);
+    return ESP_OK;
+}
+
+esp_err_t ota_trace_format_trace_id(ota_trace_context_t* trace_ctx, char* buffer, size_t buffer_size) {
+    if (!trace_ctx || !buffer || buffer_size < OTA_TRACE_ID_HEX_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    hex_encode(trace_ctx->trace_id, OTA_TRACE_ID_SIZE, buffer);
+    return ESP_OK;
+}
+
+esp_err_t ota_trace_format_span_id(ota_trace_context_t* trace_ctx, char* buffer, size_t buffer_size) {
+    if (!trace_ctx || !buffer || buffer_size < OTA_SPAN_ID_HEX_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    hex_encode(trace_ctx->span_id, OTA_SPAN_ID_SIZE, buffer);
+    return ESP_OK;
+}
+
 const char* ota_trace_get_trace_id(ota_trace_context_t* trace_ctx) {
-    return trace_ctx ? trace_ctx->trace_id : NULL;
+    static __thread char trace_id[OTA_TRACE_ID_HEX_SIZE];
+    
+    return ota_trace_format_trace_id(trace_ctx, trace_id, sizeof(trace_id)) == ESP_OK ? trace_id : NULL;
 }
 
 const char* ota_trace_get_span_id(ota_trace_context_t* trace_ctx) {
-    return trace_ctx ? trace_ctx->span_id : NULL;
+    static __thread char span_id[OTA_SPAN_ID_HEX_SIZE];
+    
+    return ota_trace_format_span_id(trace_ctx, span_id, sizeof(span_id)) == ESP_OK ? span_id : NULL;
 }
@@ -3,11 +3,39 @@
 
 #include "ota_plugin.h"
 #include "esp_err.h"
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief Trace sampling configuration
+ *
+ * Head sampling decides once per trace, when its root span starts, whether
+ * the trace is exported. Spans of unsampled traces are held back briefly so
+ * that tail sampling can still export the trace if any of its spans fails or
+ * runs longer than the latency threshold.
+ */
+typedef struct {
+    float head_sample_rate;       // 0.0 - 1.0, fraction of traces exported
+    uint32_t tail_latency_ms;     // Export unsampled traces with a span slower than this (0 disables)
+    bool tail_on_error;           // Export unsampled traces with a failed span
+} ota_trace_sampler_config_t;
+
+/**
+ * @brief Latency distribution of an operation over one collection window
+ */
+typedef struct {
+    const char* operation;
+    uint32_t count;
+    uint32_t p50_us;
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+} ota_trace_latency_summary_t;
+
 /**
  * @brief Initialize trace module
  * @return ESP_OK on success, error code otherwise
@@ -16,8 +44,12 @@ esp_err_t ota_trace_init(void);
 
 /**
  * @brief Start a trace operation
+ *
+ * When parent_span_id is NULL and the calling task has a current span (see
+ * ota_trace_enter), the new span joins its trace as a child.
+ *
  * @param operation Operation name
- * @param parent_span_id Optional parent span ID
+ * @param parent_span_id Optional parent span ID (16 hex characters)
  * @return Trace context on success, NULL on failure
  */
 ota_trace_context_t* ota_trace_start_operation(const char* operation, const char* parent_span_id);
@@ -25,11 +57,53 @@ ota_trace_context_t* ota_trace_start_operation(const char* operation, const char
 /**
  * @brief End a trace operation
  * @param trace_ctx Trace context from ota_trace_start_operation
- * @param attributes Optional JSON attributes
+ * @param attributes Optional legacy JSON attributes, merged with the typed ones
  * @return ESP_OK on success, error code otherwise
  */
 esp_err_t ota_trace_end_operation(ota_trace_context_t* trace_ctx, const char* attributes);
 
+/**
+ * @brief Set a string attribute on a span
+ *
+ * Typed attributes are stored inline in the span without allocating and are
+ * serialized once when the span is exported. Setting an existing key
+ * overwrites its value. A NULL span, as returned while tracing is disabled,
+ * records nothing and returns ESP_OK.
+ *
+ * @param trace_ctx Trace context (can be NULL)
+ * @param key Attribute key (truncated to OTA_TRACE_ATTR_KEY_SIZE - 1)
+ * @param value Attribute value (truncated to OTA_TRACE_ATTR_STRING_SIZE - 1)
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the span already has OTA_TRACE_MAX_ATTRIBUTES
+ */
+esp_err_t ota_trace_set_attr_str(ota_trace_context_t* trace_ctx, const char* key, const char* value);
+
+/**
+ * @brief Set an integer attribute on a span
+ * @param trace_ctx Trace context (can be NULL)
+ * @param key Attribute key
+ * @param value Attribute value
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_trace_set_attr_int(ota_trace_context_t* trace_ctx, const char* key, int64_t value);
+
+/**
+ * @brief Set a floating point attribute on a span
+ * @param trace_ctx Trace context (can be NULL)
+ * @param key Attribute key
+ * @param value Attribute value
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_trace_set_attr_double(ota_trace_context_t* trace_ctx, const char* key, double value);
+
+/**
+ * @brief Set a boolean attribute on a span
+ * @param trace_ctx Trace context (can be NULL)
+ * @param key Attribute key
+ * @param value Attribute value
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_trace_set_attr_bool(ota_trace_context_t* trace_ctx, const char* key, bool value);
+
 /**
  * @brief Add an event to an existing trace
  * @param trace_ctx Trace context
@@ -39,8 +113,159 @@ esp_err_t ota_trace_end_operation(ota_trace_context_t* trace_ctx, const char* at
  */
 esp_err_t ota_trace_add_event(ota_trace_context_t* trace_ctx, const char* event_name, const char* attributes);
 
+/**
+ * @brief Mark a span as failed
+ *
+ * Failed spans make tail sampling export their whole trace even when head
+ * sampling dropped it.
+ *
+ * @param trace_ctx Trace context
+ * @param error Error code of the failure (ESP_OK leaves the span unchanged)
+ */
+void ota_trace_set_error(ota_trace_context_t* trace_ctx, esp_err_t error);
+
+/**
+ * @brief Change the sampling configuration at runtime
+ * @param config New sampler configuration
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_trace_set_sampler(const ota_trace_sampler_config_t* config);
+
+/**
+ * @brief Get the current sampling configuration
+ * @param config Output: current sampler configuration
+ */
+void ota_trace_get_sampler(ota_trace_sampler_config_t* config);
+
+/**
+ * @brief Limit how many traces rooted at an operation are sampled per minute
+ * @param operation Operation name of the root span
+ * @param max_per_minute Maximum sampled traces per minute (0 removes the limit)
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if all OTA_TRACE_MAX_RATE_LIMITS slots are used
+ */
+esp_err_t ota_trace_set_rate_limit(const char* operation, uint32_t max_per_minute);
+
+/**
+ * @brief Aggregate an operation into an on-device latency histogram
+ *
+ * Successful spans of the operation are no longer exported individually;
+ * their durations are summarized in the heartbeat instead. Failed spans are
+ * not aggregated and go through head and tail sampling as before.
+ *
+ * @param operation Operation name
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if all OTA_TRACE_HISTOGRAM_SLOTS are used
+ */
+esp_err_t ota_trace_histogram_enable(const char* operation);
+
+/**
+ * @brief Record a duration for an operation that was timed without a span
+ * @param operation Operation name
+ * @param duration_us Duration in microseconds
+ * @return true if the operation has a histogram and the duration was recorded
+ */
+bool ota_trace_record_duration(const char* operation, int64_t duration_us);
+
+/**
+ * @brief Collect latency summaries of all histogram operations
+ * @param summaries Output array
+ * @param max_summaries Capacity of summaries
+ * @param reset Start a new window after reading
+ * @return Number of summaries written
+ */
+size_t ota_trace_histogram_collect(ota_trace_latency_summary_t* summaries, size_t max_summaries, bool reset);
+
+/**
+ * @brief Drop windows collected without reset, e.g. once they have been delivered
+ *
+ * Durations recorded after the collection stay in the histograms.
+ *
+ * @param summaries Summaries returned by ota_trace_histogram_collect with reset false
+ * @param count Number of summaries
+ */
+void ota_trace_histogram_discard(const ota_trace_latency_summary_t* summaries, size_t count);
+
+/**
+ * @brief Make a span the current span of the calling task
+ *
+ * Spans started by this task afterwards take it as their parent automatically.
+ * ota_trace_end_operation takes the span out of the task's chain of entered
+ * spans, restoring the previous current span if it was current. Enter and end
+ * a span from the same task.
+ *
+ * @param trace_ctx Trace context
+ */
+void ota_trace_enter(ota_trace_context_t* trace_ctx);
+
+/**
+ * @brief Restore the span that was current before ota_trace_enter
+ *
+ * If other spans were entered since, the span is only taken out of the chain
+ * and the current span stays as it is.
+ *
+ * @param trace_ctx Trace context passed to ota_trace_enter
+ */
+void ota_trace_exit(ota_trace_context_t* trace_ctx);
+
+/**
+ * @brief Get the current span of the calling task
+ * @return Trace context or NULL if no span is current
+ */
+ota_trace_context_t* ota_trace_get_current(void);
+
+/**
+ * @brief Start a trace operation and make it current (used by OTA_TRACE_SCOPE)
+ * @param operation Operation name
+ * @return Trace context on success, NULL on failure
+ */
+ota_trace_context_t* ota_trace_start_scoped(const char* operation);
+
+/**
+ * @brief Scope cleanup handler used by OTA_TRACE_SCOPE
+ * @param trace_ctx Pointer to the scoped trace context variable
+ */
+void ota_trace_scope_cleanup(ota_trace_context_t** trace_ctx);
+
+/**
+ * @brief Trace the enclosing block as a span that is current until the block exits
+ *
+ * Example:
+ *   OTA_TRACE_SCOPE(span, "sensor_reading");
+ */
+#define OTA_TRACE_SCOPE(var, operation) \
+    ota_trace_context_t* var __attribute__((cleanup(ota_trace_scope_cleanup))) = ota_trace_start_scoped(operation)
+
+/**
+ * @brief Format a W3C traceparent header value for a span
+ * @param trace_ctx Trace context
+ * @param buffer Output buffer of at least OTA_TRACEPARENT_SIZE bytes
+ * @param buffer_size Size of buffer
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_trace_format_traceparent(ota_trace_context_t* trace_ctx, char* buffer, size_t buffer_size);
+
+/**
+ * @brief Format the trace ID of a context as hex
+ * @param trace_ctx Trace context
+ * @param buffer Output buffer of at least OTA_TRACE_ID_HEX_SIZE bytes
+ * @param buffer_size Size of buffer
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_trace_format_trace_id(ota_trace_context_t* trace_ctx, char* buffer, size_t buffer_size);
+
+/**
+ * @brief Format the span ID of a context as hex
+ * @param trace_ctx Trace context
+ * @param buffer Output buffer of at least OTA_SPAN_ID_HEX_SIZE bytes
+ * @param buffer_size Size of buffer
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_trace_format_span_id(ota_trace_context_t* trace_ctx, char* buffer, size_t buffer_size);
+
 /**
  * @brief Get trace ID from context
+ *
+ * Formats into a buffer owned by the calling task, valid until its next call.
+ *
  * @param trace_ctx Trace context
  * @return Trace ID string or NULL if invalid context
  */
@@ -48,6 +273,9 @@ const char* ota_trace_get_trace_id(ota_trace_context_t* trace_ctx);
 
 /**
  * @brief Get span ID from context
+ *
+ * Formats into a buffer owned by the calling task, valid until its next call.
+ *
  * @param trace_ctx Trace context
  * @return Span ID string or NULL if invalid context
  */
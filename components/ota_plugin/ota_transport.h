@@ -0,0 +1,90 @@
+#ifndef OTA_TRANSPORT_H
+#define OTA_TRANSPORT_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * How request bodies built by ota_http_client reach the backend. Endpoints
+ * ("/heartbeat", "/firmware/check", ...) name the message whatever carries
+ * it: a URL path over HTTP, a topic suffix over MQTT. Firmware images are
+ * always downloaded over HTTP.
+ */
+
+/**
+ * @brief What came back from ota_transport_t.send()
+ */
+typedef struct {
+    size_t len; // Bytes in the response buffer
+    bool cbor;  // The body is CBOR rather than JSON
+} ota_transport_response_t;
+
+/**
+ * @brief Called for each message the backend pushes to the device
+ * @param endpoint Endpoint the message answers, e.g. "/firmware/check"
+ * @param body Message body, NUL-terminated
+ * @param body_len Bytes of body
+ * @param cbor True if body is CBOR
+ */
+typedef void (*ota_transport_receive_cb_t)(const char* endpoint, const char* body, size_t body_len, bool cbor);
+
+/**
+ * @brief A transport
+ *
+ * A transport that answers requests fills the response buffer passed to
+ * send(). One that does not (replies is false) returns as soon as the body
+ * is handed over; the backend's answers and any announcements it sends on
+ * its own arrive through the receive callback given to start().
+ */
+typedef struct {
+    const char* name;
+    bool replies;
+
+    /**
+     * @brief Connect, or prepare to; called from ota_http_client_start() (can be NULL)
+     * @param receive Called for pushed messages, from the transport's own task
+     * @return ESP_OK on success, error code otherwise
+     */
+    esp_err_t (*start)(ota_transport_receive_cb_t receive);
+
+    /**
+     * @brief Disconnect; called from ota_http_client_stop() (can be NULL)
+     */
+    void (*stop)(void);
+
+    /**
+     * @brief Deliver a request body
+     * @param endpoint Endpoint the body is for
+     * @param body Request body
+     * @param body_len Bytes of body
+     * @param cbor True if body is CBOR
+     * @param response_buffer Buffer for the answer (can be NULL)
+     * @param response_buffer_size Size of response_buffer
+     * @param response Output: length and encoding of the answer (can be NULL)
+     * @return ESP_OK once delivered or queued for delivery, ESP_ERR_NOT_SUPPORTED
+     *         if the backend refused a CBOR body, error code otherwise
+     */
+    esp_err_t (*send)(const char* endpoint, const char* body, size_t body_len, bool cbor, char* response_buffer,
+                      size_t response_buffer_size, ota_transport_response_t* response);
+} ota_transport_t;
+
+/**
+ * @brief One esp_http_client request per message (ota_http_client.c)
+ */
+extern const ota_transport_t ota_transport_http;
+
+/**
+ * @brief One persistent esp-mqtt session (ota_mqtt.c)
+ */
+extern const ota_transport_t ota_transport_mqtt;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_TRANSPORT_H
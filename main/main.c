@@ -80,6 +80,22 @@ void wifi_init_sta(void)
     ESP_LOGI(TAG, "wifi_init_sta finished.");
 }
 
+static void on_check_done(const ota_check_result_t *result, void *ctx)
+{
+    if (result->err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Manual OTA check failed: %s", esp_err_to_name(result->err));
+    }
+    else if (result->update_available)
+    {
+        ESP_LOGI(TAG, "Manual OTA check: update %s available", result->new_version);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Manual OTA check: firmware is up to date");
+    }
+}
+
 void app_main(void)
 {
     ESP_LOGI(TAG, "ESP32 OTA Plugin Example");
@@ -93,12 +109,10 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
-    // Initialize WiFi
+    // Initialize WiFi; the plugin starts its network work once the
+    // station gets an IP address, so there is no need to wait here
     wifi_init_sta();
 
-    // Wait for WiFi connection
-    vTaskDelay(pdMS_TO_TICKS(5000));
-
     // Initialize OTA plugin
     ESP_LOGI(TAG, "Initializing OTA plugin...");
     ret = ota_plugin_init();
@@ -134,11 +148,11 @@ void app_main(void)
             ota_log(OTA_LOG_LEVEL_INFO, "Application is running normally", NULL, "main_loop");
         }
 
-        // Example: Manual OTA check every 10 iterations
+        // Example: Manual OTA check every 10 iterations, without blocking the loop
         if (counter % 10 == 0)
         {
-            ESP_LOGI(TAG, "Performing manual OTA check...");
-            ota_plugin_check_update();
+            ESP_LOGI(TAG, "Requesting manual OTA check...");
+            ota_plugin_check_update_async(OTA_CHECK_ONLY, on_check_done, NULL);
         }
 
         ESP_LOGI(TAG, "App running, iteration: %d, status: %d", counter, ota_plugin_get_status());
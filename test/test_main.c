@@ -1,16 +1,167 @@
 #include "unity.h"
 #include "test_main.h" // Include the header file for test declarations
+#include "ota_executor.h"
+#include "ota_event.h"
+#include "ota_state.h"
+#include "ota_trace.h"
+#include "ota_arena.h"
+#include "ota_settings.h"
+#include "ota_compress.h"
+#include "ota_cbor.h"
+#include "ota_http_client.h"
+#include "ota_mqtt.h"
+#include "ota_exporter.h"
+#include "ota_metrics.h"
+#include "ota_status.h"
+#include "ota_schedule.h"
+#include "cJSON.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "esp_timer.h"
+#include "esp_heap_trace.h"
+#include "rom/miniz.h"
+#include "esp_rom_crc.h"
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
 
-// Dummy test setup function
+// Stop and wake-up must not wait for the sleeping job interval
+#define EXECUTOR_LATENCY_BUDGET_US 50000
+#define EXECUTOR_IDLE_INTERVAL_MS 300000
+
+#define SNAPSHOT_WRITES 20000
+
+#define HEAP_TRACE_RECORDS 32
+
+#define COMPRESSION_RUNS 20
+#define ENCODING_RUNS 200
+
+// Microseconds since the epoch, odd so a lossy double would show
+#define SPAN_STARTED_AT 1718000000123457LL
+
+// Backend stand-in behind every transport test: answers each request with a
+// preset response in a preset encoding, can refuse CBOR bodies, keeps the
+// last request, and hands out the receive callback so a test can push down
+typedef struct
+{
+    const void *answer; // NULL answers with an empty body
+    size_t answer_len;
+    bool answer_cbor;
+    bool refuse_cbor; // Answer CBOR bodies with 415
+    esp_err_t fail;   // Returned instead of an answer unless ESP_OK
+    void (*on_send)(void); // Runs while the request is in flight
+
+    int requests;
+    char endpoint[32];
+    char body[8 * OTA_ARENA_BUFFER_SIZE];
+    size_t body_len;
+    bool body_cbor;
+
+    ota_transport_receive_cb_t deliver; // Set while the client is started
+} stand_in_backend_t;
+
+static stand_in_backend_t backend;
+
+// { "updateAvailable": false } in CBOR, which every reader takes
+static const uint8_t quiet_answer_cbor[] = {0xA1, 0x6F, 'u', 'p', 'd', 'a', 't', 'e', 'A', 'v',
+                                            'a',  'i',  'l', 'a', 'b', 'l', 'e', 0xF4};
+
+static esp_err_t stand_in_start(ota_transport_receive_cb_t receive)
+{
+    backend.deliver = receive;
+    return ESP_OK;
+}
+
+static void stand_in_stop(void)
+{
+    backend.deliver = NULL;
+}
+
+static esp_err_t stand_in_send(const char *endpoint, const char *body, size_t body_len, bool cbor,
+                               char *response_buffer, size_t response_buffer_size,
+                               ota_transport_response_t *response)
+{
+    TEST_ASSERT_LESS_THAN(sizeof(backend.body), body_len);
+    backend.requests++;
+    strncpy(backend.endpoint, endpoint, sizeof(backend.endpoint) - 1);
+    memcpy(backend.body, body, body_len);
+    backend.body[body_len] = '\0';
+    backend.body_len = body_len;
+    backend.body_cbor = cbor;
+    if (backend.on_send != NULL)
+    {
+        backend.on_send();
+    }
+    if (cbor && backend.refuse_cbor)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (backend.fail != ESP_OK)
+    {
+        return backend.fail;
+    }
+
+    if (response != NULL)
+    {
+        response->len = 0;
+        response->cbor = backend.answer_cbor;
+        if (response_buffer != NULL && backend.answer_len < response_buffer_size)
+        {
+            memcpy(response_buffer, backend.answer, backend.answer_len);
+            response_buffer[backend.answer_len] = '\0';
+            response->len = backend.answer_len;
+        }
+    }
+    return ESP_OK;
+}
+
+// Not const: tests that stand in for a broker clear replies
+static ota_transport_t stand_in = {
+    .name = "stand-in",
+    .replies = true,
+    .start = stand_in_start,
+    .stop = stand_in_stop,
+    .send = stand_in_send,
+};
+
+// The last request body, parsed whatever its encoding
+static cJSON *stand_in_request(void)
+{
+    return backend.body_cbor ? ota_cbor_to_json(backend.body, backend.body_len) : cJSON_Parse(backend.body);
+}
+
+// A field of a metric in a heartbeat body, -1 if the metric or the field
+// was left out
+static double heartbeat_metric_field(cJSON *request, const char *name, const char *field)
+{
+    cJSON *metric = NULL;
+    cJSON_ArrayForEach(metric, cJSON_GetObjectItem(request, "metrics"))
+    {
+        if (strcmp(cJSON_GetObjectItem(metric, "name")->valuestring, name) == 0)
+        {
+            cJSON *value = cJSON_GetObjectItem(metric, field);
+            return cJSON_IsNumber(value) ? value->valuedouble : -1;
+        }
+    }
+    return -1;
+}
+
+// Every test starts with a silent stand-in and a client that has not
+// negotiated CBOR yet; the next ota_http_client_start() renegotiates
 void setUp(void)
 {
-    // Set up code, if needed
+    memset(&backend, 0, sizeof(backend));
+    stand_in.replies = true;
 }
 
-// Dummy test teardown function
+// A failed assertion can leave the client started on the stand-in
 void tearDown(void)
 {
-    // Tear down code, if needed
+    ota_http_client_stop();
+    ota_http_client_set_transport(NULL);
 }
 
 // Example dummy test case
@@ -25,11 +176,1624 @@ void test_another_case(void)
     TEST_ASSERT_NOT_NULL((void *)0x1234); // Dummy assertion
 }
 
+static volatile int idle_job_runs = 0;
+static volatile int64_t idle_job_last_run_us = 0;
+
+static uint32_t idle_job(void *arg)
+{
+    idle_job_runs++;
+    idle_job_last_run_us = esp_timer_get_time();
+    return EXECUTOR_IDLE_INTERVAL_MS;
+}
+
+// Start the executor with one job that has run once and now sleeps for
+// EXECUTOR_IDLE_INTERVAL_MS, like the update check between two checks
+static ota_executor_job_t start_idle_executor(void)
+{
+    idle_job_runs = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, ota_executor_start());
+
+    ota_executor_job_t job = ota_executor_add("idle", idle_job, NULL, OTA_JOB_PRIORITY_TELEMETRY, 0);
+    TEST_ASSERT_NOT_EQUAL(OTA_EXECUTOR_INVALID_JOB, job);
+
+    for (int i = 0; i < 100 && idle_job_runs == 0; i++)
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    TEST_ASSERT_EQUAL(1, idle_job_runs);
+
+    return job;
+}
+
+void test_executor_stop_latency(void)
+{
+    ota_executor_job_t job = start_idle_executor();
+
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, ota_executor_stop());
+    int64_t latency_us = esp_timer_get_time() - start;
+
+    ota_executor_cancel(job);
+
+    printf("Executor stop latency: %lld us\n", (long long)latency_us);
+    TEST_ASSERT_LESS_THAN(EXECUTOR_LATENCY_BUDGET_US, (int32_t)latency_us);
+}
+
+void test_executor_expedite_latency(void)
+{
+    ota_executor_job_t job = start_idle_executor();
+
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, ota_executor_expedite(job, 0));
+
+    for (int i = 0; i < 100 && idle_job_runs == 1; i++)
+    {
+        vTaskDelay(1);
+    }
+    TEST_ASSERT_EQUAL(2, idle_job_runs);
+    int64_t latency_us = idle_job_last_run_us - start;
+
+    ota_executor_cancel(job);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_executor_stop());
+
+    printf("Executor wake-up latency: %lld us\n", (long long)latency_us);
+    TEST_ASSERT_LESS_THAN(EXECUTOR_LATENCY_BUDGET_US, (int32_t)latency_us);
+}
+
+void test_status_snapshot_transitions(void)
+{
+    ota_plugin_status_snapshot_t snapshot;
+
+    ota_event_check_started();
+    ota_event_get_snapshot(&snapshot);
+    TEST_ASSERT_EQUAL(OTA_STATUS_CHECKING, snapshot.state);
+
+    ota_check_result_t result = {.err = ESP_OK, .update_available = true, .new_version = "7.0.0"};
+    ota_event_check_finished(&result);
+    ota_event_get_snapshot(&snapshot);
+    TEST_ASSERT_EQUAL(OTA_STATUS_IDLE, snapshot.state);
+    TEST_ASSERT_EQUAL_STRING("7.0.0", snapshot.available_version);
+    TEST_ASSERT_NOT_EQUAL(0, snapshot.last_check_time);
+
+    ota_event_heartbeat_result(ESP_FAIL);
+    ota_event_heartbeat_result(ESP_FAIL);
+    ota_event_get_snapshot(&snapshot);
+    TEST_ASSERT_EQUAL(2, snapshot.heartbeat_failures);
+
+    ota_event_heartbeat_result(ESP_OK);
+    ota_event_get_snapshot(&snapshot);
+    TEST_ASSERT_EQUAL(0, snapshot.heartbeat_failures);
+}
+
+static volatile bool snapshot_writer_done = false;
+
+static void snapshot_writer_task(void *arg)
+{
+    // Every write keeps received == total, so a torn read shows up as a mismatch
+    for (uint32_t i = 1; i <= SNAPSHOT_WRITES; i++)
+    {
+        ota_event_download_progress(i, i);
+    }
+    snapshot_writer_done = true;
+    vTaskDelete(NULL);
+}
+
+void test_status_snapshot_consistent_under_writes(void)
+{
+    snapshot_writer_done = false;
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(snapshot_writer_task, "snapshot_writer", 4096, NULL,
+                                          tskIDLE_PRIORITY + 1, NULL));
+
+    int reads = 0;
+    while (!snapshot_writer_done)
+    {
+        ota_plugin_status_snapshot_t snapshot;
+        ota_event_get_snapshot(&snapshot);
+        TEST_ASSERT_EQUAL_UINT32(snapshot.bytes_total, snapshot.bytes_received);
+        reads++;
+    }
+
+    ota_event_install_finished(ESP_FAIL, "7.0.0");
+    printf("Status snapshot reads during writes: %d\n", reads);
+}
+
+void test_state_survives_reload(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_state_load());
+
+    // One transition, one commit
+    ota_state_set_firmware_version("7.1.0");
+    ota_state_set_update_status("FAILED", "7.1.0");
+    TEST_ASSERT_EQUAL(ESP_OK, ota_state_commit());
+
+    // Drop the RAM cache and read the record back
+    ota_state_set_firmware_version("0.0.0");
+    TEST_ASSERT_EQUAL(ESP_OK, ota_state_load());
+
+    ota_state_t state;
+    ota_state_get(&state);
+    TEST_ASSERT_EQUAL_STRING("7.1.0", state.firmware_version);
+    TEST_ASSERT_EQUAL_STRING("FAILED", state.update_status);
+    TEST_ASSERT_EQUAL_STRING("7.1.0", state.last_version);
+
+    // A record from a newer layout, as found after rolling back to this
+    // firmware, keeps its known fields and is not rewritten on load
+    static struct
+    {
+        ota_state_t state;
+        uint8_t appended[24];
+    } newer;
+    newer.state = state;
+    newer.state.layout = OTA_STATE_LAYOUT_VERSION + 1;
+    newer.state.size = sizeof(newer);
+    memset(newer.appended, 0xA5, sizeof(newer.appended));
+
+    nvs_handle_t nvs_handle; // Namespace and key of the record in ota_state.c
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_open("ota_plugin", NVS_READWRITE, &nvs_handle));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_set_blob(nvs_handle, "state", &newer, sizeof(newer)));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_commit(nvs_handle));
+
+    ota_state_set_firmware_version("0.0.0");
+    TEST_ASSERT_EQUAL(ESP_OK, ota_state_load());
+    ota_state_get(&state);
+    TEST_ASSERT_EQUAL_STRING("7.1.0", state.firmware_version);
+    TEST_ASSERT_EQUAL_STRING("FAILED", state.update_status);
+    TEST_ASSERT_EQUAL_STRING("7.1.0", state.last_version);
+
+    size_t stored_size = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_get_blob(nvs_handle, "state", NULL, &stored_size));
+    TEST_ASSERT_EQUAL(sizeof(newer), stored_size);
+    nvs_close(nvs_handle);
+
+    // Leave a clean record for the application
+    ota_state_set_firmware_version(OTA_FIRMWARE_VERSION);
+    ota_state_set_update_status(NULL, NULL);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_state_commit());
+}
+
+static int settings_changes = 0;
+
+static void count_setting_change(ota_setting_t setting, void *ctx)
+{
+    settings_changes++;
+}
+
+void test_settings_validated_and_applied_live(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_reset());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_add_listener(count_setting_change, NULL));
+    settings_changes = 0;
+
+    // Rejected values leave the current ones in place
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ota_settings_set_u32(OTA_SETTING_HEARTBEAT_INTERVAL_MS, 10));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ota_settings_set_str(OTA_SETTING_SERVER_URL, "ftp://backend"));
+    TEST_ASSERT_EQUAL_UINT32(OTA_HEARTBEAT_INTERVAL_MS, ota_settings_get_u32(OTA_SETTING_HEARTBEAT_INTERVAL_MS));
+    TEST_ASSERT_EQUAL(0, settings_changes);
+
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_set_u32(OTA_SETTING_HEARTBEAT_INTERVAL_MS, 120000));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_set_u32(OTA_SETTING_LOGGING_ENABLED, false));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_set_str(OTA_SETTING_SERVER_URL, "https://backend.example/api"));
+    TEST_ASSERT_EQUAL_UINT32(120000, ota_settings_get_u32(OTA_SETTING_HEARTBEAT_INTERVAL_MS));
+    TEST_ASSERT_FALSE(ota_settings_get_bool(OTA_SETTING_LOGGING_ENABLED));
+    TEST_ASSERT_EQUAL(3, settings_changes);
+
+    char url[OTA_SETTINGS_TEXT_SIZE];
+    ota_settings_get_str(OTA_SETTING_SERVER_URL, url, sizeof(url));
+    TEST_ASSERT_EQUAL_STRING("https://backend.example/api", url);
+
+    // A remote delta cannot move the device to another server
+    cJSON *delta = cJSON_Parse("{\"serverUrl\":\"http://attacker.example/api\",\"heartbeatIntervalMs\":60000}");
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ota_settings_apply_json(delta));
+    cJSON_Delete(delta);
+    ota_settings_get_str(OTA_SETTING_SERVER_URL, url, sizeof(url));
+    TEST_ASSERT_EQUAL_STRING("https://backend.example/api", url);
+    TEST_ASSERT_EQUAL_UINT32(120000, ota_settings_get_u32(OTA_SETTING_HEARTBEAT_INTERVAL_MS));
+
+    // Back to the Kconfig defaults for the tests that follow
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_reset());
+    TEST_ASSERT_EQUAL_UINT32(OTA_HEARTBEAT_INTERVAL_MS, ota_settings_get_u32(OTA_SETTING_HEARTBEAT_INTERVAL_MS));
+    ota_settings_get_str(OTA_SETTING_SERVER_URL, url, sizeof(url));
+    TEST_ASSERT_EQUAL_STRING(OTA_SERVER_BASE_URL, url);
+}
+
+typedef struct
+{
+    char text[4096];
+    size_t len;
+    size_t largest_write;
+} exporter_capture_t;
+
+static esp_err_t capture_write(const char *data, size_t len, void *ctx)
+{
+    exporter_capture_t *capture = ctx;
+    if (capture->len + len >= sizeof(capture->text))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(&capture->text[capture->len], data, len);
+    capture->len += len;
+    capture->text[capture->len] = '\0';
+    capture->largest_write = len > capture->largest_write ? len : capture->largest_write;
+    return ESP_OK;
+}
+
+static esp_err_t refuse_write(const char *data, size_t len, void *ctx)
+{
+    (*(int *)ctx)++;
+    return ESP_ERR_TIMEOUT;
+}
+
+void test_exporter_renders_metrics(void)
+{
+    ota_metric_handle_t requests = ota_metrics_register("exporter.test-requests", OTA_METRIC_COUNTER, "requests");
+    ota_metric_handle_t level = ota_metrics_register("exporter.test_level", OTA_METRIC_GAUGE, "percent");
+    ota_metric_handle_t frame = ota_metrics_register("exporter.test_frame", OTA_METRIC_HISTOGRAM, "bytes");
+    TEST_ASSERT_NOT_EQUAL(OTA_METRIC_INVALID_HANDLE, requests);
+    TEST_ASSERT_NOT_EQUAL(OTA_METRIC_INVALID_HANDLE, level);
+    TEST_ASSERT_NOT_EQUAL(OTA_METRIC_INVALID_HANDLE, frame);
+
+    ota_metrics_counter_add(requests, 3);
+    ota_metrics_gauge_set(level, 2.5f);
+    ota_metrics_histogram_record(frame, 100);
+    ota_metrics_histogram_record(frame, 200);
+    ota_metrics_histogram_record(frame, 300);
+
+    // Spans come from the pool ota_plugin_init() reserves
+    TEST_ASSERT_EQUAL(ESP_OK, ota_arena_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_trace_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_trace_histogram_enable("exporter_op"));
+    ota_trace_context_t *span = ota_trace_start_operation("exporter_op", NULL);
+    TEST_ASSERT_NOT_NULL(span);
+
+    // The string getters return what the format functions write
+    char span_id[OTA_SPAN_ID_HEX_SIZE];
+    TEST_ASSERT_EQUAL(ESP_OK, ota_trace_format_span_id(span, span_id, sizeof(span_id)));
+    TEST_ASSERT_EQUAL_STRING(span_id, ota_trace_get_span_id(span));
+    TEST_ASSERT_EQUAL(OTA_TRACE_ID_HEX_SIZE - 1, strlen(ota_trace_get_trace_id(span)));
+    TEST_ASSERT_NULL(ota_trace_get_trace_id(NULL));
+    TEST_ASSERT_NULL(ota_trace_get_span_id(NULL));
+
+    for (int i = 0; i < OTA_TRACE_MAX_ATTRIBUTES; i++)
+    {
+        char key[8];
+        snprintf(key, sizeof(key), "k%d", i);
+        TEST_ASSERT_EQUAL(ESP_OK, ota_trace_set_attr_int(span, key, i));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, ota_trace_set_attr_int(span, "k0", 10)); // Overwrites
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, ota_trace_set_attr_bool(span, "one_too_many", true));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ota_trace_set_attr_str(span, NULL, "value"));
+    ota_trace_end_operation(span, NULL);
+
+    // What ota_trace_start_operation() returns while tracing is disabled
+    TEST_ASSERT_EQUAL(ESP_OK, ota_trace_set_attr_str(NULL, "key", "value"));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_trace_set_attr_double(NULL, "key", 1.0));
+
+    static exporter_capture_t capture;
+    char expected[160];
+    snprintf(expected, sizeof(expected), "firmware_ref=\"%s\"", FIRMWARE_REF);
+
+    // Scraping twice shows the same values: reading resets no window
+    for (int scrape = 0; scrape < 2; scrape++)
+    {
+        memset(&capture, 0, sizeof(capture));
+        TEST_ASSERT_EQUAL(ESP_OK, ota_exporter_render(capture_write, &capture));
+        TEST_ASSERT_LESS_OR_EQUAL(OTA_EXPORTER_CHUNK_SIZE, capture.largest_write);
+
+        TEST_ASSERT_NOT_NULL(strstr(capture.text, "# TYPE ota_device_info gauge\nota_device_info{device_id=\""));
+        TEST_ASSERT_NOT_NULL(strstr(capture.text, expected));
+        TEST_ASSERT_NOT_NULL(strstr(capture.text, "# TYPE ota_uptime_seconds counter\nota_uptime_seconds "));
+        TEST_ASSERT_NOT_NULL(
+            strstr(capture.text, "# TYPE ota_exporter_test_requests counter\nota_exporter_test_requests 3\n"));
+        TEST_ASSERT_NOT_NULL(strstr(capture.text, "# TYPE ota_exporter_test_level gauge\nota_exporter_test_level 2.5\n"));
+        TEST_ASSERT_NOT_NULL(strstr(capture.text, "# TYPE ota_exporter_test_frame summary\n"
+                                                  "ota_exporter_test_frame{quantile=\"0.5\"} "));
+        TEST_ASSERT_NOT_NULL(strstr(capture.text, "\nota_exporter_test_frame_sum 600\n"
+                                                  "ota_exporter_test_frame_count 3\n"));
+        TEST_ASSERT_NOT_NULL(strstr(capture.text, "# TYPE ota_span_latency_seconds summary\n"));
+        TEST_ASSERT_NOT_NULL(strstr(capture.text, "\nota_span_latency_seconds{operation=\"exporter_op\",quantile=\"0.99\"} "));
+        TEST_ASSERT_NOT_NULL(strstr(capture.text, "\nota_span_latency_seconds_sum{operation=\"exporter_op\"} "));
+        TEST_ASSERT_NOT_NULL(strstr(capture.text, "\nota_span_latency_seconds_count{operation=\"exporter_op\"} 1\n"));
+    }
+
+    // The first failed write ends rendering and is returned
+    int writes = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, ota_exporter_render(refuse_write, &writes));
+    TEST_ASSERT_EQUAL(1, writes);
+}
+
+void test_trace_unlinks_ended_spans(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, ota_arena_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_trace_init());
+
+    ota_trace_context_t *outer = ota_trace_start_scoped("outer_op");
+    ota_trace_context_t *middle = ota_trace_start_scoped("middle_op");
+    ota_trace_context_t *inner = ota_trace_start_scoped("inner_op");
+    TEST_ASSERT_NOT_NULL(outer);
+    TEST_ASSERT_NOT_NULL(middle);
+    TEST_ASSERT_NOT_NULL(inner);
+    TEST_ASSERT_EQUAL_PTR(inner, ota_trace_get_current());
+
+    // Ending a span below the top leaves the current span and closes the gap
+    ota_trace_end_operation(middle, NULL);
+    TEST_ASSERT_EQUAL_PTR(inner, ota_trace_get_current());
+    TEST_ASSERT_EQUAL_PTR(outer, inner->previous);
+
+    ota_trace_end_operation(inner, NULL);
+    TEST_ASSERT_EQUAL_PTR(outer, ota_trace_get_current());
+    ota_trace_end_operation(outer, NULL);
+    TEST_ASSERT_NULL(ota_trace_get_current());
+}
+
+void test_custom_metrics(void)
+{
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ota_status_add_custom_metric(NULL, 1.0f, "percent"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ota_status_add_custom_metric("custom.level", 1.0f, NULL));
+
+    TEST_ASSERT_EQUAL(ESP_OK, ota_status_add_custom_metric("custom.level", 4.0f, "percent"));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_status_add_custom_metric("custom.level", 1.0f, "percent"));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_status_add_custom_metric("custom.level", 7.0f, "percent"));
+
+    ota_metric_handle_t handle = ota_metrics_find("custom.level");
+    TEST_ASSERT_NOT_EQUAL(OTA_METRIC_INVALID_HANDLE, handle);
+
+    ota_metric_snapshot_t snapshot;
+    TEST_ASSERT_EQUAL(ESP_OK, ota_metrics_snapshot(handle, &snapshot, false));
+    TEST_ASSERT_EQUAL(OTA_METRIC_GAUGE, snapshot.type);
+    TEST_ASSERT_EQUAL_STRING("percent", snapshot.unit);
+    TEST_ASSERT_EQUAL(3, snapshot.value.gauge.count);
+    TEST_ASSERT_TRUE(snapshot.value.gauge.last == 7.0f);
+    TEST_ASSERT_TRUE(snapshot.value.gauge.sum == 12.0f);
+    TEST_ASSERT_TRUE(snapshot.value.gauge.min == 1.0f);
+    TEST_ASSERT_TRUE(snapshot.value.gauge.max == 7.0f);
+
+    // A name taken by another type is the caller's mistake, not a full registry
+    TEST_ASSERT_NOT_EQUAL(OTA_METRIC_INVALID_HANDLE,
+                          ota_metrics_register("custom.requests", OTA_METRIC_COUNTER, "requests"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ota_status_add_custom_metric("custom.requests", 1.0f, "requests"));
+
+    TEST_ASSERT_EQUAL(ESP_OK, ota_status_clear_custom_metrics());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_metrics_snapshot(handle, &snapshot, false));
+    TEST_ASSERT_EQUAL(0, snapshot.value.gauge.count);
+    TEST_ASSERT_TRUE(snapshot.value.gauge.last == 0.0f);
+}
+
+// Bodies shaped like the plugin's own requests, at typical sizes
+static size_t build_heartbeat_body(char *buffer, size_t size)
+{
+    static const char *metrics[] = {"heap.free", "heap.min_free", "heap.largest_block", "wifi.rssi",
+                                    "cpu.load", "executor.lag_ms", "task.ota_executor.stack_free",
+                                    "task.main.stack_free", "task.tiT.stack_free", "boot.first_heartbeat_ms"};
+    int len = snprintf(buffer, size,
+                       "{\"deviceId\":\"Test_Device_001\",\"sessionId\":\"3f9a1c0e7b2d4a6f\",\"seq\":42,"
+                       "\"full\":true,\"uptimeSec\":86400,\"ip\":\"192.168.10.23\",\"firmwareRef\":\"esp32-devboard\","
+                       "\"metrics\":[");
+    for (int i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++)
+    {
+        len += snprintf(buffer + len, size - len,
+                        "%s{\"name\":\"%s\",\"value\":%d,\"unit\":\"bytes\",\"count\":60,\"sum\":%d,\"min\":%d,\"max\":%d}",
+                        i > 0 ? "," : "", metrics[i], 180000 + i * 977, 10800000 + i * 58620, 176512 + i * 31,
+                        183904 + i * 17);
+    }
+    len += snprintf(buffer + len, size - len, "]}");
+    return len;
+}
+
+static size_t build_log_body(char *buffer, size_t size)
+{
+    return snprintf(buffer, size,
+                    "{\"deviceId\":\"Test_Device_001\",\"level\":\"WARN\","
+                    "\"message\":\"Update check failed: ESP_ERR_HTTP_CONNECT, retrying in 5000 ms\","
+                    "\"context\":\"{\\\"operation\\\":\\\"ota_check\\\",\\\"attempt\\\":2,\\\"rssi\\\":-71}\"}");
+}
+
+static size_t build_trace_body(char *buffer, size_t size)
+{
+    return snprintf(buffer, size,
+                    "{\"deviceId\":\"Test_Device_001\",\"trace_id\":\"4bf92f3577b34da6a3ce929d0e0e4736\","
+                    "\"span_id\":\"00f067aa0ba902b7\",\"operation\":\"http_post /firmware/check\",\"duration_ms\":412,"
+                    "\"started_at\":1718000000123456,\"ended_at\":1718000000535456,\"parent_span\":\"a3ce929d0e0e4736\","
+                    "\"attributes\":{\"http.status_code\":200,\"http.method\":\"POST\",\"firmware.version\":\"6.0.0\","
+                    "\"update_available\":false,\"net.peer.name\":\"192.168.10.149\"}}");
+}
+
+static uint32_t read_le32(const uint8_t *bytes)
+{
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+// A duration recorded while the heartbeat is on its way
+static void record_log_latency_in_flight(void)
+{
+    TEST_ASSERT_TRUE(ota_trace_record_duration("http_post /log", 9000));
+}
+
+void test_failed_heartbeat_keeps_window(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_reset());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_arena_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_trace_init()); // Histograms for check, heartbeat and log requests
+    TEST_ASSERT_EQUAL(ESP_OK, ota_status_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(&stand_in));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_start());
+
+    ota_metric_handle_t level = ota_metrics_register("window.level", OTA_METRIC_GAUGE, "percent");
+    TEST_ASSERT_NOT_EQUAL(OTA_METRIC_INVALID_HANDLE, level);
+    ota_metrics_gauge_set(level, 1.0f);
+    ota_metrics_gauge_set(level, 2.0f);
+    ota_metrics_gauge_set(level, 3.0f);
+    TEST_ASSERT_TRUE(ota_trace_record_duration("http_post /log", 5000));
+
+    // The backend is unreachable: the window goes out and comes back
+    backend.fail = ESP_ERR_TIMEOUT;
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, ota_status_send_heartbeat("192.168.1.20"));
+    cJSON *request = stand_in_request();
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "window.level", "count") == 3);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "latency.http_post /log.count", "value") == 1);
+    cJSON_Delete(request);
+
+    // The next heartbeat carries both windows, and a duration recorded while
+    // it is in flight stays for the one after
+    ota_metrics_gauge_set(level, 4.0f);
+    TEST_ASSERT_TRUE(ota_trace_record_duration("http_post /log", 7000));
+    backend.fail = ESP_OK;
+    backend.on_send = record_log_latency_in_flight;
+    TEST_ASSERT_EQUAL(ESP_OK, ota_status_send_heartbeat("192.168.1.20"));
+    backend.on_send = NULL;
+    request = stand_in_request();
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "window.level", "count") == 4);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "window.level", "sum") == 10);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "window.level", "min") == 1);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "window.level", "max") == 4);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "latency.http_post /log.count", "value") == 2);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "latency.http_post /log.max", "value") == 7);
+    cJSON_Delete(request);
+
+    // Delivered windows are gone; the in-flight duration is all that is left
+    TEST_ASSERT_EQUAL(ESP_OK, ota_status_send_heartbeat("192.168.1.20"));
+    request = stand_in_request();
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "window.level", "count") == -1);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "latency.http_post /log.count", "value") == 1);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "latency.http_post /log.max", "value") == 9);
+    cJSON_Delete(request);
+
+    ota_metric_snapshot_t snapshot;
+    TEST_ASSERT_EQUAL(ESP_OK, ota_metrics_snapshot(level, &snapshot, false));
+    TEST_ASSERT_EQUAL(0, snapshot.value.gauge.count);
+    TEST_ASSERT_TRUE(snapshot.value.gauge.last == 4.0f);
+}
+
+#define OUTGROW_GAUGES 20
+
+// Sets a two-sample window on every gauge and sends heartbeats until each
+// window was delivered; returns how many it took, -1 if some never were
+static int deliver_gauge_windows(ota_metric_handle_t *gauges, char names[][OTA_METRICS_NAME_SIZE], float value)
+{
+    int delivered[OUTGROW_GAUGES] = {0};
+    for (int i = 0; i < OUTGROW_GAUGES; i++)
+    {
+        ota_metrics_gauge_set(gauges[i], value);
+        ota_metrics_gauge_set(gauges[i], value + i);
+    }
+
+    for (int heartbeats = 1; heartbeats <= 4; heartbeats++)
+    {
+        TEST_ASSERT_EQUAL(ESP_OK, ota_status_send_heartbeat("192.168.1.20"));
+        cJSON *request = stand_in_request();
+        TEST_ASSERT_NOT_NULL(request);
+        int missing = 0;
+        for (int i = 0; i < OUTGROW_GAUGES; i++)
+        {
+            if (heartbeat_metric_field(request, names[i], "count") == 2)
+            {
+                delivered[i]++;
+            }
+            TEST_ASSERT_LESS_OR_EQUAL(1, delivered[i]);
+            missing += delivered[i] == 0;
+        }
+        cJSON_Delete(request);
+        if (missing == 0)
+        {
+            return heartbeats;
+        }
+    }
+    return -1;
+}
+
+void test_heartbeat_outgrows_scratch_buffer(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_reset());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_arena_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_status_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(&stand_in));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_start());
+
+    ota_metric_handle_t gauges[OUTGROW_GAUGES];
+    char names[OUTGROW_GAUGES][OTA_METRICS_NAME_SIZE];
+    for (int i = 0; i < OUTGROW_GAUGES; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "outgrow.scratch.buffer.gauge.%02d", i);
+        gauges[i] = ota_metrics_register(names[i], OTA_METRIC_GAUGE, "percent_of_peak");
+        TEST_ASSERT_NOT_EQUAL(OTA_METRIC_INVALID_HANDLE, gauges[i]);
+    }
+
+    // Once in JSON, then in CBOR after the backend answered in it
+    backend.answer = quiet_answer_cbor;
+    backend.answer_len = sizeof(quiet_answer_cbor);
+    backend.answer_cbor = true;
+    for (int cbor = 0; cbor < 2; cbor++)
+    {
+        int heartbeats = deliver_gauge_windows(gauges, names, 10.0f * (cbor + 1));
+        TEST_ASSERT_EQUAL(1, heartbeats);
+        TEST_ASSERT_EQUAL(cbor, backend.body_cbor);
+        TEST_ASSERT_GREATER_THAN(OTA_ARENA_BUFFER_SIZE, backend.body_len);
+    }
+}
+
+// Sends a heartbeat and returns its request, parsed
+static cJSON *send_heartbeat_request(esp_err_t expected)
+{
+    TEST_ASSERT_EQUAL(expected, ota_status_send_heartbeat("192.168.1.20"));
+    cJSON *request = stand_in_request();
+    TEST_ASSERT_NOT_NULL(request);
+    return request;
+}
+
+static bool request_flag(cJSON *request, const char *key)
+{
+    return cJSON_IsTrue(cJSON_GetObjectItem(request, key));
+}
+
+static double request_number(cJSON *request, const char *key)
+{
+    cJSON *value = cJSON_GetObjectItem(request, key);
+    return cJSON_IsNumber(value) ? value->valuedouble : -1;
+}
+
+void test_delta_heartbeat_protocol(void)
+{
+    static const char resync_answer[] = "{\"resync\":true}";
+
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_reset());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_arena_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_status_init()); // New session
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(&stand_in));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_start());
+
+    ota_metric_handle_t requests = ota_metrics_register("delta.requests", OTA_METRIC_COUNTER, "requests");
+    TEST_ASSERT_NOT_EQUAL(OTA_METRIC_INVALID_HANDLE, requests);
+    ota_metrics_counter_add(requests, 1000);
+
+    // A session starts with a full snapshot of every field and metric
+    cJSON *request = send_heartbeat_request(ESP_OK);
+    TEST_ASSERT_TRUE(request_flag(request, "full"));
+    TEST_ASSERT_TRUE(request_number(request, "seq") == 0);
+    const char *session = cJSON_GetStringValue(cJSON_GetObjectItem(request, "sessionId"));
+    TEST_ASSERT_NOT_NULL(session);
+    char session_id[17] = "";
+    strncpy(session_id, session ? session : "", sizeof(session_id) - 1);
+    TEST_ASSERT_EQUAL(16, strlen(session_id));
+    TEST_ASSERT_EQUAL_STRING("192.168.1.20", cJSON_GetStringValue(cJSON_GetObjectItem(request, "ip")));
+    TEST_ASSERT_NOT_NULL(cJSON_GetObjectItem(request, "firmwareRef"));
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "delta.requests", "value") == 1000);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "wifi_signal_strength", "value") != -1);
+    cJSON_Delete(request);
+
+    // Nothing changed: a delta with the same session and no fields or metrics
+    request = send_heartbeat_request(ESP_OK);
+    TEST_ASSERT_FALSE(request_flag(request, "full"));
+    TEST_ASSERT_TRUE(request_number(request, "seq") == 1);
+    TEST_ASSERT_EQUAL_STRING(session_id, cJSON_GetStringValue(cJSON_GetObjectItem(request, "sessionId")));
+    TEST_ASSERT_NULL(cJSON_GetObjectItem(request, "ip"));
+    TEST_ASSERT_NULL(cJSON_GetObjectItem(request, "firmwareRef"));
+    TEST_ASSERT_NULL(cJSON_GetObjectItem(request, "metrics"));
+    cJSON_Delete(request);
+
+    // Within the deadband of the delivered 1000, then beyond it
+    ota_metrics_counter_add(requests, 5);
+    request = send_heartbeat_request(ESP_OK);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "delta.requests", "value") == -1);
+    cJSON_Delete(request);
+    ota_metrics_counter_add(requests, 15);
+    request = send_heartbeat_request(ESP_OK);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "delta.requests", "value") == 1020);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "wifi_signal_strength", "value") == -1);
+    cJSON_Delete(request);
+
+    // A failed send commits nothing; the next heartbeat repeats the change
+    // and the server sees the skipped sequence number
+    ota_metrics_counter_add(requests, 100);
+    backend.fail = ESP_ERR_TIMEOUT;
+    request = send_heartbeat_request(ESP_ERR_TIMEOUT);
+    TEST_ASSERT_TRUE(request_number(request, "seq") == 4);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "delta.requests", "value") == 1120);
+    cJSON_Delete(request);
+    backend.fail = ESP_OK;
+    request = send_heartbeat_request(ESP_OK);
+    TEST_ASSERT_TRUE(request_number(request, "seq") == 5);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "delta.requests", "value") == 1120);
+    cJSON_Delete(request);
+    request = send_heartbeat_request(ESP_OK);
+    TEST_ASSERT_NULL(cJSON_GetObjectItem(request, "metrics"));
+    cJSON_Delete(request);
+
+    // Metrics left out of a heartbeat are not a reference for the next delta
+    ota_metrics_counter_add(requests, 200);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_set_u32(OTA_SETTING_METRICS_ENABLED, 0));
+    request = send_heartbeat_request(ESP_OK);
+    TEST_ASSERT_NULL(cJSON_GetObjectItem(request, "metrics"));
+    cJSON_Delete(request);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_set_u32(OTA_SETTING_METRICS_ENABLED, 1));
+    request = send_heartbeat_request(ESP_OK);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "delta.requests", "value") == 1320);
+    cJSON_Delete(request);
+
+    // The server lost the session: the next heartbeat is full again
+    backend.answer = resync_answer;
+    backend.answer_len = strlen(resync_answer);
+    request = send_heartbeat_request(ESP_OK);
+    TEST_ASSERT_FALSE(request_flag(request, "full"));
+    cJSON_Delete(request);
+    backend.answer = NULL;
+    backend.answer_len = 0;
+    request = send_heartbeat_request(ESP_OK);
+    TEST_ASSERT_TRUE(request_flag(request, "full"));
+    TEST_ASSERT_TRUE(request_number(request, "seq") == 10);
+    TEST_ASSERT_NOT_NULL(cJSON_GetObjectItem(request, "ip"));
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "delta.requests", "value") == 1320);
+    TEST_ASSERT_TRUE(heartbeat_metric_field(request, "wifi_signal_strength", "value") != -1);
+    cJSON_Delete(request);
+    request = send_heartbeat_request(ESP_OK);
+    TEST_ASSERT_FALSE(request_flag(request, "full"));
+    TEST_ASSERT_NULL(cJSON_GetObjectItem(request, "metrics"));
+    cJSON_Delete(request);
+}
+
+// Allows for the +/- OTA_SCHEDULE_JITTER_PERCENT of jitter
+static void assert_interval_near(uint32_t expected_ms, uint32_t interval_ms)
+{
+    TEST_ASSERT_UINT32_WITHIN((uint64_t)expected_ms * OTA_SCHEDULE_JITTER_PERCENT / 100, expected_ms, interval_ms);
+}
+
+void test_schedule_next_interval(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_reset());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_set_u32(OTA_SETTING_HEARTBEAT_INTERVAL_MS, 60000));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_set_u32(OTA_SETTING_CHECK_INTERVAL_MS, 2000000));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_schedule_init());
+    ota_schedule_set_online(true);
+    assert_interval_near(60000, ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT));
+
+    // Failed runs retry after OTA_RETRY_DELAY_MS, doubling up to the baseline
+    // and no sooner than OTA_SCHEDULE_MIN_INTERVAL_MS
+    static const uint32_t backoff_ms[] = {OTA_SCHEDULE_MIN_INTERVAL_MS, OTA_SCHEDULE_MIN_INTERVAL_MS, 20000, 40000,
+                                          60000};
+    for (int i = 0; i < sizeof(backoff_ms) / sizeof(backoff_ms[0]); i++)
+    {
+        ota_schedule_report_result(OTA_SCHEDULE_HEARTBEAT, ESP_FAIL);
+        assert_interval_near(backoff_ms[i], ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT));
+    }
+    ota_schedule_report_result(OTA_SCHEDULE_HEARTBEAT, ESP_OK);
+    assert_interval_near(60000, ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT));
+
+    // A throttled backend stretches the baseline, even after the rejected
+    // request failed and during a rollout
+    ota_schedule_set_throttled(true);
+    ota_schedule_report_result(OTA_SCHEDULE_HEARTBEAT, ESP_FAIL);
+    assert_interval_near(60000 * OTA_SCHEDULE_THROTTLE_FACTOR, ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT));
+    ota_schedule_set_rollout_active(true);
+    assert_interval_near(OTA_SCHEDULE_MAX_INTERVAL_MS, ota_schedule_next_interval_ms(OTA_SCHEDULE_CHECK));
+    ota_schedule_set_throttled(false);
+    ota_schedule_report_result(OTA_SCHEDULE_HEARTBEAT, ESP_OK);
+    assert_interval_near(OTA_SCHEDULE_ROLLOUT_INTERVAL_MS, ota_schedule_next_interval_ms(OTA_SCHEDULE_CHECK));
+    ota_schedule_set_rollout_active(false);
+
+    // A weak link stretches it too; the result is clamped before the jitter
+    ota_schedule_report_rssi(OTA_SCHEDULE_WEAK_RSSI_DBM - 5);
+    assert_interval_near(60000 * OTA_SCHEDULE_WEAK_LINK_FACTOR, ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT));
+    assert_interval_near(OTA_SCHEDULE_MAX_INTERVAL_MS, ota_schedule_next_interval_ms(OTA_SCHEDULE_CHECK));
+    ota_schedule_report_rssi(OTA_SCHEDULE_WEAK_RSSI_DBM + 5);
+
+    // A server hint is taken once, clamped but without jitter
+    ota_schedule_set_hint(OTA_SCHEDULE_HEARTBEAT, 30);
+    TEST_ASSERT_EQUAL(30000, ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT));
+    assert_interval_near(60000, ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT));
+    ota_schedule_set_hint(OTA_SCHEDULE_HEARTBEAT, 1);
+    TEST_ASSERT_EQUAL(OTA_SCHEDULE_MIN_INTERVAL_MS, ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT));
+
+    // Retry-After holds off every activity, hints included
+    ota_schedule_set_retry_after(600);
+    ota_schedule_set_hint(OTA_SCHEDULE_HEARTBEAT, 30);
+    TEST_ASSERT_UINT32_WITHIN(1000, 600000, ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT));
+    TEST_ASSERT_UINT32_WITHIN(1000, 600000, ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT));
+
+    // Offline, jobs stay parked until the network comes back
+    ota_schedule_set_online(false);
+    TEST_ASSERT_EQUAL(OTA_SCHEDULE_MAX_INTERVAL_MS, ota_schedule_next_interval_ms(OTA_SCHEDULE_HEARTBEAT));
+
+    TEST_ASSERT_EQUAL(ESP_OK, ota_schedule_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_reset());
+}
+
+// Reports CPU time against bytes saved per payload type, to tune
+// OTA_COMPRESSION_LEVEL and OTA_COMPRESSION_MIN_SIZE
+void test_compression_benchmark(void)
+{
+    if (ota_compress_init() != ESP_OK)
+    {
+        TEST_IGNORE_MESSAGE("No memory for the compressor state");
+    }
+
+    static const struct
+    {
+        const char *name;
+        size_t (*build)(char *buffer, size_t size);
+    } payloads[] = {
+        {"heartbeat", build_heartbeat_body},
+        {"log", build_log_body},
+        {"trace", build_trace_body},
+    };
+
+    static char body[OTA_ARENA_BUFFER_SIZE];
+    static char compressed[OTA_ARENA_BUFFER_SIZE];
+    static char restored[OTA_ARENA_BUFFER_SIZE];
+
+    for (int i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i++)
+    {
+        size_t body_len = payloads[i].build(body, sizeof(body));
+        size_t compressed_len = 0;
+
+        int64_t start = esp_timer_get_time();
+        for (int run = 0; run < COMPRESSION_RUNS; run++)
+        {
+            TEST_ASSERT_EQUAL(ESP_OK, ota_compress_gzip(body, body_len, compressed, sizeof(compressed), &compressed_len));
+        }
+        int64_t cpu_us = (esp_timer_get_time() - start) / COMPRESSION_RUNS;
+
+        // Member header: magic, deflate, no flags, no mtime, no extra flags, unknown OS
+        static const uint8_t header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+        TEST_ASSERT_LESS_THAN(compressed_len, sizeof(header) + 8);
+        TEST_ASSERT_EQUAL(0, memcmp(compressed, header, sizeof(header)));
+
+        // Trailer: CRC-32 and length of the uncompressed body, little-endian
+        const uint8_t *trailer = (const uint8_t *)&compressed[compressed_len - 8];
+        TEST_ASSERT_EQUAL_UINT32(esp_rom_crc32_le(0, (const uint8_t *)body, body_len), read_le32(trailer));
+        TEST_ASSERT_EQUAL_UINT32(body_len, read_le32(trailer + 4));
+
+        // Strip the 10-byte gzip header and 8-byte trailer and inflate with the ROM decompressor
+        size_t restored_len = tinfl_decompress_mem_to_mem(restored, sizeof(restored), compressed + 10,
+                                                          compressed_len - 18, 0);
+        TEST_ASSERT_EQUAL(body_len, restored_len);
+        TEST_ASSERT_EQUAL(0, memcmp(body, restored, body_len));
+
+        printf("gzip %-9s %4u -> %4u bytes (%2u%% saved), %lld us\n", payloads[i].name, (unsigned)body_len,
+               (unsigned)compressed_len, (unsigned)(100 - compressed_len * 100 / body_len), (long long)cpu_us);
+        TEST_ASSERT_LESS_THAN(body_len, compressed_len);
+    }
+}
+
+// A finished span, sent as the exporter sends it
+static void send_benchmark_span(void)
+{
+    ota_trace_attr_t attributes[3] = {
+        {.key = "http.status_code", .type = OTA_TRACE_ATTR_INT, .value.integer = 200},
+        {.key = "firmware.version", .type = OTA_TRACE_ATTR_STRING, .value.string = "6.0.0"},
+        {.key = "update_available", .type = OTA_TRACE_ATTR_BOOL, .value.boolean = false},
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_send_trace("Test_Device_001", "4bf92f3577b34da6a3ce929d0e0e4736",
+                                                  "00f067aa0ba902b7", "a3ce929d0e0e4736", "http_post /firmware/check",
+                                                  412, SPAN_STARTED_AT, SPAN_STARTED_AT + 412000, attributes, 3,
+                                                  NULL));
+}
+
+static int64_t time_checks(char *url)
+{
+    bool update_available = false;
+    char version[64];
+    int64_t start = esp_timer_get_time();
+    for (int run = 0; run < ENCODING_RUNS; run++)
+    {
+        TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, OTA_FIRMWARE_VERSION, &update_available,
+                                                                 url, OTA_URL_BUFFER_SIZE, version, sizeof(version)));
+    }
+    TEST_ASSERT_TRUE(update_available);
+    return esp_timer_get_time() - start;
+}
+
+static void read_started_at(const char *key, size_t key_len, const ota_cbor_item_t *item, void *ctx)
+{
+    if (ota_cbor_key_is(key, key_len, "started_at") && item->type == OTA_CBOR_TYPE_INT)
+    {
+        *(int64_t *)ctx = item->value.integer;
+    }
+}
+
+// Reports size and CPU time of JSON against CBOR for a span body and a check
+// response, encoded and decoded by the HTTP client itself
+void test_cbor_json_benchmark(void)
+{
+    if (!OTA_CBOR_ENABLED)
+    {
+        TEST_IGNORE_MESSAGE("Needs OTA_CBOR_ENABLED");
+    }
+
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_arena_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(&stand_in));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_start());
+
+    static const char check_json[] = "{\"updateAvailable\":true,\"firmwareUrl\":\"http://192.168.10.149:5000/fw/6.1.0.bin\","
+                                     "\"version\":\"6.1.0\",\"nextCheckIn\":600,\"rolloutActive\":true}";
+    static char check_cbor[128];
+    ota_cbor_writer_t writer;
+    ota_cbor_writer_init(&writer, check_cbor, sizeof(check_cbor));
+    ota_cbor_put_map(&writer, 5);
+    ota_cbor_put_text(&writer, "updateAvailable");
+    ota_cbor_put_bool(&writer, true);
+    ota_cbor_put_text(&writer, "firmwareUrl");
+    ota_cbor_put_text(&writer, "http://192.168.10.149:5000/fw/6.1.0.bin");
+    ota_cbor_put_text(&writer, "version");
+    ota_cbor_put_text(&writer, "6.1.0");
+    ota_cbor_put_text(&writer, "nextCheckIn");
+    ota_cbor_put_int(&writer, 600);
+    ota_cbor_put_text(&writer, "rolloutActive");
+    ota_cbor_put_bool(&writer, true);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_cbor_writer_finish(&writer));
+
+    // JSON while the backend answers in JSON
+    backend.answer = check_json;
+    backend.answer_len = strlen(check_json);
+    backend.answer_cbor = false;
+
+    int64_t start = esp_timer_get_time();
+    for (int run = 0; run < ENCODING_RUNS; run++)
+    {
+        send_benchmark_span();
+    }
+    int64_t json_us = esp_timer_get_time() - start;
+    size_t json_len = backend.body_len;
+    TEST_ASSERT_FALSE(backend.body_cbor);
+
+    // The JSON body is written without a cJSON tree and still reads back
+    cJSON *span = stand_in_request();
+    TEST_ASSERT_NOT_NULL(span);
+    TEST_ASSERT_EQUAL_STRING("http_post /firmware/check", cJSON_GetObjectItem(span, "operation")->valuestring);
+    TEST_ASSERT_TRUE(cJSON_GetObjectItem(span, "started_at")->valuedouble == SPAN_STARTED_AT);
+    cJSON *attributes = cJSON_GetObjectItem(span, "attributes");
+    TEST_ASSERT_EQUAL(200, cJSON_GetObjectItem(attributes, "http.status_code")->valueint);
+    TEST_ASSERT_EQUAL_STRING("6.0.0", cJSON_GetObjectItem(attributes, "firmware.version")->valuestring);
+    TEST_ASSERT_TRUE(cJSON_IsFalse(cJSON_GetObjectItem(attributes, "update_available")));
+    cJSON_Delete(span);
+
+    // Quotes, backslashes and control characters are escaped
+    static const char *awkward = "say \"hi\"\\\n\t\x01 ü";
+    ota_trace_attr_t note = {.key = "note", .type = OTA_TRACE_ATTR_DOUBLE, .value.number = 0.1};
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_send_trace("Test_Device_001", "4bf92f3577b34da6a3ce929d0e0e4736",
+                                                  "00f067aa0ba902b7", NULL, awkward, 1, 0, 1000, &note, 1, NULL));
+    span = stand_in_request();
+    TEST_ASSERT_NOT_NULL(span);
+    TEST_ASSERT_EQUAL_STRING(awkward, cJSON_GetObjectItem(span, "operation")->valuestring);
+    TEST_ASSERT_TRUE(cJSON_GetObjectItem(cJSON_GetObjectItem(span, "attributes"), "note")->valuedouble == 0.1);
+    cJSON_Delete(span);
+
+#if CONFIG_HEAP_TRACING_STANDALONE
+    // Scratch buffers only come from the arena in static memory mode
+    if (OTA_STATIC_MEMORY_ENABLED)
+    {
+        static heap_trace_record_t records[8];
+        TEST_ASSERT_EQUAL(ESP_OK, heap_trace_init_standalone(records, 8));
+        TEST_ASSERT_EQUAL(ESP_OK, heap_trace_start(HEAP_TRACE_ALL));
+        send_benchmark_span();
+        heap_trace_stop();
+        TEST_ASSERT_EQUAL(0, heap_trace_get_count());
+    }
+#endif
+
+    char url[OTA_URL_BUFFER_SIZE] = {0};
+    int64_t json_check_us = time_checks(url);
+    TEST_ASSERT_EQUAL_STRING("http://192.168.10.149:5000/fw/6.1.0.bin", url);
+
+    // The first CBOR answer switches the requests to CBOR
+    backend.answer = check_cbor;
+    backend.answer_len = writer.len;
+    backend.answer_cbor = true;
+    send_benchmark_span();
+
+    start = esp_timer_get_time();
+    for (int run = 0; run < ENCODING_RUNS; run++)
+    {
+        send_benchmark_span();
+    }
+    int64_t cbor_us = esp_timer_get_time() - start;
+    size_t cbor_len = backend.body_len;
+    TEST_ASSERT_TRUE(backend.body_cbor);
+
+    printf("Span encode: JSON %u bytes, %lld ns; CBOR %u bytes, %lld ns\n", (unsigned)json_len,
+           (long long)(json_us * 1000 / ENCODING_RUNS), (unsigned)cbor_len, (long long)(cbor_us * 1000 / ENCODING_RUNS));
+    TEST_ASSERT_LESS_THAN(json_len, cbor_len);
+
+    // Timestamps come back exactly
+    int64_t started_at = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, ota_cbor_read_map(backend.body, cbor_len, read_started_at, &started_at));
+    TEST_ASSERT_EQUAL(SPAN_STARTED_AT, started_at);
+
+    // Check responses: a parsed tree against a walk over the buffer
+    memset(url, 0, sizeof(url));
+    int64_t cbor_check_us = time_checks(url);
+    TEST_ASSERT_EQUAL_STRING("http://192.168.10.149:5000/fw/6.1.0.bin", url);
+    printf("Check round trip: JSON %u bytes, %lld ns; CBOR %u bytes, %lld ns\n", (unsigned)strlen(check_json),
+           (long long)(json_check_us * 1000 / ENCODING_RUNS), (unsigned)writer.len,
+           (long long)(cbor_check_us * 1000 / ENCODING_RUNS));
+
+    // Both readers leave the URL and version alone without an update, even
+    // when they come before updateAvailable
+    static const char no_update_json[] = "{\"firmwareUrl\":\"http://backend/old.bin\",\"version\":\"5.0.0\","
+                                         "\"updateAvailable\":false}";
+    static char no_update_cbor[96];
+    ota_cbor_writer_init(&writer, no_update_cbor, sizeof(no_update_cbor));
+    ota_cbor_put_map(&writer, 3);
+    ota_cbor_put_text(&writer, "firmwareUrl");
+    ota_cbor_put_text(&writer, "http://backend/old.bin");
+    ota_cbor_put_text(&writer, "version");
+    ota_cbor_put_text(&writer, "5.0.0");
+    ota_cbor_put_text(&writer, "updateAvailable");
+    ota_cbor_put_bool(&writer, false);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_cbor_writer_finish(&writer));
+
+    for (int encoding = 0; encoding < 2; encoding++)
+    {
+        backend.answer_cbor = encoding == 1;
+        backend.answer = backend.answer_cbor ? (const void *)no_update_cbor : no_update_json;
+        backend.answer_len = backend.answer_cbor ? writer.len : strlen(no_update_json);
+
+        bool update_available = true;
+        char version[64] = "unchanged";
+        strcpy(url, "unchanged");
+        TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, OTA_FIRMWARE_VERSION, &update_available,
+                                                                 url, sizeof(url), version, sizeof(version)));
+        TEST_ASSERT_FALSE(update_available);
+        TEST_ASSERT_EQUAL_STRING("unchanged", url);
+        TEST_ASSERT_EQUAL_STRING("unchanged", version);
+    }
+
+    ota_http_client_stop();
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(NULL));
+}
+
+static void read_wrapped_value(const char *key, size_t key_len, const ota_cbor_item_t *item, void *ctx)
+{
+    if (ota_cbor_key_is(key, key_len, "v"))
+    {
+        *(ota_cbor_item_t *)ctx = *item;
+    }
+}
+
+static void count_entry(const char *key, size_t key_len, const ota_cbor_item_t *item, void *ctx)
+{
+    (*(int *)ctx)++;
+}
+
+// Read one encoded item as the value of a one-entry map {"v": item}
+static esp_err_t read_wrapped_item(const uint8_t *encoded, size_t len, ota_cbor_item_t *item)
+{
+    static uint8_t map[64];
+    TEST_ASSERT_LESS_THAN(sizeof(map) - 3, len);
+    map[0] = 0xA1; // Map of one entry
+    map[1] = 0x61; // Text of one byte
+    map[2] = 'v';
+    memcpy(&map[3], encoded, len);
+
+    item->type = OTA_CBOR_TYPE_OTHER;
+    item->raw_len = 0;
+    return ota_cbor_read_map(map, len + 3, read_wrapped_value, item);
+}
+
+typedef struct
+{
+    const char *hex;
+    ota_cbor_type_t type;
+    double value; // Integers and floats
+    const char *text;
+} cbor_vector_t;
+
+static size_t hex_to_bytes(const char *hex, uint8_t *bytes, size_t size)
+{
+    size_t len = strlen(hex) / 2;
+    TEST_ASSERT_LESS_OR_EQUAL(size, len);
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned byte;
+        TEST_ASSERT_EQUAL(1, sscanf(&hex[i * 2], "%2x", &byte));
+        bytes[i] = (uint8_t)byte;
+    }
+    return len;
+}
+
+// Examples of encoded items from RFC 8949 Appendix A, as the reader reports them
+void test_cbor_reader_rfc8949_vectors(void)
+{
+    static const cbor_vector_t vectors[] = {
+        {"00", OTA_CBOR_TYPE_INT, 0},
+        {"01", OTA_CBOR_TYPE_INT, 1},
+        {"0a", OTA_CBOR_TYPE_INT, 10},
+        {"17", OTA_CBOR_TYPE_INT, 23},
+        {"1818", OTA_CBOR_TYPE_INT, 24},
+        {"1819", OTA_CBOR_TYPE_INT, 25},
+        {"1864", OTA_CBOR_TYPE_INT, 100},
+        {"1903e8", OTA_CBOR_TYPE_INT, 1000},
+        {"1a000f4240", OTA_CBOR_TYPE_INT, 1000000},
+        {"1b000000e8d4a51000", OTA_CBOR_TYPE_INT, 1000000000000.0},
+        {"1bffffffffffffffff", OTA_CBOR_TYPE_OTHER}, // 18446744073709551615 does not fit an int64_t
+        {"20", OTA_CBOR_TYPE_INT, -1},
+        {"29", OTA_CBOR_TYPE_INT, -10},
+        {"3863", OTA_CBOR_TYPE_INT, -100},
+        {"3903e7", OTA_CBOR_TYPE_INT, -1000},
+        {"f90000", OTA_CBOR_TYPE_FLOAT, 0.0},
+        {"f93c00", OTA_CBOR_TYPE_FLOAT, 1.0},
+        {"fb3ff199999999999a", OTA_CBOR_TYPE_FLOAT, 1.1},
+        {"f93e00", OTA_CBOR_TYPE_FLOAT, 1.5},
+        {"f97bff", OTA_CBOR_TYPE_FLOAT, 65504.0},
+        {"fa47c35000", OTA_CBOR_TYPE_FLOAT, 100000.0},
+        {"fa7f7fffff", OTA_CBOR_TYPE_FLOAT, 3.4028234663852886e+38},
+        {"fb7e37e43c8800759c", OTA_CBOR_TYPE_FLOAT, 1.0e+300},
+        {"f90001", OTA_CBOR_TYPE_FLOAT, 5.960464477539063e-8},
+        {"f90400", OTA_CBOR_TYPE_FLOAT, 0.00006103515625},
+        {"f9c400", OTA_CBOR_TYPE_FLOAT, -4.0},
+        {"fbc010666666666666", OTA_CBOR_TYPE_FLOAT, -4.1},
+        {"f97c00", OTA_CBOR_TYPE_FLOAT, INFINITY},
+        {"fa7f800000", OTA_CBOR_TYPE_FLOAT, INFINITY},
+        {"fb7ff0000000000000", OTA_CBOR_TYPE_FLOAT, INFINITY},
+        {"f9fc00", OTA_CBOR_TYPE_FLOAT, -INFINITY},
+        {"f4", OTA_CBOR_TYPE_BOOL, 0},
+        {"f5", OTA_CBOR_TYPE_BOOL, 1},
+        {"f6", OTA_CBOR_TYPE_NULL},
+        {"f7", OTA_CBOR_TYPE_OTHER}, // undefined
+        {"f0", OTA_CBOR_TYPE_OTHER}, // simple(16)
+        {"f8ff", OTA_CBOR_TYPE_OTHER}, // simple(255)
+        {"c074323031332d30332d32315432303a30343a30305a", OTA_CBOR_TYPE_TEXT, 0, "2013-03-21T20:04:00Z"},
+        {"c11a514b67b0", OTA_CBOR_TYPE_INT, 1363896240},
+        {"d74401020304", OTA_CBOR_TYPE_OTHER}, // Tagged byte string
+        {"40", OTA_CBOR_TYPE_OTHER},
+        {"4401020304", OTA_CBOR_TYPE_OTHER},
+        {"60", OTA_CBOR_TYPE_TEXT, 0, ""},
+        {"6161", OTA_CBOR_TYPE_TEXT, 0, "a"},
+        {"6449455446", OTA_CBOR_TYPE_TEXT, 0, "IETF"},
+        {"62225c", OTA_CBOR_TYPE_TEXT, 0, "\"\\"},
+        {"62c3bc", OTA_CBOR_TYPE_TEXT, 0, "ü"},
+        {"63e6b0b4", OTA_CBOR_TYPE_TEXT, 0, "水"},
+        {"80", OTA_CBOR_TYPE_ARRAY},
+        {"83010203", OTA_CBOR_TYPE_ARRAY},
+        {"8301820203820405", OTA_CBOR_TYPE_ARRAY},
+        {"98190102030405060708090a0b0c0d0e0f101112131415161718181819", OTA_CBOR_TYPE_ARRAY},
+        {"a0", OTA_CBOR_TYPE_MAP},
+        {"a201020304", OTA_CBOR_TYPE_MAP},
+        {"a26161016162820203", OTA_CBOR_TYPE_MAP},
+        {"826161a161626163", OTA_CBOR_TYPE_ARRAY},
+        {"9fff", OTA_CBOR_TYPE_ARRAY},
+        {"9f018202039f0405ffff", OTA_CBOR_TYPE_ARRAY},
+        {"9f01820203820405ff", OTA_CBOR_TYPE_ARRAY},
+        {"83018202039f0405ff", OTA_CBOR_TYPE_ARRAY},
+        {"83019f0203ff820405", OTA_CBOR_TYPE_ARRAY},
+        {"bf61610161629f0203ffff", OTA_CBOR_TYPE_MAP},
+        {"826161bf61626163ff", OTA_CBOR_TYPE_ARRAY},
+        {"bf6346756ef563416d7421ff", OTA_CBOR_TYPE_MAP},
+    };
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+        const cbor_vector_t *vector = &vectors[i];
+        uint8_t encoded[32];
+        size_t len = hex_to_bytes(vector->hex, encoded, sizeof(encoded));
+        ota_cbor_item_t item;
+
+        TEST_ASSERT_EQUAL_MESSAGE(ESP_OK, read_wrapped_item(encoded, len, &item), vector->hex);
+        TEST_ASSERT_EQUAL_MESSAGE(vector->type, item.type, vector->hex);
+        TEST_ASSERT_EQUAL_MESSAGE(len, item.raw_len, vector->hex); // The whole item was consumed
+
+        switch (vector->type)
+        {
+        case OTA_CBOR_TYPE_INT:
+            TEST_ASSERT_TRUE_MESSAGE((double)item.value.integer == vector->value, vector->hex);
+            break;
+        case OTA_CBOR_TYPE_FLOAT:
+            TEST_ASSERT_TRUE_MESSAGE(item.value.number == vector->value, vector->hex);
+            break;
+        case OTA_CBOR_TYPE_BOOL:
+            TEST_ASSERT_EQUAL_MESSAGE(vector->value != 0, item.value.boolean, vector->hex);
+            break;
+        case OTA_CBOR_TYPE_TEXT:
+            TEST_ASSERT_EQUAL_MESSAGE(strlen(vector->text), item.value.text.len, vector->hex);
+            TEST_ASSERT_EQUAL_MESSAGE(0, memcmp(vector->text, item.value.text.ptr, item.value.text.len), vector->hex);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // NaN compares unequal to itself
+    static const char *nans[] = {"f97e00", "fa7fc00000", "fb7ff8000000000000"};
+    for (size_t i = 0; i < sizeof(nans) / sizeof(nans[0]); i++)
+    {
+        uint8_t encoded[16];
+        size_t len = hex_to_bytes(nans[i], encoded, sizeof(encoded));
+        ota_cbor_item_t item;
+        TEST_ASSERT_EQUAL(ESP_OK, read_wrapped_item(encoded, len, &item));
+        TEST_ASSERT_EQUAL(OTA_CBOR_TYPE_FLOAT, item.type);
+        TEST_ASSERT_TRUE(isnan(item.value.number));
+    }
+}
+
+void test_cbor_reader_rejects_malformed(void)
+{
+    // Every cut of a valid response is rejected, wherever it falls
+    static const char *valid = "bf6f757064617465417661696c61626c65f56776657273696f6e65362e312e30"
+                               "66636f6e666967a1666c6576656c739f01820203fb3ff199999999999aff"
+                               "63746167c11a514b67b0ff";
+    uint8_t response[128];
+    size_t response_len = hex_to_bytes(valid, response, sizeof(response));
+    int entries = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, ota_cbor_read_map(response, response_len, count_entry, &entries));
+    TEST_ASSERT_EQUAL(4, entries);
+    for (size_t len = 0; len < response_len; len++)
+    {
+        TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ota_cbor_read_map(response, len, count_entry, &entries));
+    }
+
+    static const char *malformed[] = {
+        "83",                   // Array of three, no items
+        "1a000f42",             // Argument cut short
+        "6449455",              // Text cut short
+        "7bffffffffffffffff41", // Text longer than the input
+        "9bffffffffffffffff01", // Array longer than the input
+        "bbffffffffffffffff01", // Map longer than the input
+        "9f0102",               // Indefinite array without a break
+        "ff",                   // Break outside an indefinite container
+        "1c",                   // Reserved additional information
+        "1f",                   // Indefinite integer
+        "5f42010243030405ff",   // Chunked byte string
+        "7f657374726561646d696e67ff", // Chunked text string
+        "df01",                 // Indefinite tag
+        "a1",                   // Map of one, no entries
+        "a201",                 // Key without a value
+    };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++)
+    {
+        uint8_t encoded[32];
+        size_t len = hex_to_bytes(malformed[i], encoded, sizeof(encoded));
+        ota_cbor_item_t item;
+        TEST_ASSERT_EQUAL_MESSAGE(ESP_ERR_INVALID_ARG, read_wrapped_item(encoded, len, &item), malformed[i]);
+    }
+
+    // Not a map, or a map count larger than the input
+    static const uint8_t not_a_map[] = {0x83, 0x01, 0x02, 0x03};
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ota_cbor_read_map(not_a_map, sizeof(not_a_map), count_entry, &entries));
+    static const uint8_t huge_map[] = {0xBA, 0xFF, 0xFF, 0xFF, 0xFF, 0x61, 0x76, 0x01};
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ota_cbor_read_map(huge_map, sizeof(huge_map), count_entry, &entries));
+
+    // Nesting is followed a few levels deep, and refused before it can
+    // exhaust the stack
+    uint8_t nested[40];
+    for (size_t depth = 1; depth < sizeof(nested); depth++)
+    {
+        memset(nested, 0x81, depth); // Arrays of one
+        nested[depth] = 0x00;
+        ota_cbor_item_t item;
+        esp_err_t err = read_wrapped_item(nested, depth + 1, &item);
+        if (depth <= 4)
+        {
+            TEST_ASSERT_EQUAL(ESP_OK, err);
+        }
+        else if (depth >= 16)
+        {
+            TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, err);
+        }
+    }
+}
+
+// Replay a message fragment as the MQTT client delivers it; only the first
+// fragment carries the topic
+static void mqtt_deliver(const char *topic, const char *data, int data_len, int total_len, int offset)
+{
+    esp_mqtt_event_t event = {
+        .event_id = MQTT_EVENT_DATA,
+        .data = (char *)data,
+        .data_len = data_len,
+        .total_data_len = total_len,
+        .current_data_offset = offset,
+        .topic = (char *)topic,
+        .topic_len = topic ? (int)strlen(topic) : 0,
+    };
+    ota_mqtt_handle_event(&event);
+}
+
+static bool mqtt_update_announced(void)
+{
+    bool update_available = false;
+    char url[OTA_URL_BUFFER_SIZE];
+    char version[64];
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, OTA_FIRMWARE_VERSION, &update_available,
+                                                             url, sizeof(url), version, sizeof(version)));
+    return update_available;
+}
+
+void test_mqtt_transport_reassembles_messages(void)
+{
+    if (!OTA_MQTT_ENABLED)
+    {
+        TEST_IGNORE_MESSAGE("Needs CONFIG_OTA_PLUGIN_MQTT");
+    }
+
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_reset());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_arena_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(&ota_transport_mqtt));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_start());
+
+    char device_id[OTA_SETTINGS_TEXT_SIZE];
+    char topic[OTA_SETTINGS_TEXT_SIZE + 64];
+    ota_settings_get_str(OTA_SETTING_DEVICE_ID, device_id, sizeof(device_id));
+    snprintf(topic, sizeof(topic), "%s/%s/down/firmware/check", OTA_MQTT_TOPIC_PREFIX, device_id);
+
+    // No broker: logs are QoS 0 and dropped, checks are QoS 1 and queued
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, ota_http_send_log(DEVICE_ID, "info", "offline", NULL, NULL));
+    TEST_ASSERT_FALSE(mqtt_update_announced());
+
+    // An announcement in three fragments counts once complete
+    const char *announcement =
+        "{\"updateAvailable\":true,\"firmwareUrl\":\"http://backend/fw.bin\",\"version\":\"7.0.0\"}";
+    int len = (int)strlen(announcement);
+    mqtt_deliver(topic, announcement, 20, len, 0);
+    mqtt_deliver(NULL, &announcement[20], 20, len, 20);
+    TEST_ASSERT_FALSE(mqtt_update_announced());
+    mqtt_deliver(NULL, &announcement[40], len - 40, len, 40);
+    TEST_ASSERT_TRUE(mqtt_update_announced());
+
+    // Withdrawals that must not arrive: other devices' topics, a topic that
+    // only starts like ours, a fragment missing in between, and a message
+    // larger than a scratch buffer
+    const char *withdrawal = "{\"updateAvailable\":false}";
+    int withdrawal_len = (int)strlen(withdrawal);
+    char other_topic[OTA_SETTINGS_TEXT_SIZE + 64];
+    snprintf(other_topic, sizeof(other_topic), "%s/%s_2/down/firmware/check", OTA_MQTT_TOPIC_PREFIX, device_id);
+    mqtt_deliver(other_topic, withdrawal, withdrawal_len, withdrawal_len, 0);
+    snprintf(other_topic, sizeof(other_topic), "%s/%s/downlink/firmware/check", OTA_MQTT_TOPIC_PREFIX, device_id);
+    mqtt_deliver(other_topic, withdrawal, withdrawal_len, withdrawal_len, 0);
+    mqtt_deliver(topic, withdrawal, 10, withdrawal_len, 0);
+    mqtt_deliver(NULL, &withdrawal[12], withdrawal_len - 12, withdrawal_len, 12);
+    mqtt_deliver(topic, withdrawal, withdrawal_len, OTA_ARENA_BUFFER_SIZE, 0);
+    TEST_ASSERT_TRUE(mqtt_update_announced());
+
+    // A body starting with a CBOR map byte is read as CBOR
+    uint8_t body[32];
+    ota_cbor_writer_t writer;
+    ota_cbor_writer_init(&writer, body, sizeof(body));
+    ota_cbor_put_map(&writer, 1);
+    ota_cbor_put_text(&writer, "updateAvailable");
+    ota_cbor_put_bool(&writer, false);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_cbor_writer_finish(&writer));
+    mqtt_deliver(topic, (const char *)body, (int)writer.len, (int)writer.len, 0);
+    TEST_ASSERT_FALSE(mqtt_update_announced());
+
+    ota_http_client_stop();
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(NULL));
+}
+
+// More metrics than fit in one scratch buffer, some with a window
+static void write_steady_metrics(ota_http_metrics_writer_t *metrics, void *ctx)
+{
+    char name[32];
+    ota_metric_window_t window = {.last = 42.5f, .count = 3, .sum = 120.0f, .min = 30.0f, .max = 47.5f};
+    for (int i = 0; i < 40; i++)
+    {
+        snprintf(name, sizeof(name), "task.steady_worker_%02d.cpu", i);
+        TEST_ASSERT_TRUE(ota_http_metrics_put(metrics, name, window.last, "%", i % 2 ? &window : NULL));
+    }
+}
+
+// One pass of the work the plugin repeats while running: executor wake-ups,
+// a histogram-only span, a scratch buffer, status transitions, and a full
+// heartbeat with metrics, a log and a check encoded in CBOR
+static void run_steady_state_cycle(ota_executor_job_t job)
+{
+    int runs = idle_job_runs;
+    TEST_ASSERT_EQUAL(ESP_OK, ota_executor_expedite(job, 0));
+    for (int i = 0; i < 100 && idle_job_runs == runs; i++)
+    {
+        vTaskDelay(1);
+    }
+    TEST_ASSERT_EQUAL(runs + 1, idle_job_runs);
+
+    ota_trace_context_t *span = ota_trace_start_operation("http_post /heartbeat", NULL);
+    TEST_ASSERT_NOT_NULL(span);
+    ota_trace_end_operation(span, "{\"status\":200}");
+
+    char *buffer = ota_arena_buffer_acquire();
+    TEST_ASSERT_NOT_NULL(buffer);
+    ota_arena_buffer_release(buffer);
+
+    ota_check_result_t result = {.err = ESP_OK};
+    ota_event_check_started();
+    ota_event_check_finished(&result);
+    ota_event_heartbeat_result(ESP_OK);
+
+    bool resync = true;
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_send_heartbeat(DEVICE_ID, "0123456789abcdef", 1, true, 60, "192.168.1.20",
+                                                      FIRMWARE_REF, write_steady_metrics, NULL, &resync));
+    TEST_ASSERT_FALSE(resync);
+    TEST_ASSERT_GREATER_THAN(OTA_ARENA_BUFFER_SIZE, backend.body_len);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_send_log(DEVICE_ID, "info", "steady", NULL, NULL));
+
+    bool update_available = true;
+    char url[OTA_URL_BUFFER_SIZE];
+    char version[64];
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, OTA_FIRMWARE_VERSION, &update_available,
+                                                             url, sizeof(url), version, sizeof(version)));
+    TEST_ASSERT_FALSE(update_available);
+}
+
+void test_steady_state_no_heap(void)
+{
+#if !CONFIG_HEAP_TRACING_STANDALONE
+    TEST_IGNORE_MESSAGE("Needs CONFIG_HEAP_TRACING_STANDALONE");
+#else
+    if (!OTA_STATIC_MEMORY_ENABLED || !OTA_CBOR_ENABLED)
+    {
+        TEST_IGNORE_MESSAGE("Needs CONFIG_OTA_PLUGIN_STATIC_MEMORY and OTA_CBOR_ENABLED");
+    }
+
+    // What ota_plugin_init() reserves for these modules
+    TEST_ASSERT_EQUAL(ESP_OK, ota_arena_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_executor_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_trace_init());
+    ota_arena_seal();
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(&stand_in));
+    backend.answer = quiet_answer_cbor; // Switches the bodies to CBOR
+    backend.answer_len = sizeof(quiet_answer_cbor);
+    backend.answer_cbor = true;
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_start());
+
+    // Warm up outside the trace: first use of logging, the parked task and
+    // the switch to CBOR bodies after the first CBOR answer
+    ota_executor_job_t job = start_idle_executor();
+    run_steady_state_cycle(job);
+    run_steady_state_cycle(job);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_executor_stop());
+
+    static heap_trace_record_t records[HEAP_TRACE_RECORDS];
+    TEST_ASSERT_EQUAL(ESP_OK, heap_trace_init_standalone(records, HEAP_TRACE_RECORDS));
+    TEST_ASSERT_EQUAL(ESP_OK, heap_trace_start(HEAP_TRACE_ALL));
+
+    TEST_ASSERT_EQUAL(ESP_OK, ota_executor_start());
+    for (int i = 0; i < 10; i++)
+    {
+        run_steady_state_cycle(job);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, ota_executor_stop());
+
+    heap_trace_stop();
+    size_t allocations = heap_trace_get_count();
+    if (allocations > 0)
+    {
+        heap_trace_dump();
+    }
+
+    ota_executor_cancel(job);
+    ota_http_client_stop();
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(NULL));
+
+    printf("Arena: %u of %u bytes reserved\n", (unsigned)ota_arena_used(), (unsigned)ota_arena_capacity());
+    TEST_ASSERT_EQUAL(0, allocations);
+#endif
+}
+
+// What the backend would publish to the device's down topics
+static void broker_publish_json(const char *endpoint, const char *json)
+{
+    backend.deliver(endpoint, json, strlen(json), false);
+}
+
+static int pushed_updates = 0;
+static int pushed_resyncs = 0;
+
+static void count_push(ota_http_push_t push, void *ctx)
+{
+    if (push == OTA_HTTP_PUSH_UPDATE)
+    {
+        pushed_updates++;
+    }
+    else if (push == OTA_HTTP_PUSH_RESYNC)
+    {
+        pushed_resyncs++;
+    }
+}
+
+void test_push_transport_announces_updates(void)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_settings_reset());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_arena_init()); // Scratch buffers in static memory mode
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_init());
+    stand_in.replies = false; // A broker: requests are published, answers pushed
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(&stand_in));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_add_push_listener(count_push, NULL));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_start());
+    TEST_ASSERT_NOT_NULL(backend.deliver);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, ota_http_client_set_transport(NULL));
+    pushed_updates = 0;
+    pushed_resyncs = 0;
+
+    // Telemetry goes out without waiting for an answer
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_send_log(DEVICE_ID, "info", "hello", NULL, NULL));
+    TEST_ASSERT_EQUAL_STRING("/log", backend.endpoint);
+
+    // Nothing announced yet: the check is published and finds no update
+    bool update_available = true;
+    char url[OTA_URL_BUFFER_SIZE] = {0};
+    char version[64] = {0};
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, OTA_FIRMWARE_VERSION, &update_available,
+                                                             url, sizeof(url), version, sizeof(version)));
+    TEST_ASSERT_EQUAL_STRING("/firmware/check", backend.endpoint);
+    TEST_ASSERT_FALSE(update_available);
+
+    // Announcements without updateAvailable are ignored
+    broker_publish_json("/firmware/check", "{\"firmwareUrl\":\"http://backend/fw.bin\"}");
+    TEST_ASSERT_EQUAL(0, pushed_updates);
+
+    broker_publish_json("/firmware/check",
+                        "{\"updateAvailable\":true,\"firmwareUrl\":\"http://backend/fw.bin\",\"version\":\"7.0.0\"}");
+    TEST_ASSERT_EQUAL(1, pushed_updates);
+
+    // Every check reports the announcement until the backend replaces it
+    for (int i = 0; i < 2; i++)
+    {
+        update_available = false;
+        TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, OTA_FIRMWARE_VERSION, &update_available,
+                                                                 url, sizeof(url), version, sizeof(version)));
+        TEST_ASSERT_TRUE(update_available);
+        TEST_ASSERT_EQUAL_STRING("http://backend/fw.bin", url);
+        TEST_ASSERT_EQUAL_STRING("7.0.0", version);
+    }
+
+    // Once installed, the same retained announcement is no longer an update
+    update_available = true;
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, "7.0.0", &update_available, url, sizeof(url),
+                                                             version, sizeof(version)));
+    TEST_ASSERT_FALSE(update_available);
+
+    // A withdrawn rollout, pushed in CBOR
+    uint8_t body[64];
+    ota_cbor_writer_t writer;
+    ota_cbor_writer_init(&writer, body, sizeof(body));
+    ota_cbor_put_map(&writer, 1);
+    ota_cbor_put_text(&writer, "updateAvailable");
+    ota_cbor_put_bool(&writer, false);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_cbor_writer_finish(&writer));
+    backend.deliver("/firmware/check", (const char *)body, writer.len, true);
+    TEST_ASSERT_EQUAL(1, pushed_updates);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, OTA_FIRMWARE_VERSION, &update_available,
+                                                             url, sizeof(url), version, sizeof(version)));
+    TEST_ASSERT_FALSE(update_available);
+
+    // The heartbeat answer arrives on its own as well
+    broker_publish_json("/heartbeat", "{\"resync\":false}");
+    TEST_ASSERT_EQUAL(0, pushed_resyncs);
+    broker_publish_json("/heartbeat", "{\"resync\":true}");
+    TEST_ASSERT_EQUAL(1, pushed_resyncs);
+
+    ota_http_client_stop();
+    TEST_ASSERT_NULL(backend.deliver);
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(NULL));
+}
+
+// The device ID in the last request body, which the JSON retry of a refused
+// CBOR body must carry as well
+static void read_requesting_device(char *device_id, size_t size)
+{
+    cJSON *request = stand_in_request();
+    cJSON *device = cJSON_GetObjectItem(request, "deviceId");
+    device_id[0] = '\0';
+    if (cJSON_IsString(device))
+    {
+        strncpy(device_id, device->valuestring, size - 1);
+    }
+    cJSON_Delete(request);
+}
+
+void test_cbor_refusal_falls_back_to_json(void)
+{
+    if (!OTA_CBOR_ENABLED)
+    {
+        TEST_IGNORE_MESSAGE("Needs OTA_CBOR_ENABLED");
+    }
+
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_flash_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_arena_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_init());
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(&stand_in));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_start());
+    backend.answer = quiet_answer_cbor;
+    backend.answer_len = sizeof(quiet_answer_cbor);
+    backend.answer_cbor = true;
+
+    bool update_available = true;
+    char url[OTA_URL_BUFFER_SIZE] = {0};
+    char version[64] = {0};
+    char device_id[32];
+
+    // A CBOR answer switches requests to CBOR
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, OTA_FIRMWARE_VERSION, &update_available,
+                                                             url, sizeof(url), version, sizeof(version)));
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, OTA_FIRMWARE_VERSION, &update_available,
+                                                             url, sizeof(url), version, sizeof(version)));
+    TEST_ASSERT_TRUE(backend.body_cbor);
+    read_requesting_device(device_id, sizeof(device_id));
+    TEST_ASSERT_EQUAL_STRING(DEVICE_ID, device_id);
+
+    // The refused body is resent once as JSON and the check still succeeds
+    backend.refuse_cbor = true;
+    backend.requests = 0;
+    update_available = true;
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, OTA_FIRMWARE_VERSION, &update_available,
+                                                             url, sizeof(url), version, sizeof(version)));
+    TEST_ASSERT_EQUAL(2, backend.requests);
+    TEST_ASSERT_FALSE(backend.body_cbor);
+    read_requesting_device(device_id, sizeof(device_id));
+    TEST_ASSERT_EQUAL_STRING(DEVICE_ID, device_id);
+    TEST_ASSERT_FALSE(update_available);
+
+    // CBOR answers to the JSON requests do not switch back
+    backend.refuse_cbor = false;
+    for (int i = 0; i < 3; i++)
+    {
+        backend.requests = 0;
+        TEST_ASSERT_EQUAL(ESP_OK, ota_http_check_firmware_update(DEVICE_ID, OTA_FIRMWARE_VERSION, &update_available,
+                                                                 url, sizeof(url), version, sizeof(version)));
+        TEST_ASSERT_EQUAL(1, backend.requests);
+        TEST_ASSERT_FALSE(backend.body_cbor);
+    }
+
+    ota_http_client_stop();
+    TEST_ASSERT_EQUAL(ESP_OK, ota_http_client_set_transport(NULL));
+}
+
 // Main function to run the tests
 int main(void)
 {
     UNITY_BEGIN();
     RUN_TEST(test_example_case);
     RUN_TEST(test_another_case);
+    RUN_TEST(test_executor_stop_latency);
+    RUN_TEST(test_executor_expedite_latency);
+    RUN_TEST(test_status_snapshot_transitions);
+    RUN_TEST(test_status_snapshot_consistent_under_writes);
+    RUN_TEST(test_state_survives_reload);
+    RUN_TEST(test_settings_validated_and_applied_live);
+    RUN_TEST(test_exporter_renders_metrics);
+    RUN_TEST(test_trace_unlinks_ended_spans);
+    RUN_TEST(test_custom_metrics);
+    RUN_TEST(test_failed_heartbeat_keeps_window);
+    RUN_TEST(test_heartbeat_outgrows_scratch_buffer);
+    RUN_TEST(test_delta_heartbeat_protocol);
+    RUN_TEST(test_schedule_next_interval);
+    RUN_TEST(test_compression_benchmark);
+    RUN_TEST(test_cbor_json_benchmark);
+    RUN_TEST(test_cbor_reader_rfc8949_vectors);
+    RUN_TEST(test_cbor_reader_rejects_malformed);
+    RUN_TEST(test_push_transport_announces_updates);
+    RUN_TEST(test_mqtt_transport_reassembles_messages);
+    RUN_TEST(test_steady_state_no_heap);
+    RUN_TEST(test_cbor_refusal_falls_back_to_json);
     return UNITY_END();
 }
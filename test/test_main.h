@@ -7,5 +7,26 @@
 // Declare test functions
 void test_example_case(void);
 void test_another_case(void);
+void test_executor_stop_latency(void);
+void test_executor_expedite_latency(void);
+void test_status_snapshot_transitions(void);
+void test_status_snapshot_consistent_under_writes(void);
+void test_state_survives_reload(void);
+void test_settings_validated_and_applied_live(void);
+void test_exporter_renders_metrics(void);
+void test_trace_unlinks_ended_spans(void);
+void test_custom_metrics(void);
+void test_failed_heartbeat_keeps_window(void);
+void test_heartbeat_outgrows_scratch_buffer(void);
+void test_delta_heartbeat_protocol(void);
+void test_schedule_next_interval(void);
+void test_compression_benchmark(void);
+void test_cbor_json_benchmark(void);
+void test_cbor_reader_rfc8949_vectors(void);
+void test_cbor_reader_rejects_malformed(void);
+void test_push_transport_announces_updates(void);
+void test_mqtt_transport_reassembles_messages(void);
+void test_cbor_refusal_falls_back_to_json(void);
+void test_steady_state_no_heap(void);
 
 #endif // TEST_MAIN_H